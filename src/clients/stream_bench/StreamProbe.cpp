@@ -0,0 +1,174 @@
+///
+/// \file StreamProbe.cpp
+///
+/// \brief Stream player that measures the stream of a StreamSource.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "StreamProbe.h"
+
+#include <porting_layer/AutoLock.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+using namespace ctvc;
+
+static const uint8_t TS_SYNC_BYTE = 0x47;
+
+StreamProbe::StreamProbe()
+{
+    start();
+}
+
+StreamProbe::~StreamProbe()
+{
+}
+
+ResultCode StreamProbe::start()
+{
+    AutoLock lck(m_condition);
+
+    m_is_done = false;
+    m_result = ResultCode::SUCCESS;
+    m_n_bytes = 0;
+    m_first_data_time = TimeStamp();
+    m_last_data_time = TimeStamp();
+    m_partial_packet_size = 0;
+    m_next_sequence_number = 0;
+    m_n_dropped_bursts = 0;
+    m_n_reordered_bursts = 0;
+    m_latencies_in_us.clear();
+
+    return ResultCode::SUCCESS;
+}
+
+void StreamProbe::stop()
+{
+}
+
+bool StreamProbe::wait_until_done(uint32_t timeout_in_ms)
+{
+    AutoLock lck(m_condition);
+
+    TimeStamp deadline = TimeStamp::now().add_milliseconds(timeout_in_ms);
+    while (!m_is_done) {
+        TimeStamp now = TimeStamp::now();
+        if (now >= deadline) {
+            break;
+        }
+        m_condition.wait_without_lock(static_cast<uint32_t>((deadline - now).get_as_milliseconds()) + 1);
+    }
+
+    return m_is_done;
+}
+
+void StreamProbe::get_report(Report &report/*out*/)
+{
+    AutoLock lck(m_condition);
+
+    report.n_bytes = m_n_bytes;
+    report.duration_in_us = m_n_bytes > 0 ? m_last_data_time.get_as_microseconds() - m_first_data_time.get_as_microseconds() : 0;
+    report.n_bursts = m_latencies_in_us.size();
+    report.n_dropped_bursts = m_n_dropped_bursts;
+    report.n_reordered_bursts = m_n_reordered_bursts;
+    report.result = m_result;
+
+    report.latency_avg_in_us = 0;
+    report.latency_p50_in_us = 0;
+    report.latency_p99_in_us = 0;
+    report.latency_max_in_us = 0;
+    if (!m_latencies_in_us.empty()) {
+        std::vector<uint32_t> latencies(m_latencies_in_us);
+        std::sort(latencies.begin(), latencies.end());
+        uint64_t sum = 0;
+        for (std::vector<uint32_t>::const_iterator i = latencies.begin(); i != latencies.end(); ++i) {
+            sum += *i;
+        }
+        report.latency_avg_in_us = static_cast<uint32_t>(sum / latencies.size());
+        report.latency_p50_in_us = latencies[latencies.size() / 2];
+        report.latency_p99_in_us = latencies[latencies.size() * 99 / 100];
+        report.latency_max_in_us = latencies.back();
+    }
+}
+
+void StreamProbe::stream_data(const uint8_t *data, uint32_t length)
+{
+    TimeStamp now = TimeStamp::now();
+
+    AutoLock lck(m_condition);
+
+    if (m_n_bytes == 0) {
+        m_first_data_time = now;
+    }
+    m_last_data_time = now;
+    m_n_bytes += length;
+
+    const uint8_t *end = data + length;
+    while (data < end) {
+        if (m_partial_packet_size == 0) {
+            // Resynchronize if the stream is not aligned on packets
+            const uint8_t *sync = static_cast<const uint8_t *>(memchr(data, TS_SYNC_BYTE, end - data));
+            if (!sync) {
+                break;
+            }
+            data = sync;
+            if (static_cast<uint32_t>(end - data) >= StreamSource::TS_PACKET_SIZE) {
+                packet_received(data, now);
+                data += StreamSource::TS_PACKET_SIZE;
+                continue;
+            }
+        }
+
+        uint32_t n = std::min(static_cast<uint32_t>(end - data), StreamSource::TS_PACKET_SIZE - m_partial_packet_size);
+        memcpy(m_partial_packet + m_partial_packet_size, data, n);
+        m_partial_packet_size += n;
+        data += n;
+        if (m_partial_packet_size == StreamSource::TS_PACKET_SIZE) {
+            packet_received(m_partial_packet, now);
+            m_partial_packet_size = 0;
+        }
+    }
+}
+
+void StreamProbe::stream_error(ResultCode result)
+{
+    AutoLock lck(m_condition);
+
+    // Closing the loader after the last burst came in is not an error of the stream
+    if (!m_is_done) {
+        m_result = result;
+    }
+    m_is_done = true;
+    m_condition.notify();
+}
+
+void StreamProbe::packet_received(const uint8_t *packet, const TimeStamp &now)
+{
+    StreamSource::Stamp stamp;
+    if (!StreamSource::parse_stamp(packet, stamp)) {
+        return;
+    }
+
+    int64_t latency_in_us = now.get_as_microseconds() - stamp.send_time_in_us;
+    m_latencies_in_us.push_back(latency_in_us > 0 ? static_cast<uint32_t>(latency_in_us) : 0);
+
+    if (stamp.sequence_number >= m_next_sequence_number) {
+        m_n_dropped_bursts += stamp.sequence_number - m_next_sequence_number;
+        m_next_sequence_number = stamp.sequence_number + 1;
+    } else if (m_n_dropped_bursts > 0) {
+        // Counted as dropped when the gap was seen
+        m_n_reordered_bursts++;
+        m_n_dropped_bursts--;
+    }
+
+    if (stamp.is_last) {
+        m_is_done = true;
+        m_condition.notify();
+    }
+}
@@ -0,0 +1,83 @@
+///
+/// \file StreamProbe.h
+///
+/// \brief Stream player that measures the stream of a StreamSource.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include "StreamSource.h"
+
+#include <porting_layer/Condition.h>
+#include <porting_layer/TimeStamp.h>
+#include <stream/IStreamPlayer.h>
+
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+/// \brief Stream player that takes the place of the platform's player and measures what comes in
+///
+/// The latency is the time from sending a burst until its stamp is passed to stream_data(), so it
+/// includes the network, the socket and the stream loader.
+class StreamProbe : public IStreamPlayer
+{
+public:
+    struct Report
+    {
+        uint64_t n_bytes;
+        int64_t duration_in_us;        ///< From the first to the last data that came in
+        uint32_t n_bursts;
+        uint32_t n_dropped_bursts;     ///< Gaps in the sequence numbers of the stamps
+        uint32_t n_reordered_bursts;
+        uint32_t latency_avg_in_us;
+        uint32_t latency_p50_in_us;
+        uint32_t latency_p99_in_us;
+        uint32_t latency_max_in_us;
+        ResultCode result;             ///< What the loader ended the stream with, if it did
+    };
+
+    StreamProbe();
+    ~StreamProbe();
+
+    /// \brief Wait until the last burst came in or the stream ended
+    /// \param[in] timeout_in_ms Maximum time to wait.
+    /// \result True if the stream is complete.
+    bool wait_until_done(uint32_t timeout_in_ms);
+
+    void get_report(Report &report/*out*/);
+
+    // Implements IStreamPlayer
+    ResultCode start();
+    void stop();
+    void stream_data(const uint8_t *data, uint32_t length);
+    void stream_error(ResultCode result);
+
+private:
+    StreamProbe(const StreamProbe &);
+    StreamProbe &operator=(const StreamProbe &);
+
+    void packet_received(const uint8_t *packet, const TimeStamp &now);
+
+    Condition m_condition;
+    bool m_is_done;
+    ResultCode m_result;
+    uint64_t m_n_bytes;
+    TimeStamp m_first_data_time;
+    TimeStamp m_last_data_time;
+    uint8_t m_partial_packet[StreamSource::TS_PACKET_SIZE]; // Packet split over calls to stream_data()
+    uint32_t m_partial_packet_size;
+    uint32_t m_next_sequence_number;
+    uint32_t m_n_dropped_bursts;
+    uint32_t m_n_reordered_bursts;
+    std::vector<uint32_t> m_latencies_in_us;
+};
+
+} // namespace
@@ -0,0 +1,242 @@
+///
+/// \file StreamServer.cpp
+///
+/// \brief Stand-in server that sends a StreamSource over HTTP and UDP.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "StreamServer.h"
+
+#include <porting_layer/Log.h>
+#include <utils/utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ctvc;
+
+static const uint32_t MAX_REQUEST_SIZE = 4096;
+
+// Value of a parameter in the query of a path, or an empty string
+static std::string get_query_parameter(const std::string &path, const char *name)
+{
+    std::string::size_type query = path.find('?');
+    if (query == std::string::npos) {
+        return "";
+    }
+
+    std::string key = std::string(name) + "=";
+    std::string::size_type pos = query + 1;
+    while (pos < path.size()) {
+        std::string::size_type end = path.find('&', pos);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        if (path.compare(pos, key.size(), key) == 0) {
+            return path.substr(pos + key.size(), end - pos - key.size());
+        }
+        pos = end + 1;
+    }
+
+    return "";
+}
+
+static ResultCode send_string(TcpSocket &socket, const std::string &s)
+{
+    return socket.send(reinterpret_cast<const uint8_t *>(s.data()), s.size());
+}
+
+StreamServer::StreamServer(const StreamSource &source) :
+    m_source(source),
+    m_thread("StreamServer"),
+    m_udp_sender(source)
+{
+}
+
+StreamServer::~StreamServer()
+{
+    stop();
+}
+
+ResultCode StreamServer::start(int port)
+{
+    m_listen_socket.open();
+    m_listen_socket.set_reuse_address(true);
+    ResultCode ret = m_listen_socket.bind("0.0.0.0", port);
+    if (ret.is_ok()) {
+        ret = m_listen_socket.listen(4);
+    }
+    if (ret.is_error()) {
+        CTVC_LOG_ERROR("Can't listen on port %d: %s", port, ret.get_description());
+        m_listen_socket.close();
+        return ret;
+    }
+
+    return m_thread.start(*this, Thread::PRIO_NORMAL);
+}
+
+void StreamServer::stop()
+{
+    m_thread.stop_and_wait_until_stopped();
+    m_listen_socket.close();
+    m_udp_sender.stop();
+}
+
+ResultCode StreamServer::start_udp(const char *host, int port)
+{
+    return m_udp_sender.start(host, port);
+}
+
+bool StreamServer::run()
+{
+    TcpSocket *socket = m_listen_socket.accept();
+    if (!socket) {
+        return m_thread.must_stop();
+    }
+
+    socket->set_no_delay(true);
+    serve(*socket);
+
+    socket->close();
+    delete socket;
+
+    return false;
+}
+
+void StreamServer::serve(TcpSocket &socket)
+{
+    std::string request;
+    while (request.find("\r\n\r\n") == std::string::npos) {
+        uint8_t buffer[1024];
+        uint32_t length = 0;
+        ResultCode ret = socket.receive(buffer, sizeof(buffer), length);
+        if (ret.is_error() || length == 0 || request.size() + length > MAX_REQUEST_SIZE) {
+            return;
+        }
+        request.append(reinterpret_cast<const char *>(buffer), length);
+    }
+
+    // Request line: <method> <path> HTTP/1.x
+    std::string::size_type path_start = request.find(' ');
+    std::string::size_type path_end = path_start == std::string::npos ? path_start : request.find(' ', path_start + 1);
+    if (path_end == std::string::npos || request.compare(0, path_start, "GET") != 0) {
+        send_string(socket, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        return;
+    }
+    std::string path(request, path_start + 1, path_end - path_start - 1);
+    CTVC_LOG_INFO("GET %s", path.c_str());
+
+    if (path == "/length") {
+        send_stream(socket, false);
+    } else if (path == "/chunked") {
+        send_stream(socket, true);
+    } else if (path.compare(0, 5, "/udp?") == 0) {
+        std::string host = get_query_parameter(path, "host");
+        int port = atoi(get_query_parameter(path, "port").c_str());
+        if (host.empty() || port <= 0 || start_udp(host.c_str(), port).is_error()) {
+            send_string(socket, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            return;
+        }
+        send_string(socket, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    } else {
+        send_string(socket, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+}
+
+bool StreamServer::send_stream(TcpSocket &socket, bool is_chunked)
+{
+    std::string header("HTTP/1.1 200 OK\r\nContent-Type: video/MP2T\r\nConnection: close\r\n");
+    if (is_chunked) {
+        header += "Transfer-Encoding: chunked\r\n\r\n";
+    } else {
+        std::string content_length;
+        string_printf(content_length, "Content-Length: %llu\r\n\r\n", static_cast<unsigned long long>(m_source.get_stream_length()));
+        header += content_length;
+    }
+    if (send_string(socket, header).is_error()) {
+        return false;
+    }
+
+    // Each burst goes out in a single send, including its chunk framing
+    std::string chunk_header;
+    string_printf(chunk_header, "%x\r\n", StreamSource::BURST_SIZE);
+    uint32_t offset = is_chunked ? chunk_header.size() : 0;
+    std::vector<uint8_t> buffer(offset + StreamSource::BURST_SIZE + (is_chunked ? 2 : 0));
+    if (is_chunked) {
+        memcpy(&buffer[0], chunk_header.data(), offset);
+        memcpy(&buffer[offset + StreamSource::BURST_SIZE], "\r\n", 2);
+    }
+
+    StreamSource::Pacer pacer(m_source, m_thread);
+    while (pacer.next_burst(&buffer[offset])) {
+        if (socket.send(&buffer[0], buffer.size()).is_error()) {
+            CTVC_LOG_INFO("Client closed the connection");
+            return false;
+        }
+    }
+    if (m_thread.must_stop()) {
+        return false;
+    }
+
+    if (is_chunked) {
+        return send_string(socket, "0\r\n\r\n").is_ok();
+    }
+
+    return true;
+}
+
+StreamServer::UdpSender::UdpSender(const StreamSource &source) :
+    m_source(source),
+    m_thread("StreamServer UDP")
+{
+}
+
+StreamServer::UdpSender::~UdpSender()
+{
+    stop();
+}
+
+ResultCode StreamServer::UdpSender::start(const char *host, int port)
+{
+    stop();
+
+    m_socket.open();
+    ResultCode ret = m_socket.connect(host, port);
+    if (ret.is_error()) {
+        CTVC_LOG_ERROR("Can't send to %s:%d: %s", host, port, ret.get_description());
+        m_socket.close();
+        return ret;
+    }
+
+    return m_thread.start(*this, Thread::PRIO_NORMAL);
+}
+
+void StreamServer::UdpSender::stop()
+{
+    m_thread.stop_and_wait_until_stopped();
+    m_socket.close();
+}
+
+bool StreamServer::UdpSender::run()
+{
+    uint8_t burst[StreamSource::BURST_SIZE];
+    uint32_t n_send_errors = 0;
+
+    StreamSource::Pacer pacer(m_source, m_thread);
+    while (pacer.next_burst(burst)) {
+        // Nobody may be listening yet, which isn't a reason to stop
+        if (m_socket.send(burst, sizeof(burst)).is_error()) {
+            n_send_errors++;
+        }
+    }
+
+    if (n_send_errors > 0) {
+        CTVC_LOG_WARNING("%u bursts could not be sent", n_send_errors);
+    }
+
+    return true;
+}
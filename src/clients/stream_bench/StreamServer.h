@@ -0,0 +1,84 @@
+///
+/// \file StreamServer.h
+///
+/// \brief Stand-in server that sends a StreamSource over HTTP and UDP.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include "StreamSource.h"
+
+#include <porting_layer/ResultCode.h>
+#include <porting_layer/Socket.h>
+#include <porting_layer/Thread.h>
+
+#include <string>
+
+namespace ctvc {
+
+/// \brief Serves the stream of a StreamSource, one connection at a time
+///
+/// HTTP requests:
+/// - GET /length sends the stream with a Content-Length.
+/// - GET /chunked sends the stream with chunked transfer encoding, one chunk per burst.
+/// - GET /udp?host=<host>&port=<port> starts to send the stream to the given UDP address. The
+///   response is sent right away.
+class StreamServer : private Thread::IRunnable
+{
+public:
+    StreamServer(const StreamSource &source);
+    ~StreamServer();
+
+    /// \brief Start to accept HTTP requests
+    /// \param[in] port Port to listen on.
+    /// \result ResultCode
+    ResultCode start(int port);
+
+    void stop();
+
+    /// \brief Send the stream to a UDP address, stopping the previous UDP stream
+    /// \param[in] host Destination host.
+    /// \param[in] port Destination port.
+    /// \result ResultCode
+    ResultCode start_udp(const char *host, int port);
+
+private:
+    StreamServer(const StreamServer &);
+    StreamServer &operator=(const StreamServer &);
+
+    class UdpSender : private Thread::IRunnable
+    {
+    public:
+        UdpSender(const StreamSource &source);
+        ~UdpSender();
+
+        ResultCode start(const char *host, int port);
+        void stop();
+
+    private:
+        // Implements Thread::IRunnable
+        bool run();
+
+        const StreamSource &m_source;
+        Thread m_thread;
+        UdpSocket m_socket;
+    };
+
+    // Implements Thread::IRunnable
+    bool run();
+
+    void serve(TcpSocket &socket);
+    bool send_stream(TcpSocket &socket, bool is_chunked);
+
+    const StreamSource &m_source;
+    Thread m_thread;
+    TcpSocket m_listen_socket;
+    UdpSender m_udp_sender;
+};
+
+} // namespace
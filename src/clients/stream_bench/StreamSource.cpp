@@ -0,0 +1,211 @@
+///
+/// \file StreamSource.cpp
+///
+/// \brief Paced, time-stamped transport stream for the stream benchmark.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "StreamSource.h"
+
+#include <porting_layer/Log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ctvc;
+
+const ResultCode StreamSource::CANNOT_OPEN_CAPTURE("Cannot open the capture file");
+const ResultCode StreamSource::INVALID_CAPTURE("The capture is not a transport stream");
+
+static const uint8_t TS_SYNC_BYTE = 0x47;
+static const uint16_t NULL_PID = 0x1FFF;
+static const uint16_t GENERATED_PID = 0x100;
+static const uint32_t N_GENERATED_PACKETS = 16 * 6; // Keeps the continuity counter intact when the capture repeats
+
+// Stamp packet: TS header, magic, sequence number, send time and flags, all big endian
+static const char STAMP_MAGIC[] = "CTVCBNCH";
+static const uint32_t STAMP_MAGIC_LENGTH = 8;
+static const uint8_t STAMP_FLAG_LAST = 0x01;
+
+static void write_uint32(uint8_t *p, uint32_t value)
+{
+    for (int i = 3; i >= 0; i--) {
+        p[i] = static_cast<uint8_t>(value);
+        value >>= 8;
+    }
+}
+
+static uint32_t read_uint32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+StreamSource::StreamSource() :
+    m_bits_per_second(20000000),
+    m_jitter_in_ms(0),
+    m_duration_in_s(10)
+{
+    generate_capture();
+}
+
+StreamSource::~StreamSource()
+{
+}
+
+ResultCode StreamSource::load_capture(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        CTVC_LOG_ERROR("Can't open capture %s", path);
+        return CANNOT_OPEN_CAPTURE;
+    }
+
+    std::vector<uint8_t> capture;
+    uint8_t buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        capture.insert(capture.end(), buffer, buffer + n);
+    }
+    fclose(fp);
+
+    capture.resize(capture.size() - capture.size() % TS_PACKET_SIZE);
+    if (capture.empty() || capture[0] != TS_SYNC_BYTE) {
+        CTVC_LOG_ERROR("%s is not a transport stream capture", path);
+        return INVALID_CAPTURE;
+    }
+
+    m_capture.swap(capture);
+
+    return ResultCode::SUCCESS;
+}
+
+void StreamSource::set_bitrate(uint32_t bits_per_second)
+{
+    m_bits_per_second = bits_per_second > 0 ? bits_per_second : 1;
+}
+
+void StreamSource::set_jitter(uint32_t jitter_in_ms)
+{
+    m_jitter_in_ms = jitter_in_ms;
+}
+
+void StreamSource::set_duration(uint32_t duration_in_s)
+{
+    m_duration_in_s = duration_in_s;
+}
+
+uint64_t StreamSource::get_stream_length() const
+{
+    return static_cast<uint64_t>(get_n_bursts()) * BURST_SIZE;
+}
+
+uint32_t StreamSource::get_n_bursts() const
+{
+    uint64_t n_bursts = static_cast<uint64_t>(m_bits_per_second) * m_duration_in_s / (BURST_SIZE * 8);
+
+    return n_bursts > 0 ? static_cast<uint32_t>(n_bursts) : 1;
+}
+
+bool StreamSource::parse_stamp(const uint8_t *packet, Stamp &stamp/*out*/)
+{
+    if (packet[0] != TS_SYNC_BYTE || ((packet[1] & 0x1F) << 8 | packet[2]) != NULL_PID || memcmp(packet + 4, STAMP_MAGIC, STAMP_MAGIC_LENGTH) != 0) {
+        return false;
+    }
+
+    const uint8_t *p = packet + 4 + STAMP_MAGIC_LENGTH;
+    stamp.sequence_number = read_uint32(p);
+    stamp.send_time_in_us = static_cast<int64_t>((static_cast<uint64_t>(read_uint32(p + 4)) << 32) | read_uint32(p + 8));
+    stamp.is_last = (p[12] & STAMP_FLAG_LAST) != 0;
+
+    return true;
+}
+
+void StreamSource::generate_capture()
+{
+    m_capture.assign(N_GENERATED_PACKETS * TS_PACKET_SIZE, 0);
+
+    for (uint32_t i = 0; i < N_GENERATED_PACKETS; i++) {
+        uint8_t *packet = &m_capture[i * TS_PACKET_SIZE];
+        packet[0] = TS_SYNC_BYTE;
+        packet[1] = GENERATED_PID >> 8;
+        packet[2] = GENERATED_PID & 0xFF;
+        packet[3] = 0x10 | (i & 0x0F); // Payload only
+        for (uint32_t j = 4; j < TS_PACKET_SIZE; j++) {
+            packet[j] = static_cast<uint8_t>(i + j);
+        }
+    }
+}
+
+StreamSource::Pacer::Pacer(const StreamSource &source, Thread &thread) :
+    m_source(source),
+    m_thread(thread),
+    m_start_time(TimeStamp::now()),
+    m_due_time(m_start_time),
+    m_sequence_number(0),
+    m_n_bursts(source.get_n_bursts()),
+    m_capture_position(0),
+    m_continuity_counter(0)
+{
+}
+
+bool StreamSource::Pacer::next_burst(uint8_t *burst/*out*/)
+{
+    if (m_sequence_number >= m_n_bursts) {
+        return false;
+    }
+
+    // Nominal time of the burst, delayed by a random part of the jitter. A burst is never sent
+    // before the one in front of it.
+    int64_t offset_in_us = static_cast<int64_t>(m_sequence_number) * BURST_SIZE * 8 * 1000000 / m_source.m_bits_per_second;
+    if (m_source.m_jitter_in_ms > 0) {
+        offset_in_us += rand() % (m_source.m_jitter_in_ms * 1000);
+    }
+    TimeStamp due_time = TimeStamp(m_start_time).add_microseconds(offset_in_us);
+    if (due_time > m_due_time) {
+        m_due_time = due_time;
+    }
+
+    while (true) {
+        if (m_thread.must_stop()) {
+            return false;
+        }
+        int64_t remaining_in_us = m_due_time.get_as_microseconds() - TimeStamp::now().get_as_microseconds();
+        if (remaining_in_us < 1000) {
+            break;
+        }
+        Thread::sleep(static_cast<uint32_t>(remaining_in_us / 1000));
+    }
+
+    for (uint32_t i = 1; i < PACKETS_PER_BURST; i++) {
+        memcpy(burst + i * TS_PACKET_SIZE, &m_source.m_capture[m_capture_position], TS_PACKET_SIZE);
+        m_capture_position += TS_PACKET_SIZE;
+        if (m_capture_position >= m_source.m_capture.size()) {
+            m_capture_position = 0;
+        }
+    }
+
+    uint64_t send_time_in_us = static_cast<uint64_t>(TimeStamp::now().get_as_microseconds());
+    uint8_t *stamp = burst;
+    memset(stamp, 0xFF, TS_PACKET_SIZE);
+    stamp[0] = TS_SYNC_BYTE;
+    stamp[1] = NULL_PID >> 8;
+    stamp[2] = NULL_PID & 0xFF;
+    stamp[3] = 0x10 | m_continuity_counter;
+    m_continuity_counter = (m_continuity_counter + 1) & 0x0F;
+    uint8_t *p = stamp + 4;
+    memcpy(p, STAMP_MAGIC, STAMP_MAGIC_LENGTH);
+    p += STAMP_MAGIC_LENGTH;
+    write_uint32(p, m_sequence_number);
+    write_uint32(p + 4, static_cast<uint32_t>(send_time_in_us >> 32));
+    write_uint32(p + 8, static_cast<uint32_t>(send_time_in_us));
+    p[12] = m_sequence_number + 1 == m_n_bursts ? STAMP_FLAG_LAST : 0;
+
+    m_sequence_number++;
+
+    return true;
+}
@@ -0,0 +1,104 @@
+///
+/// \file StreamSource.h
+///
+/// \brief Paced, time-stamped transport stream for the stream benchmark.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <porting_layer/ResultCode.h>
+#include <porting_layer/Thread.h>
+#include <porting_layer/TimeStamp.h>
+
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+/// \brief A recorded TS/RAMS capture that is sent as a stream of bursts at a given bitrate
+///
+/// A burst is one UDP datagram worth of transport stream packets. The first packet of each burst
+/// is a stamp: a null packet that carries a sequence number and the time at which the burst was
+/// sent, from which the receiver derives the latency and the number of dropped bursts. The other
+/// packets come from the capture, which is repeated for as long as the stream lasts.
+class StreamSource
+{
+public:
+    static const ResultCode CANNOT_OPEN_CAPTURE;
+    static const ResultCode INVALID_CAPTURE;
+
+    static const uint32_t TS_PACKET_SIZE = 188;
+    static const uint32_t PACKETS_PER_BURST = 7;
+    static const uint32_t BURST_SIZE = TS_PACKET_SIZE * PACKETS_PER_BURST;
+
+    /// \brief Contents of a stamp packet
+    struct Stamp
+    {
+        uint32_t sequence_number;
+        int64_t send_time_in_us; ///< TimeStamp::now() of the sender
+        bool is_last;            ///< The last burst of the stream
+    };
+
+    StreamSource();
+    ~StreamSource();
+
+    /// \brief Use a capture instead of the generated stream
+    /// \param[in] path File with transport stream packets (TS or RAMS).
+    /// \result ResultCode
+    ResultCode load_capture(const char *path);
+
+    void set_bitrate(uint32_t bits_per_second);
+    void set_jitter(uint32_t jitter_in_ms);
+    void set_duration(uint32_t duration_in_s);
+
+    /// \brief Length of the stream in bytes
+    uint64_t get_stream_length() const;
+
+    /// \brief Check whether a transport stream packet is a stamp
+    /// \param[in] packet Transport stream packet of TS_PACKET_SIZE bytes.
+    /// \param[out] stamp Contents of the stamp.
+    /// \result True if the packet is a stamp.
+    static bool parse_stamp(const uint8_t *packet, Stamp &stamp/*out*/);
+
+    /// \brief Sends the bursts of one stream at the right time
+    class Pacer
+    {
+    public:
+        Pacer(const StreamSource &source, Thread &thread);
+
+        /// \brief Wait until the next burst is due and get it
+        /// \param[out] burst Burst of BURST_SIZE bytes, stamped with the current time.
+        /// \result False if the stream has ended or the thread must stop.
+        bool next_burst(uint8_t *burst/*out*/);
+
+    private:
+        const StreamSource &m_source;
+        Thread &m_thread;
+        TimeStamp m_start_time;
+        TimeStamp m_due_time;
+        uint32_t m_sequence_number;
+        uint32_t m_n_bursts;
+        uint32_t m_capture_position;
+        uint8_t m_continuity_counter;
+    };
+
+private:
+    StreamSource(const StreamSource &);
+    StreamSource &operator=(const StreamSource &);
+
+    std::vector<uint8_t> m_capture; // Whole packets only
+    uint32_t m_bits_per_second;
+    uint32_t m_jitter_in_ms;
+    uint32_t m_duration_in_s;
+
+    void generate_capture();
+    uint32_t get_n_bursts() const;
+};
+
+} // namespace
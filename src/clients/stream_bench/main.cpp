@@ -0,0 +1,298 @@
+///
+/// \file main.cpp
+///
+/// \brief Stream ingest benchmark with a stand-in HTTP/UDP stream server.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "StreamProbe.h"
+#include "StreamServer.h"
+#include "StreamSource.h"
+
+#include <http_client/HttpClient.h>
+#include <porting_layer/Socket.h>
+#include <porting_layer/Thread.h>
+#include <stream/HttpLoader.h>
+#include <stream/SimpleMediaPlayer.h>
+#include <stream/UdpLoader.h>
+#include <utils/utils.h>
+
+#include <map>
+#include <string>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace ctvc;
+
+const char *DEFAULT_MODES = "length,chunked,udp";
+const double DEFAULT_BITRATE_IN_MBPS = 20.0;
+const uint32_t DEFAULT_DURATION_IN_S = 10;
+const int DEFAULT_HTTP_PORT = 8096;
+const int DEFAULT_UDP_PORT = 12346;
+const char *DEFAULT_LOCAL_HOST = "127.0.0.1";
+
+// Time the stream may take longer than its duration before a run is considered stuck
+const uint32_t STREAM_GRACE_PERIOD_IN_MS = 5000;
+const uint32_t SERVER_STARTUP_TIMEOUT_IN_MS = 5000;
+
+volatile bool must_shutdown = false;
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "\nRuns the HTTP and UDP stream loaders against a stand-in stream server and reports the ingest\n");
+    fprintf(stderr, "rate, the CPU time per Mbit, the latency from the server to the IStream and the dropped bursts.\n");
+    fprintf(stderr, "\nAvailable options:\n");
+    fprintf(stderr, " -h                      Print this help.\n");
+    fprintf(stderr, " -f <capture>            TS/RAMS capture to stream.                             default: generated packets\n");
+    fprintf(stderr, " -r <bitrate>            Bitrate of the stream in Mbit/s.                       default: %.1f\n", DEFAULT_BITRATE_IN_MBPS);
+    fprintf(stderr, " -j <jitter>             Maximum random delay of each burst in ms.              default: 0\n");
+    fprintf(stderr, " -d <duration>           Duration of each stream in seconds.                    default: %u\n", DEFAULT_DURATION_IN_S);
+    fprintf(stderr, " -p <port>               HTTP port of the server.                               default: %d\n", DEFAULT_HTTP_PORT);
+    fprintf(stderr, " -u <port>               Local UDP port to receive the stream on.               default: %d\n", DEFAULT_UDP_PORT);
+    fprintf(stderr, " -m <modes>              Comma separated list of length, chunked and udp.       default: '%s'\n", DEFAULT_MODES);
+    fprintf(stderr, " -s                      Only run the server, until interrupted.\n");
+    fprintf(stderr, " -H <host>               Use the server on the given host instead of starting one.\n");
+    fprintf(stderr, " -l <host>               Address the server sends the UDP stream to.            default: '%s'\n", DEFAULT_LOCAL_HOST);
+    fprintf(stderr, "\nThe server is started in a child process, so the CPU time only covers the loaders.\n");
+    fprintf(stderr, "\nExample: %s -f capture.ts -r 8 -j 20 -m chunked,udp\n", name);
+}
+
+static void signal_handler(int /*signal*/)
+{
+    must_shutdown = true;
+}
+
+static int run_server(StreamSource &source, int port)
+{
+    StreamServer server(source);
+    if (server.start(port).is_error()) {
+        return 1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    while (!must_shutdown) {
+        Thread::sleep(100);
+    }
+
+    server.stop();
+
+    return 0;
+}
+
+static bool wait_for_server(const std::string &host, int port)
+{
+    for (uint32_t waited_in_ms = 0; waited_in_ms < SERVER_STARTUP_TIMEOUT_IN_MS; waited_in_ms += 100) {
+        TcpSocket socket;
+        socket.open();
+        if (socket.connect(host.c_str(), port).is_ok()) {
+            return true;
+        }
+        Thread::sleep(100);
+    }
+
+    return false;
+}
+
+static int64_t get_cpu_time_in_us()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (static_cast<int64_t>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void print_report(const char *mode, const StreamProbe::Report &report, int64_t cpu_time_in_us)
+{
+    double mbits = report.n_bytes * 8 / 1000000.0;
+    double ingest_rate = report.duration_in_us > 0 ? report.n_bytes * 8.0 / report.duration_in_us : 0.0;
+    double cpu_per_mbit = mbits > 0 ? cpu_time_in_us / 1000.0 / mbits : 0.0;
+
+    printf("%-8s %10.2f %12.3f %10.2f %10.2f %10.2f %10.2f %8u %9u %8u  %s\n", mode, ingest_rate, cpu_per_mbit,
+           report.latency_avg_in_us / 1000.0, report.latency_p50_in_us / 1000.0, report.latency_p99_in_us / 1000.0, report.latency_max_in_us / 1000.0,
+           report.n_dropped_bursts, report.n_reordered_bursts, report.n_bursts, report.result.get_description());
+}
+
+template<class STREAM_LOADER_TYPE> static bool run_benchmark(const char *mode, const std::string &url, const std::string &trigger_url, uint32_t timeout_in_ms)
+{
+    StreamProbe probe;
+    SimpleMediaPlayer<STREAM_LOADER_TYPE> player(probe);
+    std::map<std::string, std::string> stream_params;
+    IStream *stream_in = 0;
+
+    int64_t cpu_time_in_us = get_cpu_time_in_us();
+
+    ResultCode ret = player.open_stream(url, stream_params, probe, stream_in);
+    if (ret.is_error()) {
+        fprintf(stderr, "%s: can't open %s: %s\n", mode, url.c_str(), ret.get_description());
+        return false;
+    }
+
+    if (!trigger_url.empty()) {
+        // The server only starts to send after the loader listens
+        HttpClient client;
+        ret = client.get(trigger_url.c_str());
+        if (ret.is_error() || client.get_response_code() != 200) {
+            fprintf(stderr, "%s: server did not start the stream (%s)\n", mode, ret.get_description());
+            player.close_stream();
+            return false;
+        }
+    }
+
+    bool is_complete = probe.wait_until_done(timeout_in_ms);
+    player.close_stream();
+
+    cpu_time_in_us = get_cpu_time_in_us() - cpu_time_in_us;
+
+    StreamProbe::Report report;
+    probe.get_report(report);
+    print_report(mode, report, cpu_time_in_us);
+    if (!is_complete) {
+        fprintf(stderr, "%s: stream did not end within %u ms\n", mode, timeout_in_ms);
+    }
+
+    return is_complete;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string capture_path;
+    double bitrate_in_mbps = DEFAULT_BITRATE_IN_MBPS;
+    uint32_t jitter_in_ms = 0;
+    uint32_t duration_in_s = DEFAULT_DURATION_IN_S;
+    int http_port = DEFAULT_HTTP_PORT;
+    int udp_port = DEFAULT_UDP_PORT;
+    std::string modes(DEFAULT_MODES);
+    bool is_server_only = false;
+    std::string server_host;
+    std::string local_host(DEFAULT_LOCAL_HOST);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hf:r:j:d:p:u:m:sH:l:")) != -1) {
+        switch (opt) {
+        case 'f':
+            capture_path = optarg;
+            break;
+        case 'r':
+            bitrate_in_mbps = atof(optarg);
+            break;
+        case 'j':
+            jitter_in_ms = strtoul(optarg, 0, 10);
+            break;
+        case 'd':
+            duration_in_s = strtoul(optarg, 0, 10);
+            break;
+        case 'p':
+            http_port = atoi(optarg);
+            break;
+        case 'u':
+            udp_port = atoi(optarg);
+            break;
+        case 'm':
+            modes = optarg;
+            break;
+        case 's':
+            is_server_only = true;
+            break;
+        case 'H':
+            server_host = optarg;
+            break;
+        case 'l':
+            local_host = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default: /* '?' */
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc || bitrate_in_mbps <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    StreamSource source;
+    source.set_bitrate(static_cast<uint32_t>(bitrate_in_mbps * 1000000));
+    source.set_jitter(jitter_in_ms);
+    source.set_duration(duration_in_s);
+    if (!capture_path.empty() && source.load_capture(capture_path.c_str()).is_error()) {
+        fprintf(stderr, "Can't use capture %s\n", capture_path.c_str());
+        return 1;
+    }
+
+    if (is_server_only) {
+        return run_server(source, http_port);
+    }
+
+    pid_t server_pid = 0;
+    if (server_host.empty()) {
+        server_host = "127.0.0.1";
+        server_pid = fork();
+        if (server_pid < 0) {
+            perror("fork");
+            return 1;
+        } else if (server_pid == 0) {
+            return run_server(source, http_port);
+        }
+    }
+
+    int exit_code = 0;
+    if (!wait_for_server(server_host, http_port)) {
+        fprintf(stderr, "No server at %s:%d\n", server_host.c_str(), http_port);
+        exit_code = 1;
+    } else {
+        uint32_t timeout_in_ms = duration_in_s * 1000 + jitter_in_ms + STREAM_GRACE_PERIOD_IN_MS;
+
+        printf("%-8s %10s %12s %10s %10s %10s %10s %8s %9s %8s  %s\n", "mode", "Mbit/s", "CPU ms/Mbit", "lat avg", "lat p50", "lat p99", "lat max", "dropped", "reordered", "bursts", "result");
+
+        std::string::size_type pos = 0;
+        while (pos <= modes.size()) {
+            std::string::size_type end = modes.find(',', pos);
+            if (end == std::string::npos) {
+                end = modes.size();
+            }
+            std::string mode(modes, pos, end - pos);
+            pos = end + 1;
+
+            std::string url;
+            bool is_ok = true;
+            if (mode == "length" || mode == "chunked") {
+                string_printf(url, "http://%s:%d/%s", server_host.c_str(), http_port, mode.c_str());
+                is_ok = run_benchmark<HttpLoader>(mode.c_str(), url, "", timeout_in_ms);
+            } else if (mode == "udp") {
+                std::string trigger_url;
+                string_printf(url, "udp://0.0.0.0:%d", udp_port);
+                string_printf(trigger_url, "http://%s:%d/udp?host=%s&port=%d", server_host.c_str(), http_port, local_host.c_str(), udp_port);
+                is_ok = run_benchmark<UdpLoader>(mode.c_str(), url, trigger_url, timeout_in_ms);
+            } else {
+                fprintf(stderr, "Unknown mode '%s'\n", mode.c_str());
+                is_ok = false;
+            }
+            if (!is_ok) {
+                exit_code = 1;
+            }
+        }
+    }
+
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, 0, 0);
+    }
+
+    return exit_code;
+}
@@ -12,6 +12,7 @@
 #pragma once
 
 #include <core/IContentLoader.h>
+#include <http_client/HttpCancelToken.h>
 #include <http_client/HttpClient.h>
 #include <http_client/IHttpData.h>
 #include <porting_layer/Thread.h>
@@ -19,12 +20,14 @@
 #include <porting_layer/Semaphore.h>
 
 #include <vector>
-#include <list>
+#include <map>
 #include <string>
 
 namespace ctvc
 {
 
+class ContentCache;
+
 class DefaultContentLoader : public IContentLoader
 {
 public:
@@ -32,6 +35,7 @@ public:
     virtual ~DefaultContentLoader();
 
     virtual IContentLoader::IContentResult *load_content(const std::string &url, std::vector<uint8_t> &buffer);
+    virtual IContentLoader::IContentResult *load_content(const std::string &url, std::vector<uint8_t> &buffer, uint32_t priority);
     virtual void release_content_result(IContentResult *content_result);
 
     // "0" means no threading at all
@@ -41,6 +45,29 @@ public:
     // This call blocks until all threads are stopped
     void stop();
 
+    // Downloaded content is cached by URL, following the Cache-Control, ETag and Last-Modified
+    // headers of the responses. Concurrent requests for the same URL share a single download.
+    // By default DEFAULT_CACHE_SIZE bytes of content are kept in memory; "0" disables the cache.
+    static const uint32_t DEFAULT_CACHE_SIZE = 2 * 1024 * 1024;
+    void set_cache_size(uint32_t max_bytes);
+
+    // Keep up to max_bytes of content in the directory at path as well, e.g. to survive
+    // restarts of the client. The disk cache is disabled by default and if path is "0".
+    void set_disk_cache(const char *path, uint32_t max_bytes);
+
+    // Maximum number of requests that are loaded from the same host (and port) at the same time.
+    // Other requests for that host wait, while requests for other hosts go ahead.
+    static const uint32_t DEFAULT_MAX_REQUESTS_PER_HOST = 4;
+    void set_max_requests_per_host(uint32_t max_requests);
+
+    // Timeouts of the downloads: to connect to the server, from the request up to the first byte of the
+    // response, and of the download as a whole. A download that times out fails with SERVER_ERROR. "0"
+    // disables the timeout (for the connect timeout: leaves it to the platform).
+    static const uint32_t DEFAULT_CONNECT_TIMEOUT_IN_MS = 5000;
+    static const uint32_t DEFAULT_FIRST_BYTE_TIMEOUT_IN_MS = 10000;
+    static const uint32_t DEFAULT_TOTAL_TIMEOUT_IN_MS = 30000;
+    void set_timeouts(uint32_t connect_timeout_in_ms, uint32_t first_byte_timeout_in_ms, uint32_t total_timeout_in_ms);
+
 private:
     DefaultContentLoader(const DefaultContentLoader &);
     DefaultContentLoader &operator=(const DefaultContentLoader &);
@@ -53,34 +80,71 @@ private:
         }
     }
 
+    // Requests are ordered by priority, and by order of arrival within the same priority
+    typedef std::pair<uint32_t, uint32_t> RequestKey;
+
     class ContentDescriptor : public IContentResult
     {
     public:
-        ContentDescriptor() :
-            m_buffer(0)
+        enum State
         {
-        }
+            IDLE,
+            QUEUED,     // In the request queue of a loader thread
+            COALESCED,  // Waiting for the download of the same URL by another request
+            LOADING     // Being loaded, or loaded
+        };
 
-        virtual ~ContentDescriptor()
+        ContentDescriptor(DefaultContentLoader &parent) :
+            m_parent(parent),
+            m_buffer(0),
+            m_state(IDLE),
+            m_queue_index(0)
         {
         }
 
-        void set_request(const std::string &url, std::vector<uint8_t> &buffer)
+        virtual ~ContentDescriptor()
         {
-            m_url = url;
-            m_buffer = &buffer;
         }
 
+        void set_request(const std::string &url, std::vector<uint8_t> &buffer, const RequestKey &key);
+
         const std::string &get_url()
         {
             return m_url;
         }
 
+        const std::string &get_host()
+        {
+            return m_host;
+        }
+
         std::vector<uint8_t> *get_buffer()
         {
             return m_buffer;
         }
 
+        const RequestKey &get_key()
+        {
+            return m_key;
+        }
+
+        // The state is protected by the mutex of the parent
+        State get_state()
+        {
+            return m_state;
+        }
+
+        void set_state(State state, size_t queue_index = 0)
+        {
+            m_state = state;
+            m_queue_index = queue_index;
+        }
+
+        size_t get_queue_index()
+        {
+            return m_queue_index;
+        }
+
         void set_result(ResultCode result)
         {
             m_result = result;
@@ -93,22 +157,50 @@ private:
             return m_result;
         }
 
+        virtual bool wait_for_result(uint32_t timeout_in_ms, ResultCode &result/*out*/)
+        {
+            if (!m_sem.wait(timeout_in_ms)) {
+                return false;
+            }
+            result = m_result;
+            return true;
+        }
+
+        virtual void cancel();
+
     private:
+        ContentDescriptor(const ContentDescriptor &);
+        ContentDescriptor &operator=(const ContentDescriptor &);
+
+        DefaultContentLoader &m_parent;
         std::string m_url; // URL to be loaded
+        std::string m_host; // Host and port of the URL
         std::vector<uint8_t> *m_buffer; // Buffer where to store the result
+        RequestKey m_key;
+        State m_state;
+        size_t m_queue_index; // Request queue if queued
         Semaphore m_sem; // Semaphore that will be set to 1 when the result is known
         ResultCode m_result;
     };
+    friend class ContentDescriptor; // Needed for Metrowerks
 
-    ContentDescriptor *get_next_pending_content_descriptor();
+    ContentDescriptor *get_next_pending_content_descriptor(size_t queue_index);
+    void content_descriptor_loaded(const std::string &host);
+    void cancel(ContentDescriptor &content_descriptor);
 
     class ContentHandler : public Thread::IRunnable, public IHttpDataSink
     {
     public:
-        ContentHandler(DefaultContentLoader &parent);
+        ContentHandler(DefaultContentLoader &parent, size_t queue_index);
         ~ContentHandler();
 
-        ResultCode download_content(const std::string &url, std::vector<uint8_t> &buffer);
+        // Load the content of the request, from the cache or by downloading it, and set its result
+        void load_content(ContentDescriptor &content_descriptor);
+
+        // Abort the download of the request, if this handler downloads it. Called with the mutex of the parent locked.
+        bool cancel_download(ContentDescriptor &content_descriptor);
+        // Abort any download, and the next ones until load_content() is called again
+        void cancel_downloads();
 
         virtual bool run();
         virtual void write(const char *buf, uint32_t len);
@@ -117,9 +209,15 @@ private:
         ContentHandler(const ContentHandler &);
         ContentHandler &operator=(const ContentHandler &);
 
+        ResultCode download_content(const std::string &url, std::vector<uint8_t> &buffer, const std::string &etag, const std::string &last_modified);
+
+        HttpCancelToken m_cancel_token; // Before the client, which uses it until it is destroyed
         HttpClient m_http_client;
         DefaultContentLoader &m_parent;
+        size_t m_queue_index;
         std::vector<uint8_t> *m_buffer;
+        ContentDescriptor *m_download; // Request that is being downloaded, protected by the mutex of the parent
+        int m_first_byte_timeout_in_ms;
     };
     friend class ContentHandler; // Needed for Metrowerks
 
@@ -139,9 +237,24 @@ private:
     std::vector<Thread *> m_threads;
     std::vector<ContentHandler *> m_content_handlers;
 
-    std::list<ContentDescriptor *> m_pending_requests;
+    // Every loader thread has a queue of requests of its own. Requests are spread over the queues as they come in.
+    // A thread takes the first request of its own queue, unless another queue has a request of higher priority;
+    // then it steals that one. Requests for hosts that have the maximum number of requests loading are skipped.
+    std::vector<std::map<RequestKey, ContentDescriptor *> > m_request_queues;
+    size_t m_next_request_queue;
+    uint32_t m_request_sequence;
+    std::map<std::string, uint32_t> m_requests_per_host; // Number of requests loading per host
+    uint32_t m_max_requests_per_host;
+
+    uint32_t m_connect_timeout_in_ms;
+    uint32_t m_first_byte_timeout_in_ms;
+    uint32_t m_total_timeout_in_ms;
+
     std::vector<ContentDescriptor *> m_pool_requests;
     std::vector<ContentDescriptor *> m_content_descriptors;
-};
 
+    ContentCache &m_cache;
+    // Requests waiting for the download of the same URL by another thread, keyed by URL
+    std::map<std::string, std::vector<ContentDescriptor *> > m_downloads_in_progress;
+};
 }
@@ -30,13 +30,40 @@ struct IContentLoader
     {
         static const ResultCode REQUEST_ERROR; ///<! The URL is malformed or the protocol is not supported
         static const ResultCode SERVER_ERROR;  ///<! The server returned an error or the connection could not be established
-        static const ResultCode CANCELED_REQUEST; ///<! The request was canceled before it could be issued
+        static const ResultCode CANCELED_REQUEST; ///<! The request was canceled before it was loaded
         static const ResultCode UNKNOWN_ERROR; ///<! Any other error
 
         /// \brief Wait until the result of loading operation is available
         ///
         /// This call shall block until the operation has finished and it shall not be called twice.
         virtual ResultCode wait_for_result() = 0;
+
+        /// \brief Wait at most the given time until the result of the loading operation is available
+        ///
+        /// Like wait_for_result(), but it gives up if the result is not known within the timeout, after which it may be
+        /// called again. Once it has returned true, neither this call nor wait_for_result() shall be called again.
+        /// The default implementation ignores the timeout and blocks in wait_for_result().
+        ///
+        /// \param[in] timeout_in_ms Maximum time to wait in milliseconds, 0 to only check whether the result is available.
+        /// \param[out] result The result of the loading operation, only set if it is available.
+        /// \retval true The result is available.
+        /// \retval false The result was not available within the timeout.
+        virtual bool wait_for_result(uint32_t /*timeout_in_ms*/, ResultCode &result/*out*/)
+        {
+            result = wait_for_result();
+            return true;
+        }
+
+        /// \brief Cancel the request, e.g. because the content is not needed anymore
+        ///
+        /// A request that is still waiting to be loaded will not be loaded; its result becomes CANCELED_REQUEST.
+        /// An implementation may abort a request that is being loaded as well, with the same result. A request that
+        /// has been loaded is not affected. In either case the result still has to be waited for before the object is
+        /// released with release_content_result().
+        /// The default implementation does not cancel anything.
+        virtual void cancel()
+        {
+        }
     };
 
     /// \brief Request to download an asset from the given URL and store it in the passed buffer
@@ -54,6 +81,22 @@ struct IContentLoader
     /// \return A pointer to the object where the result of operation is returned.
     virtual IContentResult *load_content(const std::string &url, std::vector<uint8_t> &buffer) = 0;
 
+    /// \brief Request to download an asset with a certain priority
+    ///
+    /// Like load_content(url, buffer), but requests with a lower priority value are loaded before requests with a
+    /// higher value that are still waiting to be loaded. Nano SDK uses the size of an overlay image in pixels as
+    /// its priority, so small images can be shown before big ones.
+    /// The default implementation ignores the priority.
+    ///
+    /// \param[in] url URL where the resource can be reached.
+    /// \param[in] buffer Reference to the buffer where to download the requested asset.
+    /// \param[in] priority Priority of the request, lower values first.
+    /// \return A pointer to the object where the result of operation is returned.
+    virtual IContentResult *load_content(const std::string &url, std::vector<uint8_t> &buffer, uint32_t /*priority*/)
+    {
+        return load_content(url, buffer);
+    }
+
     /// \brief Releases the object that was allocated by load_content
     ///
     /// \param[in] content_result Pointer to the object that contained the result of a certain request.
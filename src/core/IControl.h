@@ -46,6 +46,8 @@ struct IControl
     /// \li "fw"   The firmware version running on the device, e.g. "1.3.2.300".
     /// \li "configured_display" Preferred display, typically used to indicate to the
     ///            server that an SD screen is connected. Example value: "pal4x3".
+    /// \li "key_trace_dump" When "true", the per-stage timing of every traced key event is logged
+    ///            locally. This parameter is handled by the client and not sent to the server.
     ///
     /// Please refer to the documentation of the underlying protocol for details.
     virtual void initiate(const std::string &host, const std::string &url, uint32_t screen_width, uint32_t screen_height, const std::map<std::string, std::string> &optional_parameters) = 0;
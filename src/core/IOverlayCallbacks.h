@@ -62,6 +62,10 @@ struct IOverlayCallbacks
     /// \brief Blit an image to the shadow graphics overlay plane.
     ///
     /// The shadow graphics overlay plane is not visible until \a overlay_flip() is called.
+    /// Images that are loaded from a URL are blitted as soon as they are available, so the images of a
+    /// framebuffer update may be blitted in a different order than they were sent in. Overlapping images
+    /// are always blitted in their original order. An image that cannot be loaded within a few seconds
+    /// is left out of its update; it may still be blitted (followed by a flip) when it comes in later.
     /// \param [in] picture_params PictureParameters with picture data, x and y coordinates, width and height and alpha channel information.
     virtual void overlay_blit_image(const PictureParameters &picture_params) = 0;
 
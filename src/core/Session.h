@@ -199,6 +199,67 @@ public:
     /// \result true if successful, false otherwise.
     bool unregister_handoff_handler(const std::string &handoff_scheme);
 
+    // ********* Reporting *********
+
+    /// \brief Set the window within which triggered client reports are coalesced.
+    /// \param [in] window_in_ms Time from the first update of a report until the report is sent.
+    ///        Later updates are merged into the same report, and all reports that are pending
+    ///        by then are sent in a single write. 0 (the default) sends a report on every update.
+    ///
+    /// This reduces the number of small reports during bursts of events, such as the stalls of
+    /// a network hiccup, at the cost of delaying the reports by at most \a window_in_ms.
+    void set_report_coalescing_window(uint32_t window_in_ms);
+
+    // ********* Connection *********
+
+    /// \brief Set the back-off between the attempts to reconnect a session.
+    /// \param [in] min_backoff_in_ms Longest delay of the first attempt after the connection of an active session
+    ///        was lost. Every next attempt waits up to twice as long. The default is 500 ms.
+    /// \param [in] max_backoff_in_ms Longest delay between two attempts. The default is 60000 ms.
+    /// \param [in] max_attempts Number of failed attempts after which the session is closed. The default is 8.
+    ///
+    /// A random part of each delay spreads the reconnects of many clients when a server goes down.
+    /// A connection that is refused backs off one step further, since a server that refuses connections is
+    /// not likely to be back soon. A host that can't be found is retried if it was found for the session
+    /// before, since then its name lookup more likely failed along with the network.
+    void set_reconnect_backoff(uint32_t min_backoff_in_ms, uint32_t max_backoff_in_ms, uint32_t max_attempts);
+
+    // ********* Input *********
+
+    /// \brief Policy for repeated presses of a key that reach the session faster than they can be sent or displayed.
+    enum KeyRepeatPolicy
+    {
+        KEY_REPEAT_SEND_ALL, /*!< Send every key press to the server (default) */
+        KEY_REPEAT_COALESCE  /*!< Drop repeated presses of a key that the server has not caught up with yet */
+    };
+
+    /// \brief Set the policy for repeated key presses.
+    /// \param [in] policy How repeated key presses are handled.
+    /// \param [in] max_outstanding_keys With KEY_REPEAT_COALESCE, the number of presses of the same key that
+    ///        may have been sent without having been displayed yet. Further presses of that key are dropped,
+    ///        and so is a press of a key that still waits to be sent. 0 only drops the latter.
+    ///
+    /// Keys that are pressed while earlier keys wait to be sent are always sent together in a single
+    /// write. Coalescing additionally keeps the server from queueing up presses during rapid scrolling,
+    /// at the cost of skipping some of them. Key presses are only known to be displayed while latency
+    /// reporting is enabled by the server; otherwise they count as outstanding for at most a second.
+    void set_key_repeat_policy(KeyRepeatPolicy policy, uint32_t max_outstanding_keys);
+
+    // ********* Threading *********
+
+    /// \brief Let the sessions that are constructed from now on share their event, timer and receive threads.
+    /// \param [in] n_event_threads Number of threads that handle the events of all the sharing sessions.
+    ///        0 gives every session that is constructed from now on threads of its own, which is the default.
+    ///
+    /// By default, every session has a thread that handles its events, a thread for its timers and a thread
+    /// that receives from its connection. Processes that run many sessions at once, such as load test clients,
+    /// can share a few event threads, one timer thread and one receive thread between all of them instead.
+    /// The events of a session are still handled in order and one at a time, but a callback that blocks holds
+    /// up one of the shared threads. A connection still connects on a thread of its own, and an SSL connection
+    /// keeps that thread to receive. A stream that is played also still has a thread of its own. Sessions that
+    /// have been constructed before keep the threads they have.
+    static void set_shared_event_threads(uint32_t n_event_threads);
+
 private:
     Session(const Session &);
     Session &operator=(const Session &);
@@ -0,0 +1,438 @@
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "ContentCache.h"
+
+#include <utils/utils.h>
+
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Log.h>
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ctvc;
+
+// Version line of the items in the disk tier, change it when the format changes
+static const char DISK_ITEM_VERSION[] = "ctvc-content-cache 1";
+
+// Start of the names of the items in the data store that belong to the disk tier
+static const char DISK_ID_PREFIX[] = "content_cache_";
+
+// Name of the item in the data store that holds the content of the given URL
+static std::string get_disk_id(const std::string &url)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::string::const_iterator i = url.begin(); i != url.end(); ++i) {
+        hash ^= static_cast<uint8_t>(*i);
+        hash *= 1099511628211ULL;
+    }
+
+    std::string id;
+    string_printf(id, "%s%08x%08x", DISK_ID_PREFIX, static_cast<uint32_t>(hash >> 32), static_cast<uint32_t>(hash));
+
+    return id;
+}
+
+// Read a line ending in '\n' from p up to end. Returns the position after the line, or 0 if there is no line.
+static const uint8_t *read_line(const uint8_t *p, const uint8_t *end, std::string &line/*out*/)
+{
+    const uint8_t *eol = static_cast<const uint8_t *>(memchr(p, '\n', end - p));
+    if (!eol) {
+        return 0;
+    }
+    line.assign(reinterpret_cast<const char *>(p), eol - p);
+
+    return eol + 1;
+}
+
+static bool is_saved_earlier(const DataStore::ItemInfo &a, const DataStore::ItemInfo &b)
+{
+    return a.modification_time < b.modification_time;
+}
+
+ContentCache::ContentCache() :
+    m_memory_size(0),
+    m_memory_limit(0),
+    m_is_disk_enabled(false),
+    m_disk_size(0),
+    m_disk_limit(0)
+{
+}
+
+ContentCache::~ContentCache()
+{
+}
+
+void ContentCache::set_memory_limit(uint32_t max_bytes)
+{
+    AutoLock lck(m_mutex);
+
+    m_memory_limit = max_bytes;
+    evict_from_memory(m_memory_limit);
+}
+
+void ContentCache::set_disk_tier(const char *path, uint32_t max_bytes)
+{
+    AutoLock lck(m_disk_mutex);
+
+    m_is_disk_enabled = path != 0;
+    m_data_store.set_base_store_path(path);
+    m_disk_limit = max_bytes;
+    m_disk_ids.clear();
+    m_disk_id_map.clear();
+    m_disk_size = 0;
+
+    if (!m_is_disk_enabled) {
+        return;
+    }
+
+    // Account for the items of earlier runs, as if the most recently saved ones were used last,
+    // and drop the oldest ones that don't fit anymore
+    std::vector<DataStore::ItemInfo> items;
+    if (m_data_store.get_items(items).is_error()) {
+        CTVC_LOG_WARNING("Could not get the items of the disk cache");
+        return;
+    }
+    std::sort(items.begin(), items.end(), is_saved_earlier);
+    for (std::vector<DataStore::ItemInfo>::const_iterator i = items.begin(); i != items.end(); ++i) {
+        if (i->id.compare(0, sizeof(DISK_ID_PREFIX) - 1, DISK_ID_PREFIX) != 0) {
+            continue;
+        }
+        m_disk_ids.push_front(i->id);
+        m_disk_id_map[i->id] = std::make_pair(m_disk_ids.begin(), i->length);
+        m_disk_size += i->length;
+    }
+
+    evict_from_disk(m_disk_limit);
+}
+
+ContentCache::LookupResult ContentCache::lookup(const std::string &url, std::vector<uint8_t> &data/*out*/, std::string &etag/*out*/, std::string &last_modified/*out*/)
+{
+    {
+        AutoLock lck(m_mutex);
+
+        std::map<std::string, EntryList::iterator>::iterator i = m_entry_map.find(url);
+        if (i != m_entry_map.end()) {
+            Entry &entry(*i->second);
+            m_entries.splice(m_entries.begin(), m_entries, i->second);
+            if (entry.expiry_time > time(0)) {
+                data = entry.data;
+                return FRESH;
+            }
+            etag = entry.etag;
+            last_modified = entry.last_modified;
+            return STALE;
+        }
+    }
+
+    Entry entry;
+    if (!load_from_disk(url, entry)) {
+        return NOT_CACHED;
+    }
+
+    LookupResult result = STALE;
+    if (entry.expiry_time > time(0)) {
+        data = entry.data;
+        result = FRESH;
+    } else {
+        etag = entry.etag;
+        last_modified = entry.last_modified;
+    }
+
+    AutoLock lck(m_mutex);
+    insert_in_memory(entry);
+
+    return result;
+}
+
+void ContentCache::store(const std::string &url, const std::vector<uint8_t> &data, const std::string &etag, const std::string &last_modified, const std::string &cache_control)
+{
+    time_t max_age = 0;
+    bool is_storable = parse_cache_control(cache_control, max_age);
+
+    // Content that is stale right away and can't be revalidated is of no use
+    if (!is_storable || (max_age == 0 && etag.empty() && last_modified.empty())) {
+        {
+            AutoLock lck(m_mutex);
+
+            std::map<std::string, EntryList::iterator>::iterator i = m_entry_map.find(url);
+            if (i != m_entry_map.end()) {
+                remove_from_memory(i);
+            }
+        }
+
+        remove_from_disk(get_disk_id(url));
+        return;
+    }
+
+    Entry entry;
+    entry.url = url;
+    entry.data = data;
+    entry.etag = etag;
+    entry.last_modified = last_modified;
+    entry.expiry_time = time(0) + max_age;
+
+    save_to_disk(entry);
+
+    AutoLock lck(m_mutex);
+    insert_in_memory(entry);
+}
+
+bool ContentCache::revalidated(const std::string &url, const std::string &cache_control, std::vector<uint8_t> &data/*out*/)
+{
+    time_t max_age = 0;
+    parse_cache_control(cache_control, max_age); // For no-store the content is still returned, it is just not fresh
+
+    Entry entry;
+    {
+        AutoLock lck(m_mutex);
+
+        std::map<std::string, EntryList::iterator>::iterator i = m_entry_map.find(url);
+        if (i != m_entry_map.end()) {
+            Entry &cached_entry(*i->second);
+            cached_entry.expiry_time = time(0) + max_age;
+            m_entries.splice(m_entries.begin(), m_entries, i->second);
+            data = cached_entry.data;
+
+            if (!m_is_disk_enabled) {
+                return true;
+            }
+            entry = cached_entry; // Update the expiry time of the disk tier as well
+        }
+    }
+
+    if (!entry.url.empty()) {
+        save_to_disk(entry);
+        return true;
+    }
+
+    if (!load_from_disk(url, entry)) {
+        return false;
+    }
+
+    entry.expiry_time = time(0) + max_age;
+    data = entry.data;
+    save_to_disk(entry);
+
+    AutoLock lck(m_mutex);
+    insert_in_memory(entry);
+
+    return true;
+}
+
+bool ContentCache::parse_cache_control(const std::string &cache_control, time_t &max_age/*out*/)
+{
+    bool is_no_cache = false;
+    max_age = 0;
+
+    std::string::size_type pos = 0;
+    while (pos < cache_control.size()) {
+        std::string::size_type end = cache_control.find(',', pos);
+        if (end == std::string::npos) {
+            end = cache_control.size();
+        }
+
+        // Trim the directive
+        std::string::size_type first = cache_control.find_first_not_of(" \t", pos);
+        std::string::size_type last = cache_control.find_last_not_of(" \t", end - 1);
+        if (first != std::string::npos && first < end && last >= first) {
+            std::string directive(cache_control, first, last - first + 1);
+
+            if (!ctvc::strcasecmp(directive.c_str(), "no-store")) {
+                return false;
+            } else if (!ctvc::strcasecmp(directive.c_str(), "no-cache")) {
+                is_no_cache = true;
+            } else if (!ctvc::strncasecmp(directive.c_str(), "max-age=", 8)) {
+                long value = strtol(directive.c_str() + 8, 0, 10);
+                max_age = value > 0 ? static_cast<time_t>(value) : 0;
+            }
+        }
+
+        pos = end + 1;
+    }
+
+    if (is_no_cache) {
+        max_age = 0;
+    }
+
+    return true;
+}
+
+void ContentCache::insert_in_memory(Entry &entry/*in, data is swapped out*/)
+{
+    std::map<std::string, EntryList::iterator>::iterator i = m_entry_map.find(entry.url);
+    if (i != m_entry_map.end()) {
+        remove_from_memory(i);
+    }
+
+    if (entry.data.size() > m_memory_limit) {
+        return;
+    }
+
+    m_entries.push_front(Entry());
+    Entry &new_entry(m_entries.front());
+    new_entry.url = entry.url;
+    new_entry.data.swap(entry.data);
+    new_entry.etag = entry.etag;
+    new_entry.last_modified = entry.last_modified;
+    new_entry.expiry_time = entry.expiry_time;
+
+    m_entry_map[new_entry.url] = m_entries.begin();
+    m_memory_size += new_entry.data.size();
+
+    evict_from_memory(m_memory_limit);
+}
+
+void ContentCache::remove_from_memory(std::map<std::string, EntryList::iterator>::iterator i)
+{
+    m_memory_size -= i->second->data.size();
+    m_entries.erase(i->second);
+    m_entry_map.erase(i);
+}
+
+void ContentCache::evict_from_memory(uint32_t max_bytes)
+{
+    while (m_memory_size > max_bytes && !m_entries.empty()) {
+        remove_from_memory(m_entry_map.find(m_entries.back().url));
+    }
+}
+
+bool ContentCache::load_from_disk(const std::string &url, Entry &entry/*out*/)
+{
+    AutoLock lck(m_disk_mutex);
+
+    if (!m_is_disk_enabled) {
+        return false;
+    }
+
+    std::string id = get_disk_id(url);
+    std::vector<uint8_t> item;
+    if (m_data_store.get_data(id.c_str(), item).is_error()) {
+        return false;
+    }
+
+    const uint8_t *p = item.empty() ? 0 : &item[0];
+    const uint8_t *end = p + item.size();
+    std::string version;
+    std::string expiry_time;
+    if (p) {
+        p = read_line(p, end, version);
+    }
+    if (p) {
+        p = read_line(p, end, entry.url);
+    }
+    if (p) {
+        p = read_line(p, end, entry.etag);
+    }
+    if (p) {
+        p = read_line(p, end, entry.last_modified);
+    }
+    if (p) {
+        p = read_line(p, end, expiry_time);
+    }
+    if (!p || version != DISK_ITEM_VERSION) {
+        CTVC_LOG_WARNING("Removing invalid cache item %s", id.c_str());
+        m_data_store.delete_data(id.c_str());
+        return false;
+    }
+    if (entry.url != url) {
+        // Another URL with the same hash, leave it
+        return false;
+    }
+
+    entry.expiry_time = static_cast<time_t>(strtol(expiry_time.c_str(), 0, 10));
+    entry.data.assign(p, end);
+
+    std::map<std::string, std::pair<std::list<std::string>::iterator, uint32_t> >::iterator i = m_disk_id_map.find(id);
+    if (i != m_disk_id_map.end()) {
+        m_disk_ids.splice(m_disk_ids.begin(), m_disk_ids, i->second.first);
+    } else {
+        // Written after the disk tier was enabled by another client that shares the directory, account for it from now on
+        m_disk_ids.push_front(id);
+        m_disk_id_map[id] = std::make_pair(m_disk_ids.begin(), static_cast<uint32_t>(item.size()));
+        m_disk_size += item.size();
+    }
+
+    return true;
+}
+
+void ContentCache::save_to_disk(const Entry &entry)
+{
+    AutoLock lck(m_disk_mutex);
+
+    if (!m_is_disk_enabled) {
+        return;
+    }
+
+    std::string header;
+    string_printf(header, "%s\n%s\n%s\n%s\n%ld\n", DISK_ITEM_VERSION, entry.url.c_str(), entry.etag.c_str(), entry.last_modified.c_str(), static_cast<long>(entry.expiry_time));
+
+    std::string id = get_disk_id(entry.url);
+    uint32_t size = header.size() + entry.data.size();
+    if (size > m_disk_limit) {
+        remove_from_disk(id);
+        return;
+    }
+
+    std::vector<uint8_t> item;
+    item.reserve(size);
+    item.insert(item.end(), header.begin(), header.end());
+    item.insert(item.end(), entry.data.begin(), entry.data.end());
+
+    std::map<std::string, std::pair<std::list<std::string>::iterator, uint32_t> >::iterator i = m_disk_id_map.find(id);
+    if (i != m_disk_id_map.end()) {
+        m_disk_size -= i->second.second;
+        m_disk_ids.erase(i->second.first);
+        m_disk_id_map.erase(i);
+    }
+
+    if (m_data_store.set_data(id.c_str(), item).is_error()) {
+        CTVC_LOG_WARNING("Could not write cache item %s", id.c_str());
+        return;
+    }
+
+    m_disk_ids.push_front(id);
+    m_disk_id_map[id] = std::make_pair(m_disk_ids.begin(), size);
+    m_disk_size += size;
+
+    // The new item itself fits, so it is never evicted
+    evict_from_disk(m_disk_limit);
+}
+
+void ContentCache::evict_from_disk(uint32_t max_bytes)
+{
+    // The disk mutex is already locked here
+
+    while (m_disk_size > max_bytes && !m_disk_ids.empty()) {
+        std::string oldest_id = m_disk_ids.back();
+        remove_from_disk(oldest_id);
+    }
+}
+
+void ContentCache::remove_from_disk(const std::string &id)
+{
+    AutoLock lck(m_disk_mutex);
+
+    if (!m_is_disk_enabled) {
+        return;
+    }
+
+    // Only items this process knows of; set_disk_tier() made the items of earlier runs known
+    std::map<std::string, std::pair<std::list<std::string>::iterator, uint32_t> >::iterator i = m_disk_id_map.find(id);
+    if (i == m_disk_id_map.end()) {
+        return;
+    }
+
+    m_disk_size -= i->second.second;
+    m_disk_ids.erase(i->second.first);
+    m_disk_id_map.erase(i);
+
+    m_data_store.delete_data(id.c_str());
+}
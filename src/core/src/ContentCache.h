@@ -0,0 +1,103 @@
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <porting_layer/DataStore.h>
+#include <porting_layer/Mutex.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <time.h>
+
+namespace ctvc {
+
+// Cache of downloaded content (overlay images), keyed by URL.
+//
+// Entries are kept in memory within a byte budget and evicted least recently used first.
+// Optionally a second, larger tier is kept on disk through a DataStore, so content survives
+// eviction from memory and restarts of the client.
+//
+// Freshness follows the Cache-Control header of the response: "no-store" responses are not
+// cached, "max-age" sets the lifetime and "no-cache" makes the entry stale immediately.
+// Stale entries that have an ETag or Last-Modified header are kept to revalidate the content
+// with a conditional request; if the server answers 304 the cached content is used again.
+//
+// All methods are thread-safe.
+class ContentCache
+{
+public:
+    enum LookupResult
+    {
+        NOT_CACHED,
+        FRESH, // The content is returned
+        STALE  // The content must be revalidated; the validators are returned
+    };
+
+    ContentCache();
+    ~ContentCache();
+
+    // Limit the total size of the content kept in memory. 0 disables the memory tier.
+    void set_memory_limit(uint32_t max_bytes);
+    // Enable the disk tier in directory path, or disable it if path is 0.
+    void set_disk_tier(const char *path, uint32_t max_bytes);
+
+    LookupResult lookup(const std::string &url, std::vector<uint8_t> &data/*out*/, std::string &etag/*out*/, std::string &last_modified/*out*/);
+
+    // Store the content of a complete (200 OK) response, with the values of its headers (may be empty).
+    void store(const std::string &url, const std::vector<uint8_t> &data, const std::string &etag, const std::string &last_modified, const std::string &cache_control);
+
+    // The server confirmed (304 Not Modified) that the cached content is still valid.
+    // Returns false if the content is not cached anymore, e.g. evicted in the meantime.
+    bool revalidated(const std::string &url, const std::string &cache_control, std::vector<uint8_t> &data/*out*/);
+
+private:
+    ContentCache(const ContentCache &);
+    ContentCache &operator=(const ContentCache &);
+
+    struct Entry
+    {
+        std::string url;
+        std::vector<uint8_t> data;
+        std::string etag;
+        std::string last_modified;
+        time_t expiry_time;
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    static bool parse_cache_control(const std::string &cache_control, time_t &max_age/*out*/);
+
+    void insert_in_memory(Entry &entry/*in, data is swapped out*/);
+    void remove_from_memory(std::map<std::string, EntryList::iterator>::iterator i);
+    void evict_from_memory(uint32_t max_bytes);
+
+    bool load_from_disk(const std::string &url, Entry &entry/*out*/);
+    void save_to_disk(const Entry &entry);
+    void remove_from_disk(const std::string &id);
+    void evict_from_disk(uint32_t max_bytes);
+
+    Mutex m_mutex;
+    EntryList m_entries; // Most recently used first
+    std::map<std::string, EntryList::iterator> m_entry_map; // Keyed by URL
+    uint32_t m_memory_size;
+    uint32_t m_memory_limit;
+
+    // The disk tier has its own lock so the memory tier can be used while files are read or written
+    Mutex m_disk_mutex;
+    DataStore m_data_store;
+    bool m_is_disk_enabled;
+    std::list<std::string> m_disk_ids; // Items in the directory, most recently used first
+    std::map<std::string, std::pair<std::list<std::string>::iterator, uint32_t> > m_disk_id_map; // Size per id
+    uint32_t m_disk_size;
+    uint32_t m_disk_limit;
+};
+
+} // namespace
@@ -10,25 +10,127 @@
 ///
 
 #include <core/DefaultContentLoader.h>
+#include "ContentCache.h"
 
 #include <porting_layer/AutoLock.h>
 #include <porting_layer/Log.h>
 
 #include <utils/utils.h>
+#include <utils/Metrics.h>
+
+#include <algorithm>
 
 #include <stddef.h>
 
 using namespace ctvc;
 
+namespace {
+
+struct ContentLoaderMetrics
+{
+    ContentLoaderMetrics() :
+        cache_hits(Metrics::get_counter("content_loader.cache_hits")),
+        cache_misses(Metrics::get_counter("content_loader.cache_misses")),
+        revalidations(Metrics::get_counter("content_loader.revalidations")),
+        coalesced_requests(Metrics::get_counter("content_loader.coalesced_requests")),
+        canceled_requests(Metrics::get_counter("content_loader.canceled_requests")),
+        stolen_requests(Metrics::get_counter("content_loader.stolen_requests"))
+    {
+    }
+
+    Metrics::Counter &cache_hits;
+    Metrics::Counter &cache_misses;
+    Metrics::Counter &revalidations; // Stale content confirmed by the server (304)
+    Metrics::Counter &coalesced_requests;
+    Metrics::Counter &canceled_requests;
+    Metrics::Counter &stolen_requests; // Taken from the queue of another thread
+};
+
+ContentLoaderMetrics &get_metrics()
+{
+    static ContentLoaderMetrics s_metrics;
+
+    return s_metrics;
+}
+
+} // namespace
+
+// Host (and port) part of a URL, "scheme://host:port/path"
+static std::string get_host(const std::string &url)
+{
+    std::string::size_type start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    std::string::size_type end = url.find_first_of("/?#", start);
+
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+void DefaultContentLoader::ContentDescriptor::set_request(const std::string &url, std::vector<uint8_t> &buffer, const RequestKey &key)
+{
+    m_url = url;
+    m_host = ::get_host(url);
+    m_buffer = &buffer;
+    m_key = key;
+    m_state = IDLE;
+    m_queue_index = 0;
+}
+
+void DefaultContentLoader::ContentDescriptor::cancel()
+{
+    m_parent.cancel(*this);
+}
+
 DefaultContentLoader::DefaultContentLoader() :
-    m_single_content_handler(*this),
-    m_state(STOPPED)
+    m_single_content_handler(*this, 0),
+    m_state(STOPPED),
+    m_next_request_queue(0),
+    m_request_sequence(0),
+    m_max_requests_per_host(DEFAULT_MAX_REQUESTS_PER_HOST),
+    m_connect_timeout_in_ms(DEFAULT_CONNECT_TIMEOUT_IN_MS),
+    m_first_byte_timeout_in_ms(DEFAULT_FIRST_BYTE_TIMEOUT_IN_MS),
+    m_total_timeout_in_ms(DEFAULT_TOTAL_TIMEOUT_IN_MS),
+    m_cache(*new ContentCache())
 {
+    m_cache.set_memory_limit(DEFAULT_CACHE_SIZE);
 }
 
 DefaultContentLoader::~DefaultContentLoader()
 {
     stop();
+
+    delete &m_cache;
+}
+
+void DefaultContentLoader::set_cache_size(uint32_t max_bytes)
+{
+    m_cache.set_memory_limit(max_bytes);
+}
+
+void DefaultContentLoader::set_disk_cache(const char *path, uint32_t max_bytes)
+{
+    m_cache.set_disk_tier(path, max_bytes);
+}
+
+void DefaultContentLoader::set_max_requests_per_host(uint32_t max_requests)
+{
+    AutoLock lock(m_mutex);
+
+    m_max_requests_per_host = max_requests > 0 ? max_requests : 1;
+
+    // Requests that were held back may go ahead now
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        m_pending_requests_semaphore.post();
+    }
+}
+
+void DefaultContentLoader::set_timeouts(uint32_t connect_timeout_in_ms, uint32_t first_byte_timeout_in_ms, uint32_t total_timeout_in_ms)
+{
+    AutoLock lock(m_mutex);
+
+    // Taken over by the downloads that start from now on
+    m_connect_timeout_in_ms = connect_timeout_in_ms;
+    m_first_byte_timeout_in_ms = first_byte_timeout_in_ms;
+    m_total_timeout_in_ms = total_timeout_in_ms;
 }
 
 bool DefaultContentLoader::start(uint8_t num_threads)
@@ -45,7 +147,7 @@ bool DefaultContentLoader::start(uint8_t num_threads)
         std::string thread_name;
         string_printf(thread_name, "Content loader %d/%d", i + 1, num_threads);
         Thread *thread = new Thread(thread_name);
-        ContentHandler *content_handler = new ContentHandler(*this);
+        ContentHandler *content_handler = new ContentHandler(*this, i);
 
         if (thread->start(*content_handler, Thread::PRIO_NORMAL).is_ok()) {
             m_threads.push_back(thread);
@@ -56,6 +158,9 @@ bool DefaultContentLoader::start(uint8_t num_threads)
         }
     }
 
+    m_request_queues.resize(m_threads.size());
+    m_next_request_queue = 0;
+
     m_state = STARTED;
 
     return num_threads == m_threads.size();
@@ -71,16 +176,21 @@ void DefaultContentLoader::stop()
 
     m_state = STOPPING;
 
-    // Signal all the threads to stop
+    // Signal all the threads to stop, and abort their downloads so a stalled server doesn't hold them up
     for (size_t i = 0; i < m_threads.size(); i++) {
         m_threads[i]->stop();
+        m_content_handlers[i]->cancel_downloads();
     }
+    m_single_content_handler.cancel_downloads();
 
     // Pending requests are canceled before they are handled by one of the threads
-    while (!m_pending_requests.empty()) {
-        m_pending_requests.back()->set_result(IContentResult::CANCELED_REQUEST);
-        m_pending_requests.pop_back();
+    for (size_t i = 0; i < m_request_queues.size(); i++) {
+        for (std::map<RequestKey, ContentDescriptor *>::iterator j = m_request_queues[i].begin(); j != m_request_queues[i].end(); ++j) {
+            j->second->set_state(ContentDescriptor::IDLE);
+            j->second->set_result(IContentResult::CANCELED_REQUEST);
+        }
     }
+    m_request_queues.clear();
 
     // Just in case there are threads waiting in the semaphore, we signal them as many as threads
     for (size_t i = 0; i < m_threads.size(); i++) {
@@ -101,6 +211,12 @@ void DefaultContentLoader::stop()
 }
 
 IContentLoader::IContentResult *DefaultContentLoader::load_content(const std::string &url, std::vector<uint8_t> &buffer)
+{
+    // Without a priority, requests are handled in order of arrival
+    return load_content(url, buffer, 0);
+}
+
+IContentLoader::IContentResult *DefaultContentLoader::load_content(const std::string &url, std::vector<uint8_t> &buffer, uint32_t priority)
 {
     AutoLock lock(m_mutex);
 
@@ -111,19 +227,24 @@ IContentLoader::IContentResult *DefaultContentLoader::load_content(const std::st
 
     ContentDescriptor *content_descriptor;
     if (m_pool_requests.empty()) {
-        content_descriptor = new ContentDescriptor();
+        content_descriptor = new ContentDescriptor(*this);
         m_content_descriptors.push_back(content_descriptor);
     } else {
         content_descriptor = m_pool_requests.back();
         m_pool_requests.pop_back();
     }
 
+    content_descriptor->set_request(url, buffer, RequestKey(priority, m_request_sequence++));
+
     if (m_threads.empty()) { // There are no threads running attending requests, i.e. synchronous request
-        content_descriptor->set_result(m_single_content_handler.download_content(url, buffer));
+        content_descriptor->set_state(ContentDescriptor::LOADING);
+        m_single_content_handler.load_content(*content_descriptor);
     } else { // We push the request to the pending requests and signal it to the threads
-        content_descriptor->set_request(url, buffer);
+        size_t queue_index = m_next_request_queue;
+        m_next_request_queue = (m_next_request_queue + 1) % m_request_queues.size();
 
-        m_pending_requests.push_back(content_descriptor);
+        m_request_queues[queue_index][content_descriptor->get_key()] = content_descriptor;
+        content_descriptor->set_state(ContentDescriptor::QUEUED, queue_index);
 
         m_pending_requests_semaphore.post();
     }
@@ -144,38 +265,242 @@ void DefaultContentLoader::release_content_result(IContentResult *content_result
     m_pool_requests.push_back(content_descriptor);
 }
 
-DefaultContentLoader::ContentDescriptor *DefaultContentLoader::get_next_pending_content_descriptor()
+DefaultContentLoader::ContentDescriptor *DefaultContentLoader::get_next_pending_content_descriptor(size_t queue_index)
 {
-    m_pending_requests_semaphore.wait();
+    while (true) {
+        m_pending_requests_semaphore.wait();
+
+        AutoLock lock(m_mutex);
 
+        if (m_state != STARTED) {
+            return 0;
+        }
+
+        // Take the first request of our own queue that may be loaded now, unless
+        // another queue has one of higher priority
+        ContentDescriptor *content_descriptor = 0;
+        for (size_t i = 0; i < m_request_queues.size(); i++) {
+            // Start with our own queue
+            size_t index = (queue_index + i) % m_request_queues.size();
+            std::map<RequestKey, ContentDescriptor *> &queue = m_request_queues[index];
+
+            for (std::map<RequestKey, ContentDescriptor *>::iterator j = queue.begin(); j != queue.end(); ++j) {
+                if (content_descriptor && j->first.first >= content_descriptor->get_key().first) {
+                    break;
+                }
+                std::map<std::string, uint32_t>::const_iterator host = m_requests_per_host.find(j->second->get_host());
+                if (host == m_requests_per_host.end() || host->second < m_max_requests_per_host) {
+                    content_descriptor = j->second;
+                    break;
+                }
+            }
+        }
+
+        // Nothing to do (any more), e.g. canceled or waiting for a busy host. Every finished request signals the threads again.
+        if (!content_descriptor) {
+            continue;
+        }
+
+        if (content_descriptor->get_queue_index() != queue_index) {
+            get_metrics().stolen_requests.add();
+        }
+        m_request_queues[content_descriptor->get_queue_index()].erase(content_descriptor->get_key());
+        content_descriptor->set_state(ContentDescriptor::LOADING);
+        m_requests_per_host[content_descriptor->get_host()]++;
+
+        return content_descriptor;
+    }
+}
+
+void DefaultContentLoader::content_descriptor_loaded(const std::string &host)
+{
     AutoLock lock(m_mutex);
 
-    ContentDescriptor *content_descriptor = 0;
+    std::map<std::string, uint32_t>::iterator i = m_requests_per_host.find(host);
+    if (i != m_requests_per_host.end() && --i->second == 0) {
+        m_requests_per_host.erase(i);
+    }
+
+    // A request for this host may have been held back
+    bool is_request_pending = false;
+    for (size_t j = 0; j < m_request_queues.size() && !is_request_pending; j++) {
+        is_request_pending = !m_request_queues[j].empty();
+    }
+    if (is_request_pending) {
+        m_pending_requests_semaphore.post();
+    }
+}
+
+void DefaultContentLoader::cancel(ContentDescriptor &content_descriptor)
+{
+    AutoLock lock(m_mutex);
 
-    if (!m_pending_requests.empty()) {
-        content_descriptor = m_pending_requests.front();
-        m_pending_requests.pop_front();
+    if (content_descriptor.get_state() == ContentDescriptor::QUEUED) {
+        m_request_queues[content_descriptor.get_queue_index()].erase(content_descriptor.get_key());
+    } else if (content_descriptor.get_state() == ContentDescriptor::COALESCED) {
+        std::vector<ContentDescriptor *> &waiting_requests = m_downloads_in_progress[content_descriptor.get_url()];
+        waiting_requests.erase(std::find(waiting_requests.begin(), waiting_requests.end(), &content_descriptor));
+    } else if (content_descriptor.get_state() == ContentDescriptor::LOADING) {
+        // Abort the download, unless other requests wait for the same content. The loader thread sets the result.
+        std::map<std::string, std::vector<ContentDescriptor *> >::const_iterator i = m_downloads_in_progress.find(content_descriptor.get_url());
+        if (i == m_downloads_in_progress.end() || !i->second.empty()) {
+            return;
+        }
+        bool is_canceled = m_single_content_handler.cancel_download(content_descriptor);
+        for (size_t j = 0; j < m_content_handlers.size() && !is_canceled; j++) {
+            is_canceled = m_content_handlers[j]->cancel_download(content_descriptor);
+        }
+        if (is_canceled) {
+            get_metrics().canceled_requests.add();
+        }
+        return;
+    } else {
+        return; // Too late
     }
 
-    return content_descriptor;
+    get_metrics().canceled_requests.add();
+    content_descriptor.set_state(ContentDescriptor::IDLE);
+    content_descriptor.set_result(IContentResult::CANCELED_REQUEST);
 }
 
-DefaultContentLoader::ContentHandler::ContentHandler(DefaultContentLoader &parent) :
+DefaultContentLoader::ContentHandler::ContentHandler(DefaultContentLoader &parent, size_t queue_index) :
     m_parent(parent),
-    m_buffer(0)
+    m_queue_index(queue_index),
+    m_buffer(0),
+    m_download(0),
+    m_first_byte_timeout_in_ms(0)
 {
+    m_http_client.set_cancel_token(&m_cancel_token);
 }
 
 DefaultContentLoader::ContentHandler::~ContentHandler()
 {
 }
 
-ResultCode DefaultContentLoader::ContentHandler::download_content(const std::string &url, std::vector<uint8_t> &buffer)
+void DefaultContentLoader::ContentHandler::load_content(ContentDescriptor &content_descriptor)
+{
+    const std::string &url = content_descriptor.get_url();
+    std::vector<uint8_t> &buffer = *content_descriptor.get_buffer();
+
+    std::string etag;
+    std::string last_modified;
+    if (m_parent.m_cache.lookup(url, buffer, etag, last_modified) == ContentCache::FRESH) {
+        get_metrics().cache_hits.add();
+        content_descriptor.set_result(ResultCode::SUCCESS);
+        return;
+    }
+
+    {
+        AutoLock lock(m_parent.m_mutex);
+
+        std::map<std::string, std::vector<ContentDescriptor *> >::iterator i = m_parent.m_downloads_in_progress.find(url);
+        if (i != m_parent.m_downloads_in_progress.end()) {
+            // The thread that downloads it will set the result of this request too
+            get_metrics().coalesced_requests.add();
+            i->second.push_back(&content_descriptor);
+            content_descriptor.set_state(ContentDescriptor::COALESCED);
+            return;
+        }
+        m_parent.m_downloads_in_progress[url];
+
+        m_download = &content_descriptor;
+        if (m_parent.m_state == STARTED) { // Otherwise stop() canceled the downloads
+            m_cancel_token.reset();
+        }
+        m_http_client.set_connect_timeout(m_parent.m_connect_timeout_in_ms);
+        m_http_client.set_total_timeout(m_parent.m_total_timeout_in_ms);
+        m_first_byte_timeout_in_ms = static_cast<int>(m_parent.m_first_byte_timeout_in_ms);
+    }
+
+    get_metrics().cache_misses.add();
+    ResultCode rc = download_content(url, buffer, etag, last_modified);
+
+    std::vector<ContentDescriptor *> waiting_requests;
+    {
+        AutoLock lock(m_parent.m_mutex);
+
+        std::map<std::string, std::vector<ContentDescriptor *> >::iterator i = m_parent.m_downloads_in_progress.find(url);
+        waiting_requests.swap(i->second);
+        m_parent.m_downloads_in_progress.erase(i);
+        m_download = 0;
+
+        for (std::vector<ContentDescriptor *>::iterator j = waiting_requests.begin(); j != waiting_requests.end(); ++j) {
+            (*j)->set_state(ContentDescriptor::LOADING); // Can't be canceled anymore
+        }
+    }
+
+    for (std::vector<ContentDescriptor *>::iterator i = waiting_requests.begin(); i != waiting_requests.end(); ++i) {
+        if (rc.is_ok()) {
+            *(*i)->get_buffer() = buffer;
+        }
+        (*i)->set_result(rc);
+    }
+
+    // Last, as the request (including url and buffer) may be released as soon as its result is set
+    content_descriptor.set_result(rc);
+}
+
+bool DefaultContentLoader::ContentHandler::cancel_download(ContentDescriptor &content_descriptor)
+{
+    if (m_download != &content_descriptor) {
+        return false;
+    }
+
+    CTVC_LOG_INFO("Canceling download of %s", content_descriptor.get_url().c_str());
+    m_cancel_token.cancel();
+
+    return true;
+}
+
+void DefaultContentLoader::ContentHandler::cancel_downloads()
+{
+    m_cancel_token.cancel();
+}
+
+ResultCode DefaultContentLoader::ContentHandler::download_content(const std::string &url, std::vector<uint8_t> &buffer, const std::string &etag, const std::string &last_modified)
 {
+    // Revalidate stale content with a conditional request
+    const char *headers[4];
+    uint32_t n_headers = 0;
+    if (!etag.empty()) {
+        headers[2 * n_headers] = "If-None-Match";
+        headers[2 * n_headers + 1] = etag.c_str();
+        n_headers++;
+    }
+    if (!last_modified.empty()) {
+        headers[2 * n_headers] = "If-Modified-Since";
+        headers[2 * n_headers + 1] = last_modified.c_str();
+        n_headers++;
+    }
+    m_http_client.set_custom_headers(n_headers > 0 ? headers : 0, n_headers);
+
     m_buffer = &buffer;
-    ResultCode rc = m_http_client.get(url.c_str(), this);
+    ResultCode rc = m_http_client.get(url.c_str(), this, m_first_byte_timeout_in_ms);
+    m_buffer = 0;
+
+    m_http_client.set_custom_headers(0, 0);
+
+    if (rc.is_ok()) {
+        std::string cache_control;
+        m_http_client.get_response_header("Cache-Control", cache_control);
+
+        if (m_http_client.get_response_code() == 304) {
+            if (m_parent.m_cache.revalidated(url, cache_control, buffer)) {
+                get_metrics().revalidations.add();
+                return rc;
+            }
+            // Evicted while being revalidated, download it unconditionally
+            return download_content(url, buffer, std::string(), std::string());
+        }
 
-    if (rc == HttpClient::UNRECOGNIZED_PROTOCOL) {
+        if (m_http_client.get_response_code() == 200) {
+            std::string response_etag;
+            std::string response_last_modified;
+            m_http_client.get_response_header("ETag", response_etag);
+            m_http_client.get_response_header("Last-Modified", response_last_modified);
+            m_parent.m_cache.store(url, buffer, response_etag, response_last_modified, cache_control);
+        }
+    } else if (rc == HttpClient::UNRECOGNIZED_PROTOCOL) {
         rc = IContentLoader::IContentResult::REQUEST_ERROR;
     } else if (rc == HttpClient::PROTOCOL_ERROR) {
         rc = IContentLoader::IContentResult::REQUEST_ERROR;
@@ -183,6 +508,10 @@ ResultCode DefaultContentLoader::ContentHandler::download_content(const std::str
         rc = IContentLoader::IContentResult::SERVER_ERROR;
     } else if (rc == HttpClient::EXCEEDED_MAX_REDIRECTIONS) {
         rc = IContentLoader::IContentResult::SERVER_ERROR;
+    } else if (rc == HttpClient::FIRST_BYTE_TIMEOUT || rc == HttpClient::REQUEST_TIMEOUT || rc == Socket::CONNECT_TIMEOUT) {
+        rc = IContentLoader::IContentResult::SERVER_ERROR;
+    } else if (rc == HttpClient::CANCELED) {
+        rc = IContentLoader::IContentResult::CANCELED_REQUEST;
     }
 
     return rc;
@@ -190,7 +519,7 @@ ResultCode DefaultContentLoader::ContentHandler::download_content(const std::str
 
 bool DefaultContentLoader::ContentHandler::run()
 {
-    ContentDescriptor *content_descriptor = m_parent.get_next_pending_content_descriptor();
+    ContentDescriptor *content_descriptor = m_parent.get_next_pending_content_descriptor(m_queue_index);
 
     // If the content descriptor is 0, the DefaultContentLoader wants to stop all threads
     if (content_descriptor == 0) {
@@ -198,7 +527,10 @@ bool DefaultContentLoader::ContentHandler::run()
         return true;
     }
 
-    content_descriptor->set_result(download_content(content_descriptor->get_url(), *content_descriptor->get_buffer()));
+    // The request may be released as soon as it is loaded
+    std::string host = content_descriptor->get_host();
+    load_content(*content_descriptor);
+    m_parent.content_descriptor_loaded(host);
 
     return false;
 }
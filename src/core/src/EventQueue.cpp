@@ -13,7 +13,8 @@
 
 using namespace ctvc;
 
-EventQueue::EventQueue()
+EventQueue::EventQueue() :
+    m_listener(0)
 {
 }
 
@@ -39,6 +40,11 @@ void EventQueue::put(const IEvent *event)
     {
         AutoLock lck(m_data_available);
         m_queue.push_back(event);
+
+        if (m_listener) {
+            m_listener->event_available();
+            return;
+        }
     }
 
     // No lock needed to notify and it saves a context switch
@@ -58,3 +64,41 @@ const IEvent *EventQueue::get()
 
     return event;
 }
+
+const IEvent *EventQueue::get(uint32_t timeout_in_ms)
+{
+    AutoLock lck(m_data_available);
+
+    if (m_queue.empty()) {
+        m_data_available.wait_without_lock(timeout_in_ms);
+        if (m_queue.empty()) {
+            return 0;
+        }
+    }
+
+    const IEvent *event = m_queue.front();
+    m_queue.pop_front();
+
+    return event;
+}
+
+const IEvent *EventQueue::try_get()
+{
+    AutoLock lck(m_data_available);
+
+    if (m_queue.empty()) {
+        return 0;
+    }
+
+    const IEvent *event = m_queue.front();
+    m_queue.pop_front();
+
+    return event;
+}
+
+void EventQueue::set_listener(IListener *listener)
+{
+    AutoLock lck(m_data_available);
+
+    m_listener = listener;
+}
@@ -15,6 +15,8 @@
 
 #include <list>
 
+#include <inttypes.h>
+
 namespace ctvc {
 
 class IEvent;
@@ -22,6 +24,15 @@ class IEvent;
 class EventQueue
 {
 public:
+    /// \brief Interface of an object that handles the events of the queue instead of a thread that waits in get().
+    struct IListener
+    {
+        virtual ~IListener() {}
+
+        /// \brief Called with the lock of the queue held, after an event has been put in the queue.
+        virtual void event_available() = 0;
+    };
+
     EventQueue();
     ~EventQueue();
 
@@ -38,6 +49,18 @@ public:
     /// \returns An event that has been previously posted.
     const IEvent *get();
 
+    /// \brief Get an event from the queue, waiting at most the given time.
+    /// Like get(), but it returns a null pointer if no event is available within \a timeout_in_ms milliseconds.
+    const IEvent *get(uint32_t timeout_in_ms);
+
+    /// \brief Get an event from the queue without waiting.
+    /// Like get(), but it returns a null pointer if the queue is empty.
+    const IEvent *try_get();
+
+    /// \brief Set the listener that is notified of every event that is put in the queue.
+    /// Passing a null pointer removes the listener. Once this returns, the previous listener won't be called anymore.
+    void set_listener(IListener *listener);
+
     /// \brief Empty the queue, any queued events will be deleted.
     void clear();
 
@@ -47,6 +70,7 @@ private:
 
     Condition m_data_available;
     std::list<const IEvent*> m_queue;
+    IListener *m_listener;
 };
 
 } // namespace
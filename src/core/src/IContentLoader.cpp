@@ -8,5 +8,5 @@
 
 const ctvc::ResultCode ctvc::IContentLoader::IContentResult::REQUEST_ERROR("Content could not be downloaded. Request error.");
 const ctvc::ResultCode ctvc::IContentLoader::IContentResult::SERVER_ERROR("Content could not be downloaded. Server error.");
-const ctvc::ResultCode ctvc::IContentLoader::IContentResult::CANCELED_REQUEST("Operation was cancelled before starting the request.");
+const ctvc::ResultCode ctvc::IContentLoader::IContentResult::CANCELED_REQUEST("Operation was cancelled before the content was loaded.");
 const ctvc::ResultCode ctvc::IContentLoader::IContentResult::UNKNOWN_ERROR("Content could not be downloaded. Unknown error.");
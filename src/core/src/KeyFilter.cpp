@@ -10,8 +10,12 @@
 
 #include <porting_layer/AutoLock.h>
 #include <porting_layer/Log.h>
+#include <porting_layer/Thread.h>
+
+#include <algorithm>
 
 #include <stddef.h>
+#include <string.h>
 
 using namespace ctvc;
 
@@ -23,8 +27,46 @@ static const int MAX_KEYS_IN_RANGE = 250;
 static const int HANDLE_LOCALLY = (1 << 0);
 static const int HANDLE_REMOTELY = (1 << 1);
 
-KeyFilter::KeyFilter()
+// Ranges of key codes that are looked up in the bitmaps of a table: Latin-1, the function keys
+// and the CloudTV keys. Together they hold N_DENSE_KEYS keys.
+struct DenseRange
+{
+    uint32_t first_key;
+    uint32_t n_keys;
+    uint32_t first_index; // In the bitmaps
+};
+
+static const DenseRange DENSE_RANGES[] = {
+    { 0x00000000, 0x100, 0x000 },
+    { 0x0000FF00, 0x100, 0x100 },
+    { 0x10000000, 0x200, 0x200 }
+};
+
+// Returns the index of the key in the bitmaps, or -1 if the key is not in a dense range
+static int get_dense_index(X11KeyCode x11_key)
+{
+    uint32_t key = static_cast<uint32_t>(x11_key);
+    for (uint32_t i = 0; i < sizeof(DENSE_RANGES) / sizeof(DENSE_RANGES[0]); i++) {
+        if (key - DENSE_RANGES[i].first_key < DENSE_RANGES[i].n_keys) {
+            return DENSE_RANGES[i].first_index + (key - DENSE_RANGES[i].first_key);
+        }
+    }
+
+    return -1;
+}
+
+static bool is_key_less(const std::pair<X11KeyCode, int> &entry, X11KeyCode x11_key)
 {
+    return static_cast<uint32_t>(entry.first) < static_cast<uint32_t>(x11_key);
+}
+
+KeyFilter::KeyFilter() :
+    m_published_table(0)
+{
+    for (uint32_t i = 0; i < 2; i++) {
+        memset(m_tables[i].local_bits, 0, sizeof(m_tables[i].local_bits));
+        memset(m_tables[i].remote_bits, 0, sizeof(m_tables[i].remote_bits));
+    }
 }
 
 KeyFilter::~KeyFilter()
@@ -36,6 +78,7 @@ void KeyFilter::clear()
     AutoLock lck(m_mutex);
 
     m_key_filter_map.clear();
+    publish();
 }
 
 void KeyFilter::parse_lists(const std::string &local_keys, const std::string &remote_keys)
@@ -53,16 +96,29 @@ void KeyFilter::parse_lists(const std::string &local_keys, const std::string &re
     parse_list(local_keys, false, true); // Set the mode of any keys in local_keys to handle locally (clearing any previous modes)
     parse_list(remote_keys, true, true); // Set the mode of any keys in remote_keys to handle remotely (clearing any previous modes)
     parse_list(local_keys, false, false); // Add the mode of any keys in local_keys to handle locally (adding to any previous modes)
+
+    publish();
 }
 
 void KeyFilter::find_filter_for_key(X11KeyCode x11_key, bool &client_must_handle_key_code/*out*/, bool &server_must_handle_key_code/*out*/)
 {
-    AutoLock lck(m_mutex);
+    // Register as a reader of the published table, so it is not rebuilt while we use it.
+    // If another table got published in the meantime, the registration may have come too late.
+    uint32_t index = m_published_table.load();
+    m_tables[index].n_readers.fetch_add(1);
+    while (m_published_table.load() != index) {
+        m_tables[index].n_readers.fetch_add(-1);
+        index = m_published_table.load();
+        m_tables[index].n_readers.fetch_add(1);
+    }
 
-    std::map<X11KeyCode, int>::iterator it = m_key_filter_map.find(x11_key);
-    if (it != m_key_filter_map.end()) {
-        client_must_handle_key_code = (it->second & HANDLE_LOCALLY) != 0;
-        server_must_handle_key_code = (it->second & HANDLE_REMOTELY) != 0;
+    int flags = find_flags(m_tables[index], x11_key);
+
+    m_tables[index].n_readers.fetch_add(-1);
+
+    if (flags != 0) {
+        client_must_handle_key_code = (flags & HANDLE_LOCALLY) != 0;
+        server_must_handle_key_code = (flags & HANDLE_REMOTELY) != 0;
         return;
     }
 
@@ -110,3 +166,54 @@ void KeyFilter::parse_list(const std::string &list, bool is_remote_list, bool ov
         }
     }
 }
+
+void KeyFilter::publish()
+{
+    // Our mutex is already locked here
+
+    uint32_t index = 1 - m_published_table.load();
+    Table &table = m_tables[index];
+
+    // Lookups that started before the previous update may still use the table
+    while (table.n_readers.load() != 0) {
+        Thread::sleep(1);
+    }
+
+    memset(table.local_bits, 0, sizeof(table.local_bits));
+    memset(table.remote_bits, 0, sizeof(table.remote_bits));
+    table.sparse_keys.clear();
+    for (std::map<X11KeyCode, int>::const_iterator i = m_key_filter_map.begin(); i != m_key_filter_map.end(); ++i) {
+        int dense_index = get_dense_index(i->first);
+        if (dense_index < 0) {
+            table.sparse_keys.push_back(*i); // The map is sorted by key code too
+            continue;
+        }
+
+        uint32_t bit = 1U << (dense_index % 32);
+        if (i->second & HANDLE_LOCALLY) {
+            table.local_bits[dense_index / 32] |= bit;
+        }
+        if (i->second & HANDLE_REMOTELY) {
+            table.remote_bits[dense_index / 32] |= bit;
+        }
+    }
+
+    m_published_table.store(index);
+}
+
+int KeyFilter::find_flags(const Table &table, X11KeyCode x11_key)
+{
+    // Keys without a filter have no flags
+    int dense_index = get_dense_index(x11_key);
+    if (dense_index >= 0) {
+        uint32_t bit = 1U << (dense_index % 32);
+        return ((table.local_bits[dense_index / 32] & bit) ? HANDLE_LOCALLY : 0) | ((table.remote_bits[dense_index / 32] & bit) ? HANDLE_REMOTELY : 0);
+    }
+
+    std::vector<std::pair<X11KeyCode, int> >::const_iterator i = std::lower_bound(table.sparse_keys.begin(), table.sparse_keys.end(), x11_key, is_key_less);
+    if (i != table.sparse_keys.end() && i->first == x11_key) {
+        return i->second;
+    }
+
+    return 0;
+}
@@ -6,18 +6,22 @@
 
 #pragma once
 
+#include <porting_layer/Atomic.h>
 #include <porting_layer/Mutex.h>
 #include <porting_layer/X11KeyMap.h>
 
 #include <string>
 #include <map>
+#include <vector>
+#include <utility>
 
 #include <inttypes.h>
 
 namespace ctvc {
 
 // This class manages a list of key filters for a session.
-// It is protected by a mutex so can be accessed in a thread-safe way.
+// Lookups use an immutable table and take no lock, so the input thread is never held up by
+// an update of the lists. Updates build the other of two tables and publish it when done.
 class KeyFilter
 {
 public:
@@ -32,10 +36,27 @@ private:
     KeyFilter(const KeyFilter &);
     KeyFilter &operator=(const KeyFilter &);
 
+    // Number of keys in the ranges of key codes that are looked up in bitmaps
+    static const uint32_t N_DENSE_KEYS = 0x400;
+
+    // Filters of all keys, which is not modified while it is published
+    struct Table
+    {
+        uint32_t local_bits[N_DENSE_KEYS / 32];  // Keys in the dense ranges that are handled locally
+        uint32_t remote_bits[N_DENSE_KEYS / 32]; // Keys in the dense ranges that are handled remotely
+        std::vector<std::pair<X11KeyCode, int> > sparse_keys; // Filters of the other keys, sorted by key code
+        AtomicInteger<int32_t> n_readers;
+    };
+
     void parse_list(const std::string &list, bool is_remote_list, bool overwrite);
+    void publish();
+    static int find_flags(const Table &table, X11KeyCode x11_key);
+
+    std::map<X11KeyCode, int> m_key_filter_map; // The filters that the tables are built from
+    Mutex m_mutex; // Serializes the updates
 
-    std::map<X11KeyCode, int> m_key_filter_map;
-    Mutex m_mutex;
+    Table m_tables[2];
+    AtomicInteger<uint32_t> m_published_table; // Index of the table that is used for lookups
 };
 
 } // namespace
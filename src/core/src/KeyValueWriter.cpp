@@ -0,0 +1,258 @@
+///
+/// \file KeyValueWriter.cpp
+///
+/// \brief Writes key-value pairs with JSON values directly into an RFB-TV message
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "KeyValueWriter.h"
+#include "RfbtvMessage.h"
+
+#include <porting_layer/Log.h>
+
+#include <assert.h>
+#include <string.h>
+
+using namespace ctvc;
+
+static const uint32_t MAX_STRING_LENGTH = 0xFFFF;
+static const uint32_t MAX_N_PAIRS = 0xFF;
+
+// Formats value in decimal at the end of the buffer and returns the first digit
+static char *format_decimal(uint64_t value, char *end)
+{
+    char *p = end;
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    return p;
+}
+
+KeyValueWriter::KeyValueWriter(RfbtvMessage &msg) :
+    m_msg(msg),
+    m_count_position(msg.size()),
+    m_n_pairs(0),
+    m_value_position(0),
+    m_json_depth(0),
+    m_json_is_empty(0),
+    m_is_after_member(false)
+{
+    m_msg.write_uint8(0);
+}
+
+KeyValueWriter::~KeyValueWriter()
+{
+}
+
+void KeyValueWriter::write(const char *key, const char *value)
+{
+    m_msg.write_string(key);
+    m_msg.write_string(value);
+    m_n_pairs++;
+}
+
+void KeyValueWriter::write(const char *key, const std::string &value)
+{
+    m_msg.write_string(key);
+    m_msg.write_string(value);
+    m_n_pairs++;
+}
+
+void KeyValueWriter::write(const char *key, uint32_t value)
+{
+    begin_value(key);
+    append(value);
+    end_value();
+}
+
+void KeyValueWriter::write(const char *key, uint64_t value)
+{
+    begin_value(key);
+    append(value);
+    end_value();
+}
+
+void KeyValueWriter::begin_value(const char *key)
+{
+    m_msg.write_string(key);
+    m_value_position = m_msg.size();
+    m_msg.write_uint16(0);
+
+    m_json_depth = 0;
+    m_json_is_empty = 0;
+    m_is_after_member = false;
+}
+
+void KeyValueWriter::end_value()
+{
+    assert(m_json_depth == 0);
+
+    uint32_t length = m_msg.size() - m_value_position - 2;
+    if (length > MAX_STRING_LENGTH) {
+        CTVC_LOG_ERROR("Value of %u bytes does not fit in the message", length);
+    }
+    m_msg[m_value_position] = static_cast<uint8_t>(length >> 8);
+    m_msg[m_value_position + 1] = static_cast<uint8_t>(length);
+    m_n_pairs++;
+}
+
+void KeyValueWriter::append(const char *text)
+{
+    m_msg.write_raw(reinterpret_cast<const uint8_t *>(text), strlen(text));
+}
+
+void KeyValueWriter::append(const std::string &text)
+{
+    m_msg.write_raw(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
+
+void KeyValueWriter::append(char c)
+{
+    m_msg.write_uint8(static_cast<uint8_t>(c));
+}
+
+void KeyValueWriter::append(uint32_t value)
+{
+    append(static_cast<uint64_t>(value));
+}
+
+void KeyValueWriter::append(int32_t value)
+{
+    if (value < 0) {
+        append('-');
+        append(static_cast<uint64_t>(-static_cast<int64_t>(value)));
+    } else {
+        append(static_cast<uint64_t>(value));
+    }
+}
+
+void KeyValueWriter::append(uint64_t value)
+{
+    char buffer[20];
+    char *end = buffer + sizeof(buffer);
+    char *p = format_decimal(value, end);
+    m_msg.write_raw(reinterpret_cast<const uint8_t *>(p), end - p);
+}
+
+void KeyValueWriter::begin_object()
+{
+    separate_json_value();
+    append('{');
+
+    assert(m_json_depth + 1 < MAX_JSON_DEPTH);
+    m_json_depth++;
+    m_json_is_empty |= 1U << m_json_depth;
+}
+
+void KeyValueWriter::end_object()
+{
+    assert(m_json_depth > 0);
+    m_json_depth--;
+    append('}');
+}
+
+void KeyValueWriter::begin_array()
+{
+    separate_json_value();
+    append('[');
+
+    assert(m_json_depth + 1 < MAX_JSON_DEPTH);
+    m_json_depth++;
+    m_json_is_empty |= 1U << m_json_depth;
+}
+
+void KeyValueWriter::end_array()
+{
+    assert(m_json_depth > 0);
+    m_json_depth--;
+    append(']');
+}
+
+void KeyValueWriter::member(const char *name)
+{
+    separate_json_value();
+    append_escaped(name, strlen(name));
+    append(':');
+    m_is_after_member = true;
+}
+
+void KeyValueWriter::value(uint32_t value)
+{
+    separate_json_value();
+    append(value);
+}
+
+void KeyValueWriter::value(int32_t value)
+{
+    separate_json_value();
+    append(value);
+}
+
+void KeyValueWriter::value(const char *value)
+{
+    separate_json_value();
+    append_escaped(value, strlen(value));
+}
+
+void KeyValueWriter::value(const std::string &value)
+{
+    separate_json_value();
+    append_escaped(value.data(), value.size());
+}
+
+void KeyValueWriter::finish()
+{
+    if (m_n_pairs > MAX_N_PAIRS) {
+        CTVC_LOG_ERROR("%u pairs do not fit in the message", m_n_pairs);
+    }
+    m_msg[m_count_position] = static_cast<uint8_t>(m_n_pairs);
+}
+
+void KeyValueWriter::separate_json_value()
+{
+    if (m_is_after_member) {
+        m_is_after_member = false;
+        return;
+    }
+
+    uint32_t bit = 1U << m_json_depth;
+    if (m_json_depth > 0 && !(m_json_is_empty & bit)) {
+        append(',');
+    }
+    m_json_is_empty &= ~bit;
+}
+
+void KeyValueWriter::append_escaped(const char *text, uint32_t length)
+{
+    append('"');
+
+    const char *end = text + length;
+    const char *run = text; // Characters that need no escaping are appended at once
+    for (const char *p = text; p < end; p++) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+
+        m_msg.write_raw(reinterpret_cast<const uint8_t *>(run), p - run);
+        run = p + 1;
+        if (c == '"' || c == '\\') {
+            append('\\');
+            append(static_cast<char>(c));
+        } else {
+            static const char HEX_DIGITS[] = "0123456789abcdef";
+            append("\\u00");
+            append(HEX_DIGITS[c >> 4]);
+            append(HEX_DIGITS[c & 0x0F]);
+        }
+    }
+    m_msg.write_raw(reinterpret_cast<const uint8_t *>(run), end - run);
+
+    append('"');
+}
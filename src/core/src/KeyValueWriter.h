@@ -0,0 +1,95 @@
+///
+/// \file KeyValueWriter.h
+///
+/// \brief Writes key-value pairs with JSON values directly into an RFB-TV message
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <string>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+class RfbtvMessage;
+
+// Writes a list of key-value pairs, in the format of RfbtvMessage::write_key_value_pairs(),
+// without building a map of strings first. Values can be composed in place, e.g. as JSON:
+//
+//   KeyValueWriter writer(msg);
+//   writer.write("level", "info");
+//   writer.begin_value("stats");
+//   writer.begin_object();
+//   writer.member("n");
+//   writer.value(12u);
+//   writer.end_object();
+//   writer.end_value();
+//   writer.finish();
+//
+// The count and the lengths are filled in when a pair or the list is complete, so nothing can be
+// written to the message in between, except for binary values that are written to the message
+// directly between begin_value() and end_value().
+class KeyValueWriter
+{
+public:
+    // Writes the count of the list, which is filled in by finish()
+    KeyValueWriter(RfbtvMessage &msg);
+    ~KeyValueWriter();
+
+    void write(const char *key, const char *value);
+    void write(const char *key, const std::string &value);
+    void write(const char *key, uint32_t value);
+    void write(const char *key, uint64_t value);
+
+    // Compose the value of a pair from the appended text and JSON values
+    void begin_value(const char *key);
+    void end_value();
+
+    // Append plain text to the value
+    void append(const char *text);
+    void append(const std::string &text);
+    void append(char c);
+    void append(uint32_t value);
+    void append(int32_t value);
+    void append(uint64_t value);
+
+    // Append JSON to the value; separators between members and array elements are added
+    void begin_object();
+    void end_object();
+    void begin_array();
+    void end_array();
+    void member(const char *name); // Followed by the member's value
+    void value(uint32_t value);
+    void value(int32_t value);
+    void value(const char *value); // Quoted and escaped
+    void value(const std::string &value);
+
+    // Fill in the number of pairs
+    void finish();
+
+private:
+    KeyValueWriter(const KeyValueWriter &);
+    KeyValueWriter &operator=(const KeyValueWriter &);
+
+    static const uint32_t MAX_JSON_DEPTH = 32;
+
+    RfbtvMessage &m_msg;
+    uint32_t m_count_position;
+    uint32_t m_n_pairs;
+    uint32_t m_value_position; // Of the length of the value that is being composed
+
+    uint32_t m_json_depth;
+    uint32_t m_json_is_empty; // Bit per depth: nothing written yet in the object or array
+    bool m_is_after_member;   // The next value belongs to a member name and is not separated
+
+    void separate_json_value();
+    void append_escaped(const char *text, uint32_t length);
+};
+
+} // namespace
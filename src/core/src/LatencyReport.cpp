@@ -11,13 +11,58 @@
 
 #include "LatencyReport.h"
 
+#include <porting_layer/Log.h>
+#include <utils/utils.h>
+
 #include <assert.h>
 
 using namespace ctvc;
 
+static const int32_t KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS = 60000;
+static const uint32_t KEY_TO_DISPLAY_DISTRIBUTION_SIGNIFICANT_DIGITS = 2;
+
+// Traces whose marker never arrives (e.g. because the server did not echo it) are dropped oldest first.
+static const uint32_t MAX_PENDING_KEY_TRACES = 32;
+
+static const char *const s_key_trace_stage_names[LatencyReport::N_KEY_TRACE_STAGES] = {
+    "input",
+    "handled",
+    "sent",
+    "marker",
+    "output",
+    "display"
+};
+
+static int32_t clamp_to_distribution(int64_t value_in_ms)
+{
+    if (value_in_ms < 0) {
+        return 0;
+    }
+    if (value_in_ms > KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS) {
+        return KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS;
+    }
+    return static_cast<int32_t>(value_in_ms);
+}
+
 LatencyReport::LatencyReport() :
-    m_measurement_mode(0)
+    m_measurement_mode(0),
+    m_key_to_display_distribution(m_distribution_bin_definition),
+    m_is_key_trace_dump_enabled(false)
+{
+    m_distribution_bin_definition.set_log_linear(KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS, KEY_TO_DISPLAY_DISTRIBUTION_SIGNIFICANT_DIGITS);
+    // The distribution was constructed before its bins were defined, so size it now.
+    m_key_to_display_distribution.clear();
+
+    for (uint32_t i = 0; i < N_KEY_TRACE_STAGES; i++) {
+        m_key_trace_distributions[i] = new Histogram(m_distribution_bin_definition);
+    }
+}
+
+LatencyReport::~LatencyReport()
 {
+    for (uint32_t i = 0; i < N_KEY_TRACE_STAGES; i++) {
+        delete m_key_trace_distributions[i];
+    }
 }
 
 void LatencyReport::set_measurement_mode(int mode)
@@ -30,6 +75,12 @@ void LatencyReport::reset()
     m_subtypes.clear();
     m_labels.clear();
     m_data.clear();
+    m_key_to_display_distribution.clear();
+
+    m_pending_key_traces.clear();
+    for (uint32_t i = 0; i < N_KEY_TRACE_STAGES; i++) {
+        m_key_trace_distributions[i]->clear();
+    }
 }
 
 void LatencyReport::add_entry(Subtype sub_type, const std::string &label, uint64_t data)
@@ -37,6 +88,10 @@ void LatencyReport::add_entry(Subtype sub_type, const std::string &label, uint64
     m_subtypes.push_back(sub_type);
     m_labels.push_back(label);
     m_data.push_back(data);
+
+    if (sub_type == SUBTYPE_KEY_TO_DISPLAY) {
+        m_key_to_display_distribution.accumulate(data > static_cast<uint64_t>(KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS) ? KEY_TO_DISPLAY_DISTRIBUTION_HIGHEST_VALUE_IN_MS : static_cast<int32_t>(data));
+    }
 }
 
 uint32_t LatencyReport::get_n_entries() const
@@ -69,3 +124,87 @@ uint64_t LatencyReport::get_data(uint32_t index) const
 
     return m_data[index];
 }
+
+const Histogram &LatencyReport::get_key_to_display_distribution() const
+{
+    return m_key_to_display_distribution;
+}
+
+void LatencyReport::start_key_trace(uint64_t key_id, const TimeStamp &input_time)
+{
+    for (std::vector<KeyTrace>::const_iterator i = m_pending_key_traces.begin(); i != m_pending_key_traces.end(); ++i) {
+        if (i->key_id == key_id) {
+            return;
+        }
+    }
+
+    if (m_pending_key_traces.size() >= MAX_PENDING_KEY_TRACES) {
+        m_pending_key_traces.erase(m_pending_key_traces.begin());
+    }
+
+    KeyTrace trace;
+    trace.key_id = key_id;
+    trace.stage_time[KEY_TRACE_STAGE_INPUT] = input_time;
+    m_pending_key_traces.push_back(trace);
+}
+
+void LatencyReport::mark_key_trace(uint64_t key_id, KeyTraceStage stage, const TimeStamp &time)
+{
+    assert(stage < N_KEY_TRACE_STAGES);
+
+    for (std::vector<KeyTrace>::iterator i = m_pending_key_traces.begin(); i != m_pending_key_traces.end(); ++i) {
+        if (i->key_id == key_id) {
+            i->stage_time[stage] = time;
+            if (stage == KEY_TRACE_STAGE_DISPLAY) {
+                KeyTrace trace(*i);
+                m_pending_key_traces.erase(i);
+                complete_key_trace(trace);
+            }
+            return;
+        }
+    }
+}
+
+const Histogram &LatencyReport::get_key_trace_distribution(KeyTraceStage stage) const
+{
+    assert(stage < N_KEY_TRACE_STAGES);
+
+    return *m_key_trace_distributions[stage];
+}
+
+const char *LatencyReport::get_key_trace_stage_name(KeyTraceStage stage)
+{
+    assert(stage < N_KEY_TRACE_STAGES);
+
+    return s_key_trace_stage_names[stage];
+}
+
+void LatencyReport::set_key_trace_dump(bool is_enabled)
+{
+    m_is_key_trace_dump_enabled = is_enabled;
+}
+
+void LatencyReport::complete_key_trace(const KeyTrace &trace)
+{
+    // Each stage is accounted against the most recent earlier stage that was time stamped,
+    // so a missing stage does not leave a gap in the total.
+    std::string dump;
+    int previous = -1;
+    for (int stage = 0; stage < N_KEY_TRACE_STAGES; stage++) {
+        if (!trace.stage_time[stage].is_valid()) {
+            continue;
+        }
+        if (previous >= 0) {
+            int64_t span_in_ms = trace.stage_time[stage].get_as_milliseconds() - trace.stage_time[previous].get_as_milliseconds();
+            m_key_trace_distributions[stage]->accumulate(clamp_to_distribution(span_in_ms));
+            if (m_is_key_trace_dump_enabled) {
+                string_printf_append(dump, " %s=+%lld", s_key_trace_stage_names[stage], static_cast<long long>(span_in_ms));
+            }
+        }
+        previous = stage;
+    }
+
+    if (m_is_key_trace_dump_enabled) {
+        CTVC_LOG_INFO("key trace %llu:%s", static_cast<unsigned long long>(trace.key_id), dump.c_str());
+    }
+}
@@ -14,6 +14,9 @@
 #include "ReportBase.h"
 #include "OptionalValue.h"
 
+#include <utils/Histogram.h>
+#include <porting_layer/TimeStamp.h>
+
 #include <vector>
 #include <string>
 
@@ -40,6 +43,7 @@ public:
     };
 
     LatencyReport();
+    ~LatencyReport();
 
     //
     // Configuration
@@ -73,11 +77,64 @@ public:
 
     uint64_t get_data(uint32_t index) const;
 
+    // Log-linear distribution of all SUBTYPE_KEY_TO_DISPLAY entries, used for percentiles.
+    const Histogram &get_key_to_display_distribution() const;
+
+    //
+    // Key-to-display tracing
+    //
+
+    // Points in the life of a key event at which its trace is time stamped, in chronological order.
+    enum KeyTraceStage
+    {
+        KEY_TRACE_STAGE_INPUT,      // Key handed to the session through IInput
+        KEY_TRACE_STAGE_HANDLED,    // Key picked up by the session thread
+        KEY_TRACE_STAGE_SENT,       // RFB-TV key event written to the connection
+        KEY_TRACE_STAGE_MARKER,     // Matching latency marker parsed from the stream
+        KEY_TRACE_STAGE_OUTPUT,     // First stream data output by the streamer after the marker
+        KEY_TRACE_STAGE_DISPLAY,    // Presentation time of the marker
+        N_KEY_TRACE_STAGES
+    };
+
+    // Start a trace for a key event. The key_id is the time stamp (in ms) that is sent with
+    // the key event and echoed by the server in the latency marker.
+    // Starting a trace for an id that is already being traced is ignored.
+    void start_key_trace(uint64_t key_id, const TimeStamp &input_time);
+
+    // Time stamp a stage of a trace. Marks for unknown ids are ignored, e.g. for keys sent before a reset.
+    // Marking KEY_TRACE_STAGE_DISPLAY completes the trace.
+    void mark_key_trace(uint64_t key_id, KeyTraceStage stage, const TimeStamp &time);
+
+    // Log-linear distribution of the time (in ms) spent between the previous stage and the given stage
+    // of completed traces. There is no distribution for KEY_TRACE_STAGE_INPUT.
+    const Histogram &get_key_trace_distribution(KeyTraceStage stage) const;
+
+    // Name of a stage, as used in the dump and the client report.
+    static const char *get_key_trace_stage_name(KeyTraceStage stage);
+
+    // Log every completed trace locally, one line per key event.
+    void set_key_trace_dump(bool is_enabled);
+
 private:
     int m_measurement_mode;
     std::vector<Subtype> m_subtypes;
     std::vector<std::string> m_labels;
     std::vector<uint64_t> m_data;
+
+    Histogram::BinDefinition m_distribution_bin_definition;
+    Histogram m_key_to_display_distribution;
+
+    struct KeyTrace
+    {
+        uint64_t key_id;
+        TimeStamp stage_time[N_KEY_TRACE_STAGES];
+    };
+
+    std::vector<KeyTrace> m_pending_key_traces;
+    Histogram *m_key_trace_distributions[N_KEY_TRACE_STAGES];
+    bool m_is_key_trace_dump_enabled;
+
+    void complete_key_trace(const KeyTrace &trace);
 };
 
 }
@@ -11,22 +11,134 @@
 
 #include "LogReport.h"
 
+#include <algorithm>
+
+#include <string.h>
+
 using namespace ctvc;
 
 static const LogMessageType DEFAULT_MIN_LEVEL = LOG_WARNING;
 static const LogMessageType GLOBAL_MIN_LEVEL = LOG_DEBUG;
 static const uint32_t MAX_LOG_SIZE = 65535; // In bytes; RFB-TV strings cannot be any longer.
 
+// The texts of both rings together never exceed MAX_LOG_SIZE, because the headers take space too
+static const uint32_t RETAINED_LOG_SIZE = 16 * 1024;
+static const uint32_t VERBOSE_LOG_SIZE = MAX_LOG_SIZE - RETAINED_LOG_SIZE;
+
+static const uint32_t RECORD_HEADER_SIZE = 6; // 32-bit sequence number and 16-bit text length
+
+LogReport::RecordRing::RecordRing(uint32_t capacity) :
+    m_buffer(capacity),
+    m_first_position(0),
+    m_size(0),
+    m_n_records(0)
+{
+}
+
+void LogReport::RecordRing::clear()
+{
+    m_first_position = 0;
+    m_size = 0;
+    m_n_records = 0;
+}
+
+void LogReport::RecordRing::append(uint32_t sequence_number, const char *text, uint32_t length)
+{
+    uint32_t capacity = m_buffer.size();
+    if (RECORD_HEADER_SIZE + length > capacity) {
+        text += RECORD_HEADER_SIZE + length - capacity;
+        length = capacity - RECORD_HEADER_SIZE;
+    }
+
+    // Drop the oldest records until the new one fits
+    while (m_size + RECORD_HEADER_SIZE + length > capacity) {
+        Record oldest;
+        read_record(m_first_position, oldest);
+        m_size -= RECORD_HEADER_SIZE + oldest.text_length;
+        m_first_position = oldest.next_position;
+        m_n_records--;
+    }
+
+    uint8_t header[RECORD_HEADER_SIZE] = {
+        static_cast<uint8_t>(sequence_number >> 24),
+        static_cast<uint8_t>(sequence_number >> 16),
+        static_cast<uint8_t>(sequence_number >> 8),
+        static_cast<uint8_t>(sequence_number),
+        static_cast<uint8_t>(length >> 8),
+        static_cast<uint8_t>(length)
+    };
+    uint32_t position = (m_first_position + m_size) % capacity;
+    write(position, header, RECORD_HEADER_SIZE);
+    write((position + RECORD_HEADER_SIZE) % capacity, reinterpret_cast<const uint8_t *>(text), length);
+
+    m_size += RECORD_HEADER_SIZE + length;
+    m_n_records++;
+}
+
+uint32_t LogReport::RecordRing::get_n_records() const
+{
+    return m_n_records;
+}
+
+uint32_t LogReport::RecordRing::get_first_position() const
+{
+    return m_first_position;
+}
+
+void LogReport::RecordRing::read_record(uint32_t position, Record &record/*out*/) const
+{
+    uint32_t capacity = m_buffer.size();
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    read(position, header, RECORD_HEADER_SIZE);
+
+    record.sequence_number = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    record.text_length = (header[4] << 8) | header[5];
+    record.text_position = (position + RECORD_HEADER_SIZE) % capacity;
+    record.next_position = (record.text_position + record.text_length) % capacity;
+}
+
+void LogReport::RecordRing::append_text(const Record &record, std::string &out/*out*/) const
+{
+    uint32_t length = record.text_length;
+    uint32_t first_length = std::min(length, static_cast<uint32_t>(m_buffer.size()) - record.text_position);
+
+    out.append(reinterpret_cast<const char *>(&m_buffer[record.text_position]), first_length);
+    if (first_length < length) {
+        out.append(reinterpret_cast<const char *>(&m_buffer[0]), length - first_length);
+    }
+}
+
+void LogReport::RecordRing::write(uint32_t position, const uint8_t *data, uint32_t length)
+{
+    uint32_t first_length = std::min(length, static_cast<uint32_t>(m_buffer.size()) - position);
+
+    memcpy(&m_buffer[position], data, first_length);
+    memcpy(&m_buffer[0], data + first_length, length - first_length);
+}
+
+void LogReport::RecordRing::read(uint32_t position, uint8_t *data, uint32_t length) const
+{
+    uint32_t first_length = std::min(length, static_cast<uint32_t>(m_buffer.size()) - position);
+
+    memcpy(data, &m_buffer[position], first_length);
+    memcpy(data + first_length, &m_buffer[0], length - first_length);
+}
+
 LogReport::LogReport() :
     m_min_level(DEFAULT_MIN_LEVEL),
-    m_current_max_level(GLOBAL_MIN_LEVEL)
+    m_current_max_level(GLOBAL_MIN_LEVEL),
+    m_next_sequence_number(0),
+    m_retained_records(RETAINED_LOG_SIZE),
+    m_verbose_records(VERBOSE_LOG_SIZE),
+    m_is_text_valid(true)
 {
 }
 
 void LogReport::set_min_level(LogMessageType log_level)
 {
     m_min_level = log_level;
-    if (m_current_text.empty()) {
+    if (is_empty()) {
         m_current_max_level = log_level;
     }
 }
@@ -34,7 +146,10 @@ void LogReport::set_min_level(LogMessageType log_level)
 void LogReport::reset()
 {
     m_current_max_level = m_min_level;
-    m_current_text = "";
+    m_retained_records.clear();
+    m_verbose_records.clear();
+    m_text.clear();
+    m_is_text_valid = true;
 }
 
 void LogReport::add_log(LogMessageType level, const std::string &text)
@@ -43,15 +158,22 @@ void LogReport::add_log(LogMessageType level, const std::string &text)
         return;
     }
 
-    if (m_current_text.empty() || level < m_current_max_level) {
-        m_current_max_level = level;
+    if (text.empty()) {
+        return;
     }
 
-    if (m_current_text.size() + text.size() > MAX_LOG_SIZE) {
-        m_current_text = m_current_text.substr(m_current_text.size() + text.size() - MAX_LOG_SIZE) + text;
-    } else {
-        m_current_text += text;
+    if (is_empty() || level < m_current_max_level) {
+        m_current_max_level = level;
     }
+
+    RecordRing &records(level <= LOG_WARNING ? m_retained_records : m_verbose_records);
+    records.append(m_next_sequence_number++, text.data(), text.size());
+    m_is_text_valid = false;
+}
+
+bool LogReport::is_empty() const
+{
+    return m_retained_records.get_n_records() == 0 && m_verbose_records.get_n_records() == 0;
 }
 
 LogMessageType LogReport::get_max_level() const
@@ -61,5 +183,40 @@ LogMessageType LogReport::get_max_level() const
 
 const std::string &LogReport::get_text() const
 {
-    return m_current_text;
+    if (m_is_text_valid) {
+        return m_text;
+    }
+
+    // Merge the records of both rings in the order in which they were added
+    m_text.clear();
+
+    uint32_t n_retained = m_retained_records.get_n_records();
+    uint32_t n_verbose = m_verbose_records.get_n_records();
+    RecordRing::Record retained;
+    RecordRing::Record verbose;
+    if (n_retained > 0) {
+        m_retained_records.read_record(m_retained_records.get_first_position(), retained);
+    }
+    if (n_verbose > 0) {
+        m_verbose_records.read_record(m_verbose_records.get_first_position(), verbose);
+    }
+
+    while (n_retained > 0 || n_verbose > 0) {
+        // Sequence numbers may wrap
+        if (n_verbose == 0 || (n_retained > 0 && static_cast<int32_t>(retained.sequence_number - verbose.sequence_number) < 0)) {
+            m_retained_records.append_text(retained, m_text);
+            if (--n_retained > 0) {
+                m_retained_records.read_record(retained.next_position, retained);
+            }
+        } else {
+            m_verbose_records.append_text(verbose, m_text);
+            if (--n_verbose > 0) {
+                m_verbose_records.read_record(verbose.next_position, verbose);
+            }
+        }
+    }
+
+    m_is_text_valid = true;
+
+    return m_text;
 }
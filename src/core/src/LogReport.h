@@ -16,6 +16,7 @@
 #include <porting_layer/Log.h>
 
 #include <string>
+#include <vector>
 
 #include <inttypes.h>
 
@@ -42,22 +43,69 @@ public:
     void reset();
 
     // Add a log message of a certain level.
+    // When the report is full, the oldest messages are dropped. Errors and warnings are kept
+    // apart from info and debug messages, so only other errors and warnings can push them out.
     void add_log(LogMessageType log_level, const std::string &text);
 
     //
     // Data access.
     //
 
+    // Indicates if no log messages were accumulated.
+    bool is_empty() const;
+
     // Get the maximum level of the log messages accumulated up to now.
     LogMessageType get_max_level() const;
 
-    // Get the log text accumulated up to now.
+    // Get the log text accumulated up to now, in the order in which it was added.
+    // The text is composed on the first call after a change.
     const std::string &get_text() const;
 
 private:
+    // Fixed-size ring of records, each a header with the sequence number and the length of the
+    // text, followed by the text. Appending a record drops the oldest records that don't fit.
+    class RecordRing
+    {
+    public:
+        struct Record
+        {
+            uint32_t sequence_number;
+            uint32_t text_position;
+            uint32_t text_length;
+            uint32_t next_position; // Of the next record, if any
+        };
+
+        RecordRing(uint32_t capacity);
+
+        void clear();
+
+        // Texts that don't fit in the ring at all are cut at the start
+        void append(uint32_t sequence_number, const char *text, uint32_t length);
+
+        // Iterate over the records, from the oldest at get_first_position() to the newest
+        uint32_t get_n_records() const;
+        uint32_t get_first_position() const;
+        void read_record(uint32_t position, Record &record/*out*/) const;
+        void append_text(const Record &record, std::string &out/*out*/) const;
+
+    private:
+        std::vector<uint8_t> m_buffer;
+        uint32_t m_first_position; // Of the oldest record
+        uint32_t m_size;           // In bytes, including the headers
+        uint32_t m_n_records;
+
+        void write(uint32_t position, const uint8_t *data, uint32_t length);
+        void read(uint32_t position, uint8_t *data, uint32_t length) const;
+    };
+
     LogMessageType m_min_level;
     LogMessageType m_current_max_level;
-    std::string m_current_text;
+    uint32_t m_next_sequence_number;
+    RecordRing m_retained_records; // Errors and warnings
+    RecordRing m_verbose_records;  // Info and debug messages
+
+    mutable std::string m_text;
+    mutable bool m_is_text_valid;
 };
 
 }
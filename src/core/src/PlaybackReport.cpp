@@ -13,7 +13,12 @@
 
 using namespace ctvc;
 
-PlaybackReport::PlaybackReport()
+static const int32_t STALLED_DURATION_DISTRIBUTION_HIGHEST_VALUE_IN_MS = 3600000;
+static const uint32_t STALLED_DURATION_DISTRIBUTION_SIGNIFICANT_DIGITS = 2;
+
+PlaybackReport::PlaybackReport() :
+    m_audio_stalled_duration_distribution(m_distribution_bin_definition),
+    m_video_stalled_duration_distribution(m_distribution_bin_definition)
 {
     // These are the definitions according to CTV-26999;
     const int first_bin_start = 1;
@@ -21,6 +26,11 @@ PlaybackReport::PlaybackReport()
         19, 20, 39, 78, 156, 313, 625, 1250, 2500, 5000, 2147473646
     };
     m_bin_definition.add_bins(first_bin_start, bin_widths, sizeof(bin_widths) / sizeof(bin_widths[0]));
+
+    m_distribution_bin_definition.set_log_linear(STALLED_DURATION_DISTRIBUTION_HIGHEST_VALUE_IN_MS, STALLED_DURATION_DISTRIBUTION_SIGNIFICANT_DIGITS);
+    // The distributions were constructed before their bins were defined, so size them now.
+    m_audio_stalled_duration_distribution.clear();
+    m_video_stalled_duration_distribution.clear();
 }
 
 PlaybackReport::~PlaybackReport()
@@ -42,6 +52,9 @@ void PlaybackReport::reset()
         delete i->second.second;
     }
     m_stalled_duration_histograms.clear();
+
+    m_audio_stalled_duration_distribution.clear();
+    m_video_stalled_duration_distribution.clear();
 }
 
 void PlaybackReport::add_stalled_duration_sample(const std::string &histogram_id, bool is_audio_not_video, int32_t stalled_duration_in_ms)
@@ -55,4 +68,7 @@ void PlaybackReport::add_stalled_duration_sample(const std::string &histogram_id
 
     // Accumulate this sample into the appropriate histogram.
     p->accumulate(stalled_duration_in_ms);
+
+    // And into the overall distribution.
+    (is_audio_not_video ? m_audio_stalled_duration_distribution : m_video_stalled_duration_distribution).accumulate(stalled_duration_in_ms);
 }
@@ -50,6 +50,11 @@ public:
 
     Histogram::BinDefinition m_bin_definition;
     std::map<std::string, std::pair<Histogram *, Histogram *> > m_stalled_duration_histograms;
+
+    // Log-linear distributions of the stalled durations of all streams, used for percentiles
+    Histogram::BinDefinition m_distribution_bin_definition;
+    Histogram m_audio_stalled_duration_distribution;
+    Histogram m_video_stalled_duration_distribution;
 };
 
 }
@@ -12,7 +12,9 @@ ReportManager::ReportManager(ReportBase &managed_report, IReportTransmitter &rep
     m_managed_report(managed_report),
     m_report_transmitter(report_transmitter),
     m_is_triggered_enabled(false),
-    m_interval_in_ms(0)
+    m_interval_in_ms(0),
+    m_coalescing_window_in_ms(0),
+    m_is_report_pending(false)
 {
 }
 
@@ -43,6 +45,7 @@ void ReportManager::disable_reports()
 {
     m_is_triggered_enabled = false;
     m_interval_in_ms = 0;
+    m_is_report_pending = false;
 }
 
 bool ReportManager::is_enabled() const
@@ -55,6 +58,9 @@ void ReportManager::generate_report()
     // Take every report sent into account for timing periodic reports
     m_last_triggered_time = TimeStamp::now();
 
+    // Any pending updates go along with this report
+    m_is_report_pending = false;
+
     // Send the report
     m_report_transmitter.request_transmission(m_managed_report);
 }
@@ -63,12 +69,22 @@ void ReportManager::report_updated()
 {
     // Send a report if triggered sending is enabled
     if (m_is_triggered_enabled) {
-        generate_report();
+        if (m_coalescing_window_in_ms == 0) {
+            generate_report();
+        } else if (!m_is_report_pending) {
+            // Later updates are merged into the report until the window has passed
+            m_is_report_pending = true;
+            m_first_pending_update_time = TimeStamp::now();
+        }
     }
 }
 
 void ReportManager::timer_tick()
 {
+    if (m_is_report_pending && (TimeStamp::now() - m_first_pending_update_time).get_as_milliseconds() >= m_coalescing_window_in_ms) {
+        generate_report();
+    }
+
     // Send a report if periodic report generation is enabled...
     if (m_interval_in_ms > 0) {
         // ...and it's time to generate a new report.
@@ -77,3 +93,25 @@ void ReportManager::timer_tick()
         }
     }
 }
+
+void ReportManager::set_coalescing_window(uint32_t window_in_ms)
+{
+    m_coalescing_window_in_ms = window_in_ms;
+
+    // Don't keep a report waiting for a window that no longer applies
+    if (m_coalescing_window_in_ms == 0) {
+        generate_pending_report();
+    }
+}
+
+bool ReportManager::is_report_pending() const
+{
+    return m_is_report_pending;
+}
+
+void ReportManager::generate_pending_report()
+{
+    if (m_is_report_pending) {
+        generate_report();
+    }
+}
@@ -46,6 +46,11 @@ namespace ctvc
 // update the report and subsequently call the ReportManager's report_updated() method, which
 // in turn may trigger a request_transmission().
 //
+// With a coalescing window, report_updated() only marks the report as pending. The updates keep
+// accumulating in the report (e.g. samples in its histograms) until the window has passed since
+// the first update, and then go out in a single report. The session manager can send pending
+// reports earlier with generate_pending_report(), e.g. along with other messages it sends.
+//
 
 class ReportBase;
 
@@ -91,10 +96,21 @@ public:
     void report_updated();
 
     // Signals a timer tick.
-    // May trigger generation of a report if periodic report generation is enabled.
+    // May trigger generation of a report if periodic report generation is enabled, or if the
+    // coalescing window of a pending report has passed.
     // Should be called regularly and frequent enough if periodic report generation is enabled.
     void timer_tick();
 
+    // Set the time from the first update of a report until a triggered report is generated.
+    // 0 (the default) generates a triggered report on every update.
+    void set_coalescing_window(uint32_t window_in_ms);
+
+    // Indicates if a triggered report is waiting for its coalescing window to pass.
+    bool is_report_pending() const;
+
+    // Generate the pending report, if any, without waiting for the coalescing window to pass.
+    void generate_pending_report();
+
     // Indicates if latency reporting is enabled.
     bool is_enabled() const;
 
@@ -105,6 +121,10 @@ private:
     bool m_is_triggered_enabled;
     uint32_t m_interval_in_ms;
     TimeStamp m_last_triggered_time;
+
+    uint32_t m_coalescing_window_in_ms;
+    bool m_is_report_pending;
+    TimeStamp m_first_pending_update_time;
 };
 
 } // namespace
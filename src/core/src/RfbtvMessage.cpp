@@ -33,6 +33,11 @@ void RfbtvMessage::clear()
     m_has_data_underflow = false;
 }
 
+void RfbtvMessage::reserve(uint32_t capacity)
+{
+    m_message.reserve(capacity);
+}
+
 uint32_t RfbtvMessage::size() const
 {
     return m_message.size();
@@ -73,28 +78,42 @@ void RfbtvMessage::write_uint8(uint8_t v)
 
 void RfbtvMessage::write_uint16(uint16_t v)
 {
-    m_message.push_back(v >> 8);
-    m_message.push_back(v);
+    uint32_t n = m_message.size();
+    m_message.resize(n + 2);
+    uint8_t *p = &m_message[n];
+    p[0] = v >> 8;
+    p[1] = v;
 }
 
 void RfbtvMessage::write_uint32(uint32_t v)
 {
-    m_message.push_back(v >> 24);
-    m_message.push_back(v >> 16);
-    m_message.push_back(v >> 8);
-    m_message.push_back(v);
+    uint32_t n = m_message.size();
+    m_message.resize(n + 4);
+    uint8_t *p = &m_message[n];
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
 }
 
 void RfbtvMessage::write_uint64(uint64_t v)
 {
-    m_message.push_back(v >> 56);
-    m_message.push_back(v >> 48);
-    m_message.push_back(v >> 40);
-    m_message.push_back(v >> 32);
-    m_message.push_back(v >> 24);
-    m_message.push_back(v >> 16);
-    m_message.push_back(v >> 8);
-    m_message.push_back(v);
+    write_uint32(static_cast<uint32_t>(v >> 32));
+    write_uint32(static_cast<uint32_t>(v));
+}
+
+void RfbtvMessage::write_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        m_message.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    m_message.push_back(static_cast<uint8_t>(v));
+}
+
+void RfbtvMessage::write_signed_varint(int64_t v)
+{
+    write_varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
 }
 
 void RfbtvMessage::write_raw(const uint8_t *data, uint32_t length)
@@ -244,12 +263,38 @@ std::vector<uint8_t> RfbtvMessage::read_blob()
     return read_raw_as_vector(length);
 }
 
+void RfbtvMessage::read_blob(std::vector<uint8_t> &data/*out*/)
+{
+    uint32_t length = read_uint32();
+    if (m_has_data_underflow || m_bytes_read + length > m_message.size()) {
+        m_has_data_underflow = true;
+        data.clear();
+        return;
+    }
+
+    data.assign(m_message.begin() + m_bytes_read, m_message.begin() + m_bytes_read + length);
+    m_bytes_read += length;
+}
+
 std::string RfbtvMessage::read_string()
 {
     uint16_t length = read_uint16();
     return read_raw_as_string(length);
 }
 
+void RfbtvMessage::read_string(std::string &str/*out*/)
+{
+    uint16_t length = read_uint16();
+    if (m_has_data_underflow || m_bytes_read + length > m_message.size()) {
+        m_has_data_underflow = true;
+        str.clear();
+        return;
+    }
+
+    str.assign(m_message.begin() + m_bytes_read, m_message.begin() + m_bytes_read + length);
+    m_bytes_read += length;
+}
+
 std::vector<uint8_t> RfbtvMessage::read_string_as_vector()
 {
     uint16_t length = read_uint16();
@@ -259,24 +304,31 @@ std::vector<uint8_t> RfbtvMessage::read_string_as_vector()
 std::map<std::string, std::string> RfbtvMessage::read_key_value_pairs()
 {
     std::map<std::string, std::string> map;
+    read_key_value_pairs(map);
+
+    return map;
+}
+
+void RfbtvMessage::read_key_value_pairs(std::map<std::string, std::string> &key_value_pairs/*out*/)
+{
+    key_value_pairs.clear();
 
     uint8_t nr_pairs = read_uint8();
     if (m_has_data_underflow) {
-        return map;
+        return;
     }
 
+    std::string key;
     for (uint8_t i = 0; i < nr_pairs; i++) {
-        std::string key = read_string();
+        read_string(key);
         if (m_has_data_underflow) {
             break;
         }
-        map[key] = read_string();
+        read_string(key_value_pairs[key]);
         if (m_has_data_underflow) {
             break;
         }
     }
-
-    return map;
 }
 
 bool RfbtvMessage::has_data_underflow() const
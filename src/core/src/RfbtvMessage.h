@@ -25,15 +25,24 @@ public:
     RfbtvMessage();
     ~RfbtvMessage();
 
-    // Clear the entire message
+    // Clear the entire message; the allocated capacity is kept, so a message can be reused
     void clear();
 
+    // Allocate room for at least capacity bytes, so writing up to that size does not reallocate
+    void reserve(uint32_t capacity);
+
     // Write fixed-sized integer primitives
     void write_uint8(uint8_t v);
     void write_uint16(uint16_t v);
     void write_uint32(uint32_t v);
     void write_uint64(uint64_t v);
 
+    // Write variable-length integers: 7 bits per byte, least significant first, with the high bit
+    // set in all but the last byte. Signed integers are zigzag-encoded first, so small negative
+    // values stay short too.
+    void write_varint(uint64_t v);
+    void write_signed_varint(int64_t v);
+
     // Write raw binary data
     void write_raw(const uint8_t *data, uint32_t length);
     void write_raw(const std::vector<uint8_t> &data);
@@ -64,15 +73,18 @@ public:
 
     // Read binary data preceded by a 32-bit size field
     std::vector<uint8_t> read_blob();
+    void read_blob(std::vector<uint8_t> &data/*out*/); // Reuses the capacity of data
 
     // Read a string preceded with a 16-bit length field
     std::string read_string();
+    void read_string(std::string &str/*out*/); // Reuses the capacity of str
     std::vector<uint8_t> read_string_as_vector();
 
     // Read a key-value list from the message
     // It first reads an 8-bit integer specifying the number of key value pairs and
     // subsequently reads all strings and returns them as a map of key value pairs.
     std::map<std::string, std::string> read_key_value_pairs();
+    void read_key_value_pairs(std::map<std::string, std::string> &key_value_pairs/*out*/);
 
     // Access to individual bytes; no bounds checking takes place, so 0 <= index < size()
     uint8_t &operator[](int index);
@@ -10,6 +10,7 @@
 
 #include "RfbtvProtocol.h"
 #include "RfbtvMessage.h"
+#include "KeyValueWriter.h"
 #include "PlaybackReport.h"
 #include "LatencyReport.h"
 #include "LogReport.h"
@@ -83,21 +84,46 @@ const unsigned int RFBTV_VERSION_SIZE = 15;
 
 static const int RFB_ENCODING_PICTURE_OBJECT = 42;
 static const int RFB_ENCODING_URL = 43;
+static const int RFB_ENCODING_COMPACT_CLIENT_REPORT = 44; // Pseudo-encoding: the client can send compact client reports
+
+// Compact client reports; see write_compact_playback_report() and friends for the format
+static const char *COMPACT_REPORT_KEY = "compact";
+static const uint8_t COMPACT_REPORT_FORMAT_VERSION = 1;
+static const uint32_t MAX_REPORT_DICTIONARY_SIZE = 256;
 
 // Local helper function
-static inline std::string get_map_value(const std::map<std::string, std::string> &key_value_pairs, const std::string &key)
+static inline const std::string &get_map_value(const std::map<std::string, std::string> &key_value_pairs, const std::string &key)
 {
+    static const std::string s_empty;
+
     std::map<std::string, std::string>::const_iterator i = key_value_pairs.find(key);
     if (i != key_value_pairs.end()) {
         return i->second;
     }
-    return std::string();
+    return s_empty;
+}
+
+// Handle the optional encoding field of a report control command
+static void update_report_encoding(const std::map<std::string, std::string> &key_value_pairs, bool &is_compact)
+{
+    const std::string &encoding = get_map_value(key_value_pairs, "encoding");
+    if (encoding == "compact") {
+        is_compact = true;
+    } else if (encoding == "text") {
+        is_compact = false;
+    } else if (!encoding.empty()) {
+        CTVC_LOG_WARNING("Unknown report encoding:%s", encoding.c_str());
+    }
 }
 
 RfbtvProtocol::RfbtvProtocol(ICallbacks &callbacks) :
     m_protocol_version(RFBTV_PROTOCOL_UNKNOWN),
-    m_callbacks(callbacks)
+    m_callbacks(callbacks),
+    m_is_playback_report_compact(false),
+    m_is_latency_report_compact(false),
+    m_is_log_report_compact(false)
 {
+    set_version(RFBTV_PROTOCOL_UNKNOWN);
 }
 
 RfbtvProtocol::~RfbtvProtocol()
@@ -108,24 +134,33 @@ void RfbtvProtocol::set_version(ProtocolVersion protocol_version)
 {
     m_protocol_version = protocol_version;
 
-    m_message_map.clear();
+    for (uint32_t i = 0; i < N_MESSAGE_TYPES; i++) {
+        m_message_handlers[i] = 0;
+    }
+
+    // The server has to enable compact reports again on a new connection
+    m_is_playback_report_compact = false;
+    m_is_latency_report_compact = false;
+    m_is_log_report_compact = false;
+    m_report_dictionary.clear();
+    m_uncommitted_dictionary_strings.clear();
 
     // Setup the message handler table according to the current protocol
     // All protocol versions
-    m_message_map[RFBServerMessageType_FramebufferUpdate] = &RfbtvProtocol::parse_frame_buffer_update;
-    m_message_map[RFBServerMessageType_SessionSetupResponse] = &RfbtvProtocol::parse_session_setup_response;
-    m_message_map[RFBServerMessageType_SessionTerminateRequest] = &RfbtvProtocol::parse_session_terminate_request;
-    m_message_map[RFBServerMessageType_Ping] = &RfbtvProtocol::parse_ping;
-    m_message_map[RFBServerMessageType_StreamSetupRequest] = &RfbtvProtocol::parse_stream_setup_request;
-    m_message_map[RFBServerMessageType_PassThrough] = &RfbtvProtocol::parse_passthrough;
+    m_message_handlers[RFBServerMessageType_FramebufferUpdate] = &RfbtvProtocol::parse_frame_buffer_update;
+    m_message_handlers[RFBServerMessageType_SessionSetupResponse] = &RfbtvProtocol::parse_session_setup_response;
+    m_message_handlers[RFBServerMessageType_SessionTerminateRequest] = &RfbtvProtocol::parse_session_terminate_request;
+    m_message_handlers[RFBServerMessageType_Ping] = &RfbtvProtocol::parse_ping;
+    m_message_handlers[RFBServerMessageType_StreamSetupRequest] = &RfbtvProtocol::parse_stream_setup_request;
+    m_message_handlers[RFBServerMessageType_PassThrough] = &RfbtvProtocol::parse_passthrough;
 	CLOUDTV_LOG_DEBUG("set_version...\n");
 
     // Protocol V2.0
     if (m_protocol_version == RfbtvProtocol::RFBTV_PROTOCOL_V2_0) {
-        m_message_map[RFBServerMessageType_ServerCommand] = &RfbtvProtocol::parse_server_command;
-        m_message_map[RFBServerMessageType_HandoffRequest] = &RfbtvProtocol::parse_handoff_request;
-        m_message_map[RFBServerMessageType_CdmSetupRequest] = &RfbtvProtocol::parse_cdm_setup_request;
-        m_message_map[RFBServerMessageType_CdmTerminateRequest] = &RfbtvProtocol::parse_cdm_terminate_request;
+        m_message_handlers[RFBServerMessageType_ServerCommand] = &RfbtvProtocol::parse_server_command;
+        m_message_handlers[RFBServerMessageType_HandoffRequest] = &RfbtvProtocol::parse_handoff_request;
+        m_message_handlers[RFBServerMessageType_CdmSetupRequest] = &RfbtvProtocol::parse_cdm_setup_request;
+        m_message_handlers[RFBServerMessageType_CdmTerminateRequest] = &RfbtvProtocol::parse_cdm_terminate_request;
     }
 }
 
@@ -134,34 +169,36 @@ RfbtvProtocol::ProtocolVersion RfbtvProtocol::get_version() const
     return m_protocol_version;
 }
 
-RfbtvMessage RfbtvProtocol::create_set_encodings(bool is_url_encoding_supported)
+RfbtvMessage &RfbtvProtocol::create_set_encodings(RfbtvMessage &msg/*out*/, bool is_url_encoding_supported)
 {
     CTVC_LOG_DEBUG("");
 
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_SetEncodings);
     msg.write_uint8(0); // Padding
 
     if (is_url_encoding_supported) {
         CTVC_LOG_DEBUG("Tell server we can handle both 'Picture Object' and 'URL' encodings");
-        msg.write_uint16(2); // Number of encodings
+        msg.write_uint16(3); // Number of encodings
         msg.write_uint32(RFB_ENCODING_PICTURE_OBJECT);
         msg.write_uint32(RFB_ENCODING_URL);
     } else {
         CTVC_LOG_DEBUG("Tell server we can only handle 'Picture Object' encoding");
-        msg.write_uint16(1); // Number of encodings
+        msg.write_uint16(2); // Number of encodings
         msg.write_uint32(RFB_ENCODING_PICTURE_OBJECT);
     }
+    // Servers that don't know the pseudo-encoding ignore it and keep receiving text reports
+    msg.write_uint32(RFB_ENCODING_COMPACT_CLIENT_REPORT);
 
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_frame_buffer_update_request(uint16_t screen_width, uint16_t screen_height)
+RfbtvMessage &RfbtvProtocol::create_frame_buffer_update_request(RfbtvMessage &msg/*out*/, uint16_t screen_width, uint16_t screen_height)
 {
     CTVC_LOG_DEBUG("%dx%d", screen_width, screen_height);
 
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_FramebufferUpdateRequest);
     msg.write_uint8(1); // Incremental
@@ -173,9 +210,9 @@ RfbtvMessage RfbtvProtocol::create_frame_buffer_update_request(uint16_t screen_w
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_key_event(X11KeyCode key, KeyAction key_action)
+RfbtvMessage &RfbtvProtocol::create_key_event(RfbtvMessage &msg/*out*/, X11KeyCode key, KeyAction key_action)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_KeyEvent);
     msg.write_uint8(key_action); // "event" in the protocol
@@ -185,9 +222,9 @@ RfbtvMessage RfbtvProtocol::create_key_event(X11KeyCode key, KeyAction key_actio
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_pointer_event(int button_mask, int x, int y)
+RfbtvMessage &RfbtvProtocol::create_pointer_event(RfbtvMessage &msg/*out*/, int button_mask, int x, int y)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_PointerEvent);
     msg.write_uint8(button_mask);
@@ -197,24 +234,84 @@ RfbtvMessage RfbtvProtocol::create_pointer_event(int button_mask, int x, int y)
     return msg;
 }
 
-void RfbtvProtocol::append_histogram(std::string &out, const std::string &name, const Histogram &histogram)
+void RfbtvProtocol::write_histogram(KeyValueWriter &writer, const char *name, const Histogram &histogram)
 {
-    out += ",\"" + name + "\":[";
+    writer.member(name);
+    writer.begin_array();
     uint32_t n_bins = histogram.get_bin_definition().get_n_bins();
     for (uint32_t j = 0; j < n_bins; j++) {
-        if (j > 0) {
-            out += ',';
-        }
-        string_printf_append(out, "%u", histogram.get_entry(j));
+        writer.value(histogram.get_entry(j));
+    }
+    writer.end_array();
+}
+
+void RfbtvProtocol::write_percentiles(KeyValueWriter &writer, const Histogram &histogram)
+{
+    writer.begin_object();
+    writer.member("n");
+    writer.value(histogram.get_n_samples());
+    writer.member("p50");
+    writer.value(histogram.get_value_at_percentile(50.0));
+    writer.member("p90");
+    writer.value(histogram.get_value_at_percentile(90.0));
+    writer.member("p99");
+    writer.value(histogram.get_value_at_percentile(99.0));
+    writer.member("p999");
+    writer.value(histogram.get_value_at_percentile(99.9));
+    writer.member("max");
+    writer.value(histogram.get_max_value());
+    writer.end_object();
+}
+
+static const char *get_playstate_name(PlaybackReport::PlaybackState playback_state)
+{
+    switch (playback_state) {
+    case PlaybackReport::STARTING:
+        return "starting";
+    case PlaybackReport::PLAYING:
+        return "playing";
+    case PlaybackReport::STALLED:
+        return "stalled";
+    case PlaybackReport::STOPPED:
+        return "stopped";
+    }
+
+    return "";
+}
+
+static const char *get_latency_subtype_name(LatencyReport::Subtype subtype)
+{
+    switch (subtype) {
+    case LatencyReport::SUBTYPE_SESSION_START_TO_STREAM:
+        return "session_start_to_stream";
+    case LatencyReport::SUBTYPE_SESSION_START_TO_FIRSTPAINT:
+        return "session_start_to_firstpaint";
+    case LatencyReport::SUBTYPE_SESSION_START_TO_COMPLETE:
+        return "session_start_to_complete";
+    case LatencyReport::SUBTYPE_KEY_TO_DISPLAY:
+        return "key_to_display";
+    case LatencyReport::SUBTYPE_SESSION_START_BEGIN:
+        return "session_start_begin";
+    case LatencyReport::SUBTYPE_SESSION_START_STREAM:
+        return "session_start_stream";
+    case LatencyReport::SUBTYPE_SESSION_START_FIRSTPAINT_DISPLAY:
+        return "session_start_firstpaint_display";
+    case LatencyReport::SUBTYPE_SESSION_START_COMPLETE_DISPLAY:
+        return "session_start_complete_display";
+    case LatencyReport::SUBTYPE_KEY_SENT:
+        return "key_sent";
+    case LatencyReport::SUBTYPE_KEY_DISPLAY:
+        return "key_display";
     }
-    out += "]";
+
+    return "";
 }
 
-RfbtvMessage RfbtvProtocol::create_playback_client_report(const PlaybackReport &playback_report)
+RfbtvMessage &RfbtvProtocol::create_playback_client_report(RfbtvMessage &msg/*out*/, const PlaybackReport &playback_report)
 {
     // This method only implements the RFB-TV 2.0 version of the playback report; the RFB-TV 1.3
     // version is not supported because it is not implemented in any RFB-TV 1.3 version server.
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // We don't support the RFB-TV 1.3 playback control message, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -226,135 +323,380 @@ RfbtvMessage RfbtvProtocol::create_playback_client_report(const PlaybackReport &
 
     msg.write_string("playback");
 
-    std::map<std::string, std::string> fields;
+    KeyValueWriter writer(msg);
 
-    if (playback_report.m_playback_state.is_set()) {
-        switch (playback_report.m_playback_state.get()) {
-        case PlaybackReport::STARTING:
-            fields["playstate"] = "starting";
-            break;
-        case PlaybackReport::PLAYING:
-            fields["playstate"] = "playing";
-            break;
-        case PlaybackReport::STALLED:
-            fields["playstate"] = "stalled";
-            break;
-        case PlaybackReport::STOPPED:
-            fields["playstate"] = "stopped";
-            break;
-        }
+    if (m_is_playback_report_compact) {
+        writer.begin_value(COMPACT_REPORT_KEY);
+        write_compact_playback_report(msg, playback_report);
+        writer.end_value();
+        writer.finish();
+        return msg;
     }
 
-    if (playback_report.m_stalled_duration_in_ms.is_set()) {
-        string_printf(fields["duration_stalled"], "%u", playback_report.m_stalled_duration_in_ms.get());
+    // The fields are written in alphabetical order of their keys
+
+    if (playback_report.m_bandwidth.is_set()) {
+        writer.write("bandwidth", playback_report.m_bandwidth.get());
     }
 
     if (playback_report.m_current_pts.is_set()) {
-        string_printf(fields["current_pts"], "%s", uint64_to_string(playback_report.m_current_pts.get()).c_str());
+        writer.write("current_pts", playback_report.m_current_pts.get());
     }
 
     if (playback_report.m_pcr_delay.is_set()) {
-        string_printf(fields["delay"], "%u", playback_report.m_pcr_delay.get());
+        writer.write("delay", playback_report.m_pcr_delay.get());
     }
 
-    if (playback_report.m_bandwidth.is_set()) {
-        string_printf(fields["bandwidth"], "%u", playback_report.m_bandwidth.get());
+    if (playback_report.m_stalled_duration_in_ms.is_set()) {
+        writer.write("duration_stalled", playback_report.m_stalled_duration_in_ms.get());
     }
 
-    std::string histogram_data;
-    for (std::map<std::string, std::pair<Histogram *, Histogram *> >::const_iterator i = playback_report.m_stalled_duration_histograms.begin(); i != playback_report.m_stalled_duration_histograms.end(); ++i) {
-        Histogram *audio_histogram(i->second.first);
-        Histogram *video_histogram(i->second.second);
+    if (!playback_report.m_stalled_duration_histograms.empty()) {
+        writer.begin_value("histograms");
+        writer.begin_array();
+        for (std::map<std::string, std::pair<Histogram *, Histogram *> >::const_iterator i = playback_report.m_stalled_duration_histograms.begin(); i != playback_report.m_stalled_duration_histograms.end(); ++i) {
+            Histogram *audio_histogram(i->second.first);
+            Histogram *video_histogram(i->second.second);
+
+            writer.begin_object();
+            writer.member("id");
+            writer.value(i->first);
 
-        if (!histogram_data.empty()) {
-            histogram_data += ",";
+            if (audio_histogram) {
+                write_histogram(writer, "A", *audio_histogram);
+            }
+
+            if (video_histogram) {
+                write_histogram(writer, "V", *video_histogram);
+            }
+
+            writer.end_object();
         }
-        histogram_data += "{\"id\":\"" + i->first + "\"";
+        writer.end_array();
+        writer.end_value();
+    }
+
+    if (playback_report.m_playback_state.is_set()) {
+        writer.write("playstate", get_playstate_name(playback_report.m_playback_state.get()));
+    }
 
-        if (audio_histogram) {
-            append_histogram(histogram_data, "A", *audio_histogram);
+    const Histogram &audio_distribution(playback_report.m_audio_stalled_duration_distribution);
+    const Histogram &video_distribution(playback_report.m_video_stalled_duration_distribution);
+    if (audio_distribution.get_n_samples() > 0 || video_distribution.get_n_samples() > 0) {
+        writer.begin_value("stall_percentiles");
+        writer.begin_object();
+        if (audio_distribution.get_n_samples() > 0) {
+            writer.member("A");
+            write_percentiles(writer, audio_distribution);
         }
+        if (video_distribution.get_n_samples() > 0) {
+            writer.member("V");
+            write_percentiles(writer, video_distribution);
+        }
+        writer.end_object();
+        writer.end_value();
+    }
+
+    writer.finish();
+
+    return msg;
+}
+
+RfbtvMessage &RfbtvProtocol::create_latency_client_report(RfbtvMessage &msg/*out*/, const LatencyReport &latency_report)
+{
+    msg.clear();
+
+    msg.write_uint8(RFBClientMessageType_ClientReport);
+    msg.write_string("latency");
+
+    KeyValueWriter writer(msg);
+
+    if (m_is_latency_report_compact) {
+        writer.begin_value(COMPACT_REPORT_KEY);
+        write_compact_latency_report(msg, latency_report);
+        writer.end_value();
+        writer.finish();
+        return msg;
+    }
 
-        if (video_histogram) {
-            append_histogram(histogram_data, "V", *video_histogram);
+    // There are always 3 pairs of comma-separated values, plus the key-to-display and key trace percentiles if any were measured
+    uint32_t n_entries = latency_report.get_n_entries();
+
+    writer.begin_value("subtypes");
+    for (uint32_t i = 0; i < n_entries; i++) {
+        if (i > 0) {
+            writer.append(',');
         }
+        writer.append(get_latency_subtype_name(latency_report.get_subtype(i)));
+    }
+    writer.end_value();
 
-        histogram_data += "}";
+    writer.begin_value("labels");
+    for (uint32_t i = 0; i < n_entries; i++) {
+        if (i > 0) {
+            writer.append(',');
+        }
+        writer.append(latency_report.get_label(i));
     }
-    if (!histogram_data.empty()) {
-        fields["histograms"] = "[" + histogram_data + "]";
+    writer.end_value();
+
+    writer.begin_value("data");
+    for (uint32_t i = 0; i < n_entries; i++) {
+        if (i > 0) {
+            writer.append(',');
+        }
+        writer.append(latency_report.get_data(i));
     }
+    writer.end_value();
 
-    msg.write_key_value_pairs(fields);
+    const Histogram &key_to_display_distribution(latency_report.get_key_to_display_distribution());
+    if (key_to_display_distribution.get_n_samples() > 0) {
+        writer.begin_value("key_to_display_percentiles");
+        write_percentiles(writer, key_to_display_distribution);
+        writer.end_value();
+    }
+
+    // Per stage of the traced keys, the time since the previous stage
+    bool has_key_traces = false;
+    for (int stage = LatencyReport::KEY_TRACE_STAGE_HANDLED; stage < LatencyReport::N_KEY_TRACE_STAGES; stage++) {
+        const Histogram &distribution(latency_report.get_key_trace_distribution(static_cast<LatencyReport::KeyTraceStage>(stage)));
+        if (distribution.get_n_samples() == 0) {
+            continue;
+        }
+        if (!has_key_traces) {
+            writer.begin_value("key_trace_percentiles");
+            writer.begin_object();
+            has_key_traces = true;
+        }
+        writer.member(LatencyReport::get_key_trace_stage_name(static_cast<LatencyReport::KeyTraceStage>(stage)));
+        write_percentiles(writer, distribution);
+    }
+    if (has_key_traces) {
+        writer.end_object();
+        writer.end_value();
+    }
+
+    writer.finish();
 
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_latency_client_report(const LatencyReport &latency_report)
+// A compact report is a report with a single "compact" pair, of which the value is binary. It
+// starts with the format version (uint8); all other integers are varints, signed ones zigzag-encoded.
+// Strings that recur are dictionary strings: the varint index + 1 of the string in the dictionary,
+// or 0 followed by the varint length and the characters of a new string. A new string is added to
+// the dictionary, at the next index, as long as the dictionary has less than 256 strings.
+//
+// Playback report:
+//   uint8 flags: 0x01 bandwidth, 0x02 duration_stalled, 0x04 playstate, 0x08 histograms,
+//                0x10 audio stall percentiles, 0x20 video stall percentiles, 0x40 current_pts, 0x80 delay
+//   [bandwidth]                                              if 0x01
+//   [current_pts]                                            if 0x40
+//   [delay]                                                  if 0x80
+//   [duration_stalled]                                       if 0x02
+//   [uint8 playstate (PlaybackReport::PlaybackState)]        if 0x04
+//   [number of histograms, per histogram: dictionary string id, uint8 flags (0x01 audio, 0x02 video),
+//    per present histogram: number of bins, bins]            if 0x08
+//   [audio percentiles]                                      if 0x10
+//   [video percentiles]                                      if 0x20
+//
+// Latency report:
+//   number of entries, per entry: uint8 subtype (LatencyReport::Subtype), dictionary string label,
+//   signed difference of the data with the data of the previous entry (or 0)
+//   uint8 1 if key-to-display percentiles follow, else 0
+//   uint8 flags: bit n set if the percentiles of key trace stage n (LatencyReport::KeyTraceStage) follow,
+//   in order of stage
+//
+// Log report:
+//   uint8 level (LogMessageType), length and characters of the text
+//
+// Percentiles: n, signed p50, p90, p99, p999 and max
+void RfbtvProtocol::write_compact_playback_report(RfbtvMessage &msg, const PlaybackReport &playback_report)
 {
-    // Create comma-separated value strings
-    std::string subtypes, labels, data;
-    for (uint32_t i = 0; i < latency_report.get_n_entries(); i++) {
-        if (i > 0) {
-            subtypes += ",";
-            labels += ",";
-            data += ",";
+    const Histogram &audio_distribution(playback_report.m_audio_stalled_duration_distribution);
+    const Histogram &video_distribution(playback_report.m_video_stalled_duration_distribution);
+
+    uint8_t flags = 0;
+    flags |= playback_report.m_bandwidth.is_set() ? 0x01 : 0;
+    flags |= playback_report.m_stalled_duration_in_ms.is_set() ? 0x02 : 0;
+    flags |= playback_report.m_playback_state.is_set() ? 0x04 : 0;
+    flags |= !playback_report.m_stalled_duration_histograms.empty() ? 0x08 : 0;
+    flags |= audio_distribution.get_n_samples() > 0 ? 0x10 : 0;
+    flags |= video_distribution.get_n_samples() > 0 ? 0x20 : 0;
+    flags |= playback_report.m_current_pts.is_set() ? 0x40 : 0;
+    flags |= playback_report.m_pcr_delay.is_set() ? 0x80 : 0;
+
+    msg.write_uint8(COMPACT_REPORT_FORMAT_VERSION);
+    msg.write_uint8(flags);
+
+    if (playback_report.m_bandwidth.is_set()) {
+        msg.write_varint(playback_report.m_bandwidth.get());
+    }
+
+    if (playback_report.m_current_pts.is_set()) {
+        msg.write_varint(playback_report.m_current_pts.get());
+    }
+
+    if (playback_report.m_pcr_delay.is_set()) {
+        msg.write_varint(playback_report.m_pcr_delay.get());
+    }
+
+    if (playback_report.m_stalled_duration_in_ms.is_set()) {
+        msg.write_varint(playback_report.m_stalled_duration_in_ms.get());
+    }
+
+    if (playback_report.m_playback_state.is_set()) {
+        msg.write_uint8(playback_report.m_playback_state.get());
+    }
+
+    if (!playback_report.m_stalled_duration_histograms.empty()) {
+        msg.write_varint(playback_report.m_stalled_duration_histograms.size());
+        for (std::map<std::string, std::pair<Histogram *, Histogram *> >::const_iterator i = playback_report.m_stalled_duration_histograms.begin(); i != playback_report.m_stalled_duration_histograms.end(); ++i) {
+            Histogram *audio_histogram(i->second.first);
+            Histogram *video_histogram(i->second.second);
+
+            write_dictionary_string(msg, i->first);
+            msg.write_uint8((audio_histogram ? 0x01 : 0) | (video_histogram ? 0x02 : 0));
+
+            if (audio_histogram) {
+                write_compact_histogram(msg, *audio_histogram);
+            }
+
+            if (video_histogram) {
+                write_compact_histogram(msg, *video_histogram);
+            }
         }
+    }
 
-        switch (latency_report.get_subtype(i)) {
-        case LatencyReport::SUBTYPE_SESSION_START_TO_STREAM:
-            subtypes += "session_start_to_stream";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_TO_FIRSTPAINT:
-            subtypes += "session_start_to_firstpaint";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_TO_COMPLETE:
-            subtypes += "session_start_to_complete";
-            break;
-        case LatencyReport::SUBTYPE_KEY_TO_DISPLAY:
-            subtypes += "key_to_display";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_BEGIN:
-            subtypes += "session_start_begin";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_STREAM:
-            subtypes += "session_start_stream";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_FIRSTPAINT_DISPLAY:
-            subtypes += "session_start_firstpaint_display";
-            break;
-        case LatencyReport::SUBTYPE_SESSION_START_COMPLETE_DISPLAY:
-            subtypes += "session_start_complete_display";
-            break;
-        case LatencyReport::SUBTYPE_KEY_SENT:
-            subtypes += "key_sent";
-            break;
-        case LatencyReport::SUBTYPE_KEY_DISPLAY:
-            subtypes += "key_display";
-            break;
+    if (audio_distribution.get_n_samples() > 0) {
+        write_compact_percentiles(msg, audio_distribution);
+    }
+
+    if (video_distribution.get_n_samples() > 0) {
+        write_compact_percentiles(msg, video_distribution);
+    }
+}
+
+void RfbtvProtocol::write_compact_latency_report(RfbtvMessage &msg, const LatencyReport &latency_report)
+{
+    uint32_t n_entries = latency_report.get_n_entries();
+
+    msg.write_uint8(COMPACT_REPORT_FORMAT_VERSION);
+    msg.write_varint(n_entries);
+
+    // The entries of a report are mostly time stamps close to each other
+    uint64_t previous_data = 0;
+    for (uint32_t i = 0; i < n_entries; i++) {
+        uint64_t data = latency_report.get_data(i);
+
+        msg.write_uint8(latency_report.get_subtype(i));
+        write_dictionary_string(msg, latency_report.get_label(i));
+        msg.write_signed_varint(static_cast<int64_t>(data - previous_data));
+
+        previous_data = data;
+    }
+
+    const Histogram &key_to_display_distribution(latency_report.get_key_to_display_distribution());
+    if (key_to_display_distribution.get_n_samples() > 0) {
+        msg.write_uint8(1);
+        write_compact_percentiles(msg, key_to_display_distribution);
+    } else {
+        msg.write_uint8(0);
+    }
+
+    uint8_t key_trace_stages = 0;
+    for (int stage = LatencyReport::KEY_TRACE_STAGE_HANDLED; stage < LatencyReport::N_KEY_TRACE_STAGES; stage++) {
+        if (latency_report.get_key_trace_distribution(static_cast<LatencyReport::KeyTraceStage>(stage)).get_n_samples() > 0) {
+            key_trace_stages |= 1 << stage;
+        }
+    }
+    msg.write_uint8(key_trace_stages);
+    for (int stage = LatencyReport::KEY_TRACE_STAGE_HANDLED; stage < LatencyReport::N_KEY_TRACE_STAGES; stage++) {
+        if (key_trace_stages & (1 << stage)) {
+            write_compact_percentiles(msg, latency_report.get_key_trace_distribution(static_cast<LatencyReport::KeyTraceStage>(stage)));
         }
+    }
+}
+
+void RfbtvProtocol::write_compact_log_report(RfbtvMessage &msg, const LogReport &log_report)
+{
+    const std::string &text(log_report.get_text());
 
-        labels += latency_report.get_label(i);
-        string_printf_append(data, "%s", uint64_to_string(latency_report.get_data(i)).c_str());
+    msg.write_uint8(COMPACT_REPORT_FORMAT_VERSION);
+    msg.write_uint8(log_report.get_max_level());
+    msg.write_varint(text.size());
+    msg.write_raw(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+}
+
+void RfbtvProtocol::write_dictionary_string(RfbtvMessage &msg, const std::string &str)
+{
+    std::map<std::string, uint32_t>::const_iterator i = m_report_dictionary.find(str);
+    if (i != m_report_dictionary.end()) {
+        msg.write_varint(i->second + 1);
+        return;
     }
 
-    RfbtvMessage msg;
+    msg.write_varint(0);
+    msg.write_varint(str.size());
+    msg.write_raw(reinterpret_cast<const uint8_t *>(str.data()), str.size());
 
-    msg.write_uint8(RFBClientMessageType_ClientReport);
-    msg.write_string("latency");
+    if (m_report_dictionary.size() < MAX_REPORT_DICTIONARY_SIZE) {
+        uint32_t index = m_report_dictionary.size();
+        m_report_dictionary[str] = index;
+        m_uncommitted_dictionary_strings.push_back(str);
+    }
+}
 
-    // There always 3 pairs
-    msg.write_uint8(3);
+void RfbtvProtocol::commit_report_dictionary_updates()
+{
+    m_uncommitted_dictionary_strings.clear();
+}
 
-    msg.write_key_value_pair("subtypes", subtypes.c_str());
-    msg.write_key_value_pair("labels", labels.c_str());
-    msg.write_key_value_pair("data", data.c_str());
+void RfbtvProtocol::discard_report_dictionary_updates()
+{
+    // The strings were added last, so the indices of the remaining strings stay the same
+    for (size_t i = 0; i < m_uncommitted_dictionary_strings.size(); i++) {
+        m_report_dictionary.erase(m_uncommitted_dictionary_strings[i]);
+    }
+    m_uncommitted_dictionary_strings.clear();
+}
 
-    return msg;
+void RfbtvProtocol::write_compact_histogram(RfbtvMessage &msg, const Histogram &histogram)
+{
+    uint32_t n_bins = histogram.get_bin_definition().get_n_bins();
+    msg.write_varint(n_bins);
+    for (uint32_t j = 0; j < n_bins; j++) {
+        msg.write_varint(histogram.get_entry(j));
+    }
+}
+
+void RfbtvProtocol::write_compact_percentiles(RfbtvMessage &msg, const Histogram &histogram)
+{
+    msg.write_varint(histogram.get_n_samples());
+    msg.write_signed_varint(histogram.get_value_at_percentile(50.0));
+    msg.write_signed_varint(histogram.get_value_at_percentile(90.0));
+    msg.write_signed_varint(histogram.get_value_at_percentile(99.0));
+    msg.write_signed_varint(histogram.get_value_at_percentile(99.9));
+    msg.write_signed_varint(histogram.get_max_value());
 }
 
-RfbtvMessage RfbtvProtocol::create_log_client_report(const LogReport &log_report)
+RfbtvMessage &RfbtvProtocol::create_log_client_report(RfbtvMessage &msg/*out*/, const LogReport &log_report)
 {
+    if (m_is_log_report_compact) {
+        msg.clear();
+
+        msg.write_uint8(RFBClientMessageType_ClientReport);
+        msg.write_string("log");
+
+        KeyValueWriter writer(msg);
+        writer.begin_value(COMPACT_REPORT_KEY);
+        write_compact_log_report(msg, log_report);
+        writer.end_value();
+        writer.finish();
+
+        return msg;
+    }
+
     const char *level_str = "";
     switch (log_report.get_max_level()) {
     case LOG_DEBUG:
@@ -371,7 +713,7 @@ RfbtvMessage RfbtvProtocol::create_log_client_report(const LogReport &log_report
         break;
     }
 
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_ClientReport);
     msg.write_string("log");
@@ -386,9 +728,9 @@ RfbtvMessage RfbtvProtocol::create_log_client_report(const LogReport &log_report
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_session_terminate_indication(SessionTerminateReason reason)
+RfbtvMessage &RfbtvProtocol::create_session_terminate_indication(RfbtvMessage &msg/*out*/, SessionTerminateReason reason)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_SessionTerminateIndication);
     msg.write_uint8(reason);
@@ -396,9 +738,9 @@ RfbtvMessage RfbtvProtocol::create_session_terminate_indication(SessionTerminate
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_session_setup(const std::string &client_id, const std::map<std::string, std::string> &param_list, const std::string &session_id, const std::string &cookie)
+RfbtvMessage &RfbtvProtocol::create_session_setup(RfbtvMessage &msg/*out*/, const std::string &client_id, const std::map<std::string, std::string> &param_list, const std::string &session_id, const std::string &cookie)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_SessionSetup);
 
@@ -444,7 +786,7 @@ RfbtvMessage RfbtvProtocol::create_session_setup(const std::string &client_id, c
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_stream_setup_response(StreamSetupResponseCode result, const std::map<std::string, std::string> &parameters, const std::string &local_udp_url)
+RfbtvMessage &RfbtvProtocol::create_stream_setup_response(RfbtvMessage &msg/*out*/, StreamSetupResponseCode result, const std::map<std::string, std::string> &parameters, const std::string &local_udp_url)
 {
     // Map the result to an RFB-TV 2.0 or RFB-TV 1.3.2 code
     bool is_rfbtv_1_3 = m_protocol_version == RfbtvProtocol::RFBTV_PROTOCOL_V1_3;
@@ -470,7 +812,7 @@ RfbtvMessage RfbtvProtocol::create_stream_setup_response(StreamSetupResponseCode
         break;
     }
 
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_StreamSetupResponse);
     msg.write_uint8(code);
@@ -484,7 +826,7 @@ RfbtvMessage RfbtvProtocol::create_stream_setup_response(StreamSetupResponseCode
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_stream_confirm(StreamConfirmCode result)
+RfbtvMessage &RfbtvProtocol::create_stream_confirm(RfbtvMessage &msg/*out*/, StreamConfirmCode result)
 {
     // Map the result to an RFB-TV 2.0 or RFB-TV 1.3.2 code
     bool is_rfbtv_1_3 = m_protocol_version == RfbtvProtocol::RFBTV_PROTOCOL_V1_3;
@@ -516,7 +858,7 @@ RfbtvMessage RfbtvProtocol::create_stream_confirm(StreamConfirmCode result)
         break;
     }
 
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_StreamConfirm);
     msg.write_uint8(code);
@@ -524,9 +866,9 @@ RfbtvMessage RfbtvProtocol::create_stream_confirm(StreamConfirmCode result)
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_pong()
+RfbtvMessage &RfbtvProtocol::create_pong(RfbtvMessage &msg/*out*/)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_Pong);
 
@@ -535,9 +877,9 @@ RfbtvMessage RfbtvProtocol::create_pong()
 
 // TODO: (CNP-1987) ResultCode RfbtvProtocol::create_input_event();
 
-RfbtvMessage RfbtvProtocol::create_passthrough(const std::string &protocol_id, const std::vector<uint8_t> &data)
+RfbtvMessage &RfbtvProtocol::create_passthrough(RfbtvMessage &msg/*out*/, const std::string &protocol_id, const std::vector<uint8_t> &data)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     msg.write_uint8(RFBClientMessageType_PassThrough);
     msg.write_string(protocol_id);
@@ -546,9 +888,9 @@ RfbtvMessage RfbtvProtocol::create_passthrough(const std::string &protocol_id, c
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_session_update(const std::map<std::string, std::string> &changed_params)
+RfbtvMessage &RfbtvProtocol::create_session_update(RfbtvMessage &msg/*out*/, const std::map<std::string, std::string> &changed_params)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // Not supported in RFB-TV 1.3, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -562,7 +904,7 @@ RfbtvMessage RfbtvProtocol::create_session_update(const std::map<std::string, st
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_handoff_result(IHandoffHandler::HandoffResult result, const std::string &player_specific_error)
+RfbtvMessage &RfbtvProtocol::create_handoff_result(RfbtvMessage &msg/*out*/, IHandoffHandler::HandoffResult result, const std::string &player_specific_error)
 {
     static const std::map<IHandoffHandler::HandoffResult, uint8_t> s_handoff_result_map = create_map<IHandoffHandler::HandoffResult, uint8_t>
         (IHandoffHandler::HANDOFF_UNSUPPORTED_URI, 22)
@@ -585,7 +927,7 @@ RfbtvMessage RfbtvProtocol::create_handoff_result(IHandoffHandler::HandoffResult
         code = i->second;
     }
 
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // Not supported in RFB-TV 1.3, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -600,9 +942,9 @@ RfbtvMessage RfbtvProtocol::create_handoff_result(IHandoffHandler::HandoffResult
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_key_time_event(X11KeyCode key, KeyAction key_action, const std::string &timestamp)
+RfbtvMessage &RfbtvProtocol::create_key_time_event(RfbtvMessage &msg/*out*/, X11KeyCode key, KeyAction key_action, const std::string &timestamp)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // Not supported in RFB-TV 1.3, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -618,9 +960,9 @@ RfbtvMessage RfbtvProtocol::create_key_time_event(X11KeyCode key, KeyAction key_
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_cdm_setup_response(const std::string &cdm_session_id, CdmSessionSetupResponseResult result, const std::map<std::string, std::string> &response_fields)
+RfbtvMessage &RfbtvProtocol::create_cdm_setup_response(RfbtvMessage &msg/*out*/, const std::string &cdm_session_id, CdmSessionSetupResponseResult result, const std::map<std::string, std::string> &response_fields)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // Not supported in RFB-TV 1.3, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -636,9 +978,9 @@ RfbtvMessage RfbtvProtocol::create_cdm_setup_response(const std::string &cdm_ses
     return msg;
 }
 
-RfbtvMessage RfbtvProtocol::create_cdm_terminate_indication(const std::string &cdm_session_id, CdmSessionTerminateResponseReason reason, const std::map<std::string, std::string> &data)
+RfbtvMessage &RfbtvProtocol::create_cdm_terminate_indication(RfbtvMessage &msg/*out*/, const std::string &cdm_session_id, CdmSessionTerminateResponseReason reason, const std::map<std::string, std::string> &data)
 {
-    RfbtvMessage msg;
+    msg.clear();
 
     if (m_protocol_version == RFBTV_PROTOCOL_V1_3) {
         // Not supported in RFB-TV 1.3, so if we ever want to send it, we'll return an empty message that won't disrupt the protocol
@@ -719,13 +1061,13 @@ ResultCode RfbtvProtocol::parse_message(RfbtvMessage &message)
 
     CTVC_LOG_DEBUG("Received message type %d", message_type);
 
-    std::map<uint8_t, MessageHandler>::iterator i = m_message_map.find(message_type);
-    if (i == m_message_map.end()) {
+    MessageHandler handler = m_message_handlers[message_type];
+    if (!handler) {
         CTVC_LOG_ERROR("Stream parse error, unknown message type %d", message_type);
         return PARSING_MESSAGE;
     }
 
-    return (this->*i->second)(message);
+    return (this->*handler)(message);
 }
 
 ResultCode RfbtvProtocol::rect_read(RfbtvMessage &rx_message, PictureParameters &rect)
@@ -744,13 +1086,15 @@ ResultCode RfbtvProtocol::rect_read(RfbtvMessage &rx_message, PictureParameters
     switch (encoding_type) {
     case RFB_ENCODING_PICTURE_OBJECT:
         rect.alpha = rx_message.read_uint8();
-        rect.m_data = rx_message.read_blob();
+        rx_message.read_blob(rect.m_data);
+        rect.m_url.clear();
         CTVC_LOG_DEBUG("Read data for picture object encoded rectangle at (%d, %d) %d x %d", rect.x, rect.y, rect.w, rect.h);
         break;
 
     case RFB_ENCODING_URL: {
         rect.alpha = rx_message.read_uint8();
-        rect.m_url = rx_message.read_string();
+        rx_message.read_string(rect.m_url);
+        rect.m_data.clear();
         CTVC_LOG_DEBUG("Read data for URL encoded rectangle at (%d, %d) %d x %d", rect.x, rect.y, rect.w, rect.h);
         break;
     }
@@ -790,17 +1134,18 @@ ResultCode RfbtvProtocol::parse_frame_buffer_update(RfbtvMessage &rx_message)
         return NEED_MORE_DATA;
     }
 
-    std::vector<PictureParameters> rectangles(nr_of_rects);
+    // The rectangles of earlier updates are overwritten, so their buffers are reused
+    m_rectangles.resize(nr_of_rects);
 
     // First try to read all rectangle data, which may be a lot and even incomplete in this call.
     for (int i = 0; i < nr_of_rects; i++) {
-        ResultCode ret = rect_read(rx_message, rectangles[i]);
+        ResultCode ret = rect_read(rx_message, m_rectangles[i]);
         if (ret.is_error()) {
             return ret;
         }
     }
 
-    return m_callbacks.frame_buffer_update(rectangles, (bitmap & RFB_RECT_CLEAR_BIT) != 0, (bitmap & RFB_RECT_FLIP_BIT) != 0);
+    return m_callbacks.frame_buffer_update(m_rectangles, (bitmap & RFB_RECT_CLEAR_BIT) != 0, (bitmap & RFB_RECT_FLIP_BIT) != 0);
 }
 
 ResultCode RfbtvProtocol::parse_stream_setup_request(RfbtvMessage &rx_message)
@@ -953,8 +1298,10 @@ ResultCode RfbtvProtocol::parse_server_command(RfbtvMessage &rx_message)
     CTVC_LOG_DEBUG("");
 
     // Read command and key-value list
-    std::string command = rx_message.read_string();
-    std::map<std::string, std::string> key_value_pairs = rx_message.read_key_value_pairs();
+    const std::string &command(m_command);
+    const std::map<std::string, std::string> &key_value_pairs(m_key_value_pairs);
+    rx_message.read_string(m_command);
+    rx_message.read_key_value_pairs(m_key_value_pairs);
 
     // Early return in case of underflow
     if (rx_message.has_data_underflow()) {
@@ -963,13 +1310,15 @@ ResultCode RfbtvProtocol::parse_server_command(RfbtvMessage &rx_message)
 
     // Handle the command if possible. If we can't handle the command that's no fatal error.
     if (command == "keyfilter_control") {
-        std::string local_keys = get_map_value(key_value_pairs, "localkeys");
-        std::string remote_keys = get_map_value(key_value_pairs, "remotekeys");
+        const std::string &local_keys = get_map_value(key_value_pairs, "localkeys");
+        const std::string &remote_keys = get_map_value(key_value_pairs, "remotekeys");
 
         return m_callbacks.server_command_keyfilter_control(local_keys, remote_keys);
     } else if (command == "playback_control") {
-        std::string report_mode = get_map_value(key_value_pairs, "report_mode");
-        std::string interval = get_map_value(key_value_pairs, "interval");
+        update_report_encoding(key_value_pairs, m_is_playback_report_compact);
+
+        const std::string &report_mode = get_map_value(key_value_pairs, "report_mode");
+        const std::string &interval = get_map_value(key_value_pairs, "interval");
 
         uint32_t interval_in_ms = 0; // Disabled/not present by default
         if (!interval.empty()) {
@@ -989,8 +1338,10 @@ ResultCode RfbtvProtocol::parse_server_command(RfbtvMessage &rx_message)
 
         return m_callbacks.server_command_playback_control(mode, interval_in_ms);
     } else if (command == "latency_control") {
-        std::string report_mode = get_map_value(key_value_pairs, "report_mode");
-        std::string measurement_mode = get_map_value(key_value_pairs, "measurement_mode");
+        update_report_encoding(key_value_pairs, m_is_latency_report_compact);
+
+        const std::string &report_mode = get_map_value(key_value_pairs, "report_mode");
+        const std::string &measurement_mode = get_map_value(key_value_pairs, "measurement_mode");
 
         ICallbacks::ReportMode mode = ICallbacks::REPORT_NOCHANGE;
         if (report_mode == "oneshot") {
@@ -1015,8 +1366,10 @@ ResultCode RfbtvProtocol::parse_server_command(RfbtvMessage &rx_message)
 
         return m_callbacks.server_command_latency_control(mode, is_duration, is_event);
     } else if (command == "log_control") {
-        std::string report_mode = get_map_value(key_value_pairs, "report_mode");
-        std::string log_level = get_map_value(key_value_pairs, "log_level");
+        update_report_encoding(key_value_pairs, m_is_log_report_compact);
+
+        const std::string &report_mode = get_map_value(key_value_pairs, "report_mode");
+        const std::string &log_level = get_map_value(key_value_pairs, "log_level");
         // std::string scope = get_map_value(key_value_pairs, "scope"); // Scope field is ignored currently
 
         LogMessageType min_log_level = static_cast<LogMessageType>(-1); // No change
@@ -1047,7 +1400,7 @@ ResultCode RfbtvProtocol::parse_server_command(RfbtvMessage &rx_message)
 
         return m_callbacks.server_command_log_control(mode, min_log_level);
     } else if (command == "video_control") {
-        std::string mode = get_map_value(key_value_pairs, "mode");
+        const std::string &mode = get_map_value(key_value_pairs, "mode");
         ICallbacks::VideoMode video_mode = ICallbacks::MODE_NOCHANGE;
         if (mode == "gui-optimized") {
             video_mode = ICallbacks::MODE_GUI_OPTIMIZED;
@@ -1086,15 +1439,15 @@ ResultCode RfbtvProtocol::parse_passthrough(RfbtvMessage &rx_message)
 {
     CTVC_LOG_DEBUG("");
 
-    std::string protocol_id = rx_message.read_string();
-    std::vector<uint8_t> protocol_data = rx_message.read_blob();
+    rx_message.read_string(m_protocol_id);
+    rx_message.read_blob(m_protocol_data);
 
     // Early return in case of underflow
     if (rx_message.has_data_underflow()) {
         return NEED_MORE_DATA;
     }
 
-    return m_callbacks.passthrough(protocol_id, protocol_data);
+    return m_callbacks.passthrough(m_protocol_id, m_protocol_data);
 }
 
 ResultCode RfbtvProtocol::parse_cdm_setup_request(RfbtvMessage &rx_message)
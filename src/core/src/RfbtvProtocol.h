@@ -14,6 +14,7 @@
 #include "RfbtvMessage.h"
 
 #include <core/IHandoffHandler.h>
+#include <core/IOverlayCallbacks.h>
 
 #include <porting_layer/ResultCode.h>
 #include <porting_layer/X11KeyMap.h>
@@ -28,8 +29,8 @@ namespace ctvc {
 class PlaybackReport;
 class LatencyReport;
 class LogReport;
-struct PictureParameters;
 class Histogram;
+class KeyValueWriter;
 
 class RfbtvProtocol
 {
@@ -123,18 +124,21 @@ public:
 
     //
     // Methods to create an RFB-TV message
+    // The message is cleared and written into msg, which keeps its capacity, so a caller that
+    // reuses the same message for every message it sends does not allocate per message.
+    // A reference to msg is returned so the result can be passed on directly.
     //
-    RfbtvMessage create_set_encodings(bool is_url_encoding_supported);
+    RfbtvMessage &create_set_encodings(RfbtvMessage &msg/*out*/, bool is_url_encoding_supported);
 
-    RfbtvMessage create_frame_buffer_update_request(uint16_t screen_width, uint16_t screen_height);
+    RfbtvMessage &create_frame_buffer_update_request(RfbtvMessage &msg/*out*/, uint16_t screen_width, uint16_t screen_height);
 
     enum KeyAction
     {
         KEY_UP = 0, KEY_DOWN = 1, KEYINPUT = 2
     };
-    RfbtvMessage create_key_event(X11KeyCode key, KeyAction key_action);
+    RfbtvMessage &create_key_event(RfbtvMessage &msg/*out*/, X11KeyCode key, KeyAction key_action);
 
-    RfbtvMessage create_pointer_event(int button_mask, int x, int y);
+    RfbtvMessage &create_pointer_event(RfbtvMessage &msg/*out*/, int button_mask, int x, int y);
 
     enum SessionTerminateReason
     {
@@ -143,15 +147,21 @@ public:
         SESSION_TERMINATE_HANDOFF = 2,
         SESSION_TERMINATE_CLIENT_EXECUTION_ERROR = 3
     };
-    RfbtvMessage create_session_terminate_indication(SessionTerminateReason reason);
+    RfbtvMessage &create_session_terminate_indication(RfbtvMessage &msg/*out*/, SessionTerminateReason reason);
 
-    RfbtvMessage create_playback_client_report(const PlaybackReport &playback_report);
+    RfbtvMessage &create_playback_client_report(RfbtvMessage &msg/*out*/, const PlaybackReport &playback_report);
 
-    RfbtvMessage create_latency_client_report(const LatencyReport &latency_report);
+    RfbtvMessage &create_latency_client_report(RfbtvMessage &msg/*out*/, const LatencyReport &latency_report);
 
-    RfbtvMessage create_log_client_report(const LogReport &log_report);
+    RfbtvMessage &create_log_client_report(RfbtvMessage &msg/*out*/, const LogReport &log_report);
 
-    RfbtvMessage create_session_setup(const std::string &client_id, const std::map<std::string, std::string> &param_list, const std::string &session_id, const std::string &cookie);
+    // Compact reports add strings to the report dictionary as they are created. Call this once the
+    // reports have been sent, or discard_report_dictionary_updates() if they could not be sent, so
+    // the dictionary stays the same as that of the server.
+    void commit_report_dictionary_updates();
+    void discard_report_dictionary_updates();
+
+    RfbtvMessage &create_session_setup(RfbtvMessage &msg/*out*/, const std::string &client_id, const std::map<std::string, std::string> &param_list, const std::string &session_id, const std::string &cookie);
 
     enum StreamSetupResponseCode
     {
@@ -162,7 +172,7 @@ public:
         STREAM_SETUP_CONNECTION_FAILED, /*!< Connection to remote-host could not be established, RFB-TV 2.0.*/
         STREAM_SETUP_UNSPECIFIED_ERROR /*!< Unspecified error (if no one applies), RFB-TV 2.0.*/
     };
-    RfbtvMessage create_stream_setup_response(StreamSetupResponseCode result, const std::map<std::string, std::string> &parameters, const std::string &local_udp_url);
+    RfbtvMessage &create_stream_setup_response(RfbtvMessage &msg/*out*/, StreamSetupResponseCode result, const std::map<std::string, std::string> &parameters, const std::string &local_udp_url);
 
     enum StreamConfirmCode
     {
@@ -175,20 +185,20 @@ public:
         STREAM_CONFIRM_PHYSICAL_ERROR, /*!< Unrecoverable error at the physical layer.*/
         STREAM_CONFIRM_UNSPECIFIED_ERROR /*!< Unspecified error (if no other applies).*/
     };
-    RfbtvMessage create_stream_confirm(StreamConfirmCode result);
+    RfbtvMessage &create_stream_confirm(RfbtvMessage &msg/*out*/, StreamConfirmCode result);
 
-    RfbtvMessage create_pong();
+    RfbtvMessage &create_pong(RfbtvMessage &msg/*out*/);
 
-    // TODO (CNP-1987): RfbtvMessage create_input_event();
+    // TODO (CNP-1987): RfbtvMessage &create_input_event(RfbtvMessage &msg/*out*/);
 
-    RfbtvMessage create_passthrough(const std::string &protocol_id, const std::vector<uint8_t> &data);
+    RfbtvMessage &create_passthrough(RfbtvMessage &msg/*out*/, const std::string &protocol_id, const std::vector<uint8_t> &data);
 
     // New messages in RFB-TV 2.0
-    RfbtvMessage create_session_update(const std::map<std::string, std::string> &changed_params);
+    RfbtvMessage &create_session_update(RfbtvMessage &msg/*out*/, const std::map<std::string, std::string> &changed_params);
 
-    RfbtvMessage create_handoff_result(IHandoffHandler::HandoffResult result, const std::string &player_specific_error);
+    RfbtvMessage &create_handoff_result(RfbtvMessage &msg/*out*/, IHandoffHandler::HandoffResult result, const std::string &player_specific_error);
 
-    RfbtvMessage create_key_time_event(X11KeyCode key, KeyAction key_action, const std::string &timestamp);
+    RfbtvMessage &create_key_time_event(RfbtvMessage &msg/*out*/, X11KeyCode key, KeyAction key_action, const std::string &timestamp);
 
     enum CdmSessionSetupResponseResult // (All RFB-TV 2.0.)
     {
@@ -199,7 +209,7 @@ public:
         CDM_SESSION_SETUP_RESPONSE_RESULT_NO_LICENSE_SERVER = 68, /*!< No license server location */
         CDM_SESSION_SETUP_RESPONSE_RESULT_UNSPECIFIED_ERROR = 255 /*!< Unspecified error */
     };
-    RfbtvMessage create_cdm_setup_response(const std::string &cdm_session_id, CdmSessionSetupResponseResult result, const std::map<std::string, std::string> &response_fields);
+    RfbtvMessage &create_cdm_setup_response(RfbtvMessage &msg/*out*/, const std::string &cdm_session_id, CdmSessionSetupResponseResult result, const std::map<std::string, std::string> &response_fields);
 
     enum CdmSessionTerminateResponseReason // (All RFB-TV 2.0.)
     {
@@ -210,7 +220,7 @@ public:
         CDM_SESSION_TERMINATE_RESPONSE_REASON_LICENSE_EXPIRED = 4, /*!< License expired */
         CDM_SESSION_TERMINATE_RESPONSE_REASON_UNKNOWN_SESSION = 5 /*!< Unknown session */
     };
-    RfbtvMessage create_cdm_terminate_indication(const std::string &cdm_session_id, CdmSessionTerminateResponseReason reason, const std::map<std::string, std::string> &data);
+    RfbtvMessage &create_cdm_terminate_indication(RfbtvMessage &msg/*out*/, const std::string &cdm_session_id, CdmSessionTerminateResponseReason reason, const std::map<std::string, std::string> &data);
 
     //
     // Methods to parse an RFB-TV message
@@ -225,10 +235,34 @@ private:
 
     // Message handling
     typedef ResultCode (RfbtvProtocol::*MessageHandler)(RfbtvMessage &message);
-    std::map<uint8_t, MessageHandler> m_message_map;
+    static const uint32_t N_MESSAGE_TYPES = 256;
+    MessageHandler m_message_handlers[N_MESSAGE_TYPES]; // Indexed by message type; 0 if unknown in the current protocol version
+
+    // Scratch objects of the message handlers, which keep their capacity from message to message
+    std::vector<PictureParameters> m_rectangles;
+    std::string m_protocol_id;
+    std::vector<uint8_t> m_protocol_data;
+    std::string m_command;
+    std::map<std::string, std::string> m_key_value_pairs;
+
+    // Compact client reports, which the server enables per report type in its report control
+    // commands. Strings that recur in every report are sent once and referred to by their index
+    // in a dictionary that lasts for the connection.
+    bool m_is_playback_report_compact;
+    bool m_is_latency_report_compact;
+    bool m_is_log_report_compact;
+    std::map<std::string, uint32_t> m_report_dictionary;
+    std::vector<std::string> m_uncommitted_dictionary_strings; // Added by reports that have not been sent yet
 
     ResultCode rect_read(RfbtvMessage &rx_message, PictureParameters &rect);
-    static void append_histogram(std::string &out, const std::string &name, const Histogram &histogram); // Helper method
+    static void write_histogram(KeyValueWriter &writer, const char *name, const Histogram &histogram); // Helper method
+    static void write_percentiles(KeyValueWriter &writer, const Histogram &histogram); // Helper method
+    void write_compact_playback_report(RfbtvMessage &msg, const PlaybackReport &playback_report);
+    void write_compact_latency_report(RfbtvMessage &msg, const LatencyReport &latency_report);
+    void write_compact_log_report(RfbtvMessage &msg, const LogReport &log_report);
+    void write_dictionary_string(RfbtvMessage &msg, const std::string &str);
+    static void write_compact_histogram(RfbtvMessage &msg, const Histogram &histogram);
+    static void write_compact_percentiles(RfbtvMessage &msg, const Histogram &histogram);
 
     // RFB-TV message handlers
     ResultCode parse_frame_buffer_update(RfbtvMessage &rx_message);
@@ -0,0 +1,279 @@
+///
+/// \file SessionEngine.cpp
+///
+/// \brief Threads that run the timers, handle the events and receive the data of sessions.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "SessionEngine.h"
+#include "IEvent.h"
+
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Log.h>
+
+#include <algorithm>
+
+#include <assert.h>
+
+using namespace ctvc;
+
+const uint32_t SessionEngine::MAX_EVENTS_PER_TURN;
+
+SessionEngine *SessionEngine::s_shared_engine = 0;
+uint32_t SessionEngine::s_n_shared_event_threads = 0;
+
+// Protects the shared engine and the number of sessions of every engine
+static Mutex &get_engines_mutex()
+{
+    static Mutex s_mutex;
+
+    return s_mutex;
+}
+
+SessionEngine &SessionEngine::acquire()
+{
+    AutoLock lck(get_engines_mutex());
+
+    SessionEngine *engine = s_shared_engine;
+    if (!engine) {
+        if (s_n_shared_event_threads > 0) {
+            s_shared_engine = new SessionEngine(s_n_shared_event_threads, true);
+            engine = s_shared_engine;
+        } else {
+            engine = new SessionEngine(1, false);
+        }
+    }
+    engine->m_n_sessions++;
+
+    return *engine;
+}
+
+void SessionEngine::set_shared_event_threads(uint32_t n_event_threads)
+{
+    AutoLock lck(get_engines_mutex());
+
+    if (n_event_threads == s_n_shared_event_threads) {
+        return;
+    }
+    s_n_shared_event_threads = n_event_threads;
+
+    // Sessions that share the current engine keep it until they are destroyed
+    if (s_shared_engine) {
+        if (s_shared_engine->m_n_sessions == 0) {
+            delete s_shared_engine;
+        }
+        s_shared_engine = 0;
+    }
+}
+
+void SessionEngine::release()
+{
+    AutoLock lck(get_engines_mutex());
+
+    assert(m_n_sessions > 0);
+    m_n_sessions--;
+
+    // The shared engine is kept for the next sessions, to not create its threads again
+    if (m_n_sessions == 0 && this != s_shared_engine) {
+        delete this;
+    }
+}
+
+SessionEngine::SessionEngine(uint32_t n_event_threads, bool is_shared) :
+    m_timer(is_shared ? "Shared session and stream timer" : "Session and stream timer"),
+    m_reactor(is_shared ? new SocketReactor("Shared session receiver") : 0),
+    m_n_sessions(0),
+    m_is_stopping(false)
+{
+    for (uint32_t i = 0; i < n_event_threads; i++) {
+        m_threads.push_back(new Thread(is_shared ? "Shared session event handler" : "Session event handler"));
+    }
+}
+
+SessionEngine::~SessionEngine()
+{
+    {
+        AutoLock lck(m_mutex);
+
+        m_is_stopping = true;
+    }
+
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        m_wake_up.post();
+    }
+
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        ResultCode ret = m_threads[i]->stop_and_wait_until_stopped();
+        if (ret.is_error()) {
+            CTVC_LOG_ERROR("wait_until_stopped() failed:%s", ret.get_description());
+        }
+        delete m_threads[i];
+    }
+
+    m_timer.stop();
+
+    // Every session has closed its connection before it releases the engine
+    delete m_reactor;
+
+    // Every session detaches its queue before it releases the engine
+    assert(m_strands.empty());
+}
+
+void SessionEngine::start()
+{
+    AutoLock lck(m_mutex);
+
+    ResultCode ret = m_timer.start(Thread::PRIO_HIGHEST);
+    if (ret.is_error() && ret != TimerEngine::ALREADY_STARTED) {
+        CTVC_LOG_ERROR("m_timer.start() failed:%s", ret.get_description());
+    }
+
+    for (size_t i = 0; i < m_threads.size(); i++) {
+        if (!m_threads[i]->is_running()) {
+            ret = m_threads[i]->start(*this, Thread::PRIO_HIGH);
+            if (ret.is_error()) {
+                CTVC_LOG_ERROR("start() of event thread %u failed:%s", static_cast<uint32_t>(i), ret.get_description());
+            }
+        }
+    }
+}
+
+void SessionEngine::attach(EventQueue &queue)
+{
+    Strand *strand = 0;
+    {
+        AutoLock lck(m_mutex);
+
+        for (size_t i = 0; i < m_strands.size(); i++) {
+            if (&m_strands[i]->queue == &queue) {
+                return;
+            }
+        }
+        strand = new Strand(*this, queue);
+        m_strands.push_back(strand);
+    }
+
+    queue.set_listener(strand);
+
+    // Handle the events that were put in the queue before
+    strand->event_available();
+}
+
+void SessionEngine::detach(EventQueue &queue)
+{
+    queue.set_listener(0);
+
+    AutoLock lck(m_mutex);
+
+    std::vector<Strand *>::iterator i = m_strands.begin();
+    while (i != m_strands.end() && &(*i)->queue != &queue) {
+        ++i;
+    }
+    if (i == m_strands.end()) {
+        return;
+    }
+    Strand *strand = *i;
+    m_strands.erase(i);
+
+    if (strand->is_ready) {
+        m_ready_strands.erase(std::find(m_ready_strands.begin(), m_ready_strands.end(), strand));
+    }
+
+    strand->is_detached = true;
+    if (strand->handler == Thread::self()) {
+        // Called from one of its own events
+        strand->is_detached_by_handler = true;
+        return;
+    }
+
+    if (strand->handler) {
+        Semaphore handled;
+        strand->handled = &handled;
+        m_mutex.unlock();
+        handled.wait();
+        m_mutex.lock();
+    }
+    delete strand;
+}
+
+bool SessionEngine::run()
+{
+    m_wake_up.wait();
+
+    Strand *strand = 0;
+    {
+        AutoLock lck(m_mutex);
+
+        if (m_is_stopping) {
+            return true; // Exit thread
+        }
+        if (m_ready_strands.empty()) {
+            return false; // The strand was detached before it was handled
+        }
+
+        strand = m_ready_strands.front();
+        m_ready_strands.pop_front();
+        strand->is_ready = false;
+        strand->handler = Thread::self();
+        strand->has_new_events = false;
+    }
+
+    // Handle a limited number of events, so a busy session doesn't hold up the others
+    bool is_empty = false;
+    for (uint32_t n = 0; n < MAX_EVENTS_PER_TURN && !strand->is_detached; n++) {
+        const IEvent *event = strand->queue.try_get();
+        if (!event) {
+            is_empty = true;
+            break;
+        }
+
+        event->handle();
+        delete event;
+    }
+
+    AutoLock lck(m_mutex);
+
+    strand->handler = 0;
+    if (strand->is_detached_by_handler) {
+        delete strand;
+    } else if (strand->handled) {
+        strand->handled->post(); // The detaching thread deletes it
+    } else if (!strand->is_detached && (!is_empty || strand->has_new_events)) {
+        strand->is_ready = true;
+        m_ready_strands.push_back(strand);
+        m_wake_up.post();
+    }
+
+    return false;
+}
+
+SessionEngine::Strand::Strand(SessionEngine &engine, EventQueue &queue) :
+    engine(engine),
+    queue(queue),
+    is_ready(false),
+    handler(0),
+    has_new_events(false),
+    is_detached(false),
+    is_detached_by_handler(false),
+    handled(0)
+{
+}
+
+void SessionEngine::Strand::event_available()
+{
+    // The lock of the queue is held here
+
+    AutoLock lck(engine.m_mutex);
+
+    if (handler) {
+        has_new_events = true;
+    } else if (!is_ready) {
+        is_ready = true;
+        engine.m_ready_strands.push_back(this);
+        engine.m_wake_up.post();
+    }
+}
@@ -0,0 +1,115 @@
+///
+/// \file SessionEngine.h
+///
+/// \brief Threads that run the timers, handle the events and receive the data of sessions.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include "EventQueue.h"
+#include "SocketReactor.h"
+
+#include <porting_layer/Atomic.h>
+#include <porting_layer/Mutex.h>
+#include <porting_layer/Semaphore.h>
+#include <porting_layer/Thread.h>
+#include <utils/TimerEngine.h>
+
+#include <deque>
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+// By default, every session has an engine of its own with a single event thread. Once shared event threads
+// are configured, the sessions that are constructed from then on share one engine, so that a process can
+// run many sessions on a few threads.
+//
+// The events of a queue that is attached to an engine are handled in the order in which they were put in
+// the queue, and never by two threads at the same time.
+//
+// A shared engine also has a socket reactor, which receives the data of the connections of its sessions
+// on a single thread.
+class SessionEngine : public Thread::IRunnable
+{
+public:
+    // Get the engine for a new session, which must be released when the session is destroyed
+    static SessionEngine &acquire();
+
+    // Let the sessions that are constructed from now on share an engine with the given number of event
+    // threads, or give each of them an engine of its own if 0
+    static void set_shared_event_threads(uint32_t n_event_threads);
+
+    void release();
+
+    TimerEngine &get_timer()
+    {
+        return m_timer;
+    }
+
+    // The reactor of a shared engine, or 0 if the sessions receive on threads of their own
+    SocketReactor *get_reactor()
+    {
+        return m_reactor;
+    }
+
+    // Start the threads, if they are not running yet
+    void start();
+
+    // Handle the events of the queue on the event threads. Does nothing if the queue is already attached.
+    void attach(EventQueue &queue);
+
+    // Stop handling the events of the queue. If another thread is handling an event of the queue, this
+    // waits until it is done. Events that are left in the queue are not handled.
+    void detach(EventQueue &queue);
+
+private:
+    SessionEngine(uint32_t n_event_threads, bool is_shared);
+    ~SessionEngine();
+    SessionEngine(const SessionEngine &);
+    SessionEngine &operator=(const SessionEngine &);
+
+    // An attached queue
+    struct Strand : public EventQueue::IListener
+    {
+        Strand(SessionEngine &engine, EventQueue &queue);
+
+        // Implements EventQueue::IListener
+        void event_available();
+
+        SessionEngine &engine;
+        EventQueue &queue;
+        bool is_ready;           // In m_ready_strands
+        Thread *handler;         // Thread that is handling its events, if any
+        bool has_new_events;     // Events were put while its events were being handled
+        Atomic<bool> is_detached;
+        bool is_detached_by_handler; // Then the handler deletes it
+        Semaphore *handled;      // Posted by the handler when it is done, if another thread detaches it
+    };
+
+    static const uint32_t MAX_EVENTS_PER_TURN = 16; // Before the events of other queues are handled
+
+    static SessionEngine *s_shared_engine;
+    static uint32_t s_n_shared_event_threads;
+
+    Mutex m_mutex;
+    Semaphore m_wake_up; // Posted for every strand that becomes ready, and for every thread when stopping
+    TimerEngine m_timer;
+    SocketReactor *m_reactor;
+    std::vector<Thread *> m_threads;
+    std::vector<Strand *> m_strands;
+    std::deque<Strand *> m_ready_strands;
+    uint32_t m_n_sessions; // Sessions that have acquired the engine and not released it yet
+    bool m_is_stopping;
+
+    // Implements Thread::IRunnable
+    bool run();
+};
+
+} // namespace
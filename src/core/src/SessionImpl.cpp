@@ -36,6 +36,14 @@ using namespace ctvc;
 
 static const unsigned int STREAMER_TRIGGER_PERIOD_IN_MS = 10; // Trigger period for the timer, interval to kick the Streamer/RPlayer/RAMS real-time clock
 static const unsigned int REPORT_TRIGGER_PERIOD_IN_MS = 100; // Trigger period for the timer, interval to kick the report manager(s)
+static const uint32_t OVERLAY_PICTURE_DEADLINE_IN_MS = 2000; // Pictures of a framebuffer update that take longer to load are left out
+static const uint32_t OVERLAY_POLL_INTERVAL_IN_MS = 10; // While waiting for one picture, interval to check whether others have been loaded
+static const uint32_t TX_MESSAGE_CAPACITY = 4096; // Initial capacity of the reused outgoing messages; they grow if needed
+static const uint32_t OUTSTANDING_KEY_TIMEOUT_IN_MS = 1000; // Time after which a sent key press no longer counts as outstanding if it was not displayed
+static const uint32_t MAX_OUTSTANDING_KEYS = 32; // Number of sent key presses that are tracked until they are displayed
+static const uint32_t DEFAULT_RECONNECT_MIN_BACKOFF_IN_MS = 500; // Longest delay before the first attempt to reconnect
+static const uint32_t DEFAULT_RECONNECT_MAX_BACKOFF_IN_MS = 60000; // Longest delay between attempts to reconnect
+static const uint32_t DEFAULT_RECONNECT_MAX_ATTEMPTS = 8; // Failed attempts to reconnect after which the session is closed
 
 const ResultCode Session::Impl::CONNECTION_TIMEOUT("A timeout occurred while trying to open the connection");
 const ResultCode Session::Impl::INVALID_STATE("The function cannot be called in the current state");
@@ -64,6 +72,25 @@ static const uint8_t RFBTV_MOUSE_BUTTON_RIGHT = 4;
 static const uint8_t RFBTV_MOUSE_WHEEL_UP = 8;
 static const uint8_t RFBTV_MOUSE_WHEEL_DOWN = 16;
 
+// Start looking up the host of the session URL, so a connect that follows a back-off does not wait for it
+static void prefetch_session_host(const std::string &session_url)
+{
+    std::string proto;
+    std::string authorization;
+    std::string server;
+    int port;
+    std::string path;
+    url_split(session_url, proto, authorization, server, port, path);
+
+    Socket::prefetch_host(server.c_str());
+}
+
+// Returns true for the actions that are repeated when a key is held or pressed in quick succession
+static bool is_key_press(IInput::Action action)
+{
+    return action == IInput::ACTION_DOWN || action == IInput::ACTION_DOWN_AND_UP;
+}
+
 // Construct a session object instance
 Session::Session(ClientContext &context, ISessionCallbacks *session_callbacks, IOverlayCallbacks *overlay_callbacks) :
     m_impl(*new Session::Impl(context, session_callbacks, overlay_callbacks))
@@ -145,57 +172,98 @@ bool Session::unregister_handoff_handler(const std::string &handoff_scheme)
     return m_impl.unregister_handoff_handler(handoff_scheme);
 }
 
+void Session::set_report_coalescing_window(uint32_t window_in_ms)
+{
+    m_impl.set_report_coalescing_window(window_in_ms);
+}
+
+void Session::set_reconnect_backoff(uint32_t min_backoff_in_ms, uint32_t max_backoff_in_ms, uint32_t max_attempts)
+{
+    m_impl.set_reconnect_backoff(min_backoff_in_ms, max_backoff_in_ms, max_attempts);
+}
+
+void Session::set_key_repeat_policy(KeyRepeatPolicy policy, uint32_t max_outstanding_keys)
+{
+    m_impl.set_key_repeat_policy(policy, max_outstanding_keys);
+}
+
+void Session::set_shared_event_threads(uint32_t n_event_threads)
+{
+    SessionEngine::set_shared_event_threads(n_event_threads);
+}
+
 /* ***************************** IMPLEMENTATION ***************************** */
 
 Session::Impl::Impl(ClientContext &context, ISessionCallbacks *session_callbacks, IOverlayCallbacks *overlay_callbacks) :
     m_context(context),
     m_session_callbacks(session_callbacks),
     m_overlay_callbacks(overlay_callbacks),
+    m_last_protocol_extension(m_protocol_extensions.end()),
     m_default_handler(NULL),
-    m_timer("Session and stream timer"),
+    m_engine(SessionEngine::acquire()),
+    m_timer(m_engine.get_timer()),
     m_content_loader(0),
     m_overlay_handler(*this, overlay_callbacks),
     m_playback_report_manager(m_playback_report, *this),
     m_playback_report_periodic_trigger(*this, &Session::Impl::playback_report_periodic_trigger, 0),
     m_latency_report_manager(m_latency_report, *this),
     m_log_report_manager(m_log_report, *this),
+    m_report_coalescing_window_in_ms(0),
+    m_report_coalescing_trigger(*this, &Session::Impl::report_coalescing_window_expired, 0),
     m_prev_log_output(0),
     m_is_logging(false),
     m_screen_width(0),
     m_screen_height(0),
+    m_reconnect_min_backoff_in_ms(DEFAULT_RECONNECT_MIN_BACKOFF_IN_MS),
+    m_reconnect_max_backoff_in_ms(DEFAULT_RECONNECT_MAX_BACKOFF_IN_MS),
+    m_reconnect_max_attempts(DEFAULT_RECONNECT_MAX_ATTEMPTS),
     m_rfbtv_button_mask(0),
     m_redirect_count(0),
     m_rfbtv_state(INIT),
     m_state(STATE_DISCONNECTED),
     m_closing_suspended(false),
     m_connect_attempts(0),
+    m_has_been_active(false),
     m_connection("RFB-TV TCP connection"),
-    m_event_handling_thread("Session event handler"),
     m_rfbtv_protocol(*this),
+    m_is_batching_messages(false),
+    m_key_repeat_policy(KEY_REPEAT_SEND_ALL),
+    m_max_outstanding_keys(0),
+    m_last_key_id(0),
     m_connection_backoff_time_callback(*this, &Session::Impl::connection_backoff_time_expired, 0),
     m_stream_error_callback(*this, &Session::Impl::stream_timeout_expired, 0),
     m_streamer_periodic_trigger(m_streamer, &Streamer::trigger, 0),
     m_stream_confirm_sent_state(STREAM_CONFIRM_NOT_SENT)
 {
+    m_connection.set_reactor(m_engine.get_reactor());
     m_streamer.register_latency_data_callback(this);
     m_streamer.register_stall_event_callback(this);
     m_streamer.register_media_player_callback(this);
     register_protocol_extension(m_echo_protocol);
+
+    m_tx_message.reserve(TX_MESSAGE_CAPACITY);
+    m_report_message.reserve(TX_MESSAGE_CAPACITY);
 }
 
 Session::Impl::~Impl()
 {
     CLOUDTV_LOG_DEBUG("test");
 
-    // Stop the timer before stopping the message handling to prevent further events to be posted in the event queue.
-    m_timer.stop();
-
     m_overlay_handler.stop();
 
-    // Stop the message handling thread so we don't process any further events from now on.
-    stop_message_handling_thread();
+    // Stop handling events so we don't process any further events from now on.
+    // Events that are still posted, e.g. by our timers, are deleted along with the event queue.
+    m_engine.detach(m_event_queue);
+
+    // Unregister our log report as log output if registered.
+    // (We may also register ourselves at construction time and save all registration hassle when ServerCommands are received.)
+    // This and the other callbacks below may update reports, which starts a timer, so they go before our timers are cancelled.
+    ClientContext::instance().unregister_log_output(*this);
+    m_streamer.register_media_player_callback(0);
+    m_streamer.register_stall_event_callback(0);
+    m_streamer.register_latency_data_callback(0);
 
-    // Close the connection after having stopped the message handling thread; it might still open a new connection otherwise.
+    // Close the connection after having stopped the event handling; it might still open a new connection otherwise.
     rfbtvpm_close_connection();
 
     unregister_protocol_extension(m_echo_protocol);
@@ -204,12 +272,17 @@ Session::Impl::~Impl()
         i->second->register_reply_path(0);
     }
     rfbtvpm_clean_active_cdm_sessions();
-    m_streamer.register_media_player_callback(0);
-    m_streamer.register_stall_event_callback(0);
-    m_streamer.register_latency_data_callback(0);
-    // Unregister our log report as log output if registered.
-    // (We may also register ourselves at construction time and save all registration hassle when ServerCommands are received.)
-    ClientContext::instance().unregister_log_output(*this);
+
+    // The timer engine may be shared with other sessions, so cancel our timers rather than stopping it.
+    // This is done last because event handlers and the callbacks above start timers.
+    m_timer.cancel_timer(m_playback_report_periodic_trigger);
+    m_timer.cancel_timer(m_report_coalescing_trigger);
+    m_timer.cancel_timer(m_connection_backoff_time_callback);
+    m_timer.cancel_timer(m_stream_error_callback);
+    m_timer.cancel_timer(m_streamer_periodic_trigger);
+    m_timer.wait_for_signaled_timers();
+
+    m_engine.release();
 }
 
 Session::State Session::Impl::get_state() const
@@ -221,9 +294,9 @@ Session::State Session::Impl::get_state() const
 void Session::Impl::initiate(const std::string &host, const std::string &url, uint32_t screen_width, uint32_t screen_height, const std::map<std::string, std::string> &optional_parameters)
 {
     //sw_log_info(TAG,"host:%s, url:%s, %dx%d", host.c_str(), url.c_str(), screen_width, screen_height);
-    start_message_handling_thread();
+    m_engine.start();
+    m_engine.attach(m_event_queue);
     m_overlay_handler.start(m_content_loader);
-    m_timer.start(Thread::PRIO_HIGHEST);
     m_event_queue.put(new InitiateEvent(*this, &Impl::handle_initiate_event, host, url, screen_width, screen_height, optional_parameters, TimeStamp::now()));
 }
 
@@ -271,7 +344,32 @@ void Session::Impl::send_keycode(int native_key, Action action, bool &client_mus
 
 	CLOUDTV_LOG_DEBUG("x11 Key:%x, action:%d\n", x11_key, action);
 
-    m_event_queue.put(new KeyEvent(*this, &Impl::handle_send_keycode_event, x11_key, action));
+    PendingKey key;
+    key.x11_key = x11_key;
+    key.action = action;
+    key.input_time = TimeStamp::now();
+
+    AutoLock lck(m_key_mutex);
+
+    if (m_key_repeat_policy == KEY_REPEAT_COALESCE && is_key_press(action)) {
+        // Another press of a key whose last press still waits to be sent adds nothing
+        for (std::vector<PendingKey>::reverse_iterator i = m_pending_keys.rbegin(); i != m_pending_keys.rend(); ++i) {
+            if (i->x11_key == x11_key) {
+                if (i->action == action) {
+                    CLOUDTV_LOG_DEBUG("Coalescing repeat of key 0x%x", x11_key);
+                    return;
+                }
+                break;
+            }
+        }
+    }
+
+    // The session thread sends all keys that are queued by the time it gets to them
+    bool is_first_pending_key = m_pending_keys.empty();
+    m_pending_keys.push_back(key);
+    if (is_first_pending_key) {
+        m_event_queue.put(new TriggerEvent(*this, &Impl::handle_send_keys_event));
+    }
 }
 
 void Session::Impl::send_pointer_event(uint32_t x, uint32_t y, Button button, Action action)
@@ -304,6 +402,11 @@ void Session::Impl::latency_stream_data(ILatencyData::LatencyDataType data_type,
     m_event_queue.put(new LatencyDataEvent(*this, &Impl::handle_latency_data_event, data_type, pts, original_event_time));
 }
 
+void Session::Impl::latency_marker_output(TimeStamp original_event_time, TimeStamp marker_time, TimeStamp output_time, TimeStamp pts)
+{
+    m_event_queue.put(new LatencyMarkerOutputEvent(*this, &Impl::handle_latency_marker_output_event, original_event_time, marker_time, output_time, pts));
+}
+
 void Session::Impl::stall_detected(const std::string &id, bool is_audio_not_video, const TimeStamp &stall_duration)
 {
     CLOUDTV_LOG_DEBUG("id:%s, audio=%d, duration:%u", id.c_str(), is_audio_not_video, static_cast<unsigned>(stall_duration.get_as_milliseconds()));
@@ -381,20 +484,20 @@ ResultCode Session::Impl::request_transmission(ReportBase &report)
         }
 
         // Send the report
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_playback_client_report(m_playback_report));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_playback_client_report(m_report_message, m_playback_report));
 
         // And reset
         m_playback_report.m_current_pts.reset();
         m_playback_report.m_pcr_delay.reset();
     } else if (&report == &m_latency_report) {
         // Send the report
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_latency_client_report(m_latency_report));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_latency_client_report(m_report_message, m_latency_report));
 
         // And reset
         m_latency_report.reset();
     } else if (&report == &m_log_report) {
         // Send the report
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_log_client_report(m_log_report));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_log_client_report(m_report_message, m_log_report));
 
         // And reset
         m_log_report.reset();
@@ -429,8 +532,8 @@ void Session::Impl::log_message(LogMessageType message_type, const char *message
         m_log_report.add_log(message_type, message);
 
         // Trigger if there's something to send
-        if (!m_log_report.get_text().empty()) {
-            m_log_report_manager.report_updated();
+        if (!m_log_report.is_empty()) {
+            rfbtvpm_report_updated(m_log_report_manager);
         }
 
         // We locked, so we must unlock
@@ -485,6 +588,7 @@ bool Session::Impl::unregister_protocol_extension(IProtocolExtension &protocol_e
         return false;
     }
     protocol_extension.register_reply_path(0);
+    m_last_protocol_extension = m_protocol_extensions.end();
     if (m_protocol_extensions.erase(protocol_extension.get_protocol_id()) != 1) {
         CTVC_LOG_WARNING("Attempt to unregister protocol '%s' that wasn't registered", protocol_extension.get_protocol_id().c_str());
     }
@@ -579,6 +683,43 @@ bool Session::Impl::unregister_handoff_handler(const std::string &handoff_scheme
     return true;
 }
 
+void Session::Impl::set_report_coalescing_window(uint32_t window_in_ms)
+{
+    CLOUDTV_LOG_DEBUG("window:%u ms", window_in_ms);
+
+    AutoLock lck(m_mutex);
+
+    m_report_coalescing_window_in_ms = window_in_ms;
+
+    // Reports that are pending when the window is disabled are sent right away
+    rfbtvpm_begin_message_batch();
+    m_playback_report_manager.set_coalescing_window(window_in_ms);
+    m_latency_report_manager.set_coalescing_window(window_in_ms);
+    m_log_report_manager.set_coalescing_window(window_in_ms);
+    close_session_in_case_of_error(rfbtvpm_end_message_batch());
+}
+
+void Session::Impl::set_reconnect_backoff(uint32_t min_backoff_in_ms, uint32_t max_backoff_in_ms, uint32_t max_attempts)
+{
+    CLOUDTV_LOG_DEBUG("min_backoff:%u ms, max_backoff:%u ms, max_attempts:%u", min_backoff_in_ms, max_backoff_in_ms, max_attempts);
+
+    AutoLock lck(m_mutex);
+
+    m_reconnect_min_backoff_in_ms = min_backoff_in_ms;
+    m_reconnect_max_backoff_in_ms = std::max(max_backoff_in_ms, min_backoff_in_ms);
+    m_reconnect_max_attempts = max_attempts;
+}
+
+void Session::Impl::set_key_repeat_policy(KeyRepeatPolicy policy, uint32_t max_outstanding_keys)
+{
+    CLOUDTV_LOG_DEBUG("policy:%d, max_outstanding_keys:%u", policy, max_outstanding_keys);
+
+    AutoLock lck(m_key_mutex);
+
+    m_key_repeat_policy = policy;
+    m_max_outstanding_keys = max_outstanding_keys;
+}
+
 void Session::Impl::close_session_in_case_of_error(ResultCode result)
 {
     // Our mutex is already locked here
@@ -612,7 +753,92 @@ ResultCode Session::Impl::rfbtvpm_send_message(const RfbtvMessage &msg)
 
     CLOUDTV_LOG_DEBUG("length:%u", msg.size());
 
-    return m_connection.send_data(msg.data(), msg.size());
+    if (m_is_batching_messages) {
+        m_message_batch.insert(m_message_batch.end(), msg.data(), msg.data() + msg.size());
+        return ResultCode::SUCCESS;
+    }
+
+    if (!is_active() || !rfbtvpm_has_pending_reports()) {
+        return rfbtvpm_send_data(msg.data(), msg.size());
+    }
+
+    // Reports that wait for their coalescing window go along in the same write. The message goes
+    // first, since it may be m_report_message, which the pending reports are written into.
+    rfbtvpm_begin_message_batch();
+    rfbtvpm_send_message(msg);
+    rfbtvpm_send_pending_reports();
+    return rfbtvpm_end_message_batch();
+}
+
+void Session::Impl::rfbtvpm_begin_message_batch()
+{
+    // Our mutex is already locked here
+
+    m_is_batching_messages = true;
+}
+
+ResultCode Session::Impl::rfbtvpm_end_message_batch()
+{
+    // Our mutex is already locked here
+
+    m_is_batching_messages = false;
+    if (m_message_batch.empty()) {
+        return ResultCode::SUCCESS;
+    }
+
+    ResultCode ret = rfbtvpm_send_data(&m_message_batch[0], m_message_batch.size());
+    m_message_batch.clear();
+
+    return ret;
+}
+
+ResultCode Session::Impl::rfbtvpm_send_data(const uint8_t *data, uint32_t length)
+{
+    // Our mutex is already locked here
+
+    // The server only learns the strings that compact reports add to the report dictionary if they arrive
+    ResultCode ret = m_connection.send_data(data, length);
+    if (ret.is_ok()) {
+        m_rfbtv_protocol.commit_report_dictionary_updates();
+    } else {
+        m_rfbtv_protocol.discard_report_dictionary_updates();
+    }
+
+    return ret;
+}
+
+void Session::Impl::rfbtvpm_report_updated(ReportManager &report_manager)
+{
+    // Our mutex is already locked here
+
+    report_manager.report_updated();
+
+    // The window starts with the first update of any report; the timer keeps running if it already does
+    if (report_manager.is_report_pending()) {
+        ResultCode ret = m_timer.start_timer(m_report_coalescing_trigger, m_report_coalescing_window_in_ms, TimerEngine::ONE_SHOT);
+        if (ret.is_error() && ret != TimerEngine::TIMER_ALREADY_REGISTERED) {
+            CLOUDTV_LOG_DEBUG("Unable to start report coalescing timer, sending report now");
+            report_manager.generate_pending_report();
+        }
+    }
+}
+
+bool Session::Impl::rfbtvpm_has_pending_reports() const
+{
+    // Our mutex is already locked here
+
+    return m_playback_report_manager.is_report_pending() || m_latency_report_manager.is_report_pending() || m_log_report_manager.is_report_pending();
+}
+
+void Session::Impl::rfbtvpm_send_pending_reports()
+{
+    // Our mutex is already locked here
+
+    m_timer.cancel_timer(m_report_coalescing_trigger);
+
+    m_playback_report_manager.generate_pending_report();
+    m_latency_report_manager.generate_pending_report();
+    m_log_report_manager.generate_pending_report();
 }
 
 const char *Session::Impl::rfbtvpm_get_state_name(RFBTV_STATE value)
@@ -694,15 +920,31 @@ void Session::Impl::rfbtvpm_reconnect(bool do_immediately)
         // Issue a new connection request immediately
         m_event_queue.put(new TriggerEvent(*this, &Impl::handle_connect_event));
     } else {
-        // Do an initial back-off of 5-15 seconds; apparently the server just died
-        int timeout_in_ms = 5000 + rand() % 10000;
+        // The connection of an active session was lost. That is mostly a short hiccup of the network,
+        // so try again soon, but not all at once in case the server went down for all of its clients.
+        uint32_t timeout_in_ms = rand() % (m_reconnect_min_backoff_in_ms + 1);
 
+        prefetch_session_host(m_session_url);
         m_timer.start_timer(m_connection_backoff_time_callback, timeout_in_ms, TimerEngine::ONE_SHOT);
     }
 
     rfbtvpm_set_state(CONNECTING, CLIENT_ERROR_CODE_OK);
 }
 
+uint32_t Session::Impl::rfbtvpm_get_reconnect_backoff(uint32_t attempt, ResultCode failure) const
+{
+    // Our mutex is already locked here
+
+    // The back-off doubles with every failed attempt. A server that refuses the connection is down
+    // or restarting, which takes longer than a hiccup of the network, so that backs off a step further.
+    uint32_t n_doublings = std::min(attempt + (failure == Socket::CONNECTION_REFUSED ? 2 : 1), 20U);
+    uint64_t backoff_in_ms = std::min(static_cast<uint64_t>(m_reconnect_min_backoff_in_ms) << n_doublings, static_cast<uint64_t>(m_reconnect_max_backoff_in_ms));
+
+    // Wait at least half of it, and a random part of the rest
+    uint32_t min_timeout_in_ms = static_cast<uint32_t>(backoff_in_ms / 2);
+    return min_timeout_in_ms + rand() % (static_cast<uint32_t>(backoff_in_ms) - min_timeout_in_ms + 1);
+}
+
 ResultCode Session::Impl::rfbtvpm_session_stop(ClientErrorCode error_code, RfbtvProtocol::SessionTerminateReason reason)
 {
     // Our mutex is already locked here
@@ -756,16 +998,23 @@ ResultCode Session::Impl::rfbtvpm_session_stop(ClientErrorCode error_code, Rfbtv
         stop_streaming();
     }
 
+    // Reports that wait for their coalescing window go out along with the session terminate indication
+    rfbtvpm_begin_message_batch();
+    rfbtvpm_send_pending_reports();
+
     // Disable reporting
     m_playback_report_manager.disable_reports();
     m_timer.cancel_timer(m_playback_report_periodic_trigger);
     m_latency_report_manager.disable_reports();
     m_log_report_manager.disable_reports();
 
-    ResultCode ret = ResultCode::SUCCESS;
+    // Keys of this session will not be displayed anymore
+    m_outstanding_keys.clear();
+
     if (send_session_terminate_indication) {
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_terminate_indication(reason));
+        rfbtvpm_send_message(m_rfbtv_protocol.create_session_terminate_indication(m_tx_message, reason));
     }
+    ResultCode ret = rfbtvpm_end_message_batch();
 
     rfbtvpm_close_connection();
 
@@ -791,7 +1040,7 @@ ResultCode Session::Impl::rfbtvpm_session_suspend()
         return INVALID_STATE;
     }
 
-    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_terminate_indication(RfbtvProtocol::SESSION_TERMINATE_SUSPEND));
+    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_terminate_indication(m_tx_message, RfbtvProtocol::SESSION_TERMINATE_SUSPEND));
 
     // Make sure the stream is stopped, if we had any running.
     stop_streaming();
@@ -819,25 +1068,20 @@ ResultCode Session::Impl::rfbtvpm_handle_rfbtv_version_string(RfbtvMessage &mess
     }
 
     // Send the client version string
-    RfbtvMessage msg;
-    msg.write_raw((uint8_t*)client_version_string, strlen(client_version_string));
+    m_tx_message.clear();
+    m_tx_message.write_raw((uint8_t*)client_version_string, strlen(client_version_string));
 
-    ret = rfbtvpm_send_message(msg);
+    ret = rfbtvpm_send_message(m_tx_message);
     if (ret.is_error()) {
         CTVC_LOG_WARNING("Unable to send version to server!");
         return ret;
     }
 
-    // Compose the client identifier according to RFB-TV specification
-    std::string client_id = std::string(m_context.get_manufacturer()) + "-" + m_context.get_device_type() + "_" + m_context.get_unique_id();
-    CLOUDTV_LOG_DEBUG("client_id:%s", client_id.c_str());
-
-    // Cookie, only set when we have one
-    std::string cookie;
-    ClientContext::instance().get_data_store().get_data("cookie.txt", cookie);
+    // The client identifier and cookie are looked up when the session is initiated
+    CLOUDTV_LOG_DEBUG("client_id:%s", m_client_id.c_str());
 
     // Send the session setup message
-    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_setup(client_id, m_param_list, m_session_id, cookie));
+    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_setup(m_tx_message, m_client_id, m_param_list, m_session_id, m_cookie));
     if (ret.is_error()) {
         CTVC_LOG_WARNING("Unable to send session setup to server!");
         return ret;
@@ -891,7 +1135,7 @@ void Session::Impl::rfbtvpm_send_appropriate_stream_confirm_error(const IMediaPl
 
     if (m_stream_confirm_sent_state != STREAM_CONFIRM_ERROR_SENT) {
         m_stream_confirm_sent_state = STREAM_CONFIRM_ERROR_SENT;
-        rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(code));
+        rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(m_tx_message, code));
     }
 }
 
@@ -899,7 +1143,8 @@ Session::Impl::OverlayHandler::OverlayHandler(Impl &impl, IOverlayCallbacks *ove
     m_impl(impl),
     m_overlay_callbacks(overlay_callbacks),
     m_thread("Session overlay handler"),
-    m_content_loader(0)
+    m_content_loader(0),
+    m_update_sequence(0)
 {
 }
 
@@ -927,6 +1172,9 @@ void Session::Impl::OverlayHandler::stop()
         m_thread.stop();
         m_new_overlays_available.put(new NullEvent());
         m_thread.wait_until_stopped();
+
+        // The content loader may still be writing into the buffers of late pictures
+        handle_late_pictures(true);
     }
 }
 
@@ -937,69 +1185,204 @@ void Session::Impl::OverlayHandler::process_images(const std::vector<PicturePara
 
 bool Session::Impl::OverlayHandler::run()
 {
-    const IEvent *event = m_new_overlays_available.get();
+    // Check regularly for late pictures, they may still be shown
+    const IEvent *event = m_late_pictures.empty() ? m_new_overlays_available.get() : m_new_overlays_available.get(OVERLAY_POLL_INTERVAL_IN_MS);
+    if (!event) {
+        handle_late_pictures(false);
+        return false;
+    }
+
     event->handle();
     delete event;
     return false;
 }
 
+static bool is_overlapping(const PictureParameters &a, const PictureParameters &b)
+{
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
 void Session::Impl::OverlayHandler::handle_overlay_event(const OverlaysAvailableEvent &event)
 {
     assert(m_overlay_callbacks);
 
-    // It is actual safe to modify the content - and we need to when downloading via URL - of the images.
-    std::vector<PictureParameters> &images = event.images();
+    const std::vector<PictureParameters> &images = event.images();
 
     CLOUDTV_LOG_DEBUG("Request to handle framebuffer update with %u rectangles (m_content_loader:%p)", (uint32_t)images.size(), m_content_loader);
 
+    // Late pictures of earlier updates can't be shown anymore once this update is drawn, so don't load them
+    m_update_sequence++;
+    for (std::list<PictureLoad *>::iterator i = m_late_pictures.begin(); i != m_late_pictures.end(); ++i) {
+        if (!(*i)->is_loaded) {
+            (*i)->result->cancel();
+        }
+    }
+    handle_late_pictures(false);
+
     // If necessary, fetch images from the remote server
+    std::vector<PictureLoad *> loads(images.size(), static_cast<PictureLoad *>(0));
     if (m_content_loader) {
-        std::vector<IContentLoader::IContentResult *> loading_results(images.size());
-        for (size_t i = 0; i < images.size(); i++) {
-            if (!images[i].m_url.empty()) {
-                //sw_log_info(TAG,"Downloading image from [%s]", images[i].m_url.c_str());
-                loading_results[i] = m_content_loader->load_content(images[i].m_url, images[i].m_data);
-            }
-        }
+        TimeStamp deadline(TimeStamp::now());
+        deadline.add_milliseconds(OVERLAY_PICTURE_DEADLINE_IN_MS);
 
-        // Wait for ALL images to be downloaded, so we can blit them in the correct order.
-        for (size_t i = 0; i < images.size() && !m_thread.must_stop(); i++) {
+        for (size_t i = 0; i < images.size(); i++) {
             if (!images[i].m_url.empty()) {
-                if (loading_results[i] != 0) {
-                    // This call blocks until the result (positive or negative) is known
-                    ResultCode ret = loading_results[i]->wait_for_result();
-                    if (ret.is_error()) {
-                        // The user of the SDK has to deal with this error by showing an empty image or an error image
-                        CTVC_LOG_WARNING("There was an error downloading image from [%s]", images[i].m_url.c_str());
-                    }
-                    m_content_loader->release_content_result(loading_results[i]);
-                } else {
+                PictureLoad *load = new PictureLoad(images[i]);
+                // Small images first, they are quick to load and show
+                uint32_t priority = static_cast<uint32_t>(images[i].w) * images[i].h;
+                load->result = m_content_loader->load_content(load->picture.m_url, load->picture.m_data, priority);
+                if (!load->result) {
                     CLOUDTV_LOG_DEBUG("IContentLoader::IContentResult NULL object was returned from IContentLoader::load_content()");
+                    delete load;
+                    continue;
                 }
+                load->deadline = deadline;
+                load->update_sequence = m_update_sequence;
+                loads[i] = load;
             }
         }
     }
 
     if (!m_thread.must_stop()) {
         // Indicate to server that we're ready to receive the next update (if any).
+        // There is no need to wait for the images to be loaded; the server can prepare the next update meanwhile.
         m_impl.post_frame_buffer_update_request();
 
         if (event.clear_flag()) {
             CLOUDTV_LOG_DEBUG("CLEAR");
             m_overlay_callbacks->overlay_clear();
         }
+    }
+
+    // Blit the images as soon as they are available. Images only have to wait for earlier images that they overlap,
+    // so the result is the same as blitting them all in order.
+    std::vector<bool> is_done(images.size(), false);
+    size_t first_pending = 0;
+    while (first_pending < images.size() && !m_thread.must_stop()) {
+        TimeStamp now(TimeStamp::now());
+
+        for (size_t i = first_pending; i < images.size(); i++) {
+            if (is_done[i]) {
+                continue;
+            }
+
+            if (loads[i] && !wait_for_picture(*loads[i], 0)) {
+                if (now < loads[i]->deadline) {
+                    continue;
+                }
+
+                CTVC_LOG_WARNING("Image from [%s] was not loaded in time, leaving it out", images[i].m_url.c_str());
+                // It can still be shown when it is loaded if that doesn't change the outcome of this update
+                loads[i]->can_deliver_late = event.commit_flag();
+                for (size_t j = i + 1; j < images.size() && loads[i]->can_deliver_late; j++) {
+                    loads[i]->can_deliver_late = !is_overlapping(images[i], images[j]);
+                }
+                m_late_pictures.push_back(loads[i]);
+                loads[i] = 0;
+                is_done[i] = true;
+                continue;
+            }
 
-        for (size_t i = 0; i < event.images().size(); i++) {
-            if (!event.images()[i].m_data.empty()) {
+            bool is_blocked = false;
+            for (size_t j = first_pending; j < i && !is_blocked; j++) {
+                is_blocked = !is_done[j] && is_overlapping(images[j], images[i]);
+            }
+            if (is_blocked) {
+                continue;
+            }
+
+            const PictureParameters &picture = loads[i] ? loads[i]->picture : images[i];
+            if (!picture.m_data.empty()) {
                 CLOUDTV_LOG_DEBUG("IMAGE");
-                m_overlay_callbacks->overlay_blit_image(event.images()[i]);
+                m_overlay_callbacks->overlay_blit_image(picture);
             }
+            delete loads[i];
+            loads[i] = 0;
+            is_done[i] = true;
+        }
+
+        while (first_pending < images.size() && is_done[first_pending]) {
+            first_pending++;
+        }
+
+        // Wait for the first image that is still loading, the images after it may be waiting for it.
+        // Check every now and then whether any of the other images are loaded.
+        for (size_t i = first_pending; i < images.size(); i++) {
+            if (!is_done[i] && loads[i] && !loads[i]->is_loaded) {
+                int64_t time_left_in_ms = (loads[i]->deadline - now).get_as_milliseconds();
+                uint32_t timeout_in_ms = time_left_in_ms <= 0 ? 0 : std::min(static_cast<uint32_t>(time_left_in_ms), OVERLAY_POLL_INTERVAL_IN_MS);
+                wait_for_picture(*loads[i], timeout_in_ms);
+                break;
+            }
+        }
+    }
+
+    if (m_thread.must_stop()) {
+        for (size_t i = 0; i < loads.size(); i++) {
+            if (loads[i]) {
+                if (!loads[i]->is_loaded) {
+                    loads[i]->result->cancel();
+                }
+                m_late_pictures.push_back(loads[i]);
+            }
+        }
+        return;
+    }
+
+    // The framebuffer update is only complete when all its images have been blitted (or left out)
+    if (event.commit_flag()) {
+        CLOUDTV_LOG_DEBUG("FLIP");
+        m_overlay_callbacks->overlay_flip();
+    }
+}
+
+bool Session::Impl::OverlayHandler::wait_for_picture(PictureLoad &load, uint32_t timeout_in_ms, bool is_blocking)
+{
+    if (load.is_loaded) {
+        return true;
+    }
+
+    ResultCode ret;
+    if (is_blocking) {
+        ret = load.result->wait_for_result();
+    } else if (!load.result->wait_for_result(timeout_in_ms, ret)) {
+        return false;
+    }
+
+    m_content_loader->release_content_result(load.result);
+    load.result = 0;
+    load.is_loaded = true;
+
+    if (ret == IContentLoader::IContentResult::CANCELED_REQUEST) {
+        CLOUDTV_LOG_DEBUG("Loading image from [%s] was canceled", load.picture.m_url.c_str());
+        load.picture.m_data.clear();
+    } else if (ret.is_error()) {
+        // The user of the SDK has to deal with this error by showing an empty image or an error image
+        CTVC_LOG_WARNING("There was an error downloading image from [%s]", load.picture.m_url.c_str());
+        load.picture.m_data.clear();
+    }
+
+    return true;
+}
+
+void Session::Impl::OverlayHandler::handle_late_pictures(bool is_stopping)
+{
+    std::list<PictureLoad *>::iterator i = m_late_pictures.begin();
+    while (i != m_late_pictures.end()) {
+        PictureLoad *load = *i;
+        if (!wait_for_picture(*load, 0, is_stopping)) {
+            ++i;
+            continue;
         }
 
-        if (event.commit_flag()) {
-            CLOUDTV_LOG_DEBUG("FLIP");
+        if (!is_stopping && load->can_deliver_late && load->update_sequence == m_update_sequence && !load->picture.m_data.empty()) {
+            CLOUDTV_LOG_DEBUG("LATE IMAGE");
+            m_overlay_callbacks->overlay_blit_image(load->picture);
             m_overlay_callbacks->overlay_flip();
         }
+
+        delete load;
+        i = m_late_pictures.erase(i);
     }
 }
 
@@ -1027,11 +1410,16 @@ ResultCode Session::Impl::session_setup_response(RfbtvProtocol::ICallbacks::Sess
 
     m_session_id = session_id;
 
-    CLOUDTV_LOG_DEBUG("Storing cookie:%s", cookie.c_str());
-    ResultCode ret = ClientContext::instance().get_data_store().set_data("cookie.txt", cookie);
-    if (ret.is_error()) {
-        CLOUDTV_LOG_DEBUG("Can't store cookie");
-        return ret;
+    // The cookie is mostly the same on a reconnect, which then saves a write to the data store
+    ResultCode ret;
+    if (cookie != m_cookie) {
+        CLOUDTV_LOG_DEBUG("Storing cookie:%s", cookie.c_str());
+        ret = ClientContext::instance().get_data_store().set_data("cookie.txt", cookie);
+        if (ret.is_error()) {
+            CLOUDTV_LOG_DEBUG("Can't store cookie");
+            return ret;
+        }
+        m_cookie = cookie;
     }
 
     if (result == RfbtvProtocol::ICallbacks::SESSION_SETUP_REDIRECT) {
@@ -1048,6 +1436,7 @@ ResultCode Session::Impl::session_setup_response(RfbtvProtocol::ICallbacks::Sess
         m_redirect_count++;
 
         rfbtvpm_set_state(REDIRECTED, CLIENT_ERROR_CODE_OK);
+        prefetch_session_host(redirect_url);
 
         std::string url; // Posting an empty url will keep m_param_list["url"] intact in handle_initiate_event()
         m_event_queue.put(new InitiateEvent(*this, &Impl::handle_initiate_event, redirect_url, url, m_screen_width, m_screen_height, m_param_list, m_session_start_time));
@@ -1082,6 +1471,7 @@ ResultCode Session::Impl::session_setup_response(RfbtvProtocol::ICallbacks::Sess
 
     // The session has been set up now
     rfbtvpm_set_state(ACTIVE, CLIENT_ERROR_CODE_OK);
+    m_has_been_active = true;
 
     // If reconnecting because we're about to close a suspended session, terminate normally now
     if (m_closing_suspended) {
@@ -1090,14 +1480,14 @@ ResultCode Session::Impl::session_setup_response(RfbtvProtocol::ICallbacks::Sess
     }
 
     // Send the list of supported encodings
-    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_set_encodings(m_content_loader != 0));
+    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_set_encodings(m_tx_message, m_content_loader != 0));
     if (ret.is_error()) {
         CTVC_LOG_WARNING("Unable to send encodings to server!");
         return ret;
     }
 
     // Tell server we are ready for receiving update requests, even if the client did not register an overlay handler.
-    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_frame_buffer_update_request(m_screen_width, m_screen_height));
+    ret = rfbtvpm_send_message(m_rfbtv_protocol.create_frame_buffer_update_request(m_tx_message, m_screen_width, m_screen_height));
     if (ret.is_error()) {
         CTVC_LOG_WARNING("Unable to send frame buffer update request to server!");
         return ret;
@@ -1146,7 +1536,7 @@ ResultCode Session::Impl::ping()
 
     // Ping is 1 byte message type, message type is already read, nothing to do
     // Send back pong to indicate we are alive
-    return rfbtvpm_send_message(m_rfbtv_protocol.create_pong());
+    return rfbtvpm_send_message(m_rfbtv_protocol.create_pong(m_tx_message));
 }
 
 ResultCode Session::Impl::stream_setup_request(const std::string &uri, const std::map<std::string, std::string> &stream_params)
@@ -1163,12 +1553,12 @@ ResultCode Session::Impl::stream_setup_request(const std::string &uri, const std
     if (m_current_stream_uri.compare(uri) == 0) {
         //sw_log_info(TAG,"Current URI already playing, request ignored");
 
-        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
+        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(m_tx_message, RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
         if (ret.is_error()) {
             return ret;
         }
 
-        return rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(RfbtvProtocol::STREAM_CONFIRM_SUCCESS)); // TODO (CTV-27819): Send another StreamConfirm code if there was an error before the reconnect.
+        return rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(m_tx_message, RfbtvProtocol::STREAM_CONFIRM_SUCCESS)); // TODO (CTV-27819): Send another StreamConfirm code if there was an error before the reconnect.
     }
 
     // Stop any running stream
@@ -1184,12 +1574,12 @@ ResultCode Session::Impl::stream_setup_request(const std::string &uri, const std
     // Server indicates to stop playing and blank the screen
     // (Stopping a stream is indicated by opening an empty URL)
     if (uri.empty()) {
-        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
+        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(m_tx_message, RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
         if (ret.is_error()) {
             return ret;
         }
 
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(RfbtvProtocol::STREAM_CONFIRM_SUCCESS));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(m_tx_message, RfbtvProtocol::STREAM_CONFIRM_SUCCESS));
         if (ret.is_error()) {
             return ret;
         }
@@ -1211,7 +1601,7 @@ ResultCode Session::Impl::stream_setup_request(const std::string &uri, const std
 
     // Check the error codes and signal the correct replies
     if (ret.is_ok()) {
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(m_tx_message, RfbtvProtocol::STREAM_SETUP_SUCCESS, std::map<std::string, std::string>(), m_local_udp_url));
         if (ret.is_ok()) {
             all_succeeded = true;
         }
@@ -1230,7 +1620,7 @@ ResultCode Session::Impl::stream_setup_request(const std::string &uri, const std
         }
 
         // The stream setup error is handled by RFB-TV so we overwrite the error code.
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(code, std::map<std::string, std::string>(), m_local_udp_url));
+        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_stream_setup_response(m_tx_message, code, std::map<std::string, std::string>(), m_local_udp_url));
     }
 
     // Stop the streamer and the player if there were any errors
@@ -1247,7 +1637,11 @@ ResultCode Session::Impl::passthrough(const std::string &protocol_id, const std:
 
     CLOUDTV_LOG_DEBUG("test");
 
-    std::map<std::string, IProtocolExtension *>::iterator it = m_protocol_extensions.find(protocol_id);
+    std::map<std::string, IProtocolExtension *>::const_iterator it = m_last_protocol_extension;
+    if (it == m_protocol_extensions.end() || it->first != protocol_id) {
+        it = m_protocol_extensions.find(protocol_id);
+        m_last_protocol_extension = it;
+    }
     if (it == m_protocol_extensions.end()) {
         if (m_default_handler) {
             CLOUDTV_LOG_DEBUG("Sending message to default handler.");
@@ -1475,7 +1869,7 @@ ResultCode Session::Impl::handoff_request(const std::string &uri, bool resume_se
         CTVC_LOG_WARNING("Received handoff request without scheme '%s'.", uri.c_str());
     }
 
-    return rfbtvpm_send_message(m_rfbtv_protocol.create_handoff_result(result, ""));
+    return rfbtvpm_send_message(m_rfbtv_protocol.create_handoff_result(m_tx_message, result, ""));
 }
 
 ResultCode Session::Impl::cdm_setup_request(const std::string &cdm_session_id, const uint8_t (&drm_system_id)[16], const std::string &session_type, const std::map<std::string, std::string> &init_data)
@@ -1517,7 +1911,7 @@ ResultCode Session::Impl::cdm_setup_request(const std::string &cdm_session_id, c
 
     if (!factory) {
         CLOUDTV_LOG_DEBUG("No registered DRM system found with given DRM system ID (%s)", id_to_guid_string(drm_system_id).c_str());
-        return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(cdm_session_id, RfbtvProtocol::CDM_SESSION_SETUP_RESPONSE_RESULT_DRM_SYSTEM_NOT_INSTALLED, response));
+        return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(m_tx_message, cdm_session_id, RfbtvProtocol::CDM_SESSION_SETUP_RESPONSE_RESULT_DRM_SYSTEM_NOT_INSTALLED, response));
     }
 
     // Create and register the new session
@@ -1525,7 +1919,7 @@ ResultCode Session::Impl::cdm_setup_request(const std::string &cdm_session_id, c
 
     if (!session) {
         CLOUDTV_LOG_DEBUG("CDM session could not be created");
-        return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(cdm_session_id, RfbtvProtocol::CDM_SESSION_SETUP_RESPONSE_RESULT_DRM_SYSTEM_ERROR, response));
+        return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(m_tx_message, cdm_session_id, RfbtvProtocol::CDM_SESSION_SETUP_RESPONSE_RESULT_DRM_SYSTEM_ERROR, response));
     }
 
     CdmSessionContainer *container = new CdmSessionContainer(*this, cdm_session_id, *session, *factory);
@@ -1615,7 +2009,7 @@ void Session::Impl::handle_cdm_setup_result(const CdmSetupResultEvent &event)
     }
 
     // Send the CdmSetupResponse message
-    rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(event.cdm_session_id(), rfbtv_result, event.response()));
+    rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_setup_response(m_tx_message, event.cdm_session_id(), rfbtv_result, event.response()));
 }
 
 ResultCode Session::Impl::rfbtvpm_cdm_session_terminate(const std::string &cdm_session_id, RfbtvProtocol::CdmSessionTerminateResponseReason reason)
@@ -1631,7 +2025,7 @@ ResultCode Session::Impl::rfbtvpm_cdm_session_terminate(const std::string &cdm_s
     if (i == m_active_cdm_sessions.end()) {
         CTVC_LOG_WARNING("CDM session with cdm_session_id '%s' not found", cdm_session_id.c_str());
         if (reason == RfbtvProtocol::CDM_SESSION_TERMINATE_RESPONSE_REASON_SERVER_REQUEST) {
-            return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_terminate_indication(cdm_session_id, RfbtvProtocol::CDM_SESSION_TERMINATE_RESPONSE_REASON_UNKNOWN_SESSION, stop_data));
+            return rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_terminate_indication(m_tx_message, cdm_session_id, RfbtvProtocol::CDM_SESSION_TERMINATE_RESPONSE_REASON_UNKNOWN_SESSION, stop_data));
         } else {
             return ResultCode::SUCCESS;
         }
@@ -1670,7 +2064,7 @@ void Session::Impl::handle_cdm_terminate_result(const CdmTerminateResultEvent &e
     rfbtvpm_register_active_cdm_stream_decrypt_engine();
 
     // Send the CdmTerminateIndication message
-    rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_terminate_indication(event.cdm_session_id(), event.reason(), event.stop_data()));
+    rfbtvpm_send_message(m_rfbtv_protocol.create_cdm_terminate_indication(m_tx_message, event.cdm_session_id(), event.reason(), event.stop_data()));
 
     delete event.container();
 }
@@ -1723,29 +2117,6 @@ void Session::Impl::rfbtvpm_close_connection()
     }
 }
 
-void Session::Impl::start_message_handling_thread()
-{
-    if (!m_event_handling_thread.is_running()) {
-        CLOUDTV_LOG_DEBUG("Starting message handling thread.\n");
-        ResultCode ret = m_event_handling_thread.start(*this, Thread::PRIO_HIGH);
-        if (ret.is_error()) {
-            CLOUDTV_LOG_DEBUG("m_event_handling_thread.start() failed:%s.\n", ret.get_description());
-        }
-    }
-}
-
-void Session::Impl::stop_message_handling_thread()
-{
-    m_event_handling_thread.stop();
-
-    m_event_queue.put(new NullEvent());
-
-    ResultCode ret = m_event_handling_thread.wait_until_stopped();
-    if (ret.is_error()) {
-        CLOUDTV_LOG_DEBUG("m_event_handling_thread.wait_until_stopped() failed:%s", ret.get_description());
-    }
-}
-
 void Session::Impl::stop_streaming()
 {
     // Our mutex is already locked here
@@ -1815,6 +2186,11 @@ void Session::Impl::playback_report_periodic_trigger()
     m_event_queue.put(new TriggerEvent(*this, &Session::Impl::handle_playback_report_trigger_event));
 }
 
+void Session::Impl::report_coalescing_window_expired()
+{
+    m_event_queue.put(new TriggerEvent(*this, &Session::Impl::handle_report_coalescing_event));
+}
+
 void Session::Impl::handle_initiate_event(const InitiateEvent &event)
 {
     AutoLock lck(m_mutex);
@@ -1830,7 +2206,15 @@ void Session::Impl::handle_initiate_event(const InitiateEvent &event)
     // If we're REDIRECTED, we have received a redirect request and should not reset the redirect counter.
     if (m_rfbtv_state != REDIRECTED) {
         m_redirect_count = 0;
+
+        // Compose the client identifier according to RFB-TV specification
+        m_client_id = std::string(m_context.get_manufacturer()) + "-" + m_context.get_device_type() + "_" + m_context.get_unique_id();
+
+        // Cookie, only set when we have one
+        m_cookie.clear();
+        ClientContext::instance().get_data_store().get_data("cookie.txt", m_cookie);
     }
+    m_has_been_active = false;
 
     rfbtvpm_set_state(INITIATED, CLIENT_ERROR_CODE_OK);
 
@@ -1844,6 +2228,12 @@ void Session::Impl::handle_initiate_event(const InitiateEvent &event)
         // If URL is empty, the user might be using launch_parameters to start the application
         m_param_list["url"] = event.url();
     }
+    // The key trace dump is a local option that is not passed on to the server
+    std::map<std::string, std::string>::iterator key_trace_dump_param = m_param_list.find("key_trace_dump");
+    m_latency_report.set_key_trace_dump(key_trace_dump_param != m_param_list.end() && key_trace_dump_param->second == "true");
+    if (key_trace_dump_param != m_param_list.end()) {
+        m_param_list.erase(key_trace_dump_param);
+    }
     m_session_start_time = event.start_time();
 	CLOUDTV_LOG_DEBUG( " ");
 
@@ -1856,6 +2246,7 @@ void Session::Impl::handle_initiate_event(const InitiateEvent &event)
     m_playback_report.reset();
     m_playback_report_manager.disable_reports();
     m_timer.cancel_timer(m_playback_report_periodic_trigger);
+    m_timer.cancel_timer(m_report_coalescing_trigger);
     m_latency_report.reset();
     m_latency_report.set_measurement_mode(0);
     m_latency_report_manager.disable_reports();
@@ -1929,7 +2320,6 @@ void Session::Impl::handle_resume_event(const TriggerEvent &/*event*/)
 
 void Session::Impl::post_frame_buffer_update_request()
 {
-    CLOUDTV_LOG_DEBUG("test\n");
     m_event_queue.put(new TriggerEvent(*this, &Impl::handle_frame_buffer_update_request_event));
 }
 
@@ -1939,7 +2329,7 @@ void Session::Impl::handle_frame_buffer_update_request_event(const TriggerEvent
 
     CLOUDTV_LOG_DEBUG("state:%s\n", rfbtvpm_get_state_name(m_rfbtv_state));
 
-    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_frame_buffer_update_request(m_screen_width, m_screen_height));
+    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_frame_buffer_update_request(m_tx_message, m_screen_width, m_screen_height));
     if (ret.is_error()) {
         CTVC_LOG_WARNING("Unable to send frame buffer update request to server!");
     }
@@ -1964,6 +2354,12 @@ void Session::Impl::handle_update_session_optional_parameters_event(const Parame
 
         CLOUDTV_LOG_DEBUG("key:%s, value:%s\n", key.c_str(), value.c_str());
 
+        if (key == "key_trace_dump") {
+            // Local option, see handle_initiate_event()
+            m_latency_report.set_key_trace_dump(value == "true");
+            continue;
+        }
+
         // If active, check whether the parameter is new or whether it changed and build an update map from these
         std::map<std::string, std::string>::iterator j = m_param_list.find(key);
         if (j == m_param_list.end() || j->second != value) {
@@ -1976,24 +2372,69 @@ void Session::Impl::handle_update_session_optional_parameters_event(const Parame
 
     // Send an update message if necessary
     if (!update_map.empty()) {
-        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_update(update_map));
+        ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_session_update(m_tx_message, update_map));
         close_session_in_case_of_error(ret);
     }
 }
 
-void Session::Impl::handle_send_keycode_event(const KeyEvent &event)
+void Session::Impl::handle_send_keys_event(const TriggerEvent &)
 {
     AutoLock lck(m_mutex);
 
-    CLOUDTV_LOG_DEBUG("state:%s\n", rfbtvpm_get_state_name(m_rfbtv_state));
+    bool is_coalescing = false;
+    uint32_t max_outstanding_keys = 0;
+    {
+        AutoLock key_lck(m_key_mutex);
+
+        m_keys_to_send.swap(m_pending_keys);
+        is_coalescing = m_key_repeat_policy == KEY_REPEAT_COALESCE;
+        max_outstanding_keys = m_max_outstanding_keys;
+    }
+
+    CLOUDTV_LOG_DEBUG("state:%s, keys:%u\n", rfbtvpm_get_state_name(m_rfbtv_state), static_cast<uint32_t>(m_keys_to_send.size()));
 
     if (!is_active()) {
         CLOUDTV_LOG_DEBUG("Session is not running\n");
+        m_keys_to_send.clear();
         return;
     }
 
+    // Forget about key presses that will not be displayed anymore, before new ones are added
+    TimeStamp now(TimeStamp::now());
+    while (!m_outstanding_keys.empty() && (m_outstanding_keys.size() > MAX_OUTSTANDING_KEYS || (now - m_outstanding_keys.front().sent_time).get_as_milliseconds() > OUTSTANDING_KEY_TIMEOUT_IN_MS)) {
+        m_outstanding_keys.erase(m_outstanding_keys.begin());
+    }
+    uint32_t first_new_outstanding_key = m_outstanding_keys.size();
+
+    // All keys go out in a single write instead of one small segment per key
+    rfbtvpm_begin_message_batch();
+    for (std::vector<PendingKey>::const_iterator i = m_keys_to_send.begin(); i != m_keys_to_send.end(); ++i) {
+        if (is_coalescing && max_outstanding_keys > 0 && is_key_press(i->action) && rfbtvpm_count_outstanding_keys(i->x11_key) >= max_outstanding_keys) {
+            CLOUDTV_LOG_DEBUG("Coalescing repeat of key 0x%x, the server did not catch up yet", i->x11_key);
+            continue;
+        }
+        rfbtvpm_send_key(*i, is_coalescing);
+    }
+    ResultCode ret = rfbtvpm_end_message_batch();
+    m_keys_to_send.clear();
+
+    if (ret.is_ok()) {
+        TimeStamp sent_time(TimeStamp::now());
+        for (uint32_t j = first_new_outstanding_key; j < m_outstanding_keys.size(); j++) {
+            m_outstanding_keys[j].sent_time = sent_time;
+            m_latency_report.mark_key_trace(m_outstanding_keys[j].key_id, LatencyReport::KEY_TRACE_STAGE_SENT, sent_time);
+        }
+    }
+
+    close_session_in_case_of_error(ret);
+}
+
+void Session::Impl::rfbtvpm_send_key(const PendingKey &key, bool is_tracking_outstanding_keys)
+{
+    // Our mutex is already locked here
+
     RfbtvProtocol::KeyAction key_action = RfbtvProtocol::KEY_DOWN;
-    switch (event.action()) {
+    switch (key.action) {
     case IInput::ACTION_NONE:
         return;
 
@@ -2016,34 +2457,73 @@ void Session::Impl::handle_send_keycode_event(const KeyEvent &event)
     }
 	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
 
-    ResultCode ret;
-    if (m_rfbtv_protocol.get_version() == RfbtvProtocol::RFBTV_PROTOCOL_V2_0) {
-        std::string timestamp;
-        if (m_latency_report_manager.is_enabled()) {
-            timestamp = uint64_to_string(TimeStamp::now().get_as_milliseconds());
+    // Only RFB-TV version 2.0 can carry the time stamp that the server echoes in a latency marker
+    bool is_traced = m_rfbtv_protocol.get_version() == RfbtvProtocol::RFBTV_PROTOCOL_V2_0 && m_latency_report_manager.is_enabled();
+    std::string timestamp;
+    if (is_traced || is_tracking_outstanding_keys) {
+        TimeStamp handled_time(TimeStamp::now());
+
+        // Keys that are sent in the same millisecond still need an id of their own
+        uint64_t key_id = std::max(static_cast<uint64_t>(handled_time.get_as_milliseconds()), m_last_key_id + 1);
+        m_last_key_id = key_id;
+
+        if (is_traced) {
+            timestamp = uint64_to_string(key_id);
+
+            // The server echoes the time stamp in a latency marker in the stream, which completes the trace
+            m_latency_report.start_key_trace(key_id, key.input_time);
+            m_latency_report.mark_key_trace(key_id, LatencyReport::KEY_TRACE_STAGE_HANDLED, handled_time);
 
             CLOUDTV_LOG_DEBUG("timestamp:[%s]", timestamp.c_str());
         }
 
-	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_key_time_event(event.x11_key(), key_action, timestamp));
-	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
+        // The key is outstanding until the server reports it displayed, or without a time stamp until
+        // OUTSTANDING_KEY_TIMEOUT_IN_MS has passed; it is marked as sent when the batch has been written
+        OutstandingKey outstanding_key;
+        outstanding_key.key_id = key_id;
+        outstanding_key.x11_key = key.x11_key;
+        outstanding_key.action = key.action;
+        outstanding_key.sent_time = handled_time;
+        m_outstanding_keys.push_back(outstanding_key);
+    }
 
-        if (event.action() == IInput::ACTION_DOWN_AND_UP && ret.is_ok()) {
-            ret = rfbtvpm_send_message(m_rfbtv_protocol.create_key_time_event(event.x11_key(), RfbtvProtocol::KEY_UP, timestamp));
-	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
+    if (m_rfbtv_protocol.get_version() == RfbtvProtocol::RFBTV_PROTOCOL_V2_0) {
+        rfbtvpm_send_message(m_rfbtv_protocol.create_key_time_event(m_tx_message, key.x11_key, key_action, timestamp));
+        if (key.action == IInput::ACTION_DOWN_AND_UP) {
+            rfbtvpm_send_message(m_rfbtv_protocol.create_key_time_event(m_tx_message, key.x11_key, RfbtvProtocol::KEY_UP, timestamp));
         }
     } else {
-        ret = rfbtvpm_send_message(m_rfbtv_protocol.create_key_event(event.x11_key(), key_action));
-	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
+        rfbtvpm_send_message(m_rfbtv_protocol.create_key_event(m_tx_message, key.x11_key, key_action));
+        if (key.action == IInput::ACTION_DOWN_AND_UP) {
+            rfbtvpm_send_message(m_rfbtv_protocol.create_key_event(m_tx_message, key.x11_key, RfbtvProtocol::KEY_UP));
+        }
+    }
+}
 
-        if (event.action() == IInput::ACTION_DOWN_AND_UP && ret.is_ok()) {
-            ret =rfbtvpm_send_message(m_rfbtv_protocol.create_key_event(event.x11_key(), RfbtvProtocol::KEY_UP));
-	CLOUDTV_LOG_DEBUG("key_action:%d.\n", key_action);
+uint32_t Session::Impl::rfbtvpm_count_outstanding_keys(X11KeyCode x11_key) const
+{
+    // Our mutex is already locked here
+
+    uint32_t n = 0;
+    for (std::vector<OutstandingKey>::const_iterator i = m_outstanding_keys.begin(); i != m_outstanding_keys.end(); ++i) {
+        if (i->x11_key == x11_key && is_key_press(i->action)) {
+            n++;
         }
     }
 
-    close_session_in_case_of_error(ret);
+    return n;
+}
+
+void Session::Impl::rfbtvpm_key_displayed(uint64_t key_id)
+{
+    // Our mutex is already locked here
+
+    for (std::vector<OutstandingKey>::iterator i = m_outstanding_keys.begin(); i != m_outstanding_keys.end(); ++i) {
+        if (i->key_id == key_id) {
+            m_outstanding_keys.erase(i);
+            return;
+        }
+    }
 }
 
 void Session::Impl::handle_pointer_event(const PointerEvent &event)
@@ -2089,7 +2569,7 @@ void Session::Impl::handle_pointer_event(const PointerEvent &event)
         break;
     case IInput::ACTION_DOWN_AND_UP:
         if ((m_rfbtv_button_mask & mask) == 0) { // Don't send if already down
-            rfbtvpm_send_message(m_rfbtv_protocol.create_pointer_event(m_rfbtv_button_mask | mask, event.x(), event.y()));
+            rfbtvpm_send_message(m_rfbtv_protocol.create_pointer_event(m_tx_message, m_rfbtv_button_mask | mask, event.x(), event.y()));
         }
         m_rfbtv_button_mask &= ~mask;
         break;
@@ -2098,7 +2578,7 @@ void Session::Impl::handle_pointer_event(const PointerEvent &event)
         return;
     }
 
-    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_pointer_event(m_rfbtv_button_mask, event.x(), event.y()));
+    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_pointer_event(m_tx_message, m_rfbtv_button_mask, event.x(), event.y()));
     close_session_in_case_of_error(ret);
 }
 
@@ -2124,7 +2604,7 @@ void Session::Impl::handle_player_event(const PlayerEvent &event)
             // Also update the stream-to-start latency measurement when we send an 'ok' StreamConfirm
             m_latency_report.add_entry(LatencyReport::SUBTYPE_SESSION_START_TO_STREAM, "SUBTYPE_SESSION_START_TO_STREAM", TimeStamp::now().get_as_milliseconds() - m_session_start_time.get_as_milliseconds());
             m_stream_confirm_sent_state = STREAM_CONFIRM_OK_SENT;
-            rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(RfbtvProtocol::STREAM_CONFIRM_SUCCESS));
+            rfbtvpm_send_message(m_rfbtv_protocol.create_stream_confirm(m_tx_message, RfbtvProtocol::STREAM_CONFIRM_SUCCESS));
         }
         break;
 
@@ -2202,7 +2682,7 @@ void Session::Impl::handle_player_event(const PlayerEvent &event)
 
     // Signal the update if the report has changed
     if (has_report_changed) {
-        m_playback_report_manager.report_updated();
+        rfbtvpm_report_updated(m_playback_report_manager);
     }
 }
 
@@ -2302,21 +2782,21 @@ void Session::Impl::handle_stream_error_event(const StreamErrorEvent &event)
             close_session_in_case_of_error(result);
         } else {
             // In the process of connecting, so check whether we need to retry and when.
-            size_t index = m_connect_attempts++;
-            const int backoff_times[] = { 10, 20, 40, 80 }; // Reconnect back-off times
+            uint32_t attempt = m_connect_attempts++;
 
             // Fail after we retried the max. amount of times or when retrying makes no sense (e.g. when the host is not found).
-            if (index >= sizeof(backoff_times) / sizeof(backoff_times[0]) || result == Socket::HOST_NOT_FOUND) {
+            // A host that was found for this session before is more likely missing because the network is down.
+            if (attempt >= m_reconnect_max_attempts || (result == Socket::HOST_NOT_FOUND && !m_has_been_active)) {
                 // We failed to (re)connect. Close the session.
-                CLOUDTV_LOG_DEBUG("Failed to reconnect after %d attempts, closing the session", m_connect_attempts);
+                CLOUDTV_LOG_DEBUG("Failed to reconnect after %u attempts, closing the session", m_connect_attempts);
                 close_session_in_case_of_error(result);
                 return;
             }
 
-            // Do a back-off of 5+N seconds
-            int timeout_in_ms = 5000 + rand() % (1000 * backoff_times[index] + 1);
+            uint32_t timeout_in_ms = rfbtvpm_get_reconnect_backoff(attempt, result);
 
-            //sw_log_info(TAG,"Retry scheduled in %dms", timeout_in_ms);
+            CLOUDTV_LOG_DEBUG("Retry scheduled in %ums", timeout_in_ms);
+            prefetch_session_host(m_session_url);
             m_timer.start_timer(m_connection_backoff_time_callback, timeout_in_ms, TimerEngine::ONE_SHOT);
         }
     }
@@ -2331,6 +2811,7 @@ void Session::Impl::handle_latency_data_event(const LatencyDataEvent &event)
     switch(event.data_type()) {
     case ILatencyData::KEY_PRESS:
         m_latency_report.add_entry(LatencyReport::SUBTYPE_KEY_TO_DISPLAY, "", (event.pts() - event.original_event_time()).get_as_milliseconds());
+        rfbtvpm_key_displayed(event.original_event_time().get_as_milliseconds());
         break;
     case ILatencyData::FIRST_PAINT:
         m_latency_report.add_entry(LatencyReport::SUBTYPE_SESSION_START_TO_FIRSTPAINT, "", (event.pts() - m_session_start_time).get_as_milliseconds());
@@ -2340,7 +2821,18 @@ void Session::Impl::handle_latency_data_event(const LatencyDataEvent &event)
         break;
     }
 
-    m_latency_report_manager.report_updated();
+    rfbtvpm_report_updated(m_latency_report_manager);
+}
+
+void Session::Impl::handle_latency_marker_output_event(const LatencyMarkerOutputEvent &event)
+{
+    AutoLock lck(m_mutex);
+
+    uint64_t key_id = event.original_event_time().get_as_milliseconds();
+    m_latency_report.mark_key_trace(key_id, LatencyReport::KEY_TRACE_STAGE_MARKER, event.marker_time());
+    m_latency_report.mark_key_trace(key_id, LatencyReport::KEY_TRACE_STAGE_OUTPUT, event.output_time());
+    m_latency_report.mark_key_trace(key_id, LatencyReport::KEY_TRACE_STAGE_DISPLAY, event.pts());
+    rfbtvpm_key_displayed(key_id);
 }
 
 void Session::Impl::handle_stall_event(const StallEvent &event)
@@ -2429,7 +2921,7 @@ void Session::Impl::handle_protocol_extension_send_event(const ProtocolExtension
         return;
     }
 
-    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_passthrough(event.protocol_id(), event.data()));
+    ResultCode ret = rfbtvpm_send_message(m_rfbtv_protocol.create_passthrough(m_tx_message, event.protocol_id(), event.data()));
     close_session_in_case_of_error(ret);
 }
 
@@ -2453,12 +2945,12 @@ void Session::Impl::handle_playback_report_trigger_event(const TriggerEvent &/*e
     m_playback_report_manager.timer_tick();
 }
 
-bool Session::Impl::run()
+void Session::Impl::handle_report_coalescing_event(const TriggerEvent &/*event*/)
 {
-    const IEvent *event = m_event_queue.get();
-
-    event->handle();
-    delete event;
+    AutoLock lck(m_mutex);
 
-    return false;
+    // All reports that are pending by now go out in a single write
+    rfbtvpm_begin_message_batch();
+    rfbtvpm_send_pending_reports();
+    close_session_in_case_of_error(rfbtvpm_end_message_batch());
 }
@@ -22,9 +22,11 @@
 #include "IEvent.h"
 #include "BoundEvent.h"
 #include "KeyFilter.h"
+#include "SessionEngine.h"
 
 #include <core/Session.h>
 #include <core/ICdmSession.h>
+#include <core/IContentLoader.h>
 #include <core/IControl.h>
 #include <core/IInput.h>
 #include <core/IOverlayCallbacks.h>
@@ -52,9 +54,8 @@ namespace ctvc {
 struct IMediaPlayerFactory;
 struct PictureParameters;
 struct IOverlayCallbacks;
-struct IContentLoader;
 
-class Session::Impl : public IProtocolExtension::IReply, public IMediaPlayer::ICallback, public IControl, public IInput, public IReportTransmitter, public ILogOutput, public RfbtvProtocol::ICallbacks, public Thread::IRunnable, public IStream, public ILatencyData, public IStallEvent
+class Session::Impl : public IProtocolExtension::IReply, public IMediaPlayer::ICallback, public IControl, public IInput, public IReportTransmitter, public ILogOutput, public RfbtvProtocol::ICallbacks, public IStream, public ILatencyData, public IStallEvent
 {
 public:
     static const ResultCode CONNECTION_TIMEOUT;
@@ -75,6 +76,9 @@ public:
     bool unregister_drm_system(ICdmSessionFactory &factory);
     bool register_handoff_handler(const std::string &handoff_scheme, IHandoffHandler &handoff_handler);
     bool unregister_handoff_handler(const std::string &handoff_scheme);
+    void set_report_coalescing_window(uint32_t window_in_ms);
+    void set_reconnect_backoff(uint32_t min_backoff_in_ms, uint32_t max_backoff_in_ms, uint32_t max_attempts);
+    void set_key_repeat_policy(KeyRepeatPolicy policy, uint32_t max_outstanding_keys);
 
 private:
     friend class Session;
@@ -247,29 +251,21 @@ private:
         std::map<std::string, std::string> m_optional_parameters;
     };
 
-    class KeyEvent : public BoundEvent<Impl, KeyEvent>
+    // Key that waits to be sent by the session thread
+    struct PendingKey
     {
-    public:
-        KeyEvent(Impl &impl, void (Impl::*handler)(const KeyEvent &), X11KeyCode keycode, IInput::Action action) :
-            BoundEvent<Impl, KeyEvent>(impl, handler),
-            m_x11_key(keycode),
-            m_action(action)
-        {
-        }
-
-        X11KeyCode x11_key() const
-        {
-            return m_x11_key;
-        }
-
-        IInput::Action action() const
-        {
-            return m_action;
-        }
+        X11KeyCode x11_key;
+        IInput::Action action;
+        TimeStamp input_time;
+    };
 
-    private:
-        X11KeyCode m_x11_key;
-        IInput::Action m_action;
+    // Key press that has been sent with a time stamp but has not been displayed yet
+    struct OutstandingKey
+    {
+        uint64_t key_id;
+        X11KeyCode x11_key;
+        IInput::Action action;
+        TimeStamp sent_time; // Or the time it was handled, until the batch with the key has been written
     };
 
     class PointerEvent : public BoundEvent<Impl, PointerEvent>
@@ -409,6 +405,45 @@ private:
         TimeStamp m_original_event_time;
     };
 
+    class LatencyMarkerOutputEvent : public BoundEvent<Impl, LatencyMarkerOutputEvent>
+    {
+    public:
+        LatencyMarkerOutputEvent(Impl &impl, void (Impl::*handler)(const LatencyMarkerOutputEvent &), TimeStamp original_event_time, TimeStamp marker_time, TimeStamp output_time, TimeStamp pts) :
+            BoundEvent<Impl, LatencyMarkerOutputEvent>(impl, handler),
+            m_original_event_time(original_event_time),
+            m_marker_time(marker_time),
+            m_output_time(output_time),
+            m_pts(pts)
+        {
+        }
+
+        const TimeStamp &original_event_time() const
+        {
+            return m_original_event_time;
+        }
+
+        const TimeStamp &marker_time() const
+        {
+            return m_marker_time;
+        }
+
+        const TimeStamp &output_time() const
+        {
+            return m_output_time;
+        }
+
+        const TimeStamp &pts() const
+        {
+            return m_pts;
+        }
+
+    private:
+        TimeStamp m_original_event_time;
+        TimeStamp m_marker_time;
+        TimeStamp m_output_time;
+        TimeStamp m_pts;
+    };
+
     class StallEvent : public BoundEvent<Impl, StallEvent>
     {
     public:
@@ -609,14 +644,38 @@ private:
             bool m_commit_flag;
         };
 
+        // A picture of a framebuffer update that is loaded through the content loader
+        struct PictureLoad
+        {
+            PictureLoad(const PictureParameters &picture_parameters) :
+                picture(picture_parameters),
+                result(0),
+                is_loaded(false),
+                update_sequence(0),
+                can_deliver_late(false)
+            {
+            }
+
+            PictureParameters picture; // Owns the buffer the content is loaded into
+            IContentLoader::IContentResult *result; // Released once the picture is loaded
+            bool is_loaded;
+            TimeStamp deadline;
+            uint32_t update_sequence; // Framebuffer update the picture belongs to
+            bool can_deliver_late; // If it misses its deadline, it may still be shown as long as no newer update came in
+        };
+
         bool run();
         void handle_overlay_event(const OverlaysAvailableEvent &event);
+        bool wait_for_picture(PictureLoad &load, uint32_t timeout_in_ms, bool is_blocking = false);
+        void handle_late_pictures(bool is_stopping);
 
         Impl &m_impl;
         IOverlayCallbacks *m_overlay_callbacks;
         Thread m_thread;
         IContentLoader *m_content_loader;
         EventQueue m_new_overlays_available;
+        uint32_t m_update_sequence;
+        std::list<PictureLoad *> m_late_pictures; // Pictures that missed their deadline but are still being loaded
     };
 
     mutable Mutex m_mutex;
@@ -630,13 +689,15 @@ private:
     EchoProtocolExtension m_echo_protocol;
 
     std::map<std::string, IProtocolExtension *> m_protocol_extensions;
+    std::map<std::string, IProtocolExtension *>::const_iterator m_last_protocol_extension; // Passthrough messages mostly come in runs of one protocol
     IDefaultProtocolHandler *m_default_handler;
     std::vector<ICdmSessionFactory *> m_drm_systems;
     std::map<std::string, CdmSessionContainer *> m_active_cdm_sessions;
     std::map<std::string, IHandoffHandler *> m_handoff_handlers;
 
     Streamer m_streamer;
-    TimerEngine m_timer;
+    SessionEngine &m_engine; // Runs our timers and handles our events, possibly shared with other sessions
+    TimerEngine &m_timer;    // Of m_engine
 
     // Current content loader
     IContentLoader *m_content_loader;
@@ -652,6 +713,8 @@ private:
     ReportManager m_latency_report_manager;
     LogReport m_log_report;
     ReportManager m_log_report_manager;
+    uint32_t m_report_coalescing_window_in_ms;
+    BoundTimerEngineTimer<Session::Impl> m_report_coalescing_trigger;
     TimeStamp m_session_start_time;
 
     TimeStamp m_stalled_timestamp;
@@ -665,6 +728,13 @@ private:
     uint16_t m_screen_width;
     uint16_t m_screen_height;
     std::map<std::string, std::string> m_param_list;
+    uint32_t m_reconnect_min_backoff_in_ms;
+    uint32_t m_reconnect_max_backoff_in_ms;
+    uint32_t m_reconnect_max_attempts;
+
+    // Session setup parameters, which are reused when reconnecting or redirecting
+    std::string m_client_id;
+    std::string m_cookie; // As last stored in the data store
 
     // Dynamic session state
     std::string m_session_id;
@@ -674,15 +744,28 @@ private:
     RFBTV_STATE m_rfbtv_state;
     Atomic<State> m_state;
     bool m_closing_suspended;
-    int m_connect_attempts;
+    uint32_t m_connect_attempts;
+    bool m_has_been_active; // The session has been set up with the current host
 
     // Misc session state
     EventQueue m_event_queue;   // Needs to be constructed before m_connection since m_connection might write into m_stream_queue upon destruction (stopping m_connection in the destructor should solve this, but apparently this doesn't solve all cases...)
     TcpConnection m_connection;
-    Thread m_event_handling_thread;
     RfbtvMessage m_rx_message;
+    RfbtvMessage m_tx_message;     // Reused for every message that is sent, to keep its capacity
+    RfbtvMessage m_report_message; // Reports can be sent while m_tx_message is being sent
     RfbtvProtocol m_rfbtv_protocol;
+    bool m_is_batching_messages;
+    std::vector<uint8_t> m_message_batch; // Messages that are sent in a single write
     KeyFilter m_key_filter;
+
+    // Upstream keys
+    Mutex m_key_mutex;                        // Protects the members up to m_keys_to_send, which are used by the client thread
+    std::vector<PendingKey> m_pending_keys;   // Keys that are queued for the session thread
+    KeyRepeatPolicy m_key_repeat_policy;
+    uint32_t m_max_outstanding_keys;
+    std::vector<PendingKey> m_keys_to_send;   // Keys that are being sent, swapped with m_pending_keys
+    std::vector<OutstandingKey> m_outstanding_keys;
+    uint64_t m_last_key_id;
     BoundTimerEngineTimer<Session::Impl> m_connection_backoff_time_callback;
 
     // Stream & stream error handling
@@ -714,6 +797,7 @@ private:
 
     // Implements ILatencyData
     void latency_stream_data(ILatencyData::LatencyDataType data_type, TimeStamp pts, TimeStamp original_event_time);
+    void latency_marker_output(TimeStamp original_event_time, TimeStamp marker_time, TimeStamp output_time, TimeStamp pts);
 
     // Implements IStallEvent
     void stall_detected(const std::string &id, bool is_audio_not_video, const TimeStamp &stall_duration);
@@ -746,13 +830,7 @@ private:
     ResultCode cdm_setup_request(const std::string &cdm_session_id, const uint8_t (&drm_system_id)[16], const std::string &session_type, const std::map<std::string, std::string> &init_data);
     ResultCode cdm_terminate_request(const std::string &cdm_session_id, RfbtvProtocol::ICallbacks::CdmSessionTerminateReason reason);
 
-    // Implements Thread::IRunnable
-    bool run();
-
     // Private helper methods
-    void start_message_handling_thread();
-    void stop_message_handling_thread();
-
     void stop_streaming();
 
     void set_state(State state, ClientErrorCode reason);
@@ -768,12 +846,13 @@ private:
     void handle_resume_event(const TriggerEvent &event);
     void handle_frame_buffer_update_request_event(const TriggerEvent &event);
     void handle_update_session_optional_parameters_event(const ParameterUpdateEvent &event);
-    void handle_send_keycode_event(const KeyEvent &event);
+    void handle_send_keys_event(const TriggerEvent &event);
     void handle_pointer_event(const PointerEvent &event);
     void handle_player_event(const PlayerEvent &event);
     void handle_stream_data_event(const StreamDataEvent &event);
     void handle_stream_error_event(const StreamErrorEvent &event);
     void handle_latency_data_event(const LatencyDataEvent &event);
+    void handle_latency_marker_output_event(const LatencyMarkerOutputEvent &event);
     void handle_stall_event(const StallEvent &event);
     void handle_connect_event(const TriggerEvent &event);
     void handle_cdm_session_terminate_event(const CdmSessionTerminateEvent &event);
@@ -782,6 +861,7 @@ private:
     void handle_protocol_extension_send_event(const ProtocolExtensionSendEvent &event);
     void handle_stream_timeout_expired_event(const TriggerEvent &event);
     void handle_playback_report_trigger_event(const TriggerEvent &event);
+    void handle_report_coalescing_event(const TriggerEvent &event);
 
     void cdm_session_terminate_indication(const std::string &cdm_session_id, ICdmSession::ICallback::TerminateReason reason);
     void cdm_setup_result(const std::string &cdm_session_id, ICdmSession::SetupResult result, const std::map<std::string, std::string> &response, CdmSessionContainer *container);
@@ -800,13 +880,24 @@ private:
     ResultCode rfbtvpm_session_suspend();
     void rfbtvpm_close_connection();
     ResultCode rfbtvpm_send_message(const RfbtvMessage &msg);
+    void rfbtvpm_begin_message_batch();
+    ResultCode rfbtvpm_end_message_batch();
+    ResultCode rfbtvpm_send_data(const uint8_t *data, uint32_t length);
+    void rfbtvpm_report_updated(ReportManager &report_manager);
+    bool rfbtvpm_has_pending_reports() const;
+    void rfbtvpm_send_pending_reports();
+    void rfbtvpm_send_key(const PendingKey &key, bool is_tracking_outstanding_keys); // Only to be called while batching messages
+    uint32_t rfbtvpm_count_outstanding_keys(X11KeyCode x11_key) const; // Key presses only
+    void rfbtvpm_key_displayed(uint64_t key_id);
     void rfbtvpm_reconnect(bool do_immediately);
+    uint32_t rfbtvpm_get_reconnect_backoff(uint32_t attempt, ResultCode failure) const;
     ResultCode rfbtvpm_handle_rfbtv_version_string(RfbtvMessage &message);
     void rfbtvpm_send_appropriate_stream_confirm_error(const IMediaPlayer::PlayerEvent &event);
 
     void connection_backoff_time_expired();
     void stream_timeout_expired();
     void playback_report_periodic_trigger();
+    void report_coalescing_window_expired();
     void post_frame_buffer_update_request();
 };
 
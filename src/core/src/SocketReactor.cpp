@@ -0,0 +1,172 @@
+///
+/// \file SocketReactor.cpp
+///
+/// \brief Thread that receives from the connected sockets of many sessions.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include "SocketReactor.h"
+
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Log.h>
+
+using namespace ctvc;
+
+const uint32_t SocketReactor::POLL_TIMEOUT_IN_MS;
+const uint32_t SocketReactor::IDLE_TIMEOUT_IN_MS;
+
+SocketReactor::SocketReactor(const std::string &thread_name) :
+    m_thread(thread_name),
+    m_is_in_pass(false)
+{
+}
+
+SocketReactor::~SocketReactor()
+{
+    m_thread.stop();
+    m_wake_up.post();
+
+    ResultCode ret = m_thread.wait_until_stopped();
+    if (ret.is_error()) {
+        CTVC_LOG_ERROR("wait_until_stopped() failed:%s", ret.get_description());
+    }
+}
+
+ResultCode SocketReactor::add(Socket &socket, IHandler &handler)
+{
+    AutoLock lck(m_mutex);
+
+    if (!m_thread.is_running()) {
+        ResultCode ret = m_thread.start(*this, Thread::PRIO_NORMAL);
+        if (ret.is_error()) {
+            CTVC_LOG_ERROR("m_thread.start() failed:%s", ret.get_description());
+            return ret;
+        }
+    }
+
+    Entry entry;
+    entry.socket = &socket;
+    entry.handler = &handler;
+    m_entries.push_back(entry);
+
+    if (m_entries.size() == 1) {
+        m_wake_up.post();
+    }
+
+    return ResultCode::SUCCESS;
+}
+
+void SocketReactor::remove(IHandler &handler)
+{
+    AutoLock lck(m_mutex);
+
+    erase(handler);
+
+    if (Thread::self() == &m_thread) {
+        // Called from a handler, which is not called anymore after it returns
+        return;
+    }
+
+    // The thread may still wait for the socket, or call the handler
+    bool is_in_current_pass = false;
+    if (m_is_in_pass) {
+        for (size_t i = 0; i < m_pass_entries.size(); i++) {
+            is_in_current_pass |= m_pass_entries[i].handler == &handler;
+        }
+    }
+    if (is_in_current_pass) {
+        Semaphore pass_completed;
+        m_pass_waiters.push_back(&pass_completed);
+        m_mutex.unlock();
+        pass_completed.wait();
+        m_mutex.lock();
+    }
+}
+
+bool SocketReactor::is_added(const IHandler &handler) const
+{
+    // Our mutex is already locked here
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].handler == &handler) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SocketReactor::erase(const IHandler &handler)
+{
+    // Our mutex is already locked here
+
+    for (std::vector<Entry>::iterator i = m_entries.begin(); i != m_entries.end(); ++i) {
+        if (i->handler == &handler) {
+            m_entries.erase(i);
+            return;
+        }
+    }
+}
+
+bool SocketReactor::run()
+{
+    {
+        AutoLock lck(m_mutex);
+
+        m_pass_entries = m_entries;
+        m_is_in_pass = !m_pass_entries.empty();
+    }
+
+    if (m_pass_entries.empty()) {
+        m_wake_up.wait(IDLE_TIMEOUT_IN_MS);
+        return false;
+    }
+
+    m_pass_sockets.resize(m_pass_entries.size());
+    for (size_t i = 0; i < m_pass_entries.size(); i++) {
+        m_pass_sockets[i] = m_pass_entries[i].socket;
+    }
+
+    bool *is_ready = new bool[m_pass_entries.size()];
+    ResultCode ret = Socket::wait_for_data(&m_pass_sockets[0], m_pass_sockets.size(), POLL_TIMEOUT_IN_MS, is_ready);
+    if (ret.is_error()) {
+        CTVC_LOG_ERROR("Socket::wait_for_data() failed:%s", ret.get_description());
+        Thread::sleep(POLL_TIMEOUT_IN_MS);
+    }
+
+    for (size_t i = 0; i < m_pass_entries.size() && ret.is_ok(); i++) {
+        if (!is_ready[i]) {
+            continue;
+        }
+
+        IHandler &handler(*m_pass_entries[i].handler);
+        {
+            AutoLock lck(m_mutex);
+
+            // Removed while we waited
+            if (!is_added(handler)) {
+                continue;
+            }
+        }
+
+        if (!handler.data_available()) {
+            AutoLock lck(m_mutex);
+            erase(handler);
+        }
+    }
+    delete[] is_ready;
+
+    AutoLock lck(m_mutex);
+
+    m_is_in_pass = false;
+    for (size_t i = 0; i < m_pass_waiters.size(); i++) {
+        m_pass_waiters[i]->post();
+    }
+    m_pass_waiters.clear();
+
+    return false;
+}
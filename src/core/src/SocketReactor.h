@@ -0,0 +1,84 @@
+///
+/// \file SocketReactor.h
+///
+/// \brief Thread that receives from the connected sockets of many sessions.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <porting_layer/Mutex.h>
+#include <porting_layer/ResultCode.h>
+#include <porting_layer/Semaphore.h>
+#include <porting_layer/Socket.h>
+#include <porting_layer/Thread.h>
+
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+// Waits for data on all sockets that are added to it at once, and lets the handler of a socket receive
+// from it once it has data. Handlers must not block, other than to receive the data that is available.
+class SocketReactor : public Thread::IRunnable
+{
+public:
+    struct IHandler
+    {
+        virtual ~IHandler()
+        {
+        }
+
+        // The socket has data, or its connection was closed. Returns false to stop handling the socket.
+        virtual bool data_available() = 0;
+    };
+
+    SocketReactor(const std::string &thread_name);
+    ~SocketReactor();
+
+    // Handle the socket from now on, until the handler is removed or returns false. Starts the thread
+    // if it is not running yet.
+    ResultCode add(Socket &socket, IHandler &handler);
+
+    // Stop handling the socket of the handler. If the handler is being called on the thread of the
+    // reactor, this waits until it is done, so the socket can be closed when this returns.
+    void remove(IHandler &handler);
+
+private:
+    SocketReactor(const SocketReactor &);
+    SocketReactor &operator=(const SocketReactor &);
+
+    struct Entry
+    {
+        Socket *socket;
+        IHandler *handler;
+    };
+
+    static const uint32_t POLL_TIMEOUT_IN_MS = 5;  // Until sockets that were added are waited for as well
+    static const uint32_t IDLE_TIMEOUT_IN_MS = 100; // Without any sockets
+
+    Thread m_thread;
+    Mutex m_mutex;
+    Semaphore m_wake_up; // Posted when the first socket is added
+    std::vector<Entry> m_entries;
+    std::vector<Semaphore *> m_pass_waiters; // Posted when the current pass has completed
+    bool m_is_in_pass; // The thread waits for or handles a copy of m_entries
+
+    // Owned by the thread, kept to prevent reallocation on each pass
+    std::vector<Entry> m_pass_entries;
+    std::vector<Socket *> m_pass_sockets;
+
+    bool is_added(const IHandler &handler) const;
+    void erase(const IHandler &handler);
+
+    // Implements Thread::IRunnable
+    bool run();
+};
+
+} // namespace
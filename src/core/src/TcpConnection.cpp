@@ -9,6 +9,8 @@
 #include <porting_layer/Log.h>
 #include <porting_layer/AutoLock.h>
 #include <porting_layer/Socket.h>
+#include <porting_layer/TimeStamp.h>
+#include <utils/Metrics.h>
 
 #include <assert.h>
 
@@ -16,12 +18,47 @@ using namespace ctvc;
 
 const ResultCode TcpConnection::CONNECTION_NOT_OPEN("Trying to send data while the connection is not open");
 
+namespace {
+
+// Metrics of all TCP connections together
+struct TcpConnectionMetrics
+{
+    TcpConnectionMetrics() :
+        connects(Metrics::get_counter("tcp_connection.connects")),
+        connect_failures(Metrics::get_counter("tcp_connection.connect_failures")),
+        connect_time(Metrics::get_distribution("tcp_connection.connect_time_ms", 60000)),
+        bytes_sent(Metrics::get_counter("tcp_connection.bytes_sent")),
+        bytes_received(Metrics::get_counter("tcp_connection.bytes_received")),
+        send_errors(Metrics::get_counter("tcp_connection.send_errors"))
+    {
+    }
+
+    Metrics::Counter &connects;
+    Metrics::Counter &connect_failures;
+    Metrics::Distribution &connect_time;
+    Metrics::Counter &bytes_sent;
+    Metrics::Counter &bytes_received;
+    Metrics::Counter &send_errors;
+};
+
+TcpConnectionMetrics &get_metrics()
+{
+    static TcpConnectionMetrics s_metrics;
+
+    return s_metrics;
+}
+
+} // namespace
+
 TcpConnection::TcpConnection(const std::string &thread_name) :
     m_socket(0),
     m_thread(thread_name),
     m_stream_out(0),
     m_do_connect(false),
-    m_port(-1)
+    m_port(-1),
+    m_is_ssl(false),
+    m_reactor(0),
+    m_is_in_reactor(false)
 {
 }
 
@@ -30,6 +67,13 @@ TcpConnection::~TcpConnection()
     close();
 }
 
+void TcpConnection::set_reactor(SocketReactor *reactor)
+{
+    AutoLock lck(m_mutex);
+
+    m_reactor = reactor;
+}
+
 ResultCode TcpConnection::open(const std::string &host, int port, bool ssl_flag, IStream &data_out)
 {
     CTVC_LOG_DEBUG("host:%s, port:%d, ssl:%d", host.c_str(), port, ssl_flag);
@@ -43,6 +87,7 @@ ResultCode TcpConnection::open(const std::string &host, int port, bool ssl_flag,
     m_do_connect = true;
     m_host = host;
     m_port = port;
+    m_is_ssl = ssl_flag;
     m_stream_out = &data_out;
 
     m_socket = ssl_flag ? new SslSocket : new TcpSocket;
@@ -70,6 +115,20 @@ ResultCode TcpConnection::close()
 
     ResultCode ret = m_thread.stop_and_wait_until_stopped();
 
+    // The thread hands the socket to the reactor once connected, so only then can it be there
+    SocketReactor *reactor = 0;
+    {
+        AutoLock lck(m_mutex);
+
+        if (m_is_in_reactor) {
+            reactor = m_reactor;
+            m_is_in_reactor = false;
+        }
+    }
+    if (reactor) {
+        reactor->remove(*this);
+    }
+
     {
         AutoLock lck(m_mutex);
         close_socket_and_stream();
@@ -85,7 +144,13 @@ ResultCode TcpConnection::send_data(const uint8_t *data, uint32_t length)
     AutoLock lck(m_mutex);
 
     if (m_socket) {
-        return m_socket->send(data, length);
+        ResultCode ret = m_socket->send(data, length);
+        if (ret.is_ok()) {
+            get_metrics().bytes_sent.add(length);
+        } else {
+            get_metrics().send_errors.add();
+        }
+        return ret;
     } else {
         return CONNECTION_NOT_OPEN;
     }
@@ -134,8 +199,10 @@ bool TcpConnection::run()
 
     if (do_connect) {
         assert(port != -1);
+        TimeStamp connect_start_time(TimeStamp::now());
         ResultCode ret = socket->connect(host.c_str(), port);
         if (ret.is_error()) {
+            get_metrics().connect_failures.add();
             if (ret != Socket::THREAD_SHUTDOWN) {
                 CTVC_LOG_ERROR("m_socket->connect(%s,%d) failed", host.c_str(), port);
             } else {
@@ -148,19 +215,65 @@ bool TcpConnection::run()
         }
 
         CTVC_LOG_DEBUG("m_socket->connect(%s,%d) successful", host.c_str(), port);
+        get_metrics().connects.add();
+        get_metrics().connect_time.add_sample((TimeStamp::now() - connect_start_time).get_as_milliseconds());
+
+        AutoLock lck(m_mutex);
+
+        if (m_reactor && !m_is_ssl) {
+            ResultCode ret = m_reactor->add(*socket, *this);
+            if (ret.is_ok()) {
+                m_is_in_reactor = true;
+                return true; // Exit thread, the reactor receives from now on
+            }
+            CTVC_LOG_WARNING("Receiving on the thread of the connection, m_reactor->add() failed:%s", ret.get_description());
+        }
     }
 
+    return !receive(*socket, *stream_out); // Exit thread when done
+}
+
+bool TcpConnection::data_available()
+{
+    TcpSocket *socket = 0;
+    IStream *stream_out = 0;
+
+    {
+        AutoLock lck(m_mutex);
+
+        socket = m_socket;
+        stream_out = m_stream_out;
+    }
+
+    // close() removes us from the reactor before it deletes the socket
+    assert(socket);
+    assert(stream_out);
+
+    if (receive(*socket, *stream_out)) {
+        return true;
+    }
+
+    AutoLock lck(m_mutex);
+
+    m_is_in_reactor = false;
+
+    return false;
+}
+
+bool TcpConnection::receive(TcpSocket &socket, IStream &stream_out)
+{
     const unsigned int BUFSIZE = 4096;
     uint8_t *buf = new uint8_t[BUFSIZE];
     uint32_t bytes_received = 0;
 
-    ResultCode ret = socket->receive(buf, BUFSIZE, bytes_received);
+    ResultCode ret = socket.receive(buf, BUFSIZE, bytes_received);
 
     if (ret.is_ok() && bytes_received > 0) {
         CTVC_LOG_DEBUG("Got %d bytes of data", bytes_received);
+        get_metrics().bytes_received.add(bytes_received);
 
         // Ownership of 'buf' is passed downstream.
-        stream_out->stream_data(buf, bytes_received);
+        stream_out.stream_data(buf, bytes_received);
     } else {
         delete[] buf;
 
@@ -173,10 +286,10 @@ bool TcpConnection::run()
             CTVC_LOG_ERROR("Receive failed, ret:%s", ret.get_description());
         }
 
-        stream_out->stream_error(ret);
+        stream_out.stream_error(ret);
 
-        return true; // Exit thread
+        return false;
     }
 
-    return false; // Continue looping
+    return true;
 }
@@ -1,7 +1,7 @@
 ///
 /// \file TcpConnection.h
 ///
-/// \brief Class that manages a TCP client-side connection, including a receive thread.
+/// \brief Class that manages a TCP client-side connection, receiving on a thread of its own or of a reactor.
 ///
 ///
 /// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include "SocketReactor.h"
+
 #include <stream/IStream.h>
 
 #include <porting_layer/Thread.h>
@@ -22,7 +24,7 @@ namespace ctvc {
 
 class TcpSocket;
 
-class TcpConnection : public Thread::IRunnable
+class TcpConnection : public Thread::IRunnable, private SocketReactor::IHandler
 {
 public:
     static const ResultCode CONNECTION_NOT_OPEN;
@@ -30,6 +32,11 @@ public:
     TcpConnection(const std::string &thread_name);
     ~TcpConnection();
 
+    // Once connected, receive on the thread of the given reactor instead of on a thread of our own, or
+    // not if 0 (the default). SSL connections always keep their own thread, because receiving a record
+    // that is only partly received would hold up the reactor. Takes effect from the next open().
+    void set_reactor(SocketReactor *reactor);
+
     // Open a connection to given host and port (possibly using SSL) and create a
     // receive thread that sends its output to the given IStream object.
     // To prevent data copies, the IStream semantics are different that usual: the
@@ -49,9 +56,15 @@ public:
 private:
     void close_socket_and_stream();
 
+    // Receive once and pass the data on. Returns false when the connection is closed or failed.
+    bool receive(TcpSocket &socket, IStream &stream_out);
+
     // Implementation of Thread::IRunnable
     bool run();
 
+    // Implementation of SocketReactor::IHandler
+    bool data_available();
+
     TcpSocket *m_socket;
     Thread m_thread;
     mutable Mutex m_mutex;
@@ -59,6 +72,9 @@ private:
     bool m_do_connect;
     std::string m_host;
     int m_port;
+    bool m_is_ssl;
+    SocketReactor *m_reactor;
+    bool m_is_in_reactor; // The socket is handled by m_reactor
 };
 
 } // namespace
@@ -0,0 +1,67 @@
+///
+/// \file HttpCancelToken.h
+///
+/// \brief Cancellation of HTTP requests from another thread
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <porting_layer/Atomic.h>
+#include <porting_layer/Condition.h>
+
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc {
+
+class Socket;
+
+/// \brief Token to cancel the requests of one or more HttpClients from another thread
+///
+/// Once the token is canceled, the request that a client that uses the token (see
+/// HttpClient::set_cancel_token()) is executing fails with HttpClient::CANCELED, and so do all its
+/// next requests, until the token is reset. A blocking connect or receive is interrupted within a
+/// few milliseconds.
+///
+/// All methods are thread-safe. The token must outlive the clients that use it.
+class HttpCancelToken
+{
+public:
+    HttpCancelToken();
+    ~HttpCancelToken();
+
+    /// Cancel the requests of the clients that use the token
+    void cancel();
+
+    /// Make the token usable for new requests
+    void reset();
+
+    bool is_canceled() const;
+
+    /// Wait until the token is canceled, e.g. to back off before a retry without delaying a cancel.
+    /// @param[in] timeout_in_ms maximum time to wait
+    /// @return true if the token is canceled
+    bool wait(uint32_t timeout_in_ms);
+
+private:
+    HttpCancelToken(const HttpCancelToken &);
+    HttpCancelToken &operator=(const HttpCancelToken &);
+
+    friend class HttpClient;
+    // Sockets of the clients that use the token, which are aborted when it is canceled
+    void attach(Socket &socket);
+    void detach(Socket &socket);
+
+    Condition m_condition;
+    AtomicInteger<int> m_is_canceled;
+    std::vector<Socket *> m_sockets;
+    uint32_t m_n_waiting_threads;
+};
+
+} // namespace
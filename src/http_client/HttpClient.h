@@ -26,13 +26,17 @@
 
 #include <porting_layer/Socket.h>
 #include <porting_layer/ResultCode.h>
+#include <porting_layer/TimeStamp.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <inttypes.h>
 
 namespace ctvc {
 
+class HttpCancelToken;
 class IHttpDataSink;
 class IHttpDataSource;
 
@@ -48,6 +52,9 @@ public:
     static const ResultCode PROTOCOL_ERROR;            ///< Encountered some HTTP protocol violation
     static const ResultCode CONNECTION_CLOSED;         ///< Connection was closed by peer
     static const ResultCode EXCEEDED_MAX_REDIRECTIONS; ///< The maximum number of redirections have been exceeded
+    static const ResultCode FIRST_BYTE_TIMEOUT;        ///< The server did not start to respond within the timeout of the request
+    static const ResultCode REQUEST_TIMEOUT;           ///< The request did not complete within the total timeout
+    static const ResultCode CANCELED;                  ///< The request was canceled through the cancel token
 
     /// Instantiate the HTTP client
     HttpClient();
@@ -87,12 +94,66 @@ public:
      */
     void set_custom_headers(const char * const *headers, uint32_t pairs);
 
+    /**
+     Request the resource from a byte position on, e.g. to resume an interrupted download.
+
+     A "Range: bytes=<first_byte_position>-" header is sent with the next requests. The server
+     may ignore it, so check get_response_range_start() to find where the body starts.
+     Pass 0 to request the complete resource again.
+
+     @param[in] first_byte_position position of the first byte to request
+     */
+    void set_range(uint64_t first_byte_position);
+
+    /**
+     Limit the time that the client waits for data from the server.
+
+     If no data arrives within the timeout, the request fails with Socket::RECEIVE_TIMEOUT.
+
+     @param[in] timeout_in_ms maximum time between data from the server, 0 to wait indefinitely (the default)
+     */
+    void set_receive_timeout(uint32_t timeout_in_ms);
+
+    /**
+     Limit the time to connect to the server, including the lookup of its host name.
+
+     If the connection is not established within the timeout, the request fails with Socket::CONNECT_TIMEOUT.
+
+     @param[in] timeout_in_ms maximum time per connection (also of redirections), 0 for the default of the platform (the default)
+     */
+    void set_connect_timeout(uint32_t timeout_in_ms);
+
+    /**
+     Limit the time that a request takes, from the start of get(), post(), put() or del() up to the end of receive().
+
+     If the request is not completed within the timeout, it fails with REQUEST_TIMEOUT.
+
+     @param[in] timeout_in_ms maximum time of a request, 0 to let requests take as long as they need (the default)
+     */
+    void set_total_timeout(uint32_t timeout_in_ms);
+
+    /**
+     Use a token to cancel requests from another thread.
+
+     @param[in] cancel_token token that is checked by the next requests, or NULL to stop using a token
+     */
+    void set_cancel_token(HttpCancelToken *cancel_token);
+
+    /**
+     Set the size of the receive buffer of the socket.
+
+     This is how much data the platform can receive ahead of the calls to the IHttpDataSink.
+
+     @param[in] size size of the socket's receive buffer in bytes
+     */
+    void set_receive_buffer_size(uint32_t size);
+
     // High Level setup functions
     /** Execute a GET request on the URL
      Blocks until completion
      Unless there was an error, receive() MUST be called to complete the transaction and close the connection.
      @param[in] url : url on which to execute the request
-     @param[in] timeout waiting timeout in ms
+     @param[in] timeout maximum time in ms from sending the request up to the first byte of the response, 0 or less to wait indefinitely
      @return ResultCode
      */
     ResultCode get(const char *url, int timeout = HTTP_CLIENT_DEFAULT_TIMEOUT); // Blocking
@@ -104,7 +165,7 @@ public:
      stream reception) it is more desirable to separate the connection and header parsing from
      the retrieval of the data.
      @param[in] url : url on which to execute the request
-     @param[in] timeout waiting timeout in ms
+     @param[in] timeout maximum time in ms from sending the request up to the first byte of the response, 0 or less to wait indefinitely
      @return ResultCode
      */
     ResultCode get(const char *url, IHttpDataSink *data_sink, int timeout = HTTP_CLIENT_DEFAULT_TIMEOUT);
@@ -114,7 +175,7 @@ public:
      Unless there was an error, receive() MUST be called to complete the transaction and close the connection.
      @param[in] url : url on which to execute the request
      @param[in] data_source : a IHttpDataSource instance that contains the data that will be posted
-     @param[in] timeout waiting timeout in ms
+     @param[in] timeout maximum time in ms from sending the request up to the first byte of the response, 0 or less to wait indefinitely
      @return ResultCode
      */
     ResultCode post(const char *url, IHttpDataSource &data_source, int timeout = HTTP_CLIENT_DEFAULT_TIMEOUT); // Blocking
@@ -124,7 +185,7 @@ public:
      Unless there was an error, receive() MUST be called to complete the transaction and close the connection.
      @param[in] url : url on which to execute the request
      @param[in] data_source : a IHttpDataSource instance that contains the data that will be put
-     @param[in] timeout waiting timeout in ms
+     @param[in] timeout maximum time in ms from sending the request up to the first byte of the response, 0 or less to wait indefinitely
      @return ResultCode
      */
     ResultCode put(const char *url, IHttpDataSource &data_source, int timeout = HTTP_CLIENT_DEFAULT_TIMEOUT); // Blocking
@@ -133,7 +194,7 @@ public:
      Blocks until completion
      Unless there was an error, receive() MUST be called to complete the transaction and close the connection.
      @param[in] url : url on which to execute the request
-     @param[in] timeout waiting timeout in ms
+     @param[in] timeout maximum time in ms from sending the request up to the first byte of the response, 0 or less to wait indefinitely
      @return ResultCode
      */
     ResultCode del(const char *url, int timeout = HTTP_CLIENT_DEFAULT_TIMEOUT); // Blocking
@@ -150,6 +211,34 @@ public:
      */
     int get_response_code();
 
+    /** Get a header of the last request's response
+     Only headers of the final response (after following any redirects) are available.
+     @param[in] name : name of the header, compared case-insensitively
+     @param[out] value : value of the header, only set if the header is present
+     @return true if the header was present in the response
+     */
+    bool get_response_header(const char *name, std::string &value/*out*/) const;
+
+    /** Get the position in the resource of the first byte of the last request's response body
+     This is the start of the Content-Range of a 206 (Partial Content) response, and 0 for other responses.
+     @return The position of the first byte of the body
+     */
+    uint64_t get_response_range_start() const;
+
+    /** Get the number of headers of the last request's response
+     @return The number of headers, in the order they were received
+     */
+    uint32_t get_n_response_headers() const;
+
+    /** Get a header of the last request's response by index, without copying it
+     The name and value are null-terminated strings in the client's receive buffer, valid until the next request.
+     Leading and trailing whitespace of the value is removed.
+     @param[in] index : index of the header, less than get_n_response_headers()
+     @param[out] name : name of the header
+     @param[out] value : value of the header
+     */
+    void get_response_header(uint32_t index, const char *&name/*out*/, const char *&value/*out*/) const;
+
     /** Set the maximum number of automated redirections
      @param[in] i is the number of redirections.
      */
@@ -163,23 +252,58 @@ private:
     ResultCode send_headers(const char *method, const std::string &path, const std::string &hostname, int port, const std::string &authorization, IHttpDataSource *data_source);
     ResultCode send_data(IHttpDataSource *data_source);
     ResultCode receive_headers(std::string &redirect_location/*out*/);
-    ResultCode receive_chunked_data(IHttpDataSink *data_sink);
-    ResultCode receive_data(uint32_t content_length, IHttpDataSink *data_sink);
-    ResultCode recv();
+    ResultCode receive_body(IHttpDataSink *data_sink);
+    ResultCode decode_body(char *data, uint32_t &length/*in,out*/, bool &is_done/*out*/);
+    ResultCode decode_chunked_data(char *data, uint32_t &length/*in,out*/, bool &is_done/*out*/);
+    ResultCode parse_status_line(const char *line, uint32_t length);
+    ResultCode parse_header_line(uint32_t offset, uint32_t length);
+    ResultCode recv(char *buf, uint32_t size, uint32_t &length/*out*/);
     ResultCode send(const char *buf, uint32_t len = 0);
+    bool is_canceled() const;
 
     void read_data(uint32_t n);
-    ResultCode read_crlf();
-    ResultCode find_line(uint32_t &line_length/*out*/);
+
+    // State of the decoding of chunked transfer-encoding
+    enum ChunkState
+    {
+        CHUNK_SIZE_START, // At the first hex digit of the chunk size
+        CHUNK_SIZE,       // In the chunk size
+        CHUNK_EXTENSION,  // After the chunk size, up to the CR
+        CHUNK_SIZE_LF,    // At the LF after the chunk size line
+        CHUNK_DATA,       // In the chunk data
+        CHUNK_DATA_CR,    // At the CR after the chunk data
+        CHUNK_DATA_LF     // At the LF after the chunk data
+    };
 
     TcpSocket m_socket;
+    HttpCancelToken *m_cancel_token;
 
-    int m_timeout;
+    int m_timeout; // Of the first byte of the response
+    uint32_t m_connect_timeout_in_ms;
+    uint32_t m_receive_timeout_in_ms;
+    uint32_t m_total_timeout_in_ms;
+    bool m_is_waiting_for_first_byte;
+    TimeStamp m_first_byte_deadline;
+    TimeStamp m_total_deadline;
     int m_response_code;
     bool m_is_chunked_data;
     uint32_t m_content_length;
+    uint64_t m_range_start;
+    uint64_t m_response_range_start;
+    uint32_t m_body_length_left; // Of the content length, or of the current chunk
+    ChunkState m_chunk_state;
     std::string m_data_type;
 
+    // Response headers, as offsets of their null-terminated name and value in m_header_buf
+    struct HeaderField
+    {
+        uint32_t name;
+        uint32_t value;
+        uint32_t value_length;
+    };
+    std::vector<HeaderField> m_response_headers;
+    std::vector<char> m_header_buf; // Grows to hold the complete header block
+
     std::string m_basic_authorization;
     const char * const *m_custom_headers;
     uint32_t m_num_custom_headers;
@@ -89,6 +89,26 @@ public:
      */
     virtual void write(const char *buf, uint32_t len) = 0;
 
+    /** Get a buffer for the HTTP client to receive data in directly
+     * This saves copying the data from the client's own receive buffer. The data that is received
+     * in the buffer is passed with commit_write() instead of write(). Note that data that arrived
+     * together with the headers is still passed with write().
+     * @param[out] size Size of the buffer
+     * @returns The buffer, or 0 to receive all data with write()
+     */
+    virtual char *get_write_buffer(uint32_t &size/*out*/)
+    {
+        size = 0;
+        return 0;
+    }
+
+    /** Data was received in the buffer returned by get_write_buffer()
+     * @param len Length of the data, from the start of the buffer
+     */
+    virtual void commit_write(uint32_t /*len*/)
+    {
+    }
+
     /** Set MIME type
      * @param type Internet media type from Content-Type header
      */
@@ -0,0 +1,87 @@
+///
+/// \file HttpCancelToken.cpp
+///
+/// \brief Cancellation of HTTP requests from another thread
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include <http_client/HttpCancelToken.h>
+
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Socket.h>
+
+#include <algorithm>
+
+using namespace ctvc;
+
+HttpCancelToken::HttpCancelToken() :
+    m_is_canceled(0),
+    m_n_waiting_threads(0)
+{
+}
+
+HttpCancelToken::~HttpCancelToken()
+{
+}
+
+void HttpCancelToken::cancel()
+{
+    AutoLock lck(m_condition);
+
+    m_is_canceled.store(1);
+
+    // A client that checked the token before it was canceled sees the abort of its socket
+    for (std::vector<Socket *>::iterator i = m_sockets.begin(); i != m_sockets.end(); ++i) {
+        (*i)->abort();
+    }
+
+    for (uint32_t i = 0; i < m_n_waiting_threads; i++) {
+        m_condition.notify();
+    }
+}
+
+void HttpCancelToken::reset()
+{
+    AutoLock lck(m_condition);
+
+    m_is_canceled.store(0);
+}
+
+bool HttpCancelToken::is_canceled() const
+{
+    return m_is_canceled.load() != 0;
+}
+
+bool HttpCancelToken::wait(uint32_t timeout_in_ms)
+{
+    AutoLock lck(m_condition);
+
+    if (!is_canceled()) {
+        m_n_waiting_threads++;
+        m_condition.wait_without_lock(timeout_in_ms);
+        m_n_waiting_threads--;
+    }
+
+    return is_canceled();
+}
+
+void HttpCancelToken::attach(Socket &socket)
+{
+    AutoLock lck(m_condition);
+
+    m_sockets.push_back(&socket);
+}
+
+void HttpCancelToken::detach(Socket &socket)
+{
+    AutoLock lck(m_condition);
+
+    std::vector<Socket *>::iterator i = std::find(m_sockets.begin(), m_sockets.end(), &socket);
+    if (i != m_sockets.end()) {
+        m_sockets.erase(i);
+    }
+}
@@ -23,21 +23,26 @@
 ///
 
 #include <http_client/HttpClient.h>
+#include <http_client/HttpCancelToken.h>
 #include <http_client/IHttpData.h>
 
 #include <porting_layer/Log.h>
 #include <porting_layer/Thread.h>
+#include <porting_layer/TimeStamp.h>
 #include <utils/utils.h>
 #include <utils/base64.h>
+#include <utils/Metrics.h>
 
 #include <algorithm>
 
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 static const unsigned int CHUNK_SIZE = 4096;
 static const unsigned int READ_BUF_SIZE = 4096;
+static const unsigned int MAX_HEADER_SIZE = 256 * 1024; // Of the complete header block
 
 using namespace ctvc;
 
@@ -45,13 +50,77 @@ const ResultCode HttpClient::UNRECOGNIZED_PROTOCOL("Protocol (e.g. http://) not
 const ResultCode HttpClient::PROTOCOL_ERROR("Encountered some HTTP protocol violation");
 const ResultCode HttpClient::CONNECTION_CLOSED("Connection was closed by peer");
 const ResultCode HttpClient::EXCEEDED_MAX_REDIRECTIONS("The maximum number of redirections have been exceeded");
+const ResultCode HttpClient::FIRST_BYTE_TIMEOUT("The server did not start to respond within the timeout of the request");
+const ResultCode HttpClient::REQUEST_TIMEOUT("The request did not complete within the total timeout");
+const ResultCode HttpClient::CANCELED("The request was canceled");
+
+namespace {
+
+// Metrics of all HTTP clients together
+struct HttpClientMetrics
+{
+    HttpClientMetrics() :
+        requests(Metrics::get_counter("http_client.requests")),
+        redirects(Metrics::get_counter("http_client.redirects")),
+        errors(Metrics::get_counter("http_client.errors")),
+        timeouts(Metrics::get_counter("http_client.timeouts")),
+        cancellations(Metrics::get_counter("http_client.cancellations")),
+        response_time(Metrics::get_distribution("http_client.response_time_ms", 60000)),
+        bytes_sent(Metrics::get_counter("http_client.bytes_sent")),
+        bytes_received(Metrics::get_counter("http_client.bytes_received"))
+    {
+    }
+
+    Metrics::Counter &requests;
+    Metrics::Counter &redirects;
+    Metrics::Counter &errors;
+    Metrics::Counter &timeouts; // Connect, first byte, receive and total timeouts
+    Metrics::Counter &cancellations;
+    Metrics::Distribution &response_time; // From the start of the request up to the end of the response headers
+    Metrics::Counter &bytes_sent;
+    Metrics::Counter &bytes_received;
+};
+
+HttpClientMetrics &get_metrics()
+{
+    static HttpClientMetrics s_metrics;
+
+    return s_metrics;
+}
+
+} // namespace
+
+// Shorten timeout_in_ms to the time that is left until deadline, which ends the request with result
+static bool limit_timeout(const TimeStamp &deadline, const ResultCode &result, uint32_t &timeout_in_ms/*in,out*/, ResultCode &timeout_result/*in,out*/)
+{
+    int64_t time_left_in_ms = (deadline - TimeStamp::now()).get_as_milliseconds();
+    if (time_left_in_ms <= 0) {
+        timeout_result = result;
+        return false;
+    }
+    if (timeout_in_ms == 0 || time_left_in_ms < timeout_in_ms) {
+        timeout_in_ms = static_cast<uint32_t>(time_left_in_ms);
+        timeout_result = result;
+    }
+
+    return true;
+}
 
 HttpClient::HttpClient() :
     m_socket(),
+    m_cancel_token(0),
     m_timeout(0),
+    m_connect_timeout_in_ms(0),
+    m_receive_timeout_in_ms(0),
+    m_total_timeout_in_ms(0),
+    m_is_waiting_for_first_byte(false),
     m_response_code(0),
     m_is_chunked_data(false),
     m_content_length(0),
+    m_range_start(0),
+    m_response_range_start(0),
+    m_body_length_left(0),
+    m_chunk_state(CHUNK_SIZE_START),
     m_num_custom_headers(0),
     m_max_redirections(10),
     m_rx_buf(new char[READ_BUF_SIZE]),
@@ -63,6 +132,8 @@ HttpClient::HttpClient() :
 
 HttpClient::~HttpClient()
 {
+    set_cancel_token(0);
+
     delete[] m_rx_buf;
 }
 
@@ -84,6 +155,48 @@ void HttpClient::set_custom_headers(const char * const *headers, uint32_t pairs)
     m_num_custom_headers = pairs;
 }
 
+void HttpClient::set_range(uint64_t first_byte_position)
+{
+    m_range_start = first_byte_position;
+}
+
+void HttpClient::set_receive_timeout(uint32_t timeout_in_ms)
+{
+    m_receive_timeout_in_ms = timeout_in_ms;
+}
+
+void HttpClient::set_connect_timeout(uint32_t timeout_in_ms)
+{
+    m_connect_timeout_in_ms = timeout_in_ms;
+}
+
+void HttpClient::set_total_timeout(uint32_t timeout_in_ms)
+{
+    m_total_timeout_in_ms = timeout_in_ms;
+}
+
+void HttpClient::set_cancel_token(HttpCancelToken *cancel_token)
+{
+    if (m_cancel_token) {
+        m_cancel_token->detach(m_socket);
+    }
+    m_cancel_token = cancel_token;
+    if (m_cancel_token) {
+        m_cancel_token->attach(m_socket);
+    }
+}
+
+bool HttpClient::is_canceled() const
+{
+    return m_cancel_token && m_cancel_token->is_canceled();
+}
+
+void HttpClient::set_receive_buffer_size(uint32_t size)
+{
+    // The size is kept for the sockets of the next connects if the socket is not open now
+    m_socket.set_receive_buffer_size(size);
+}
+
 ResultCode HttpClient::get(const char *url, int timeout /*= HTTP_CLIENT_DEFAULT_TIMEOUT*/)
 {
     return connect(url, "GET", NULL, timeout);
@@ -118,6 +231,34 @@ int HttpClient::get_response_code()
     return m_response_code;
 }
 
+bool HttpClient::get_response_header(const char *name, std::string &value/*out*/) const
+{
+    for (std::vector<HeaderField>::const_iterator i = m_response_headers.begin(); i != m_response_headers.end(); ++i) {
+        if (!ctvc::strcasecmp(&m_header_buf[i->name], name)) {
+            value.assign(&m_header_buf[i->value], i->value_length);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t HttpClient::get_response_range_start() const
+{
+    return m_response_range_start;
+}
+
+uint32_t HttpClient::get_n_response_headers() const
+{
+    return m_response_headers.size();
+}
+
+void HttpClient::get_response_header(uint32_t index, const char *&name/*out*/, const char *&value/*out*/) const
+{
+    name = &m_header_buf[m_response_headers[index].name];
+    value = &m_header_buf[m_response_headers[index].value];
+}
+
 void HttpClient::set_max_redirections(unsigned int i)
 {
     m_max_redirections = i;
@@ -135,6 +276,11 @@ ResultCode HttpClient::connect(const char *url, const char *method, IHttpDataSou
 
     std::string redirect_location;
 
+    get_metrics().requests.add();
+    TimeStamp request_start_time(TimeStamp::now());
+    m_total_deadline = request_start_time;
+    m_total_deadline.add_milliseconds(m_total_timeout_in_ms);
+
     for (int n_redirections_left = m_max_redirections; n_redirections_left >= 0; --n_redirections_left) {
         CTVC_LOG_DEBUG("parse: [%s]", url);
 
@@ -162,12 +308,44 @@ ResultCode HttpClient::connect(const char *url, const char *method, IHttpDataSou
         m_rx_data = m_rx_buf;
         m_rx_data_len = 0;
 
+        // A new socket also forgets the abort of a canceled earlier request. Only then the token
+        // is checked, so a cancel that comes in after the check aborts the socket.
+        m_socket.open();
+        if (is_canceled()) {
+            CTVC_LOG_INFO("Request canceled");
+            m_socket.close();
+            get_metrics().cancellations.add();
+            get_metrics().errors.add();
+            return CANCELED;
+        }
+
+        // The connect timeout, limited to the time that is left of the total timeout
+        uint32_t connect_timeout_in_ms = m_connect_timeout_in_ms;
+        ResultCode timeout_result = Socket::CONNECT_TIMEOUT;
+        if (m_total_timeout_in_ms > 0 && !limit_timeout(m_total_deadline, REQUEST_TIMEOUT, connect_timeout_in_ms, timeout_result)) {
+            CTVC_LOG_WARNING("%s", timeout_result.get_description());
+            m_socket.close();
+            get_metrics().timeouts.add();
+            get_metrics().errors.add();
+            return timeout_result;
+        }
+        m_socket.set_connect_timeout(connect_timeout_in_ms);
+
         // Connect
         CTVC_LOG_DEBUG("Connecting socket to server");
         ResultCode ret = m_socket.connect(hostname.c_str(), port);
+        if (ret == Socket::ABORTED) {
+            CTVC_LOG_INFO("Request canceled");
+            ret = CANCELED;
+            get_metrics().cancellations.add();
+        } else if (ret == Socket::CONNECT_TIMEOUT) {
+            ret = timeout_result;
+            get_metrics().timeouts.add();
+        }
         if (ret.is_error()) {
             CTVC_LOG_ERROR("Unable to connect: %s", ret.get_description());
             m_socket.close();
+            get_metrics().errors.add();
             return ret;
         }
 
@@ -175,6 +353,7 @@ ResultCode HttpClient::connect(const char *url, const char *method, IHttpDataSou
         ret = send_headers(method, path, hostname, port, authorization, data_source);
         if (ret.is_error()) {
             m_socket.close();
+            get_metrics().errors.add();
             return ret;
         }
 
@@ -183,25 +362,32 @@ ResultCode HttpClient::connect(const char *url, const char *method, IHttpDataSou
             ret = send_data(data_source);
             if (ret.is_error()) {
                 m_socket.close();
+                get_metrics().errors.add();
                 return ret;
             }
         }
 
         // Receive response
         CTVC_LOG_DEBUG("Receiving response");
+        m_is_waiting_for_first_byte = true;
+        m_first_byte_deadline = TimeStamp::now();
+        m_first_byte_deadline.add_milliseconds(timeout > 0 ? timeout : 0);
         ret = receive_headers(redirect_location);
         if (ret.is_error()) {
             m_socket.close();
+            get_metrics().errors.add();
             return ret;
         }
 
         if (!redirect_location.empty()) {
             if (n_redirections_left <= 0) {
                 CTVC_LOG_ERROR("Exceeded max number of redirections:%d", m_max_redirections);
+                get_metrics().errors.add();
                 return EXCEEDED_MAX_REDIRECTIONS;
             }
             url = redirect_location.c_str();
             CTVC_LOG_INFO("Following redirect[%d] to [%s]", m_max_redirections - n_redirections_left + 1, url);
+            get_metrics().redirects.add();
             m_socket.close();
         } else {
             break;
@@ -209,6 +395,7 @@ ResultCode HttpClient::connect(const char *url, const char *method, IHttpDataSou
     }
 
     CTVC_LOG_DEBUG("Done receiving response header");
+    get_metrics().response_time.add_sample((TimeStamp::now() - request_start_time).get_as_milliseconds());
 
     return ResultCode::SUCCESS;
 }
@@ -224,14 +411,10 @@ ResultCode HttpClient::receive(IHttpDataSink *data_sink)
 
     // Receive data
     CTVC_LOG_DEBUG("Receiving data");
-    ResultCode ret;
-    if (m_is_chunked_data) {
-        ret = receive_chunked_data(data_sink);
-    } else {
-        ret = receive_data(m_content_length, data_sink);
-    }
+    ResultCode ret = receive_body(data_sink);
     if (ret.is_error()) {
         m_socket.close();
+        get_metrics().errors.add();
         return ret;
     }
 
@@ -266,6 +449,10 @@ ResultCode HttpClient::send_headers(const char *method, const std::string &path,
         tmp += "\r\n";
     }
 
+    if (m_range_start > 0) {
+        string_printf_append(tmp, "Range: bytes=%llu-\r\n", static_cast<unsigned long long>(m_range_start));
+    }
+
     // Create default headers
     if (data_source) {
         if (data_source->get_is_chunked()) {
@@ -353,201 +540,413 @@ void HttpClient::read_data(uint32_t n)
     }
 }
 
-ResultCode HttpClient::read_crlf()
+ResultCode HttpClient::receive_headers(std::string &redirect_location/*out*/)
 {
-    // There must be at least 2 bytes in the buffer
-    while (m_rx_data_len < 2) {
-        ResultCode ret = recv();
-        if (ret.is_error()) {
-            return ret;
-        }
-    }
+    m_is_chunked_data = false;
+    m_content_length = 0;
+    m_data_type = "";
+    m_response_range_start = 0;
+    m_response_headers.clear();
+    redirect_location = "";
 
-    // Check CRLF
-    if ((m_rx_data[0] != '\r') || (m_rx_data[1] != '\n')) {
-        CTVC_LOG_ERROR("Format error");
-        return PROTOCOL_ERROR;
+    if (m_header_buf.size() < READ_BUF_SIZE) {
+        m_header_buf.resize(READ_BUF_SIZE);
     }
 
-    // Skip CRLF
-    read_data(2);
+    // The header block is parsed in a single pass: each received byte is searched for the end of
+    // its line only once, and complete lines are parsed in place. Only offsets are kept, as the
+    // buffer may be reallocated when it grows.
+    uint32_t length = 0;
+    uint32_t line_start = 0;
+    uint32_t scan_start = 0; // The bytes before it don't end the current line
+    bool is_status_line = true;
 
-    return ResultCode::SUCCESS;
-}
+    while (true) {
+        char *buf = &m_header_buf[0];
+        const char *eol = static_cast<const char *>(memchr(buf + scan_start, '\n', length - scan_start));
+        if (!eol) {
+            scan_start = length;
+            if (length == m_header_buf.size()) {
+                if (length >= MAX_HEADER_SIZE) {
+                    CTVC_LOG_ERROR("Response headers too big (>%u bytes)", MAX_HEADER_SIZE);
+                    return PROTOCOL_ERROR;
+                }
+                m_header_buf.resize(std::min(2 * length, MAX_HEADER_SIZE));
+            }
 
-ResultCode HttpClient::find_line(uint32_t &line_length/*out*/)
-{
-    for (uint32_t n = 0; ; n++) {
-        while (m_rx_data_len < n + 2) { // Read at least enough for a CRLF
-            ResultCode ret = recv();
+            uint32_t read_len = 0;
+            ResultCode ret = recv(&m_header_buf[length], m_header_buf.size() - length, read_len);
             if (ret.is_error()) {
                 return ret;
             }
+            length += read_len;
+            continue;
         }
 
-        if (m_rx_data[n] == '\r' && m_rx_data[n + 1] == '\n') {
-            m_rx_data[n] = '\0'; // Terminate line to enable sscanf() by caller
-            line_length = n + 2; // Include CRLF in line length
-            return ResultCode::SUCCESS;
+        uint32_t line_end = eol - buf;
+        uint32_t line_length = line_end - line_start;
+        if (line_length > 0 && buf[line_end - 1] == '\r') {
+            line_length--;
         }
-    }
-}
+        scan_start = line_end + 1;
 
-ResultCode HttpClient::receive_headers(std::string &redirect_location/*out*/)
-{
-    m_is_chunked_data = false;
-    m_content_length = 0;
-    m_data_type = "";
-    redirect_location = "";
+        if (is_status_line) {
+            ResultCode ret = parse_status_line(buf + line_start, line_length);
+            if (ret.is_error()) {
+                return ret;
+            }
 
-    uint32_t line_length = 0;
-    ResultCode ret = find_line(line_length);
-    if (ret.is_error()) {
-        return ret;
-    }
+            if ((m_response_code < 200) || (m_response_code >= 400)) {
+                CTVC_LOG_WARNING("Response code %d", m_response_code);
+                return PROTOCOL_ERROR;
+            }
 
-    CTVC_LOG_DEBUG("Received %u chars; Line: [%s], line_length=%u", m_rx_data_len, m_rx_data, line_length);
+            CTVC_LOG_DEBUG("Reading headers");
+            is_status_line = false;
+        } else if (line_length == 0) {
+            // End of headers, the rest is the start of the body
+            m_rx_data = buf + scan_start;
+            m_rx_data_len = length - scan_start;
+            break;
+        } else {
+            ResultCode ret = parse_header_line(line_start, line_length);
+            if (ret.is_error()) {
+                return ret;
+            }
+        }
 
-    // Parse HTTP response
-    if (sscanf(m_rx_data, "HTTP/%*d.%*d %d %*[^\r\n]", &m_response_code) != 1) {
-        // Cannot match string, error
-        CTVC_LOG_ERROR("Not a correct HTTP answer: {%s}", m_rx_data);
-        return PROTOCOL_ERROR;
+        line_start = scan_start;
     }
 
-    read_data(line_length);
-
-    if ((m_response_code < 200) || (m_response_code >= 400)) {
-        CTVC_LOG_WARNING("Response code %d", m_response_code);
-        return PROTOCOL_ERROR;
+    CTVC_LOG_DEBUG("Headers read");
+
+    for (std::vector<HeaderField>::const_iterator i = m_response_headers.begin(); i != m_response_headers.end(); ++i) {
+        const char *key = &m_header_buf[i->name];
+        const char *value = &m_header_buf[i->value];
+        if (!ctvc::strcasecmp(key, "Content-Length")) {
+            char *end = 0;
+            unsigned long content_length = strtoul(value, &end, 10);
+            if (*value < '0' || *value > '9' || *end != '\0' || content_length > 0xFFFFFFFFUL) {
+                CTVC_LOG_ERROR("Invalid Content-Length: %s", value);
+                return PROTOCOL_ERROR;
+            }
+            m_content_length = static_cast<uint32_t>(content_length);
+        } else if (!ctvc::strcasecmp(key, "Transfer-Encoding")) {
+            if (!ctvc::strcasecmp(value, "Chunked")) {
+                m_is_chunked_data = true;
+            }
+        } else if (!ctvc::strcasecmp(key, "Content-Type")) {
+            m_data_type = value;
+        } else if (!ctvc::strcasecmp(key, "Location")) {
+            redirect_location = value;
+        } else if (!ctvc::strcasecmp(key, "Content-Range") && m_response_code == 206) {
+            // bytes <first>-<last>/<length>
+            if (ctvc::strncasecmp(value, "bytes ", 6) || value[6] < '0' || value[6] > '9') {
+                CTVC_LOG_ERROR("Invalid Content-Range: %s", value);
+                return PROTOCOL_ERROR;
+            }
+            m_response_range_start = strtoull(value + 6, 0, 10);
+        }
     }
 
-    CTVC_LOG_DEBUG("Reading headers");
+    return ResultCode::SUCCESS;
+}
 
-    // Now get headers
-    while (true) {
-        ret = find_line(line_length);
-        if (ret.is_error()) {
-            return ret;
-        }
+ResultCode HttpClient::parse_status_line(const char *line, uint32_t length)
+{
+    CTVC_LOG_DEBUG("Status line: [%.*s]", static_cast<int>(length), line);
 
-        CTVC_LOG_DEBUG("Received %u chars; Line: [%s], line_length=%u", m_rx_data_len, m_rx_data, line_length);
+    // HTTP/<major>.<minor> <3-digit status code> <reason phrase>
+    const char *end = line + length;
+    const char *status_code = length > 5 && !memcmp(line, "HTTP/", 5) ? static_cast<const char *>(memchr(line, ' ', length)) : 0;
+    if (!status_code || end - status_code < 4 || (end - status_code > 4 && status_code[4] != ' ')) {
+        CTVC_LOG_ERROR("Not a correct HTTP answer: {%.*s}", static_cast<int>(length), line);
+        return PROTOCOL_ERROR;
+    }
 
-        if (line_length == 2) { // End of headers
-            CTVC_LOG_DEBUG("Headers read");
-            read_data(line_length);
-            return ResultCode::SUCCESS;
+    int response_code = 0;
+    for (const char *p = status_code + 1; p < status_code + 4; p++) {
+        if (*p < '0' || *p > '9') {
+            CTVC_LOG_ERROR("Not a correct HTTP answer: {%.*s}", static_cast<int>(length), line);
+            return PROTOCOL_ERROR;
         }
+        response_code = response_code * 10 + (*p - '0');
+    }
+    m_response_code = response_code;
 
-        char key[32];
-        char value[121];
+    return ResultCode::SUCCESS;
+}
 
-        key[31] = '\0';
-        value[120] = '\0';
+static bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\t';
+}
 
-        int n = sscanf(m_rx_data, "%31[^:]: %120[^\r\n]", key, value);
-        if (n == 2) {
-            CTVC_LOG_DEBUG("Read header: %s: %s", key, value);
-            if (!ctvc::strcasecmp(key, "Content-Length")) {
-                sscanf(value, "%u", &m_content_length);
-            } else if (!ctvc::strcasecmp(key, "Transfer-Encoding")) {
-                if (!ctvc::strcasecmp(value, "Chunked")) {
-                    m_is_chunked_data = true;
-                }
-            } else if (!ctvc::strcasecmp(key, "Content-Type")) {
-                m_data_type = value;
-            } else if (!ctvc::strcasecmp(key, "Location")) {
-                redirect_location = value;
-                return ResultCode::SUCCESS; // Exit to follow the redirect
-            }
-            read_data(line_length);
-        } else {
+ResultCode HttpClient::parse_header_line(uint32_t offset, uint32_t length)
+{
+    char *base = &m_header_buf[0];
+    char *line = base + offset;
+    char *end = line + length; // At the CR or LF, which may be overwritten
+
+    if (is_whitespace(*line)) {
+        // Obsolete line folding: the line continues the value of the previous header. The line break
+        // is replaced by spaces, so the value stays contiguous.
+        if (m_response_headers.empty()) {
             CTVC_LOG_ERROR("Could not parse header");
             return PROTOCOL_ERROR;
         }
+        while (end > line && is_whitespace(end[-1])) {
+            end--;
+        }
+        if (end > line) {
+            HeaderField &field(m_response_headers.back());
+            char *value_end = base + field.value + field.value_length;
+            memset(value_end, ' ', line - value_end);
+            field.value_length = end - (base + field.value);
+            *end = '\0';
+        }
+        return ResultCode::SUCCESS;
+    }
+
+    char *colon = static_cast<char *>(memchr(line, ':', length));
+    if (!colon || colon == line) {
+        CTVC_LOG_ERROR("Could not parse header: [%.*s]", static_cast<int>(length), line);
+        return PROTOCOL_ERROR;
+    }
+
+    char *name_end = colon;
+    while (name_end > line && is_whitespace(name_end[-1])) {
+        name_end--;
+    }
+    char *value = colon + 1;
+    while (value < end && is_whitespace(*value)) {
+        value++;
+    }
+    char *value_end = end;
+    while (value_end > value && is_whitespace(value_end[-1])) {
+        value_end--;
     }
+    *name_end = '\0';
+    *value_end = '\0';
+
+    HeaderField field;
+    field.name = offset;
+    field.value = value - base;
+    field.value_length = value_end - value;
+    m_response_headers.push_back(field);
+
+    CTVC_LOG_DEBUG("Read header: %s: %s", line, value);
+
+    return ResultCode::SUCCESS;
 }
 
-ResultCode HttpClient::receive_chunked_data(IHttpDataSink *data_sink)
+ResultCode HttpClient::receive_body(IHttpDataSink *data_sink)
 {
-    while (true) {
-        // Read chunk header
-        uint32_t line_length = 0;
-        ResultCode ret = find_line(line_length);
+    m_body_length_left = m_is_chunked_data ? 0 : m_content_length;
+    m_chunk_state = CHUNK_SIZE_START;
+
+    if (!m_is_chunked_data && m_content_length == 0) {
+        return ResultCode::SUCCESS;
+    }
+
+    // First the data that was received together with the headers
+    bool is_done = false;
+    if (m_rx_data_len > 0) {
+        uint32_t length = m_rx_data_len;
+        ResultCode ret = decode_body(m_rx_data, length, is_done);
         if (ret.is_error()) {
             return ret;
         }
+        if (data_sink && length > 0) {
+            data_sink->write(m_rx_data, length);
+        }
+        read_data(m_rx_data_len);
+    }
 
-        // Similar to sscanf or strtol(s, 0, 16) but much faster, which saves around 1% of overall CPU.
-        uint32_t chunk_len = atox(m_rx_data);
-
-        read_data(line_length);
-
-        if (chunk_len == 0) {
-            // Last chunk
-            return ResultCode::SUCCESS;
+    // Then receive in the buffer of the data sink if it has one, so the data doesn't have to be copied
+    while (!is_done) {
+        uint32_t size = 0;
+        char *buf = data_sink ? data_sink->get_write_buffer(size) : 0;
+        bool is_sink_buffer = buf && size > 0;
+        if (!is_sink_buffer) {
+            buf = m_rx_buf;
+            size = READ_BUF_SIZE;
+        }
+        if (!m_is_chunked_data) {
+            size = std::min(size, m_body_length_left); // Don't read beyond the body
         }
 
-        ret = receive_data(chunk_len, data_sink);
+        uint32_t length = 0;
+        ResultCode ret = recv(buf, size, length);
         if (ret.is_error()) {
             return ret;
         }
 
-        ret = read_crlf();
+        ret = decode_body(buf, length, is_done);
         if (ret.is_error()) {
             return ret;
         }
+
+        if (is_sink_buffer) {
+            data_sink->commit_write(length);
+        } else if (data_sink && length > 0) {
+            data_sink->write(buf, length);
+        }
+    }
+
+    return ResultCode::SUCCESS;
+}
+
+ResultCode HttpClient::decode_body(char *data, uint32_t &length/*in,out*/, bool &is_done/*out*/)
+{
+    if (m_is_chunked_data) {
+        return decode_chunked_data(data, length, is_done);
     }
+
+    length = std::min(length, m_body_length_left);
+    m_body_length_left -= length;
+    is_done = m_body_length_left == 0;
+
+    return ResultCode::SUCCESS;
 }
 
-ResultCode HttpClient::receive_data(uint32_t content_length, IHttpDataSink *data_sink)
+ResultCode HttpClient::decode_chunked_data(char *data, uint32_t &length/*in,out*/, bool &is_done/*out*/)
 {
-    while (content_length > 0) {
-        uint32_t n = std::min(m_rx_data_len, content_length);
+    // The chunk framing is removed in place: chunk data that follows framing is moved down over it.
+    // The state is kept between calls, so the framing may be split over several receives.
+    char *out = data;
+    const char *p = data;
+    const char *end = data + length;
+
+    is_done = false;
+
+    while (p < end && !is_done) {
+        switch (m_chunk_state) {
+        case CHUNK_DATA: {
+            uint32_t n = std::min(static_cast<uint32_t>(end - p), m_body_length_left);
+            if (out != p) {
+                memmove(out, p, n);
+            }
+            out += n;
+            p += n;
+            m_body_length_left -= n;
+            if (m_body_length_left == 0) {
+                m_chunk_state = CHUNK_DATA_CR;
+            }
+            continue;
+        }
+
+        case CHUNK_SIZE_START:
+        case CHUNK_SIZE: {
+            char c = *p;
+            uint32_t digit = 16;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                digit = c - 'A' + 10;
+            }
 
-        if (data_sink) {
-            data_sink->write(m_rx_data, n);
+            if (digit < 16) {
+                if (m_body_length_left > 0x0FFFFFFF) {
+                    CTVC_LOG_ERROR("Chunk too big");
+                    return PROTOCOL_ERROR;
+                }
+                m_body_length_left = (m_body_length_left << 4) | digit;
+                m_chunk_state = CHUNK_SIZE;
+            } else if (m_chunk_state == CHUNK_SIZE && (c == ';' || c == ' ' || c == '\t')) {
+                m_chunk_state = CHUNK_EXTENSION;
+            } else if (m_chunk_state == CHUNK_SIZE && c == '\r') {
+                m_chunk_state = CHUNK_SIZE_LF;
+            } else {
+                CTVC_LOG_ERROR("Format error in chunk size");
+                return PROTOCOL_ERROR;
+            }
+            break;
         }
 
-        read_data(n);
+        case CHUNK_EXTENSION:
+            if (*p == '\r') {
+                m_chunk_state = CHUNK_SIZE_LF;
+            }
+            break;
 
-        content_length -= n;
+        case CHUNK_SIZE_LF:
+            if (*p != '\n') {
+                CTVC_LOG_ERROR("Format error");
+                return PROTOCOL_ERROR;
+            }
+            if (m_body_length_left == 0) {
+                // Last chunk, the connection is closed so any trailer is not read
+                is_done = true;
+            }
+            m_chunk_state = CHUNK_DATA;
+            break;
 
-        if (content_length > 0) {
-            ResultCode ret = recv();
-            if (ret.is_error()) {
-                return ret;
+        case CHUNK_DATA_CR:
+            if (*p != '\r') {
+                CTVC_LOG_ERROR("Format error");
+                return PROTOCOL_ERROR;
+            }
+            m_chunk_state = CHUNK_DATA_LF;
+            break;
+
+        case CHUNK_DATA_LF:
+            if (*p != '\n') {
+                CTVC_LOG_ERROR("Format error");
+                return PROTOCOL_ERROR;
             }
+            m_chunk_state = CHUNK_SIZE_START;
+            break;
         }
+
+        p++;
     }
 
+    length = out - data;
+
     return ResultCode::SUCCESS;
 }
 
-ResultCode HttpClient::recv()
+ResultCode HttpClient::recv(char *buf, uint32_t size, uint32_t &length/*out*/)
 {
-    // Move the data from the end of the buffer it there is not enough left to read a minimal amount of data
-    // (This part can only be unit tested with the current tests if m_rx_buf size == 120)
-    if (m_rx_data != m_rx_buf) {
-        if (m_rx_buf_end - m_rx_data < 16 || m_rx_data_len < 2 || m_rx_data + m_rx_data_len == m_rx_buf_end) {
-            memmove(m_rx_buf, m_rx_data, m_rx_data_len);
-            m_rx_data = m_rx_buf;
-        }
+    length = 0;
+
+    // Wait for data up to the nearest deadline
+    uint32_t timeout_in_ms = m_receive_timeout_in_ms;
+    ResultCode timeout_result = Socket::RECEIVE_TIMEOUT;
+    bool is_before_deadline = true;
+    if (m_is_waiting_for_first_byte && m_timeout > 0) {
+        is_before_deadline = limit_timeout(m_first_byte_deadline, FIRST_BYTE_TIMEOUT, timeout_in_ms, timeout_result);
+    }
+    if (is_before_deadline && m_total_timeout_in_ms > 0) {
+        is_before_deadline = limit_timeout(m_total_deadline, REQUEST_TIMEOUT, timeout_in_ms, timeout_result);
     }
 
-    if (m_rx_data + m_rx_data_len >= m_rx_buf_end) {
-        CTVC_LOG_ERROR("Received data too big for buffer (%ld)", static_cast<long>(m_rx_buf_end - m_rx_buf));
-        return PROTOCOL_ERROR;
+    ResultCode ret = Socket::RECEIVE_TIMEOUT;
+    if (is_before_deadline) {
+        m_socket.set_receive_timeout(timeout_in_ms);
+        ret = m_socket.receive(reinterpret_cast<uint8_t *>(buf), size, length);
+    }
+    get_metrics().bytes_received.add(length);
+    if (length > 0) {
+        m_is_waiting_for_first_byte = false;
     }
 
-    uint32_t read_len = 0;
-    ResultCode ret = m_socket.receive(reinterpret_cast<uint8_t *>(m_rx_data + m_rx_data_len), m_rx_buf_end - (m_rx_data + m_rx_data_len), read_len); // TODO: (CNP-2069) Make timeout operational
-    m_rx_data_len += read_len;
-    if (ret.is_ok() && read_len == 0) {
+    if (ret.is_ok() && length == 0) {
         CTVC_LOG_WARNING("Connection was closed by server");
         return CONNECTION_CLOSED;
     } else if (ret == Socket::THREAD_SHUTDOWN) {
         CTVC_LOG_INFO("Connection to be closed by us");
+    } else if (ret == Socket::ABORTED) {
+        CTVC_LOG_INFO("Request canceled");
+        get_metrics().cancellations.add();
+        ret = CANCELED;
+    } else if (ret == Socket::RECEIVE_TIMEOUT) {
+        ret = timeout_result;
+        CTVC_LOG_WARNING("%s", ret.get_description());
+        get_metrics().timeouts.add();
     } else if (ret.is_error()) {
         CTVC_LOG_ERROR("Connection error: %s", ret.get_description());
     }
@@ -563,9 +962,19 @@ ResultCode HttpClient::send(const char *buf, uint32_t len)
 
     CTVC_LOG_DEBUG("Sending %u bytes", len);
 
-    ResultCode ret = m_socket.send(reinterpret_cast<const uint8_t *>(buf), len); // TODO: (CNP-2069) Make timeout operational
+    // Sending doesn't wait for the server unless its receive window is full, so the deadlines are
+    // only checked when receiving
+    if (is_canceled()) {
+        CTVC_LOG_INFO("Request canceled");
+        get_metrics().cancellations.add();
+        return CANCELED;
+    }
+
+    ResultCode ret = m_socket.send(reinterpret_cast<const uint8_t *>(buf), len);
     if (ret.is_error()) {
         CTVC_LOG_ERROR("Connection error: %s", ret.get_description());
+    } else {
+        get_metrics().bytes_sent.add(len);
     }
     return ret;
 }
@@ -62,4 +62,98 @@ private:
     T m_value;
 };
 
+/// \brief Atomic integer that uses lock-free operations where the compiler supports them.
+///
+/// This template class is meant for counters, indices and flags that are accessed on
+/// time-critical paths, where the mutex of Atomic would be too expensive.
+/// T must be an integer type no larger than the native word size.
+/// If the compiler provides no atomic built-ins, a mutex is used instead.
+template<typename T> struct AtomicInteger
+{
+    AtomicInteger() :
+        m_value(0)
+    {
+    }
+
+    /// \brief Construct an atomic integer.
+    AtomicInteger(T value) :
+        m_value(value)
+    {
+    }
+
+    ~AtomicInteger()
+    {
+    }
+
+#if defined __GNUC__
+    /// \brief Get the value. Memory accesses after this call are not moved before it.
+    T load() const
+    {
+        T value = m_value;
+        __sync_synchronize();
+        return value;
+    }
+
+    /// \brief Assign new \a value. Memory accesses before this call are not moved after it.
+    void store(T value)
+    {
+        __sync_synchronize();
+        m_value = value;
+    }
+
+    /// \brief Add \a delta to the value.
+    /// \return The value before the addition.
+    T fetch_add(T delta)
+    {
+        return __sync_fetch_and_add(&m_value, delta);
+    }
+
+    /// \brief Replace the value by \a desired if it equals \a expected.
+    /// \return True if the value was replaced, false otherwise.
+    bool compare_and_swap(T expected, T desired)
+    {
+        return __sync_bool_compare_and_swap(&m_value, expected, desired);
+    }
+#else
+    T load() const
+    {
+        AutoLock l(m_mutex);
+        return m_value;
+    }
+
+    void store(T value)
+    {
+        AutoLock l(m_mutex);
+        m_value = value;
+    }
+
+    T fetch_add(T delta)
+    {
+        AutoLock l(m_mutex);
+        T value = m_value;
+        m_value += delta;
+        return value;
+    }
+
+    bool compare_and_swap(T expected, T desired)
+    {
+        AutoLock l(m_mutex);
+        if (m_value != expected) {
+            return false;
+        }
+        m_value = desired;
+        return true;
+    }
+#endif
+
+private:
+    AtomicInteger(const AtomicInteger &rhs);
+    AtomicInteger &operator=(const AtomicInteger &value);
+
+#if !defined __GNUC__
+    mutable Mutex m_mutex;
+#endif
+    volatile T m_value;
+};
+
 } // namespace
@@ -14,6 +14,9 @@
 #include <string>
 #include <set>
 
+#include <stdarg.h>
+#include <inttypes.h>
+
 namespace ctvc {
 
 /// \brief Log output forwarding interface
@@ -138,6 +141,25 @@ public:
         log_message(message_type, 0, 0, 0, message);
     }
 
+    /// \brief Forwards a printf-style log message to all registered ILogOutput interfaces
+    /// \param[in] message_type Log level \see Log.h
+    /// \param[in] file Name of the source file issuing the log.
+    /// \param[in] line Line number of the source code issuing the log.
+    /// \param[in] function Function that issues the log.
+    /// \param[in] fmt printf-style format string of the log message
+    /// \param[in] args Arguments of the format string
+    /// In asynchronous mode, the message is expanded directly into the log queue.
+    void vlog_message(LogMessageType message_type, const char *file, int line, const char *function, const char *fmt, va_list args) const;
+
+    /// \brief Enables or disables asynchronous logging.
+    /// \param[in] enable True to enable asynchronous logging, false to return to synchronous logging.
+    /// In asynchronous mode, a log call only expands the message text into a fixed-size record in a lock-free queue.
+    /// A background thread applies the log format and forwards the result to the registered outputs (or stderr).
+    /// Messages are truncated to the record size and messages logged while the queue is full are dropped; the
+    /// number of dropped messages is reported in the log. Disabling outputs all queued messages before returning.
+    /// \note The registered ILogOutput interfaces are called from the background thread in asynchronous mode.
+    void set_async_logging(bool enable);
+
     /// \brief Set base store path for get/set/delete_secure_data and cookie files
     /// \param[in] path The path
     void set_base_store_path(const char *path)
@@ -158,10 +180,16 @@ public:
     X11KeyMap &get_keymap();
 
 private:
+    class AsyncLog;
+    friend class AsyncLog;
+
     // Constructor and destructor are private for as long as ClientContext is a singleton
     ClientContext();
     ~ClientContext();
 
+    void format_log_message(std::string &log_message, LogMessageType message_type, int64_t time_in_us, const char *file, int line, const char *function, const char *thread_name, const char *message) const;
+    void output_log_message(LogMessageType message_type, const std::string &log_message) const;
+
     std::string m_manufacturer;
     std::string m_devicetype;
     std::string m_unique_id;
@@ -176,6 +204,8 @@ private:
 
     X11KeyMap m_keymap;
 
+    AsyncLog &m_async_log;
+
     mutable Mutex m_mutex;
 };
 
@@ -11,6 +11,7 @@
 #include <inttypes.h>
 #include <string>
 #include <vector>
+#include <time.h>
 
 namespace ctvc {
 
@@ -81,6 +82,19 @@ public:
     /// \result ResultCode
     ResultCode get_data(const char *id, std::string &data/*out*/);
 
+    /// \brief Description of a stored item, \see get_items().
+    struct ItemInfo
+    {
+        std::string id;            ///< The id of the data.
+        uint32_t length;           ///< The length of the data.
+        time_t modification_time;  ///< The time at which the data was last saved.
+    };
+
+    /// \brief This is called to get all stored persistent data items, e.g. to clean up items of an earlier run.
+    /// \param[out] items The stored items, in no particular order.
+    /// \result ResultCode
+    ResultCode get_items(std::vector<ItemInfo> &items/*out*/);
+
     /// \brief This is called to delete persistent data.
     /// \param[in] id The id of the data.
     /// \result ResultCode
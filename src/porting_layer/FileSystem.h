@@ -1,7 +1,24 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+#include <time.h>
+
 namespace ctvc {
 
 extern const char FILE_SEPARATOR;
 
+struct FileInfo
+{
+    std::string name;
+    uint32_t size;
+    time_t modification_time;
+};
+
+// Get the regular files in the directory at path (which may end in FILE_SEPARATOR). Returns false if the
+// directory can't be read.
+bool get_files_in_directory(const std::string &path, std::vector<FileInfo> &files/*out*/);
+
 } // namespace
@@ -34,6 +34,15 @@ public:
     static const ResultCode LISTEN_FAILED;               ///< The port could not be listened
     static const ResultCode SOCKET_OPTION_ACCESS_FAILED; ///< Error in the given options
     static const ResultCode THREAD_SHUTDOWN;             ///< A blocking call was interrupted because the calling thread is shut down
+    static const ResultCode RECEIVE_TIMEOUT;             ///< No data was received within the receive timeout
+    static const ResultCode ABORTED;                     ///< A blocking call was aborted from another thread
+
+    /// \brief Buffer to be sent by send_segments()
+    struct Segment
+    {
+        const uint8_t *data;
+        uint32_t length;
+    };
 
     /// \brief Interface for the implementation of socket functionality
     ///
@@ -57,11 +66,15 @@ public:
         virtual ResultCode bind(const char *host, int port) = 0;
 
         virtual ResultCode send(const uint8_t *data, uint32_t length) = 0;
+        virtual ResultCode send_segments(const Segment *segments, uint32_t n_segments) = 0;
         virtual ResultCode receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/) = 0;
 
         virtual ResultCode set_receive_buffer_size(uint32_t size) = 0;
         virtual ResultCode set_reuse_address(bool on) = 0;
         virtual ResultCode set_non_blocking(bool on) = 0;
+        virtual void set_receive_timeout(uint32_t timeout_in_ms) = 0;
+        virtual void set_connect_timeout(uint32_t timeout_in_ms) = 0;
+        virtual void abort() = 0;
         /// \}
     };
 
@@ -97,6 +110,8 @@ public:
     /// \retval SOCKET_NOT_OPEN When the socket has not been previously opened
     /// \retval HOST_NOT_FOUND When the hostname cannot be resolved or be reached
     /// \retval CONNECTION_REFUSED When the server has refused the connection request
+    /// \retval CONNECT_TIMEOUT When the connection was not established within the connect timeout \see set_connect_timeout().
+    /// \retval ABORTED When the call was aborted from another thread \see abort().
     ResultCode connect(const char *host, int port)
     {
         return m_impl.connect(host, port);
@@ -131,6 +146,20 @@ public:
         return m_impl.send(data, length);
     }
 
+    /// \brief Send several buffers with as few system calls as possible
+    ///
+    /// A TCP socket sends the segments as one contiguous stream, as if send() were called for each
+    /// of them in turn. A UDP socket sends each segment as a separate datagram.
+    /// \param[in] segments Buffers to be sent
+    /// \param[in] n_segments Number of buffers
+    /// \retval ResultCode::SUCCESS If all segments have been successfully sent
+    /// \retval SOCKET_NOT_OPEN When the socket has not been previously opened
+    /// \retval WRITE_ERROR When there was an error with the writing, e.g. the connection is closed.
+    ResultCode send_segments(const Segment *segments, uint32_t n_segments)
+    {
+        return m_impl.send_segments(segments, n_segments);
+    }
+
     /// \brief Receive data from the socket
     ///
     /// This method only can be used after a successful binding.
@@ -142,6 +171,8 @@ public:
     /// \retval SOCKET_NOT_OPEN When the socket has not been previously opened.
     /// \retval READ_ERROR When there was an error with the reading, e.g. the socket was not opened.
     /// \retval THREAD_SHUTDOWN When the call was interrupted because the calling thread is shut down.
+    /// \retval RECEIVE_TIMEOUT When no data was received within the receive timeout \see set_receive_timeout().
+    /// \retval ABORTED When the call was aborted from another thread \see abort().
     ResultCode receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/)
     {
         return m_impl.receive(data, size, length);
@@ -167,6 +198,33 @@ public:
         return m_impl.set_reuse_address(on);
     }
 
+    /// \brief Limit the time that receive() waits for data
+    ///
+    /// The socket remains usable after a timeout; a next receive() waits for the data again.
+    /// \param[in] timeout_in_ms Maximum time to wait in milliseconds, or 0 to wait until data arrives (the default).
+    void set_receive_timeout(uint32_t timeout_in_ms)
+    {
+        m_impl.set_receive_timeout(timeout_in_ms);
+    }
+
+    /// \brief Limit the time that connect() takes, including the lookup of the host name
+    /// \param[in] timeout_in_ms Maximum time in milliseconds, or 0 for the default of the platform.
+    void set_connect_timeout(uint32_t timeout_in_ms)
+    {
+        m_impl.set_connect_timeout(timeout_in_ms);
+    }
+
+    /// \brief Abort a blocking connect() or receive() of another thread
+    ///
+    /// This is the only method that may be called while another thread uses the socket. The
+    /// blocking call returns ABORTED, as do the calls to connect() and receive() that follow,
+    /// until the socket is opened again \see open(). A send() that blocks because the platform's
+    /// send buffer is full is not aborted.
+    void abort()
+    {
+        m_impl.abort();
+    }
+
     /// \brief Get the address that is bound to the network adapter (usually DHCP assigned).
     /// \param[out] local_address The local address in dotted IP notatation (e.g. 172.178.16.128).
     /// \retval ResultCode::SUCCESS If the operation succeeded.
@@ -174,6 +232,24 @@ public:
     /// \retval SOCKET_OPTION_ACCESS_FAILED If the operation failed.
     static ResultCode get_local_address(std::string &local_address);
 
+    /// \brief Wait until one or more of the given sockets can receive without waiting for data
+    ///
+    /// A socket is also ready when its connection was closed or failed, so that receive() reports
+    /// it. This lets a single thread receive from many sockets. A ready SslSocket may still wait in
+    /// receive() for the rest of a record that is only partly received.
+    /// \param[in] sockets Sockets to wait for, which are connected or bound
+    /// \param[in] n_sockets Number of sockets
+    /// \param[in] timeout_in_ms Maximum time to wait in milliseconds
+    /// \param[out] is_ready Whether each of the sockets is ready, n_sockets elements
+    /// \retval ResultCode::SUCCESS If the sockets were waited for, whether or not any is ready.
+    /// \retval READ_ERROR If the platform failed to wait.
+    static ResultCode wait_for_data(Socket *const *sockets, uint32_t n_sockets, uint32_t timeout_in_ms, bool *is_ready/*out*/);
+
+    /// \brief Start looking up a host name in the background, so a later connect() to it does not wait for the lookup.
+    /// \param[in] host Name of the host. Nothing is done for numeric addresses or names that were recently looked up.
+    /// \note On platforms that don't cache host names, this does nothing.
+    static void prefetch_host(const char *host);
+
     /// \{
     ISocket &get_impl()
     {
@@ -6,6 +6,8 @@
 
 #include <porting_layer/ClientContext.h>
 #include <porting_layer/AutoLock.h>
+#include <porting_layer/Atomic.h>
+#include <porting_layer/Semaphore.h>
 #include <porting_layer/TimeStamp.h>
 #include <porting_layer/Thread.h>
 
@@ -22,6 +24,214 @@ using namespace ctvc;
 
 static const char *DEFAULT_LOG_FORMAT = "<%T> Type:<%t> at %f:%l, %F%[, Message:<%m>%]\r\n";
 
+static const size_t MAX_LOG_MESSAGE_SIZE = 3000;
+
+static const uint32_t ASYNC_LOG_QUEUE_SIZE = 256; // Number of records, must be a power of 2
+static const size_t ASYNC_LOG_RECORD_MESSAGE_SIZE = 960; // Keeps a record around 1kB
+static const size_t ASYNC_LOG_THREAD_NAME_SIZE = 32;
+static const uint32_t ASYNC_LOG_IDLE_TIMEOUT_IN_MS = 100;
+
+static int64_t get_wall_clock_time_in_us()
+{
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    gettimeofday(&tv, 0); // Don't check error code as logging any error would recursively get into here
+
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// Queue of fixed-size log records filled by any number of logging threads and emptied by
+// a single background thread that formats and outputs them.
+// The queue is a bounded ring in which each slot carries a sequence number that tells
+// whether it is free for the producer at a given position or filled for the consumer at
+// that position. Producers claim a position with a compare-and-swap, so they never block
+// on each other or on the consumer.
+class ClientContext::AsyncLog : public Thread::IRunnable
+{
+public:
+    struct LogRecord
+    {
+        LogMessageType m_message_type;
+        int64_t m_time_in_us;
+        const char *m_file;
+        int m_line;
+        const char *m_function;
+        char m_thread_name[ASYNC_LOG_THREAD_NAME_SIZE];
+        char m_message[ASYNC_LOG_RECORD_MESSAGE_SIZE];
+    };
+
+    AsyncLog(const ClientContext &context) :
+        m_context(context),
+        m_thread("AsyncLog"),
+        m_slots(0),
+        m_is_active(0),
+        m_enqueue_position(0),
+        m_dequeue_position(0),
+        m_dropped_count(0),
+        m_reported_dropped_count(0)
+    {
+    }
+
+    ~AsyncLog()
+    {
+        stop();
+        delete[] m_slots;
+    }
+
+    bool is_active() const
+    {
+        return m_is_active.load() != 0;
+    }
+
+    bool start()
+    {
+        AutoLock lck(m_mutex);
+
+        if (m_thread.is_running()) {
+            return true;
+        }
+
+        if (!m_slots) {
+            // The queue is kept after stopping, since late logging threads may still be filling a record.
+            m_slots = new Slot[ASYNC_LOG_QUEUE_SIZE];
+            for (uint32_t i = 0; i < ASYNC_LOG_QUEUE_SIZE; i++) {
+                m_slots[i].m_sequence.store(i);
+            }
+        }
+
+        if (m_thread.start(*this, Thread::PRIO_LOW).is_error()) {
+            return false;
+        }
+
+        m_is_active.store(1);
+
+        return true;
+    }
+
+    void stop()
+    {
+        AutoLock lck(m_mutex);
+
+        if (!m_thread.is_running()) {
+            return;
+        }
+
+        m_is_active.store(0);
+
+        m_thread.stop();
+        m_semaphore.post();
+        m_thread.wait_until_stopped();
+
+        // Output whatever was queued before logging became synchronous again.
+        output_queued_records();
+    }
+
+    // Claims a record in the queue to be filled by the caller and then handed to commit().
+    // Returns 0 if the queue is full.
+    LogRecord *claim(LogMessageType message_type, const char *file, int line, const char *function, uint32_t &position)
+    {
+        position = m_enqueue_position.load();
+        for (;;) {
+            Slot &slot(m_slots[position & (ASYNC_LOG_QUEUE_SIZE - 1)]);
+            int32_t diff = static_cast<int32_t>(slot.m_sequence.load() - position);
+            if (diff == 0) {
+                // The slot is free; try to claim it.
+                if (m_enqueue_position.compare_and_swap(position, position + 1)) {
+                    break;
+                }
+                position = m_enqueue_position.load();
+            } else if (diff < 0) {
+                // The slot still holds a record of the previous round: the queue is full.
+                m_dropped_count.fetch_add(1);
+                return 0;
+            } else {
+                // Another thread claimed this position in the meantime.
+                position = m_enqueue_position.load();
+            }
+        }
+
+        LogRecord &record(m_slots[position & (ASYNC_LOG_QUEUE_SIZE - 1)].m_record);
+        record.m_message_type = message_type;
+        record.m_time_in_us = get_wall_clock_time_in_us();
+        record.m_file = file;
+        record.m_line = line;
+        record.m_function = function;
+
+        Thread *current_thread = Thread::self();
+        strncpy(record.m_thread_name, current_thread ? current_thread->get_name().c_str() : "main", sizeof(record.m_thread_name) - 1);
+        record.m_thread_name[sizeof(record.m_thread_name) - 1] = '\0';
+
+        return &record;
+    }
+
+    void commit(uint32_t position)
+    {
+        m_slots[position & (ASYNC_LOG_QUEUE_SIZE - 1)].m_sequence.store(position + 1);
+        m_semaphore.post();
+    }
+
+private:
+    struct Slot
+    {
+        AtomicInteger<uint32_t> m_sequence;
+        LogRecord m_record;
+    };
+
+    const ClientContext &m_context;
+    Mutex m_mutex; // Serializes start() and stop()
+    Thread m_thread;
+    Semaphore m_semaphore;
+    Slot *m_slots;
+    AtomicInteger<uint32_t> m_is_active;
+    AtomicInteger<uint32_t> m_enqueue_position;
+    uint32_t m_dequeue_position; // Only accessed by the consumer
+    AtomicInteger<uint32_t> m_dropped_count;
+    uint32_t m_reported_dropped_count; // Only accessed by the consumer
+    std::string m_log_message; // Only accessed by the consumer; reused to prevent reallocation
+
+    // Implements Thread::IRunnable
+    bool run()
+    {
+        m_semaphore.wait(ASYNC_LOG_IDLE_TIMEOUT_IN_MS);
+
+        output_queued_records();
+
+        return false; // Continue the thread
+    }
+
+    void output_queued_records()
+    {
+        for (;;) {
+            Slot &slot(m_slots[m_dequeue_position & (ASYNC_LOG_QUEUE_SIZE - 1)]);
+            if (slot.m_sequence.load() != m_dequeue_position + 1) {
+                // Not filled (yet)
+                break;
+            }
+
+            const LogRecord &record(slot.m_record);
+            m_log_message.clear();
+            m_context.format_log_message(m_log_message, record.m_message_type, record.m_time_in_us, record.m_file, record.m_line, record.m_function, record.m_thread_name, record.m_message);
+            m_context.output_log_message(record.m_message_type, m_log_message);
+
+            // Hand the slot back to the producers for the next round.
+            slot.m_sequence.store(m_dequeue_position + ASYNC_LOG_QUEUE_SIZE);
+            m_dequeue_position++;
+        }
+
+        uint32_t dropped_count = m_dropped_count.load();
+        if (dropped_count != m_reported_dropped_count) {
+            char message[64];
+            snprintf(message, sizeof(message), "%u log messages dropped", static_cast<unsigned int>(dropped_count - m_reported_dropped_count));
+            m_reported_dropped_count = dropped_count;
+
+            m_log_message.clear();
+            m_context.format_log_message(m_log_message, LOG_WARNING, 0, 0, 0, 0, m_thread.get_name().c_str(), message);
+            m_context.output_log_message(LOG_WARNING, m_log_message);
+        }
+    }
+};
+
 ClientContext &ClientContext::instance()
 {
     static ClientContext s_instance;
@@ -29,13 +239,15 @@ ClientContext &ClientContext::instance()
 }
 
 ClientContext::ClientContext() :
-    m_log_format(DEFAULT_LOG_FORMAT)
+    m_log_format(DEFAULT_LOG_FORMAT),
+    m_async_log(*new AsyncLog(*this))
 {
     srand(static_cast<unsigned int>(TimeStamp::now().get_as_microseconds()));
 }
 
 ClientContext::~ClientContext()
 {
+    delete &m_async_log;
 }
 
 void ClientContext::set_manufacturer(const char *manufacturer)
@@ -121,9 +333,59 @@ void ClientContext::set_log_format(const char *log_format)
 
 void ClientContext::log_message(LogMessageType message_type, const char *file, int line, const char *function, const char *message) const
 {
+    if (m_async_log.is_active()) {
+        uint32_t position;
+        AsyncLog::LogRecord *record = m_async_log.claim(message_type, file, line, function, position);
+        if (record) {
+            strncpy(record->m_message, message ? message : "", sizeof(record->m_message) - 1);
+            record->m_message[sizeof(record->m_message) - 1] = '\0';
+            m_async_log.commit(position);
+        }
+        return;
+    }
+
     AutoLock lck(m_mutex);
 
     std::string log_message;
+    format_log_message(log_message, message_type, 0, file, line, function, 0, message);
+    output_log_message(message_type, log_message);
+}
+
+void ClientContext::vlog_message(LogMessageType message_type, const char *file, int line, const char *function, const char *fmt, va_list args) const
+{
+    if (m_async_log.is_active()) {
+        // Expand the message directly into the queued record.
+        uint32_t position;
+        AsyncLog::LogRecord *record = m_async_log.claim(message_type, file, line, function, position);
+        if (record) {
+            vsnprintf(record->m_message, sizeof(record->m_message), fmt, args);
+            m_async_log.commit(position);
+        }
+        return;
+    }
+
+    char expanded_message[MAX_LOG_MESSAGE_SIZE];
+    vsnprintf(expanded_message, sizeof(expanded_message), fmt, args);
+
+    log_message(message_type, file, line, function, expanded_message);
+}
+
+void ClientContext::set_async_logging(bool enable)
+{
+    // Not locking m_mutex here: stopping waits for the background thread, which needs it for output.
+    if (enable) {
+        if (!m_async_log.start()) {
+            fputs("Failed to start asynchronous logging\n", stderr);
+        }
+    } else {
+        m_async_log.stop();
+    }
+}
+
+void ClientContext::format_log_message(std::string &log_message, LogMessageType message_type, int64_t time_in_us, const char *file, int line, const char *function, const char *thread_name, const char *message) const
+{
+    AutoLock lck(m_mutex);
+
     bool is_copy_mode = true;
     for (size_t i = 0; i < m_log_format.size(); i++) {
         char c = m_log_format[i];
@@ -137,17 +399,16 @@ void ClientContext::log_message(LogMessageType message_type, const char *file, i
             switch (c) {
             case 'T': // Print time
                 if (is_copy_mode) {
-                    struct timeval tv;
-                    tv.tv_sec = 0;
-                    tv.tv_usec = 0;
-                    gettimeofday(&tv, 0); // Don't check error code as logging any error would recursively get into here
+                    if (time_in_us == 0) {
+                        time_in_us = get_wall_clock_time_in_us();
+                    }
 
-                    time_t t = tv.tv_sec;
+                    time_t t = static_cast<time_t>(time_in_us / 1000000);
                     struct tm *tm_info = localtime(&t);
                     char timestamp[25];
                     strftime(timestamp, sizeof(timestamp), "%H:%M:%S", tm_info);
 
-                    string_printf_append(log_message, "%s.%03u", timestamp, static_cast<unsigned int>(tv.tv_usec / 1000U));
+                    string_printf_append(log_message, "%s.%03u", timestamp, static_cast<unsigned int>((time_in_us % 1000000) / 1000));
                 }
                 break;
             case 't': // Print type
@@ -199,14 +460,17 @@ void ClientContext::log_message(LogMessageType message_type, const char *file, i
                     string_printf_append(log_message, "%d", line);
                 }
                 break;
-            case 'n': {// Print the current thread name
-                Thread *current_thread = Thread::self();
-                if (current_thread) {
-                    log_message += current_thread->get_name();
+            case 'n': // Print the name of the logging thread
+                if (thread_name) {
+                    log_message += thread_name;
                 } else {
-                    log_message += "main";
+                    Thread *current_thread = Thread::self();
+                    if (current_thread) {
+                        log_message += current_thread->get_name();
+                    } else {
+                        log_message += "main";
+                    }
                 }
-            }
                 break;
             case 'm': // Print the message
                 if (message) {
@@ -228,6 +492,11 @@ void ClientContext::log_message(LogMessageType message_type, const char *file, i
             }
         }
     }
+}
+
+void ClientContext::output_log_message(LogMessageType message_type, const std::string &log_message) const
+{
+    AutoLock lck(m_mutex);
 
     // Forward the log message to all registered outputs
     for (std::set<ILogOutput *>::const_iterator i = m_log_outputs.begin(); i != m_log_outputs.end(); ++i) {
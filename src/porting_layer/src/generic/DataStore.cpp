@@ -173,6 +173,27 @@ ResultCode DataStore::get_data(const char *id, std::string &data)
     return ResultCode::SUCCESS;
 }
 
+ResultCode DataStore::get_items(std::vector<ItemInfo> &items)
+{
+    items.clear();
+
+    std::vector<FileInfo> files;
+    if (!get_files_in_directory(m_base_store_path, files)) {
+        CTVC_LOG_INFO("Could not read directory: %s (errno:%d)", m_base_store_path.c_str(), errno);
+        return COULD_NOT_OPEN_ITEM;
+    }
+
+    for (std::vector<FileInfo>::const_iterator i = files.begin(); i != files.end(); ++i) {
+        ItemInfo item;
+        item.id = i->name;
+        item.length = i->size;
+        item.modification_time = i->modification_time;
+        items.push_back(item);
+    }
+
+    return ResultCode::SUCCESS;
+}
+
 ResultCode DataStore::delete_data(const char *id)
 {
     if (!id) {
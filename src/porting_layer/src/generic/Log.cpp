@@ -17,13 +17,11 @@ using namespace ctvc;
 
 void ctvc::log_message(LogMessageType message_type, const char *file, int line, const char *function, const char *fmt, ...)
 {
-    char expanded_message[3000];
-
     va_list valist;
     va_start(valist, fmt);
-    vsnprintf(expanded_message, sizeof(expanded_message), fmt, valist);
-    va_end(valist);
 
     // Forward the log message to all objects registered with the ClientContext
-    ClientContext::instance().log_message(message_type, file, line, function, expanded_message);
+    ClientContext::instance().vlog_message(message_type, file, line, function, fmt, valist);
+
+    va_end(valist);
 }
@@ -45,7 +45,7 @@ ConditionImpl::ConditionImpl() :
 {
     pthread_condattr_t cattr;
     pthread_condattr_init(&cattr);
-   // pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC); // The clock of the timeouts of wait_without_lock()
     if (pthread_cond_init(&m_cond, &cattr) != 0) {
         CTVC_LOG_ERROR("Failed to create condition variable");
     } else {
@@ -2,8 +2,44 @@
 
 #include <porting_layer/FileSystem.h>
 
+#include <dirent.h>
+#include <sys/stat.h>
+
 namespace ctvc {
 
 const char FILE_SEPARATOR = '/';
 
+bool get_files_in_directory(const std::string &path, std::vector<FileInfo> &files/*out*/)
+{
+    files.clear();
+
+    std::string directory = path.empty() ? std::string(".") : path;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        return false;
+    }
+
+    if (directory[directory.length() - 1] != FILE_SEPARATOR) {
+        directory += FILE_SEPARATOR;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != 0) {
+        struct stat file_stat;
+        if (stat((directory + entry->d_name).c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            continue;
+        }
+
+        FileInfo file;
+        file.name = entry->d_name;
+        file.size = static_cast<uint32_t>(file_stat.st_size);
+        file.modification_time = file_stat.st_mtime;
+        files.push_back(file);
+    }
+
+    closedir(dir);
+
+    return true;
+}
+
 } // namespace
@@ -5,10 +5,21 @@
 ///
 
 #include <porting_layer/Socket.h>
+#include <porting_layer/Atomic.h>
 #include <porting_layer/Thread.h>
 #include <porting_layer/Log.h>
 #include <porting_layer/ClientContext.h>
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Mutex.h>
+#include <porting_layer/Semaphore.h>
+#include <porting_layer/TimeStamp.h>
 
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -24,11 +35,13 @@
 #define BUFFER_TYPE void *
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <poll.h>
 
 #ifndef MSG_NOSIGNAL // MSG_NOSIGNAL for Linux, 0 for other systems
 #define MSG_NOSIGNAL 0
@@ -49,9 +62,20 @@ const ResultCode Socket::CONNECT_TIMEOUT("TCP connection failed to open because
 const ResultCode Socket::LISTEN_FAILED("Listen failed on the TCP socket");
 const ResultCode Socket::SOCKET_OPTION_ACCESS_FAILED("Failed to get or set a socket option");
 const ResultCode Socket::THREAD_SHUTDOWN("A blocking call was interrupted because the calling thread is shut down");
+const ResultCode Socket::RECEIVE_TIMEOUT("No data was received within the receive timeout");
+const ResultCode Socket::ABORTED("A blocking call was aborted from another thread");
 
 static const int SOCKET_CONNECT_TIMEOUT_TIME_SECONDS = 10;
 static const int SOCKET_SELECT_TIMEOUT_TIME_MICROSECONDS = 5000;
+static const uint32_t HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY_IN_MS = 250; // RFC 8305
+
+static const uint32_t RESOLVE_TIMEOUT_IN_MS = 5000;
+static const uint32_t RESOLVE_POLL_INTERVAL_IN_MS = 50;
+static const int32_t RESOLVE_CACHE_TIME_TO_LIVE_IN_S = 60;
+static const int32_t RESOLVE_NEGATIVE_CACHE_TIME_TO_LIVE_IN_S = 5;
+static const uint32_t RESOLVE_CACHE_MAX_ENTRIES = 64;
+static const uint32_t RESOLVER_MAX_THREADS = 4;
+static const uint32_t MAX_SEGMENTS_PER_CALL = 64; // Segments passed to the platform in a single call of send_segments()
 
 static bool thread_must_stop()
 {
@@ -59,6 +83,350 @@ static bool thread_must_stop()
     return thread && thread->must_stop();
 }
 
+struct SocketAddress
+{
+    struct sockaddr_storage address;
+    socklen_t length;
+
+    void set_port(int port)
+    {
+        if (address.ss_family == AF_INET6) {
+            reinterpret_cast<struct sockaddr_in6 &>(address).sin6_port = htons(port);
+        } else {
+            reinterpret_cast<struct sockaddr_in &>(address).sin_port = htons(port);
+        }
+    }
+
+    std::string to_string() const
+    {
+        char host[NI_MAXHOST];
+        if (getnameinfo(reinterpret_cast<const struct sockaddr *>(&address), length, host, sizeof(host), 0, 0, NI_NUMERICHOST) != 0) {
+            return "?";
+        }
+        return host;
+    }
+};
+
+// Resolves host names with getaddrinfo() on a small pool of worker threads.
+//
+// getaddrinfo() blocks for as long as the system resolver takes and can't be interrupted, so
+// the calling thread only waits for the result, with a timeout, and gives up as soon as it is
+// stopped. Concurrent lookups of the same host share one getaddrinfo() call.
+//
+// Results are cached. getaddrinfo() doesn't tell the time to live of the DNS records, so a fixed
+// one is used, and a much shorter one for hosts that don't exist.
+class Resolver
+{
+public:
+    static Resolver &instance()
+    {
+        // Intentionally leaked: worker threads may still be inside getaddrinfo() at exit
+        static Resolver *s_resolver = new Resolver();
+
+        return *s_resolver;
+    }
+
+    // Resolve host into addresses in the order they should be tried. The wait for the lookup
+    // ends early if is_aborted is set (from another thread).
+    ResultCode resolve(const char *host, std::vector<SocketAddress> &addresses/*out*/, uint32_t timeout_in_ms = RESOLVE_TIMEOUT_IN_MS, const AtomicInteger<int> *is_aborted = 0)
+    {
+        addresses.clear();
+
+        // Numeric addresses are converted without a lookup
+        if (get_addresses(host, AI_NUMERICHOST, addresses) == 0) {
+            return ResultCode::SUCCESS;
+        }
+
+        Lookup *lookup = 0;
+        {
+            AutoLock lck(m_mutex);
+
+            if (find_in_cache(host, addresses)) {
+                return addresses.empty() ? Socket::HOST_NOT_FOUND : ResultCode::SUCCESS;
+            }
+
+            lookup = start_lookup(host);
+            lookup->n_references++;
+        }
+
+        ResultCode ret = Socket::CONNECT_TIMEOUT;
+        TimeStamp deadline = TimeStamp::now().add_milliseconds(timeout_in_ms);
+        while (!lookup->is_done_semaphore.wait(RESOLVE_POLL_INTERVAL_IN_MS)) {
+            if (thread_must_stop()) {
+                CTVC_LOG_INFO("Thread shutdown");
+                ret = Socket::THREAD_SHUTDOWN;
+                break;
+            }
+            if (is_aborted && is_aborted->load()) {
+                CTVC_LOG_INFO("Aborted while resolving '%s'", host);
+                ret = Socket::ABORTED;
+                break;
+            }
+            if (TimeStamp::now() > deadline) {
+                CTVC_LOG_WARNING("Timeout while resolving '%s'", host);
+                break;
+            }
+        }
+
+        AutoLock lck(m_mutex);
+
+        if (lookup->is_done) {
+            addresses = lookup->addresses;
+            ret = addresses.empty() ? Socket::HOST_NOT_FOUND : ResultCode::SUCCESS;
+        }
+        release(lookup);
+
+        return ret;
+    }
+
+    // Start a lookup of host that nobody waits for, so the result is in the cache by the time it is needed
+    void prefetch(const char *host)
+    {
+        std::vector<SocketAddress> addresses;
+        if (get_addresses(host, AI_NUMERICHOST, addresses) == 0) {
+            return;
+        }
+
+        AutoLock lck(m_mutex);
+
+        if (!find_in_cache(host, addresses)) {
+            start_lookup(host);
+        }
+    }
+
+private:
+    Resolver() :
+        m_n_threads(0),
+        m_n_busy_threads(0)
+    {
+    }
+
+    Resolver(const Resolver &);
+    Resolver &operator=(const Resolver &);
+
+    struct Lookup
+    {
+        Lookup(const std::string &host) :
+            host(host),
+            n_references(1), // The worker
+            is_done(false)
+        {
+        }
+
+        const std::string host;
+        Semaphore is_done_semaphore; // Posted once for every waiting thread
+        uint32_t n_references;
+        bool is_done;
+        std::vector<SocketAddress> addresses;
+    };
+
+    struct CacheEntry
+    {
+        std::vector<SocketAddress> addresses; // Empty if the host doesn't exist
+        TimeStamp expiry_time;
+    };
+
+    class Worker : public Thread::IRunnable
+    {
+    public:
+        Worker(Resolver &resolver) :
+            m_resolver(resolver)
+        {
+        }
+
+        bool run()
+        {
+            m_resolver.handle_next_lookup();
+
+            return false;
+        }
+
+    private:
+        Resolver &m_resolver;
+    };
+
+    // Returns the getaddrinfo() result
+    static int get_addresses(const char *host, int flags, std::vector<SocketAddress> &addresses/*out*/)
+    {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM; // Otherwise every address is returned for each socket type
+        hints.ai_flags = flags | AI_ADDRCONFIG; // Only IPv6 addresses if the host has IPv6 configured, and vice versa
+
+        struct addrinfo *result = 0;
+        int error = getaddrinfo(host, 0, &hints, &result);
+        if (error != 0) {
+            return error;
+        }
+
+        // Interleave the address families, starting with the preferred one (RFC 8305 section 4)
+        std::vector<SocketAddress> preferred;
+        std::vector<SocketAddress> other;
+        for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+            if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) || ai->ai_addrlen > sizeof(struct sockaddr_storage)) {
+                continue;
+            }
+            SocketAddress address;
+            memset(&address, 0, sizeof(address));
+            memcpy(&address.address, ai->ai_addr, ai->ai_addrlen);
+            address.length = ai->ai_addrlen;
+            if (preferred.empty() || ai->ai_family == preferred[0].address.ss_family) {
+                preferred.push_back(address);
+            } else {
+                other.push_back(address);
+            }
+        }
+        freeaddrinfo(result);
+
+        for (size_t i = 0; i < preferred.size() || i < other.size(); i++) {
+            if (i < preferred.size()) {
+                addresses.push_back(preferred[i]);
+            }
+            if (i < other.size()) {
+                addresses.push_back(other[i]);
+            }
+        }
+
+        return addresses.empty() ? EAI_NONAME : 0;
+    }
+
+    // Called with m_mutex locked; returns false if host is not in the cache or its entry has expired
+    bool find_in_cache(const char *host, std::vector<SocketAddress> &addresses/*out*/)
+    {
+        std::map<std::string, CacheEntry>::iterator i = m_cache.find(host);
+        if (i == m_cache.end()) {
+            return false;
+        }
+        if (i->second.expiry_time <= TimeStamp::now()) {
+            m_cache.erase(i);
+            return false;
+        }
+
+        addresses = i->second.addresses;
+        return true;
+    }
+
+    // Called with m_mutex locked; returns the lookup of host, which is started unless it is already going on
+    Lookup *start_lookup(const char *host)
+    {
+        std::map<std::string, Lookup *>::iterator i = m_lookups.find(host);
+        if (i != m_lookups.end()) {
+            return i->second;
+        }
+
+        Lookup *lookup = new Lookup(host);
+        m_lookups[host] = lookup;
+        m_queue.push_back(lookup);
+        m_queue_semaphore.post();
+        if (m_queue.size() > m_n_threads - m_n_busy_threads && m_n_threads < RESOLVER_MAX_THREADS) {
+            start_worker();
+        }
+
+        return lookup;
+    }
+
+    // Called with m_mutex locked
+    void start_worker()
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "Resolver%u", m_n_threads);
+        Thread *thread = new Thread(name);
+        if (thread->start(*new Worker(*this), Thread::PRIO_NORMAL).is_error()) {
+            CTVC_LOG_ERROR("Failed to start resolver thread");
+            return;
+        }
+        m_n_threads++;
+    }
+
+    void handle_next_lookup()
+    {
+        m_queue_semaphore.wait();
+
+        Lookup *lookup = 0;
+        {
+            AutoLock lck(m_mutex);
+
+            if (m_queue.empty()) {
+                return;
+            }
+            lookup = m_queue.front();
+            m_queue.pop_front();
+            m_n_busy_threads++;
+        }
+
+        std::vector<SocketAddress> addresses;
+        int error = get_addresses(lookup->host.c_str(), 0, addresses);
+        if (error != 0) {
+            CTVC_LOG_WARNING("getaddrinfo(%s) failed: %s", lookup->host.c_str(), gai_strerror(error));
+        } else {
+            CTVC_LOG_INFO("%s resolves to %s (%u addresses)", lookup->host.c_str(), addresses[0].to_string().c_str(), static_cast<uint32_t>(addresses.size()));
+        }
+
+        AutoLock lck(m_mutex);
+
+        m_n_busy_threads--;
+
+        // Only cache definite answers; a failing resolver may work again the next time
+        if (error == 0 || error == EAI_NONAME) {
+            add_to_cache(lookup->host, addresses, error == 0 ? RESOLVE_CACHE_TIME_TO_LIVE_IN_S : RESOLVE_NEGATIVE_CACHE_TIME_TO_LIVE_IN_S);
+        }
+
+        m_lookups.erase(lookup->host);
+        lookup->addresses.swap(addresses);
+        lookup->is_done = true;
+        for (uint32_t i = 1; i < lookup->n_references; i++) {
+            lookup->is_done_semaphore.post();
+        }
+        release(lookup);
+    }
+
+    // Called with m_mutex locked
+    void add_to_cache(const std::string &host, const std::vector<SocketAddress> &addresses, int32_t time_to_live_in_s)
+    {
+        TimeStamp now = TimeStamp::now();
+
+        if (m_cache.size() >= RESOLVE_CACHE_MAX_ENTRIES) {
+            // Drop the expired entries, or else the one that expires first
+            std::map<std::string, CacheEntry>::iterator first_to_expire = m_cache.begin();
+            for (std::map<std::string, CacheEntry>::iterator i = m_cache.begin(); i != m_cache.end();) {
+                if (i->second.expiry_time <= now) {
+                    m_cache.erase(i++);
+                    first_to_expire = m_cache.begin();
+                } else {
+                    if (i->second.expiry_time < first_to_expire->second.expiry_time) {
+                        first_to_expire = i;
+                    }
+                    ++i;
+                }
+            }
+            if (m_cache.size() >= RESOLVE_CACHE_MAX_ENTRIES) {
+                m_cache.erase(first_to_expire);
+            }
+        }
+
+        CacheEntry &entry(m_cache[host]);
+        entry.addresses = addresses;
+        entry.expiry_time = now.add_seconds(time_to_live_in_s);
+    }
+
+    // Called with m_mutex locked
+    void release(Lookup *lookup)
+    {
+        if (--lookup->n_references == 0) {
+            delete lookup;
+        }
+    }
+
+    Mutex m_mutex;
+    std::map<std::string, CacheEntry> m_cache;
+    std::map<std::string, Lookup *> m_lookups; // In progress, keyed by host
+    std::deque<Lookup *> m_queue; // Waiting for a worker
+    Semaphore m_queue_semaphore;
+    uint32_t m_n_threads;
+    uint32_t m_n_busy_threads;
+};
+
 class SocketImpl : public Socket::ISocket
 {
 public:
@@ -72,25 +440,57 @@ public:
     virtual ResultCode bind(const char *host, int port);
 
     virtual ResultCode send(const uint8_t *data, uint32_t length);
+    virtual ResultCode send_segments(const Socket::Segment *segments, uint32_t n_segments);
     virtual ResultCode receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/);
 
     virtual ResultCode set_receive_buffer_size(uint32_t size);
     virtual ResultCode set_reuse_address(bool on);
+    virtual void set_receive_timeout(uint32_t timeout_in_ms);
+    virtual void set_connect_timeout(uint32_t timeout_in_ms);
+    virtual void abort();
+
+    int get_socket() const
+    {
+        return m_socket;
+    }
+
+    // Whether receive() can return data that was read from the socket before
+    virtual bool has_buffered_data() const
+    {
+        return false;
+    }
 
 protected:
     int m_socket;
     struct sockaddr_in m_local_address;
-    struct sockaddr_in m_remote_address;
+    SocketAddress m_remote_address;
+    std::vector<SocketAddress> m_remote_addresses; // All addresses of the host that is connected to
+
+    // Options are remembered so they can be applied to every socket that a connect attempt creates
+    static const int OPTION_NOT_SET = -1;
+    int m_receive_buffer_size;
+    int m_reuse_address;
+    int m_no_delay;
+
+    uint32_t m_receive_timeout_in_ms; // 0 if receive() waits indefinitely
+    TimeStamp m_receive_deadline;
+    uint32_t m_connect_timeout_in_ms; // 0 for the default timeouts
+    TimeStamp m_connect_deadline;
+    AtomicInteger<int> m_is_aborted; // Set by abort(), from any thread, and cleared by open()
 
     static const int INVALID_SOCKET = -1;
 
     virtual ResultCode set_non_blocking(bool on);
+    static ResultCode set_non_blocking(int socket, bool on);
     virtual ResultCode set_address(const char *host, int port, struct sockaddr_in &);
-    virtual int createSocket() = 0;
+    void apply_options(int socket);
+    virtual int createSocket(int family = AF_INET) = 0;
     virtual ResultCode do_connect() = 0;
     virtual ssize_t do_send(const uint8_t *data, uint32_t length) = 0;
     virtual ResultCode do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length) = 0;
     int timeout_select(bool test_for_write);
+    bool is_receive_timed_out() const;
+    bool is_aborted() const;
 };
 
 class UdpSocketImpl : public SocketImpl
@@ -98,13 +498,17 @@ class UdpSocketImpl : public SocketImpl
 public:
     UdpSocketImpl();
 
+    virtual ResultCode send_segments(const Socket::Segment *segments, uint32_t n_segments);
+
 protected:
-    virtual int createSocket();
+    virtual int createSocket(int family);
     virtual ResultCode do_connect();
     virtual ssize_t do_send(const uint8_t *data, uint32_t length);
     virtual ResultCode do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length);
 };
 
+const int SocketImpl::INVALID_SOCKET;
+
 class TcpSocketImpl : public SocketImpl
 {
 public:
@@ -113,10 +517,12 @@ public:
     virtual ResultCode listen(uint32_t backlog);
     virtual TcpSocket *accept();
 
+    virtual ResultCode send_segments(const Socket::Segment *segments, uint32_t n_segments);
+
     virtual ResultCode set_no_delay(bool on);
 
 protected:
-    virtual int createSocket();
+    virtual int createSocket(int family);
     virtual ResultCode do_connect();
     virtual ssize_t do_send(const uint8_t *data, uint32_t length);
     virtual ResultCode do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length);
@@ -128,6 +534,10 @@ public:
     SslSocketImpl();
     virtual void close();
 
+    virtual ResultCode send_segments(const Socket::Segment *segments, uint32_t n_segments);
+
+    virtual bool has_buffered_data() const;
+
 protected:
     virtual ResultCode do_connect();
     virtual ssize_t do_send(const uint8_t *data, uint32_t length);
@@ -176,7 +586,13 @@ SslSocket::SslSocket() :
 }
 
 SocketImpl::SocketImpl() :
-    m_socket(INVALID_SOCKET)
+    m_socket(INVALID_SOCKET),
+    m_receive_buffer_size(OPTION_NOT_SET),
+    m_reuse_address(OPTION_NOT_SET),
+    m_no_delay(OPTION_NOT_SET),
+    m_receive_timeout_in_ms(0),
+    m_connect_timeout_in_ms(0),
+    m_is_aborted(0)
 {
     memset(&m_local_address, 0, sizeof(m_local_address));
     memset(&m_remote_address, 0, sizeof(m_remote_address));
@@ -189,11 +605,14 @@ SocketImpl::~SocketImpl()
 
 void SocketImpl::open()
 {
+    m_is_aborted.store(0);
     close();
     m_socket = createSocket();
     if (m_socket == INVALID_SOCKET) {
         CTVC_LOG_ERROR("Failed to create socket");
+        return;
     }
+    apply_options(m_socket);
 }
 
 void SocketImpl::close()
@@ -234,19 +653,37 @@ ResultCode SocketImpl::set_address(const char *host, int port, struct sockaddr_i
     address.sin_port = htons(port);
     if (host == 0) {
         address.sin_addr.s_addr = INADDR_ANY;
-    } else if (inet_aton(host, &address.sin_addr) == 0) {
-        struct hostent *remoteHost = gethostbyname(host);
-        if (remoteHost == NULL) {
-            CTVC_LOG_DEBUG("gethostbyname() failed");
-            return Socket::HOST_NOT_FOUND;
-        }
-        memcpy(&address.sin_addr, remoteHost->h_addr, remoteHost->h_length);
+        return ResultCode::SUCCESS;
+    }
 
-        const uint8_t *ip = reinterpret_cast<const uint8_t *>(remoteHost->h_addr);
-        CTVC_LOG_INFO("ip:%d.%d.%d.%d, port:%d", ip[0], ip[1], ip[2], ip[3], port);
+    std::vector<SocketAddress> addresses;
+    ResultCode ret = Resolver::instance().resolve(host, addresses);
+    if (ret.is_error()) {
+        return ret;
+    }
+    for (std::vector<SocketAddress>::const_iterator i = addresses.begin(); i != addresses.end(); ++i) {
+        if (i->address.ss_family == AF_INET) {
+            address.sin_addr = reinterpret_cast<const struct sockaddr_in &>(i->address).sin_addr;
+            return ResultCode::SUCCESS;
+        }
     }
 
-    return ResultCode::SUCCESS;
+    CTVC_LOG_WARNING("%s has no IPv4 address", host);
+    return Socket::HOST_NOT_FOUND;
+}
+
+void SocketImpl::apply_options(int socket)
+{
+    // Failures were reported when the option was set on the socket at hand
+    if (m_receive_buffer_size != OPTION_NOT_SET) {
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &m_receive_buffer_size, sizeof(m_receive_buffer_size));
+    }
+    if (m_reuse_address != OPTION_NOT_SET) {
+        setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (char *)&m_reuse_address, sizeof(int));
+    }
+    if (m_no_delay != OPTION_NOT_SET) {
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (char *)&m_no_delay, sizeof(int));
+    }
 }
 
 ResultCode SocketImpl::connect(const char *host, int port)
@@ -260,10 +697,27 @@ ResultCode SocketImpl::connect(const char *host, int port)
         }
     }
 
-    ResultCode ret = set_address(host, port, m_remote_address);
+    CTVC_LOG_DEBUG("'%s:%d'", host, port);
+
+    if (is_aborted()) {
+        return Socket::ABORTED;
+    }
+
+    // A connect timeout that is set covers the lookup of the host name as well
+    TimeStamp start_time = TimeStamp::now();
+    ResultCode ret = Resolver::instance().resolve(host, m_remote_addresses, m_connect_timeout_in_ms > 0 ? m_connect_timeout_in_ms : RESOLVE_TIMEOUT_IN_MS, &m_is_aborted);
     if (ret.is_error()) {
         return ret;
     }
+    for (std::vector<SocketAddress>::iterator i = m_remote_addresses.begin(); i != m_remote_addresses.end(); ++i) {
+        i->set_port(port);
+    }
+
+    if (m_connect_timeout_in_ms > 0) {
+        m_connect_deadline = start_time.add_milliseconds(m_connect_timeout_in_ms);
+    } else {
+        m_connect_deadline = TimeStamp::now().add_seconds(SOCKET_CONNECT_TIMEOUT_TIME_SECONDS);
+    }
 
     ret = do_connect();
     if (ret.is_error()) {
@@ -310,12 +764,25 @@ ResultCode SocketImpl::send(const uint8_t *data, uint32_t length)
             break;
         }
 
+        data += bytes_sent;
         length -= bytes_sent;
     }
 
     return ResultCode::SUCCESS;
 }
 
+ResultCode SocketImpl::send_segments(const Socket::Segment *segments, uint32_t n_segments)
+{
+    for (uint32_t i = 0; i < n_segments; i++) {
+        ResultCode ret = send(segments[i].data, segments[i].length);
+        if (ret.is_error()) {
+            return ret;
+        }
+    }
+
+    return ResultCode::SUCCESS;
+}
+
 ResultCode SocketImpl::receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/)
 {
     length = 0;
@@ -325,6 +792,14 @@ ResultCode SocketImpl::receive(uint8_t *data, uint32_t size, uint32_t &length/*o
         return Socket::SOCKET_NOT_OPEN;
     }
 
+    if (is_aborted()) {
+        return Socket::ABORTED;
+    }
+
+    if (m_receive_timeout_in_ms > 0) {
+        m_receive_deadline = TimeStamp::now().add_milliseconds(m_receive_timeout_in_ms);
+    }
+
     ssize_t received_data_length = 0;
     ResultCode result = do_receive(data, size, received_data_length);
     length = received_data_length;
@@ -334,6 +809,8 @@ ResultCode SocketImpl::receive(uint8_t *data, uint32_t size, uint32_t &length/*o
 
 ResultCode SocketImpl::set_receive_buffer_size(uint32_t size)
 {
+    m_receive_buffer_size = size;
+
     if (m_socket == INVALID_SOCKET) {
         CTVC_LOG_WARNING("Socket not open");
         return Socket::SOCKET_NOT_OPEN;
@@ -344,6 +821,8 @@ ResultCode SocketImpl::set_receive_buffer_size(uint32_t size)
 
 ResultCode SocketImpl::set_reuse_address(bool on)
 {
+    m_reuse_address = on;
+
     if (m_socket == INVALID_SOCKET) {
         CTVC_LOG_WARNING("Socket not open");
         return Socket::SOCKET_NOT_OPEN;
@@ -353,14 +832,45 @@ ResultCode SocketImpl::set_reuse_address(bool on)
     return setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(int)) == 0 ? ResultCode::SUCCESS : Socket::SOCKET_OPTION_ACCESS_FAILED;
 }
 
+void SocketImpl::set_receive_timeout(uint32_t timeout_in_ms)
+{
+    m_receive_timeout_in_ms = timeout_in_ms;
+}
+
+bool SocketImpl::is_receive_timed_out() const
+{
+    return m_receive_timeout_in_ms > 0 && TimeStamp::now() > m_receive_deadline;
+}
+
+void SocketImpl::set_connect_timeout(uint32_t timeout_in_ms)
+{
+    m_connect_timeout_in_ms = timeout_in_ms;
+}
+
+void SocketImpl::abort()
+{
+    // The blocking calls poll the flag while they wait
+    m_is_aborted.store(1);
+}
+
+bool SocketImpl::is_aborted() const
+{
+    return m_is_aborted.load() != 0;
+}
+
 ResultCode SocketImpl::set_non_blocking(bool on)
 {
-    if (m_socket == INVALID_SOCKET) {
+    return set_non_blocking(m_socket, on);
+}
+
+ResultCode SocketImpl::set_non_blocking(int socket, bool on)
+{
+    if (socket == INVALID_SOCKET) {
         CTVC_LOG_WARNING("Socket not open");
         return Socket::SOCKET_NOT_OPEN;
     }
 
-    int flags = fcntl(m_socket, F_GETFL, 0);
+    int flags = fcntl(socket, F_GETFL, 0);
     if (flags < 0) {
         CTVC_LOG_WARNING("fcntl() F_GETFL fails: %s", strerror(errno));
         return Socket::SOCKET_OPTION_ACCESS_FAILED;
@@ -370,7 +880,7 @@ ResultCode SocketImpl::set_non_blocking(bool on)
     } else {
         flags &= ~O_NONBLOCK;
     }
-    flags  = fcntl(m_socket, F_SETFL, flags);
+    flags  = fcntl(socket, F_SETFL, flags);
     if (flags < 0) {
         CTVC_LOG_WARNING("fcntl() F_SETFL fails: %s", strerror(errno));
         return Socket::SOCKET_OPTION_ACCESS_FAILED;
@@ -379,6 +889,43 @@ ResultCode SocketImpl::set_non_blocking(bool on)
     return ResultCode::SUCCESS;
 }
 
+/* static */
+ResultCode Socket::wait_for_data(Socket *const *sockets, uint32_t n_sockets, uint32_t timeout_in_ms, bool *is_ready/*out*/)
+{
+    std::vector<struct pollfd> poll_fds(n_sockets);
+    int timeout = static_cast<int>(timeout_in_ms);
+    for (uint32_t i = 0; i < n_sockets; i++) {
+        const SocketImpl &impl(static_cast<const SocketImpl &>(sockets[i]->get_impl()));
+        poll_fds[i].fd = impl.get_socket();
+        poll_fds[i].events = POLLIN;
+        poll_fds[i].revents = 0;
+        is_ready[i] = impl.has_buffered_data();
+        if (is_ready[i]) {
+            timeout = 0;
+        }
+    }
+
+    int result = n_sockets > 0 ? ::poll(&poll_fds[0], n_sockets, timeout) : ::poll(0, 0, timeout);
+    if (result < 0 && errno != EINTR) {
+        CTVC_LOG_ERROR("The poll() call failed with errno:%d", errno);
+        return Socket::READ_ERROR;
+    }
+
+    for (uint32_t i = 0; i < n_sockets && result > 0; i++) {
+        if (poll_fds[i].revents != 0) {
+            is_ready[i] = true;
+        }
+    }
+
+    return ResultCode::SUCCESS;
+}
+
+/* static */
+void Socket::prefetch_host(const char *host)
+{
+    Resolver::instance().prefetch(host);
+}
+
 /* static */
 ResultCode Socket::get_local_address(std::string &local_address)
 {
@@ -442,19 +989,76 @@ UdpSocketImpl::UdpSocketImpl()
     open(); // Creates initial socket
 }
 
-int UdpSocketImpl::createSocket()
+int UdpSocketImpl::createSocket(int family)
 {
-    return ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    return ::socket(family, SOCK_DGRAM, IPPROTO_UDP);
 }
 
 ResultCode UdpSocketImpl::do_connect()
 {
-    return ResultCode::SUCCESS;
+    // The socket may already be bound, so use an address of its own family
+    struct sockaddr_storage local_address;
+    socklen_t length = sizeof(local_address);
+    if (getsockname(m_socket, (struct sockaddr *)&local_address, &length) != 0) {
+        CTVC_LOG_ERROR("getsockname() failed, errno:%d:%s", errno, strerror(errno));
+        return Socket::CONNECT_FAILED;
+    }
+    for (std::vector<SocketAddress>::const_iterator i = m_remote_addresses.begin(); i != m_remote_addresses.end(); ++i) {
+        if (i->address.ss_family == local_address.ss_family) {
+            m_remote_address = *i;
+            return ResultCode::SUCCESS;
+        }
+    }
+
+    CTVC_LOG_WARNING("Host has no address of the socket's address family");
+    return Socket::HOST_NOT_FOUND;
 }
 
 ssize_t UdpSocketImpl::do_send(const uint8_t *data, uint32_t length)
 {
-    return ::sendto(m_socket, data, length, 0, (struct sockaddr *)&m_remote_address, sizeof(m_remote_address));
+    return ::sendto(m_socket, data, length, 0, (struct sockaddr *)&m_remote_address.address, m_remote_address.length);
+}
+
+ResultCode UdpSocketImpl::send_segments(const Socket::Segment *segments, uint32_t n_segments)
+{
+#ifdef __linux__
+    if (m_socket == INVALID_SOCKET) {
+        CTVC_LOG_WARNING("Socket not open");
+        return Socket::SOCKET_NOT_OPEN;
+    }
+
+    // One datagram per segment, up to MAX_SEGMENTS_PER_CALL datagrams per system call
+    struct mmsghdr messages[MAX_SEGMENTS_PER_CALL];
+    struct iovec vectors[MAX_SEGMENTS_PER_CALL];
+    while (n_segments > 0) {
+        uint32_t n = n_segments < MAX_SEGMENTS_PER_CALL ? n_segments : MAX_SEGMENTS_PER_CALL;
+        memset(messages, 0, n * sizeof(messages[0]));
+        for (uint32_t i = 0; i < n; i++) {
+            vectors[i].iov_base = const_cast<uint8_t *>(segments[i].data);
+            vectors[i].iov_len = segments[i].length;
+            messages[i].msg_hdr.msg_name = &m_remote_address.address;
+            messages[i].msg_hdr.msg_namelen = m_remote_address.length;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n_sent = ::sendmmsg(m_socket, messages, n, 0);
+        if (n_sent <= 0) {
+            if (n_sent < 0 && errno == EINTR) {
+                continue;
+            }
+            CTVC_LOG_ERROR("Send errno:%d", errno);
+            return Socket::WRITE_ERROR;
+        }
+
+        segments += n_sent;
+        n_segments -= n_sent;
+    }
+
+    return ResultCode::SUCCESS;
+#else
+    return SocketImpl::send_segments(segments, n_segments);
+#endif
 }
 
 ResultCode UdpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length)
@@ -469,6 +1073,12 @@ ResultCode UdpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
                 CTVC_LOG_INFO("Thread shutdown");
                 return Socket::THREAD_SHUTDOWN;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -492,9 +1102,9 @@ TcpSocketImpl::TcpSocketImpl()
     open(); // Creates initial socket
 }
 
-int TcpSocketImpl::createSocket()
+int TcpSocketImpl::createSocket(int family)
 {
-    return ::socket(AF_INET, SOCK_STREAM, 0);
+    return ::socket(family, SOCK_STREAM, 0);
 }
 
 ResultCode TcpSocketImpl::listen(uint32_t backlog)
@@ -519,7 +1129,7 @@ TcpSocket *TcpSocketImpl::accept()
         return 0;
     }
 
-    struct sockaddr_in remote_address;
+    struct sockaddr_storage remote_address;
     socklen_t sockaddr_len = sizeof(remote_address);
 
     while (1) {
@@ -549,81 +1159,162 @@ TcpSocket *TcpSocketImpl::accept()
     TcpSocketImpl &impl(static_cast<TcpSocketImpl &>(tcp_socket->get_impl()));
     impl.close();
     impl.m_socket = new_socket;
-    memcpy(&impl.m_remote_address, &remote_address, sizeof(impl.m_remote_address));
+    memcpy(&impl.m_remote_address.address, &remote_address, sizeof(remote_address));
+    impl.m_remote_address.length = sockaddr_len;
 
     return tcp_socket;
 }
 
 ResultCode TcpSocketImpl::do_connect()
 {
-    ResultCode ret = Socket::CONNECTION_REFUSED;
-
-    // Set socket non-blocking because we don't want the 'connect()' call to block
-    if (set_non_blocking(true).is_error()) {
-        CTVC_LOG_ERROR("Failed to set socket non-blocking");
-        return Socket::CONNECT_FAILED;
-    }
+    // Happy Eyeballs (RFC 8305): the addresses are tried in order, but if an attempt hasn't
+    // completed within the connection attempt delay, the next one is started alongside it. The
+    // first connection that is established wins, so an unreachable address family (typically a
+    // broken IPv6 route) only costs the delay instead of a full connect timeout.
+    // The attempts create their own sockets, as the addresses may be of different families.
+    SocketImpl::close();
 
-    int retries = SOCKET_CONNECT_TIMEOUT_TIME_SECONDS * 1000000 / SOCKET_SELECT_TIMEOUT_TIME_MICROSECONDS;
+    const size_t n_addresses = m_remote_addresses.size();
+    std::vector<int> sockets(n_addresses, INVALID_SOCKET);
+    size_t n_started = 0;
+    size_t n_pending = 0;
+    size_t winner = n_addresses;
+    int last_error = 0;
+    ResultCode ret = Socket::CONNECT_FAILED;
+
+    TimeStamp next_attempt_time = TimeStamp::now();
+
+    while (true) {
+        TimeStamp now = TimeStamp::now();
+        if (n_started < n_addresses && (n_pending == 0 || now >= next_attempt_time)) {
+            const SocketAddress &address(m_remote_addresses[n_started]);
+            int socket = createSocket(address.address.ss_family);
+            if (socket == INVALID_SOCKET || socket >= FD_SETSIZE) {
+                CTVC_LOG_ERROR("Failed to create socket for %s", address.to_string().c_str());
+                last_error = errno;
+                if (socket != INVALID_SOCKET) {
+                    ::close(socket);
+                }
+                n_started++;
+                continue;
+            }
+            apply_options(socket);
+
+            // Set socket non-blocking because we don't want the 'connect()' call to block
+            if (set_non_blocking(socket, true).is_error()) {
+                CTVC_LOG_ERROR("Failed to set socket non-blocking");
+                ::close(socket);
+                n_started++;
+                continue;
+            }
 
-    // Try to connect in non-blocking mode, using select() and getsockopt() to poll the connect status
-    int connect_result = ::connect(m_socket, (struct sockaddr*)&m_remote_address, sizeof(m_remote_address));
-    if ((connect_result < 0) && (errno == EINPROGRESS)) {
-        while (true) {
-            int select_result = timeout_select(true);
-            if (select_result < 0) {
-                CTVC_LOG_ERROR("The select() call failed with errno:%d m_socket:%d (%p)", errno,  m_socket, &m_socket);
+            CTVC_LOG_DEBUG("Connecting to %s", address.to_string().c_str());
+            int connect_result = ::connect(socket, (struct sockaddr *)&address.address, address.length);
+            if (connect_result == 0) {
+                sockets[n_started] = socket;
+                winner = n_started++;
                 break;
+            } else if (errno == EINPROGRESS) {
+                sockets[n_started++] = socket;
+                n_pending++;
+                next_attempt_time = TimeStamp(now).add_milliseconds(HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY_IN_MS);
+            } else {
+                CTVC_LOG_WARNING("The connect() call to %s failed with errno:%d", address.to_string().c_str(), errno);
+                last_error = errno;
+                ::close(socket);
+                n_started++;
             }
-            if (select_result == 0) {
-                if (thread_must_stop()) {
-                    CTVC_LOG_INFO("Thread shutdown");
-                    ret = Socket::THREAD_SHUTDOWN;
-                    break;
-                }
-                if (retries > 0) {
-                    retries--;
-                    continue;
-                }
-                CTVC_LOG_INFO("Timeout while trying to connect to remote server");
-                ret = Socket::CONNECT_TIMEOUT;
-                break;
+            continue;
+        }
+
+        if (n_pending == 0) {
+            break; // All attempts failed
+        }
+        if (thread_must_stop()) {
+            CTVC_LOG_INFO("Thread shutdown");
+            ret = Socket::THREAD_SHUTDOWN;
+            break;
+        }
+        if (is_aborted()) {
+            CTVC_LOG_INFO("Connect aborted");
+            ret = Socket::ABORTED;
+            break;
+        }
+        if (now > m_connect_deadline) {
+            CTVC_LOG_INFO("Timeout while trying to connect to remote server");
+            ret = Socket::CONNECT_TIMEOUT;
+            break;
+        }
+
+        // Poll the pending attempts, using select() and getsockopt() to get their connect status
+        fd_set socket_set;
+        FD_ZERO(&socket_set);
+        int max_socket = INVALID_SOCKET;
+        for (size_t i = 0; i < n_started; i++) {
+            if (sockets[i] != INVALID_SOCKET) {
+                FD_SET(sockets[i], &socket_set);
+                max_socket = sockets[i] > max_socket ? sockets[i] : max_socket;
+            }
+        }
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = SOCKET_SELECT_TIMEOUT_TIME_MICROSECONDS;
+        int select_result = select(max_socket + 1, NULL, &socket_set, NULL, &tv);
+        if (select_result < 0) {
+            CTVC_LOG_ERROR("The select() call failed with errno:%d", errno);
+            break;
+        }
+
+        for (size_t i = 0; i < n_started && select_result > 0; i++) {
+            if (sockets[i] == INVALID_SOCKET || !FD_ISSET(sockets[i], &socket_set)) {
+                continue;
             }
             // Check the status of the socket
             int socket_error;
             socklen_t opt_length = sizeof(socket_error);
-            if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, (void*)&socket_error, &opt_length) < 0) {
-                CTVC_LOG_WARNING("Failed to retrieve socket error status m_socket:%d (%p)", m_socket, &m_socket);
-                break;
+            if (getsockopt(sockets[i], SOL_SOCKET, SO_ERROR, (void*)&socket_error, &opt_length) < 0) {
+                socket_error = errno;
             }
-            if (socket_error != 0) {
-                errno = socket_error; // Set errno for ECONNREFUSED test below
-                CTVC_LOG_WARNING("Connect failed with socket error %d: %s", errno, strerror(errno));
+            if (socket_error == 0) {
+                winner = i;
                 break;
             }
-            CTVC_LOG_INFO("Connection established");
-            ret = ResultCode::SUCCESS;
+            CTVC_LOG_WARNING("Connect to %s failed with socket error %d: %s", m_remote_addresses[i].to_string().c_str(), socket_error, strerror(socket_error));
+            last_error = socket_error;
+            ::close(sockets[i]);
+            sockets[i] = INVALID_SOCKET;
+            n_pending--;
+            // Don't wait for the delay to try the next address
+            next_attempt_time = now;
+        }
+        if (winner != n_addresses) {
             break;
         }
-    } else if (connect_result == 0) {
-        CTVC_LOG_INFO("Connection established");
-        ret = ResultCode::SUCCESS;
-    } else {
-        CTVC_LOG_ERROR("The connect() call failed with error:%d m_socket:%d (%p)", errno,  m_socket, &m_socket);
     }
 
-    if (ret.is_error() && (errno == ECONNREFUSED)) {
-        ret = Socket::CONNECTION_REFUSED;
+    for (size_t i = 0; i < n_started; i++) {
+        if (i != winner && sockets[i] != INVALID_SOCKET) {
+            ::close(sockets[i]);
+        }
     }
 
-    if (set_non_blocking(false).is_error()) {
-        CTVC_LOG_ERROR("Failed to set socket blocking");
-        if (ret.is_ok()) {
-            ret = Socket::CONNECT_FAILED;
+    if (winner == n_addresses) {
+        if (ret == Socket::CONNECT_FAILED && last_error == ECONNREFUSED) {
+            ret = Socket::CONNECTION_REFUSED;
         }
+        return ret;
+    }
+
+    m_socket = sockets[winner];
+    m_remote_address = m_remote_addresses[winner];
+    CTVC_LOG_INFO("Connection established to %s", m_remote_address.to_string().c_str());
+
+    if (set_non_blocking(m_socket, false).is_error()) {
+        CTVC_LOG_ERROR("Failed to set socket blocking");
+        return Socket::CONNECT_FAILED;
     }
 
-    return ret;
+    return ResultCode::SUCCESS;
 }
 
 ssize_t TcpSocketImpl::do_send(const uint8_t *data, uint32_t length)
@@ -631,6 +1322,53 @@ ssize_t TcpSocketImpl::do_send(const uint8_t *data, uint32_t length)
     return ::send(m_socket, data, length, MSG_NOSIGNAL);
 }
 
+ResultCode TcpSocketImpl::send_segments(const Socket::Segment *segments, uint32_t n_segments)
+{
+    if (m_socket == INVALID_SOCKET) {
+        CTVC_LOG_WARNING("Socket not open");
+        return Socket::SOCKET_NOT_OPEN;
+    }
+
+    // Gather up to MAX_SEGMENTS_PER_CALL segments per system call. A partial send continues in the
+    // middle of a segment.
+    struct iovec vectors[MAX_SEGMENTS_PER_CALL];
+    uint32_t offset = 0; // Part of the first segment that has been sent
+    while (n_segments > 0) {
+        uint32_t n = n_segments < MAX_SEGMENTS_PER_CALL ? n_segments : MAX_SEGMENTS_PER_CALL;
+        for (uint32_t i = 0; i < n; i++) {
+            vectors[i].iov_base = const_cast<uint8_t *>(segments[i].data);
+            vectors[i].iov_len = segments[i].length;
+        }
+        vectors[0].iov_base = static_cast<uint8_t *>(vectors[0].iov_base) + offset;
+        vectors[0].iov_len -= offset;
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = n;
+
+        ssize_t bytes_sent = ::sendmsg(m_socket, &message, MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            CTVC_LOG_ERROR("Send errno:%d", errno);
+            return Socket::WRITE_ERROR;
+        }
+
+        // Skip what has been sent, including empty segments
+        while (n_segments > 0 && static_cast<size_t>(bytes_sent) >= segments[0].length - offset) {
+            bytes_sent -= segments[0].length - offset;
+            offset = 0;
+            segments++;
+            n_segments--;
+        }
+        offset += bytes_sent;
+    }
+
+    return ResultCode::SUCCESS;
+}
+
 ResultCode TcpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length)
 {
     while (1) {
@@ -643,6 +1381,12 @@ ResultCode TcpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
                 CTVC_LOG_INFO("Thread shutdown");
                 return Socket::THREAD_SHUTDOWN;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -665,6 +1409,8 @@ ResultCode TcpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
 
 ResultCode TcpSocketImpl::set_no_delay(bool on)
 {
+    m_no_delay = on;
+
     if (m_socket == INVALID_SOCKET) {
         CTVC_LOG_WARNING("Socket not open");
         return Socket::SOCKET_NOT_OPEN;
@@ -682,6 +1428,15 @@ SslSocketImpl::SslSocketImpl()
 #endif
 }
 
+bool SslSocketImpl::has_buffered_data() const
+{
+#ifdef ENABLE_SSL
+    return m_tls_handle && SSL_pending(m_tls_handle) > 0;
+#else
+    return false;
+#endif
+}
+
 void SslSocketImpl::close()
 {
 #ifdef ENABLE_SSL
@@ -743,12 +1498,6 @@ ResultCode SslSocketImpl::do_connect()
         return Socket::CONNECTION_REFUSED;
     }
 
-    ret = SSL_set_fd(m_tls_handle, m_socket);
-    if (ret != 1) {
-        CTVC_LOG_ERROR("Failed SSL_set_fd: ret:%d, SSL_get_error:%d", ret, SSL_get_error(m_tls_handle, ret));
-        return Socket::CONNECTION_REFUSED;
-    }
-
     //SSL_set_verify(m_tls_handle, SSL_VERIFY_NONE, NULL);
 
     ResultCode result = TcpSocketImpl::do_connect();
@@ -756,6 +1505,13 @@ ResultCode SslSocketImpl::do_connect()
         return result;
     }
 
+    // Only now the socket is known: the connect creates a socket for every address it tries
+    ret = SSL_set_fd(m_tls_handle, m_socket);
+    if (ret != 1) {
+        CTVC_LOG_ERROR("Failed SSL_set_fd: ret:%d, SSL_get_error:%d", ret, SSL_get_error(m_tls_handle, ret));
+        return Socket::CONNECTION_REFUSED;
+    }
+
     ret = SSL_connect(m_tls_handle);
     if (ret != 1) {
         CTVC_LOG_ERROR("Failed SSL_connect() ret:%d, SSL_get_error:%d ", ret, SSL_get_error(m_tls_handle, ret));
@@ -778,6 +1534,12 @@ ResultCode SslSocketImpl::do_connect()
 #endif
 }
 
+ResultCode SslSocketImpl::send_segments(const Socket::Segment *segments, uint32_t n_segments)
+{
+    // Each segment goes through the TLS layer separately
+    return SocketImpl::send_segments(segments, n_segments);
+}
+
 ssize_t SslSocketImpl::do_send(const uint8_t *data, uint32_t length)
 {
 #ifdef ENABLE_SSL
@@ -802,6 +1564,12 @@ ResultCode SslSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
                 CTVC_LOG_INFO("Thread shutdown");
                 return Socket::THREAD_SHUTDOWN;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -28,9 +28,18 @@ const ResultCode Socket::HOST_NOT_FOUND("The given host is not found by the DNS"
 const ResultCode Socket::CONNECTION_REFUSED("TCP connection failed to open due to the connection being refused");
 const ResultCode Socket::CONNECT_TIMEOUT("TCP connection failed to open because remote server did not respond in time");
 const ResultCode Socket::THREAD_SHUTDOWN("A blocking call was interrupted because the calling thread is shut down");
+const ResultCode Socket::RECEIVE_TIMEOUT("No data was received within the receive timeout");
+const ResultCode Socket::ABORTED("A blocking call was aborted from another thread");
 
 const char ctvc::FILE_SEPARATOR = '/';
 
+bool ctvc::get_files_in_directory(const std::string &/*path*/, std::vector<FileInfo> &files/*out*/)
+{
+    files.clear();
+
+    return false;
+}
+
 class SocketImpl : public Socket::ISocket
 {
 public:
@@ -65,6 +74,11 @@ public:
         return ResultCode::SUCCESS;
     }
 
+    virtual ResultCode send_segments(const Socket::Segment */*segments*/, uint32_t /*n_segments*/)
+    {
+        return ResultCode::SUCCESS;
+    }
+
     virtual ResultCode receive(uint8_t */*data*/, uint32_t /*size*/, uint32_t &length/*out*/)
     {
         length = 0;
@@ -85,6 +99,18 @@ public:
     {
         return ResultCode::SUCCESS;
     }
+
+    virtual void set_receive_timeout(uint32_t /*timeout_in_ms*/)
+    {
+    }
+
+    virtual void set_connect_timeout(uint32_t /*timeout_in_ms*/)
+    {
+    }
+
+    virtual void abort()
+    {
+    }
 };
 
 UdpSocket::UdpSocket() :
@@ -117,6 +143,19 @@ ResultCode TcpSocket::set_no_delay(bool /*on*/)
     return ResultCode::SUCCESS;
 }
 
+ResultCode Socket::wait_for_data(Socket *const */*sockets*/, uint32_t n_sockets, uint32_t /*timeout_in_ms*/, bool *is_ready/*out*/)
+{
+    for (uint32_t i = 0; i < n_sockets; i++) {
+        is_ready[i] = false;
+    }
+
+    return Socket::READ_ERROR;
+}
+
+void Socket::prefetch_host(const char */*host*/)
+{
+}
+
 SslSocket::SslSocket() :
     TcpSocket(*new SocketImpl())
 {
@@ -33,3 +33,45 @@ int remove(const char *pathname)
     delete[] widestr;
     return result;
 }
+
+bool ctvc::get_files_in_directory(const std::string &path, std::vector<FileInfo> &files/*out*/)
+{
+    files.clear();
+
+    std::string pattern = path;
+    if (!pattern.empty() && pattern[pattern.length() - 1] != FILE_SEPARATOR) {
+        pattern += FILE_SEPARATOR;
+    }
+    pattern += '*';
+
+    int len = pattern.length() + 1; // include terminating zero
+    WCHAR *widestr = new WCHAR[len];
+    char2wchar(pattern.c_str(), widestr, len);
+    WIN32_FIND_DATA find_data;
+    HANDLE handle = ::FindFirstFile(widestr, &find_data);
+    delete[] widestr;
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    do {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+
+        FileInfo file;
+        // File names without fancy UTF characters, as above
+        for (const WCHAR *p = find_data.cFileName; *p; p++) {
+            file.name += static_cast<char>(*p);
+        }
+        file.size = find_data.nFileSizeLow;
+        // FILETIME counts 100 ns intervals since 1601
+        uint64_t file_time = (static_cast<uint64_t>(find_data.ftLastWriteTime.dwHighDateTime) << 32) | find_data.ftLastWriteTime.dwLowDateTime;
+        file.modification_time = static_cast<time_t>((file_time - 116444736000000000ULL) / 10000000);
+        files.push_back(file);
+    } while (::FindNextFile(handle, &find_data));
+
+    ::FindClose(handle);
+
+    return true;
+}
@@ -21,12 +21,8 @@ using namespace ctvc;
 
 static void log_msg(LogMessageType message_type, const char *file, int line, const char *function, const char *fmt, va_list valist)
 {
-    char expanded_message[3000];
-
-    vsnprintf(expanded_message, sizeof(expanded_message), fmt, valist);
-
     // Forward the log message to all objects registered with the ClientContext
-    ClientContext::instance().log_message(message_type, file, line, function, expanded_message);
+    ClientContext::instance().vlog_message(message_type, file, line, function, fmt, valist);
 }
 
 void ctvc::log_error(const char *fmt, ...)
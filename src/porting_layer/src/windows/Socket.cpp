@@ -9,9 +9,11 @@
 #include <winsock2.h>
 #undef HOST_NOT_FOUND
 #include <porting_layer/Socket.h>
+#include <porting_layer/Atomic.h>
 #include <porting_layer/Thread.h>
 #include <porting_layer/Log.h>
 #include <porting_layer/ClientContext.h>
+#include <porting_layer/TimeStamp.h>
 
 #include <string.h>
 #include <unistd.h>
@@ -70,6 +72,8 @@ const ResultCode Socket::CONNECT_TIMEOUT("TCP connection failed to open because
 const ResultCode Socket::LISTEN_FAILED("Listen failed on the TCP socket");
 const ResultCode Socket::SOCKET_OPTION_ACCESS_FAILED("Failed to get or set a socket option");
 const ResultCode Socket::THREAD_SHUTDOWN("A blocking call was interrupted because the calling thread is shut down");
+const ResultCode Socket::RECEIVE_TIMEOUT("No data was received within the receive timeout");
+const ResultCode Socket::ABORTED("A blocking call was aborted from another thread");
 
 static const int SOCKET_CONNECT_TIMEOUT_TIME_SECONDS = 10;
 static const int SOCKET_SELECT_TIMEOUT_TIME_MICROSECONDS = 5000;
@@ -87,15 +91,35 @@ public:
     virtual ResultCode bind(const char *host, int port);
 
     virtual ResultCode send(const uint8_t *data, uint32_t length);
+    virtual ResultCode send_segments(const Socket::Segment *segments, uint32_t n_segments);
     virtual ResultCode receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/);
 
     virtual ResultCode set_receive_buffer_size(uint32_t size);
     virtual ResultCode set_reuse_address(bool on);
+    virtual void set_receive_timeout(uint32_t timeout_in_ms);
+    virtual void set_connect_timeout(uint32_t timeout_in_ms);
+    virtual void abort();
+
+    SOCKET get_socket() const
+    {
+        return m_socket;
+    }
+
+    // Whether receive() can return data that was read from the socket before
+    virtual bool has_buffered_data() const
+    {
+        return false;
+    }
 
 protected:
     SOCKET m_socket;
     struct sockaddr_in m_local_address;
     struct sockaddr_in m_remote_address;
+    uint32_t m_receive_timeout_in_ms; // 0 if receive() waits indefinitely
+    TimeStamp m_receive_deadline;
+    uint32_t m_connect_timeout_in_ms; // 0 for the default timeout
+    TimeStamp m_connect_deadline;
+    AtomicInteger<int> m_is_aborted; // Set by abort(), from any thread, and cleared by open()
 
     virtual ResultCode set_non_blocking(bool on);
     virtual ResultCode set_address(const char *host, int port, struct sockaddr_in &);
@@ -104,6 +128,8 @@ protected:
     virtual ssize_t do_send(const uint8_t *data, uint32_t length) = 0;
     virtual ResultCode do_receive(uint8_t *data, uint32_t length, ssize_t &received_data_length) = 0;
     int timeout_select(bool test_for_write);
+    bool is_receive_timed_out() const;
+    bool is_aborted() const;
 };
 
 class UdpSocketImpl : public SocketImpl
@@ -141,6 +167,8 @@ public:
     SslSocketImpl();
     virtual void close();
 
+    virtual bool has_buffered_data() const;
+
 protected:
     virtual ResultCode do_connect();
     virtual ssize_t do_send(const uint8_t *data, uint32_t length);
@@ -189,7 +217,10 @@ SslSocket::SslSocket() :
 }
 
 SocketImpl::SocketImpl() :
-    m_socket(INVALID_SOCKET)
+    m_socket(INVALID_SOCKET),
+    m_receive_timeout_in_ms(0),
+    m_connect_timeout_in_ms(0),
+    m_is_aborted(0)
 {
     memset(&m_local_address, 0, sizeof(m_local_address));
     memset(&m_remote_address, 0, sizeof(m_remote_address));
@@ -202,6 +233,7 @@ SocketImpl::~SocketImpl()
 
 void SocketImpl::open()
 {
+    m_is_aborted.store(0);
     close();
     m_socket = createSocket();
     if (m_socket == INVALID_SOCKET) {
@@ -269,11 +301,23 @@ ResultCode SocketImpl::connect(const char *host, int port)
         }
     }
 
+    if (is_aborted()) {
+        return Socket::ABORTED;
+    }
+
+    // The host name is looked up synchronously; the time it takes counts towards the connect timeout
+    TimeStamp start_time = TimeStamp::now();
     ResultCode ret = set_address(host, port, m_remote_address);
     if (ret.is_error()) {
         return ret;
     }
 
+    if (m_connect_timeout_in_ms > 0) {
+        m_connect_deadline = start_time.add_milliseconds(m_connect_timeout_in_ms);
+    } else {
+        m_connect_deadline = TimeStamp::now().add_seconds(SOCKET_CONNECT_TIMEOUT_TIME_SECONDS);
+    }
+
     ret = do_connect();
     if (ret.is_error()) {
         CTVC_LOG_ERROR("Connect failed");
@@ -316,12 +360,26 @@ ResultCode SocketImpl::send(const uint8_t *data, uint32_t length)
             return Socket::WRITE_ERROR;
         }
 
+        data += bytes_sent;
         length -= bytes_sent;
     }
 
     return ResultCode::SUCCESS;
 }
 
+ResultCode SocketImpl::send_segments(const Socket::Segment *segments, uint32_t n_segments)
+{
+    // One send per segment, which keeps the datagram boundaries of UDP
+    for (uint32_t i = 0; i < n_segments; i++) {
+        ResultCode ret = send(segments[i].data, segments[i].length);
+        if (ret.is_error()) {
+            return ret;
+        }
+    }
+
+    return ResultCode::SUCCESS;
+}
+
 ResultCode SocketImpl::receive(uint8_t *data, uint32_t size, uint32_t &length/*out*/)
 {
     length = 0;
@@ -331,6 +389,14 @@ ResultCode SocketImpl::receive(uint8_t *data, uint32_t size, uint32_t &length/*o
         return Socket::SOCKET_NOT_OPEN;
     }
 
+    if (is_aborted()) {
+        return Socket::ABORTED;
+    }
+
+    if (m_receive_timeout_in_ms > 0) {
+        m_receive_deadline = TimeStamp::now().add_milliseconds(m_receive_timeout_in_ms);
+    }
+
     ssize_t received_data_length = 0;
     ResultCode result = do_receive(data, size, received_data_length);
     length = received_data_length;
@@ -359,6 +425,32 @@ ResultCode SocketImpl::set_reuse_address(bool on)
     return setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(int)) == 0 ? ResultCode::SUCCESS : Socket::SOCKET_OPTION_ACCESS_FAILED;
 }
 
+void SocketImpl::set_receive_timeout(uint32_t timeout_in_ms)
+{
+    m_receive_timeout_in_ms = timeout_in_ms;
+}
+
+bool SocketImpl::is_receive_timed_out() const
+{
+    return m_receive_timeout_in_ms > 0 && TimeStamp::now() > m_receive_deadline;
+}
+
+void SocketImpl::set_connect_timeout(uint32_t timeout_in_ms)
+{
+    m_connect_timeout_in_ms = timeout_in_ms;
+}
+
+void SocketImpl::abort()
+{
+    // The blocking calls poll the flag while they wait
+    m_is_aborted.store(1);
+}
+
+bool SocketImpl::is_aborted() const
+{
+    return m_is_aborted.load() != 0;
+}
+
 ResultCode SocketImpl::set_non_blocking(bool on)
 {
     if (m_socket == INVALID_SOCKET) {
@@ -379,6 +471,52 @@ ResultCode SocketImpl::set_non_blocking(bool on)
     return ResultCode::SUCCESS;
 }
 
+/* static */
+ResultCode Socket::wait_for_data(Socket *const *sockets, uint32_t n_sockets, uint32_t timeout_in_ms, bool *is_ready/*out*/)
+{
+    fd_set socket_set;
+    struct timeval tv;
+
+    FD_ZERO(&socket_set);
+    tv.tv_sec = timeout_in_ms / 1000;
+    tv.tv_usec = (timeout_in_ms % 1000) * 1000;
+    for (uint32_t i = 0; i < n_sockets; i++) {
+        const SocketImpl &impl(static_cast<const SocketImpl &>(sockets[i]->get_impl()));
+        FD_SET(impl.get_socket(), &socket_set);
+        is_ready[i] = impl.has_buffered_data();
+        if (is_ready[i]) {
+            tv.tv_sec = 0;
+            tv.tv_usec = 0;
+        }
+    }
+
+    if (n_sockets == 0) {
+        // select() fails without any socket
+        Thread::sleep(timeout_in_ms);
+        return ResultCode::SUCCESS;
+    }
+
+    int result = select(0, &socket_set, NULL, NULL, &tv);
+    if (result < 0) {
+        CTVC_LOG_ERROR("The select() call failed with error:%d", WSAGetLastError());
+        return Socket::READ_ERROR;
+    }
+
+    for (uint32_t i = 0; i < n_sockets && result > 0; i++) {
+        if (FD_ISSET(static_cast<const SocketImpl &>(sockets[i]->get_impl()).get_socket(), &socket_set)) {
+            is_ready[i] = true;
+        }
+    }
+
+    return ResultCode::SUCCESS;
+}
+
+/* static */
+void Socket::prefetch_host(const char */*host*/)
+{
+    // Host names are not cached, so there is nothing to prefetch
+}
+
 /* static */
 ResultCode Socket::get_local_address(std::string &/*local_address*/)
 {
@@ -418,6 +556,12 @@ ResultCode UdpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
             if (thread_must_stop()) {
                 return Socket::READ_ERROR;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -513,8 +657,6 @@ ResultCode TcpSocketImpl::do_connect()
         return Socket::CONNECT_FAILED;
     }
 
-    int retries = SOCKET_CONNECT_TIMEOUT_TIME_SECONDS * 1000000 / SOCKET_SELECT_TIMEOUT_TIME_MICROSECONDS;
-
     // Try to connect in non-blocking mode, using select() and getsockopt() to poll the connect status
     int connect_result = ::connect(m_socket, (struct sockaddr*)&m_remote_address, sizeof(m_remote_address));
     int socket_error = WSAGetLastError();
@@ -531,8 +673,12 @@ ResultCode TcpSocketImpl::do_connect()
                     CTVC_LOG_INFO("Thread shutdown");
                     break;
                 }
-                if (retries > 0) {
-                    retries--;
+                if (is_aborted()) {
+                    CTVC_LOG_INFO("Connect aborted");
+                    ret = Socket::ABORTED;
+                    break;
+                }
+                if (TimeStamp::now() <= m_connect_deadline) {
                     continue;
                 }
                 CTVC_LOG_INFO("Timeout while trying to connect to remote server");
@@ -595,6 +741,12 @@ ResultCode TcpSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
             if (thread_must_stop()) {
                 return Socket::READ_ERROR;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -634,6 +786,15 @@ SslSocketImpl::SslSocketImpl()
 #endif
 }
 
+bool SslSocketImpl::has_buffered_data() const
+{
+#ifdef ENABLE_SSL
+    return m_tls_handle && SSL_pending(m_tls_handle) > 0;
+#else
+    return false;
+#endif
+}
+
 void SslSocketImpl::close()
 {
 #ifdef ENABLE_SSL
@@ -754,6 +915,12 @@ ResultCode SslSocketImpl::do_receive(uint8_t *data, uint32_t length, ssize_t &re
             if (thread_must_stop()) {
                 return Socket::READ_ERROR;
             }
+            if (is_aborted()) {
+                return Socket::ABORTED;
+            }
+            if (is_receive_timed_out()) {
+                return Socket::RECEIVE_TIMEOUT;
+            }
             continue;
         }
 
@@ -11,27 +11,76 @@
 
 #include "LoaderBase.h"
 
+#include <http_client/HttpCancelToken.h>
+
+#include <inttypes.h>
+
 namespace ctvc {
 
 class HttpClient;
 
+/// \brief Loader for streams over HTTP
+///
+/// If the connection drops or stalls while the stream is being received, the loader reconnects
+/// and resumes the stream where it was interrupted, using a Range request. If the server doesn't
+/// support ranges, a stream of known length is received from the start again and the part that
+/// was already passed on is skipped; a live stream simply continues with the data that the server
+/// sends now.
 class HttpLoader : public LoaderBase
 {
 public:
     static const ResultCode ERROR_WHILE_DOWNLOADING_STREAM;
 
+    static const uint32_t DEFAULT_READ_AHEAD_WINDOW = 256 * 1024;
+    static const uint32_t DEFAULT_STALL_TIMEOUT_IN_MS = 2000;
+    static const uint32_t DEFAULT_MAX_RESUME_ATTEMPTS = 5;
+    static const uint32_t DEFAULT_CONNECT_TIMEOUT_IN_MS = 5000;
+
     HttpLoader();
     ~HttpLoader();
 
+    /// \brief Set the amount of data that may be received ahead of the stream sink.
+    ///
+    /// This is the size of the socket's receive buffer, so the network can keep delivering data
+    /// while the stream sink is busy. Takes effect for the next stream that is opened.
+    /// \param[in] size_in_bytes Size of the read-ahead window.
+    void set_read_ahead_window(uint32_t size_in_bytes);
+
+    /// \brief Set the time without any data after which the connection is considered stalled.
+    ///
+    /// A stalled connection is closed and the stream is resumed on a new connection. Keep this
+    /// well below the stream timeout of the Streamer, so the stream resumes before it is given up.
+    /// \param[in] timeout_in_ms Stall timeout, 0 to disable stall detection.
+    void set_stall_timeout(uint32_t timeout_in_ms);
+
+    /// \brief Set the number of times in a row that the stream is resumed without receiving any data in between.
+    /// \param[in] n_attempts Maximum number of attempts, 0 to disable resuming.
+    void set_max_resume_attempts(uint32_t n_attempts);
+
+    /// \brief Set the maximum time to connect to the server, for the initial request as well as to resume.
+    /// \param[in] timeout_in_ms Connect timeout, 0 for the default of the platform.
+    void set_connect_timeout(uint32_t timeout_in_ms);
+
 private:
     // Implementation of LoaderBase
     bool run();
     ResultCode setup();
     void teardown();
+    void abort();
+
+    ResultCode resume();
 
     class Router;
 
     HttpClient *m_client;
+    Router *m_router;
+    HttpCancelToken m_cancel_token; // Canceled when the stream is closed
+
+    uint32_t m_read_ahead_window;
+    uint32_t m_stall_timeout_in_ms;
+    uint32_t m_max_resume_attempts;
+    uint32_t m_connect_timeout_in_ms;
+    bool m_has_known_length; // False for live streams
 };
 
 } // namespace
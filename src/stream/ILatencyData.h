@@ -37,6 +37,15 @@ struct ILatencyData
 
     /// \brief Called when there is new latency data from the stream.
      virtual void latency_stream_data(LatencyDataType data_type, TimeStamp pts, TimeStamp original_event_time) = 0;
+
+    /// \brief Called when the first stream data following a KEY_PRESS latency marker has been output.
+    /// \param[in] original_event_time Time stamp of the key event, as echoed in the marker.
+    /// \param[in] marker_time Time at which the marker was parsed from the stream.
+    /// \param[in] output_time Time at which the first stream data after the marker was output.
+    /// \param[in] pts Presentation time of the marker, converted to local time.
+    virtual void latency_marker_output(TimeStamp /*original_event_time*/, TimeStamp /*marker_time*/, TimeStamp /*output_time*/, TimeStamp /*pts*/)
+    {
+    }
 };
 
 } // namespace
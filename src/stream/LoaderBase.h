@@ -45,6 +45,9 @@ private:
     // Implementation-specific loader setup and teardown
     virtual ResultCode setup() = 0;
     virtual void teardown() = 0;
+
+    // Interrupt the blocking calls of the loader thread, called by close_stream() before it waits for the thread to stop
+    virtual void abort();
 };
 
 } // namespace
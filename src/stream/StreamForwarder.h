@@ -10,6 +10,8 @@
 
 #include <porting_layer/ResultCode.h>
 #include <porting_layer/Mutex.h>
+#include <porting_layer/Socket.h>
+#include <utils/TimerEngine.h>
 
 #include <string>
 #include <vector>
@@ -19,15 +21,19 @@
 
 namespace ctvc {
 
-class Socket;
-
 /// \brief Helper class to forward a stream to a specified destination.
+///
+/// The stream is forwarded in batches to limit the number of system calls. A batch of UDP
+/// datagrams is sent with a single call where the platform supports it, and a batch of TCP data is
+/// gathered from the buffered and the new data without copying the latter.
 class StreamForwarder : public IStream
 {
 public:
     static const ResultCode INVALID_URL; ///< An invalid URL was passed to open()
     static const ResultCode CANNOT_CREATE_FILE; ///< Cannot create file
 
+    static const uint32_t DATAGRAM_SIZE = 7 * 188; ///< Size of the UDP datagrams, 7 TS packets
+
     StreamForwarder();
     virtual ~StreamForwarder();
 
@@ -41,15 +47,38 @@ public:
     /// \brief Close the socket.
     void close();
 
+    /// \brief Set how much data is collected before it is forwarded
+    ///
+    /// Takes effect at the next call to open().
+    /// \param[in] batch_size Data is forwarded as soon as this many bytes are buffered. The default
+    ///            of DATAGRAM_SIZE forwards the data as it comes in.
+    /// \param[in] max_delay_in_ms Buffered data is forwarded at the latest this long after it came
+    ///            in, or 0 to keep it until the batch is complete (the default).
+    void set_batching(uint32_t batch_size, uint32_t max_delay_in_ms);
+
     // Implements IStream
     virtual void stream_data(const uint8_t *data, uint32_t length);
     virtual void stream_error(ResultCode result);
 
 private:
+    StreamForwarder(const StreamForwarder &);
+    StreamForwarder &operator=(const StreamForwarder &);
+
     Socket *m_socket;
+    bool m_is_udp;
     FILE *m_file;
     Mutex m_mutex;
+    uint32_t m_batch_size;
+    uint32_t m_max_delay_in_ms;
     std::vector<uint8_t> m_buffer;
+    std::vector<Socket::Segment> m_segments;
+    TimerEngine m_timer_engine;
+    BoundTimerEngineTimer<StreamForwarder> m_flush_timer;
+
+    void send(const uint8_t *data, uint32_t length, bool is_flush);
+    void add_segments(const uint8_t *data, uint32_t length);
+    void buffer_data(const uint8_t *data, uint32_t length);
+    void flush_timer_expired();
 };
 
 } // namespace
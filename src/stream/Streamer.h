@@ -108,6 +108,8 @@ private:
     friend class PacketReceptacle; // Needed for Metrowerks
     class LatencyEventSink;
     class StallEventSink;
+    class MetricsCollector;
+    friend class MetricsCollector;
 
     Mutex m_mutex;
     Mutex m_player_event_mutex;
@@ -125,6 +127,7 @@ private:
     IMediaPlayer::ICallback *m_media_player_callback;
     uint64_t m_stream_timout_mark_time_in_ms; // Stream timeout is measured with this timestamp as base time (typically the time the last data was received).
     bool m_was_stream_data_sent;
+    MetricsCollector &m_metrics_collector;
 
     // Implements IStream
     virtual void stream_data(const uint8_t *data, uint32_t length);
@@ -16,29 +16,90 @@
 #include <stream/IStream.h>
 #include <porting_layer/Thread.h>
 
+#include <algorithm>
+#include <vector>
+
 using namespace ctvc;
 
 const ResultCode HttpLoader::ERROR_WHILE_DOWNLOADING_STREAM("Error during HTTP stream download");
 
+// The stream is received straight into this buffer and passed on from there
+static const uint32_t RECEIVE_BUFFER_SIZE = 348 * 188; // Whole transport stream packets, about 64kB
+
+// Wait a little longer before every next attempt to resume
+static const uint32_t RESUME_BACKOFF_IN_MS = 200;
+
+static const char *HEADERS[] = { "User-Agent", "avplay" };
+
 class HttpLoader::Router : public IHttpDataSink
 {
 public:
     Router(IStream &sink) :
-        m_sink(sink)
+        m_sink(sink),
+        m_buffer(RECEIVE_BUFFER_SIZE),
+        m_position(0),
+        m_n_bytes_to_skip(0)
     {
     }
 
     void write(const char *buf, uint32_t len)
     {
-        m_sink.stream_data(reinterpret_cast<const uint8_t *>(buf), len);
+        forward(buf, len);
+    }
+
+    char *get_write_buffer(uint32_t &size/*out*/)
+    {
+        size = m_buffer.size();
+        return &m_buffer[0];
+    }
+
+    void commit_write(uint32_t len)
+    {
+        forward(&m_buffer[0], len);
+    }
+
+    // Number of bytes of the stream that were passed on
+    uint64_t get_position() const
+    {
+        return m_position;
+    }
+
+    // Don't pass on the next n bytes, they were passed on before the stream was resumed
+    void skip(uint64_t n)
+    {
+        m_n_bytes_to_skip = n;
     }
 
 private:
+    void forward(const char *buf, uint32_t len)
+    {
+        if (m_n_bytes_to_skip > 0) {
+            uint32_t n = static_cast<uint32_t>(std::min(static_cast<uint64_t>(len), m_n_bytes_to_skip));
+            buf += n;
+            len -= n;
+            m_n_bytes_to_skip -= n;
+        }
+
+        if (len > 0) {
+            m_sink.stream_data(reinterpret_cast<const uint8_t *>(buf), len);
+            m_position += len;
+        }
+    }
+
     IStream &m_sink;
+    std::vector<char> m_buffer;
+    uint64_t m_position;
+    uint64_t m_n_bytes_to_skip;
 };
 
 HttpLoader::HttpLoader() :
-    m_client(0)
+    m_client(0),
+    m_router(0),
+    m_read_ahead_window(DEFAULT_READ_AHEAD_WINDOW),
+    m_stall_timeout_in_ms(DEFAULT_STALL_TIMEOUT_IN_MS),
+    m_max_resume_attempts(DEFAULT_MAX_RESUME_ATTEMPTS),
+    m_connect_timeout_in_ms(DEFAULT_CONNECT_TIMEOUT_IN_MS),
+    m_has_known_length(false)
 {
 }
 
@@ -46,18 +107,90 @@ HttpLoader::~HttpLoader()
 {
 }
 
+void HttpLoader::set_read_ahead_window(uint32_t size_in_bytes)
+{
+    m_read_ahead_window = size_in_bytes;
+}
+
+void HttpLoader::set_stall_timeout(uint32_t timeout_in_ms)
+{
+    m_stall_timeout_in_ms = timeout_in_ms;
+}
+
+void HttpLoader::set_max_resume_attempts(uint32_t n_attempts)
+{
+    m_max_resume_attempts = n_attempts;
+}
+
+void HttpLoader::set_connect_timeout(uint32_t timeout_in_ms)
+{
+    m_connect_timeout_in_ms = timeout_in_ms;
+}
+
 ResultCode HttpLoader::setup()
 {
     m_client = new HttpClient();
+    m_router = new Router(*m_stream_sink);
+
+    m_client->set_custom_headers(HEADERS, sizeof(HEADERS) / (sizeof(HEADERS[0]) * 2));
+    m_client->set_receive_buffer_size(m_read_ahead_window);
+    m_client->set_connect_timeout(m_connect_timeout_in_ms);
+    m_cancel_token.reset();
+    m_client->set_cancel_token(&m_cancel_token);
 
     // Start up the transfer (blocking)
-    return m_client->get(m_uri.c_str());
+    ResultCode ret = m_client->get(m_uri.c_str());
+    if (ret.is_error()) {
+        return ret;
+    }
+
+    std::string content_length;
+    m_has_known_length = m_client->get_response_header("Content-Length", content_length);
+
+    return ResultCode::SUCCESS;
 }
 
 void HttpLoader::teardown()
 {
     delete m_client;
     m_client = 0;
+    delete m_router;
+    m_router = 0;
+}
+
+void HttpLoader::abort()
+{
+    m_cancel_token.cancel();
+}
+
+ResultCode HttpLoader::resume()
+{
+    uint64_t position = m_router->get_position();
+
+    // A live stream can't be resumed at a position, it continues with what the server sends now
+    m_client->set_range(m_has_known_length ? position : 0);
+
+    // Until the response arrives, only the first-byte deadline of the request applies
+    m_client->set_receive_timeout(0);
+
+    ResultCode ret = m_client->get(m_uri.c_str());
+    if (ret.is_error()) {
+        return ret;
+    }
+
+    if (m_has_known_length) {
+        // The server may have ignored the range and sent the stream from the start
+        uint64_t start = m_client->get_response_range_start();
+        if (start > position) {
+            CTVC_LOG_ERROR("Stream resumed at %llu instead of %llu", static_cast<unsigned long long>(start), static_cast<unsigned long long>(position));
+            return ERROR_WHILE_DOWNLOADING_STREAM;
+        }
+        m_router->skip(position - start);
+    }
+
+    CTVC_LOG_INFO("Resumed stream at %llu", static_cast<unsigned long long>(position));
+
+    return ResultCode::SUCCESS;
 }
 
 bool HttpLoader::run()
@@ -65,18 +198,38 @@ bool HttpLoader::run()
     CTVC_LOG_INFO("Starting for URL: '%s'", m_uri.c_str());
 
     assert(m_client);
+    assert(m_router);
     assert(m_stream_sink);
 
-    Router router(*m_stream_sink);
-
-    const char *headers[] = { "User-Agent", "avplay" };
-
-    m_client->set_custom_headers(headers, sizeof(headers) / (sizeof(headers[0]) * 2));
-
-    // Do the transfer (blocking)
-    ResultCode ret = m_client->receive(&router);
+    // Do the transfer (blocking). The stall timeout applies once the response has arrived.
+    m_client->set_receive_timeout(m_stall_timeout_in_ms);
+    ResultCode ret = m_client->receive(m_router);
+
+    // Resume the stream if the connection dropped or stalled. Attempts are only counted as long
+    // as no data comes in.
+    uint32_t n_resume_attempts = 0;
+    while (ret.is_error() && ret != Socket::THREAD_SHUTDOWN && ret != HttpClient::CANCELED && n_resume_attempts < m_max_resume_attempts && !m_thread.must_stop()) {
+        CTVC_LOG_WARNING("Receive error %s at %llu, resuming. url:%s", ret.get_description(), static_cast<unsigned long long>(m_router->get_position()), m_uri.c_str());
+
+        // The stream may be closed while backing off
+        if (n_resume_attempts > 0 && m_cancel_token.wait(RESUME_BACKOFF_IN_MS * n_resume_attempts)) {
+            ret = HttpClient::CANCELED;
+            break;
+        }
+        n_resume_attempts++;
+
+        uint64_t position = m_router->get_position();
+        ret = resume();
+        if (ret.is_ok()) {
+            m_client->set_receive_timeout(m_stall_timeout_in_ms);
+            ret = m_client->receive(m_router);
+            if (m_router->get_position() > position) {
+                n_resume_attempts = 0;
+            }
+        }
+    }
 
-    if (ret == Socket::THREAD_SHUTDOWN) {
+    if (ret == Socket::THREAD_SHUTDOWN || ret == HttpClient::CANCELED) {
         CTVC_LOG_DEBUG("Thread shutdown");
     } else if (ret.is_error()) {
         CTVC_LOG_ERROR("Receive error %s. url:%s", ret.get_description(), m_uri.c_str());
@@ -56,6 +56,7 @@ void LoaderBase::close_stream()
 {
     CTVC_LOG_INFO("uri:%s", m_uri.c_str());
 
+    abort();
     m_thread.stop_and_wait_until_stopped();
 
     if (m_stream_sink) { // Prevent multiple callbacks if we close multiple times
@@ -67,3 +68,8 @@ void LoaderBase::close_stream()
 
     CTVC_LOG_DEBUG("Done");
 }
+
+void LoaderBase::abort()
+{
+    // The thread is interrupted by stopping it
+}
@@ -21,11 +21,14 @@ using namespace ctvc;
 const ResultCode StreamForwarder::INVALID_URL("Invalid URL");
 const ResultCode StreamForwarder::CANNOT_CREATE_FILE("Cannot create file");
 
-const uint32_t BUFFERING_THRESHOLD = 7 * 188; // Buffer at least 7 TS packets before forwarding.
-
 StreamForwarder::StreamForwarder() :
     m_socket(0),
-    m_file(0)
+    m_is_udp(false),
+    m_file(0),
+    m_batch_size(DATAGRAM_SIZE),
+    m_max_delay_in_ms(0),
+    m_timer_engine("StreamForwarder"),
+    m_flush_timer(*this, &StreamForwarder::flush_timer_expired, 0)
 {
 }
 
@@ -34,6 +37,14 @@ StreamForwarder::~StreamForwarder()
     close();
 }
 
+void StreamForwarder::set_batching(uint32_t batch_size, uint32_t max_delay_in_ms)
+{
+    AutoLock lck(m_mutex);
+
+    m_batch_size = batch_size > 0 ? batch_size : 1;
+    m_max_delay_in_ms = max_delay_in_ms;
+}
+
 ResultCode StreamForwarder::open(const std::string &url)
 {
     CTVC_LOG_DEBUG("url:%s", url.c_str());
@@ -45,12 +56,15 @@ ResultCode StreamForwarder::open(const std::string &url)
     url_split(url, proto, authorization, host, port, path);
 
     bool is_file = proto.compare("file") == 0;
+    bool is_udp = proto.compare("udp") == 0;
 
     if (proto.empty() || (!is_file && (host.empty() || port <= 0))) {
         CTVC_LOG_ERROR("One or more illegal parameters");
         return INVALID_URL;
     }
 
+    AutoLock lck(m_mutex);
+
     Socket *socket = 0;
     FILE *file = 0;
     if (is_file) {
@@ -59,7 +73,9 @@ ResultCode StreamForwarder::open(const std::string &url)
             CTVC_LOG_ERROR("Cannot create file:%s", path.c_str());
             return CANNOT_CREATE_FILE;
         }
-    } else if (proto.compare("udp") == 0) {
+        // Let stdio collect the batches, so each is written at once
+        setvbuf(file, 0, _IOFBF, m_batch_size > BUFSIZ ? m_batch_size : BUFSIZ);
+    } else if (is_udp) {
         socket = new UdpSocket();
     } else {
         socket = new TcpSocket();
@@ -73,15 +89,26 @@ ResultCode StreamForwarder::open(const std::string &url)
         }
     }
 
-    AutoLock lck(m_mutex);
+    if (m_max_delay_in_ms > 0) {
+        ResultCode ret = m_timer_engine.start(Thread::PRIO_NORMAL);
+        if (ret.is_error()) {
+            CTVC_LOG_WARNING("Cannot start flush timer (%s), data is only forwarded in full batches", ret.get_description());
+        }
+    }
+
     m_socket = socket;
+    m_is_udp = is_udp;
     m_file = file;
+    m_buffer.reserve(m_batch_size + DATAGRAM_SIZE);
 
     return ResultCode::SUCCESS;
 }
 
 void StreamForwarder::close()
 {
+    // Not while holding the mutex, which the flush timer takes
+    m_timer_engine.stop();
+
     AutoLock lck(m_mutex);
 
     // Flush any outstanding data
@@ -110,23 +137,96 @@ void StreamForwarder::stream_data(const uint8_t *data, uint32_t length)
     if (m_file) {
         if (length > 0) {
             fwrite(data, 1, length, m_file);
+            if (m_max_delay_in_ms > 0) {
+                m_timer_engine.start_timer(m_flush_timer, m_max_delay_in_ms, TimerEngine::ONE_SHOT);
+            }
         } else {
             fflush(m_file);
         }
     }
     if (m_socket) {
-        if (m_buffer.empty() && length >= BUFFERING_THRESHOLD) {
-            // Send right away if nothing is buffered and we have enough data to immediately send.
-            m_socket->send(data, length);
-        } else if (length > 0) {
-            // Buffer the data
-            m_buffer.insert(m_buffer.end(), data, data + length);
+        if (length == 0) {
+            // Flush buffer
+            send(0, 0, true);
+        } else if (m_buffer.size() + length >= m_batch_size) {
+            send(data, length, false);
+        } else {
+            buffer_data(data, length);
+        }
+    }
+}
+
+void StreamForwarder::send(const uint8_t *data, uint32_t length, bool is_flush)
+{
+    m_segments.clear();
+
+    if (m_is_udp) {
+        // Complete the last datagram of the buffer, so the buffer only holds whole datagrams
+        uint32_t n_missing = (DATAGRAM_SIZE - m_buffer.size() % DATAGRAM_SIZE) % DATAGRAM_SIZE;
+        if (n_missing > length) {
+            n_missing = length;
         }
+        m_buffer.insert(m_buffer.end(), data, data + n_missing);
+        data += n_missing;
+        length -= n_missing;
 
-        if ((length == 0 && !m_buffer.empty()) || m_buffer.size() >= BUFFERING_THRESHOLD) {
-            // Flush buffer if triggered by length == 0 or if we have enough data to send.
-            m_socket->send(&m_buffer[0], m_buffer.size());
-            m_buffer.clear();
+        if (!is_flush && m_buffer.size() % DATAGRAM_SIZE != 0) {
+            return;
         }
+
+        // A partial datagram at the end waits for more data, unless the buffer is flushed
+        uint32_t n_remaining = is_flush ? 0 : length % DATAGRAM_SIZE;
+        add_segments(m_buffer.empty() ? 0 : &m_buffer[0], m_buffer.size());
+        add_segments(data, length - n_remaining);
+        data += length - n_remaining;
+        length = n_remaining;
+    } else {
+        // Sent as one stream: the buffer followed by the new data
+        add_segments(m_buffer.empty() ? 0 : &m_buffer[0], m_buffer.size());
+        add_segments(data, length);
+        length = 0;
+    }
+
+    if (!m_segments.empty()) {
+        ResultCode ret = m_socket->send_segments(&m_segments[0], m_segments.size());
+        if (ret.is_error()) {
+            CTVC_LOG_DEBUG("Forwarding failed (%s)", ret.get_description());
+        }
+    }
+
+    m_buffer.clear();
+    buffer_data(data, length);
+}
+
+void StreamForwarder::add_segments(const uint8_t *data, uint32_t length)
+{
+    // UDP data is split in datagrams, TCP data goes in a single segment
+    uint32_t segment_size = m_is_udp ? DATAGRAM_SIZE : length;
+    while (length > 0) {
+        Socket::Segment segment;
+        segment.data = data;
+        segment.length = length < segment_size ? length : segment_size;
+        m_segments.push_back(segment);
+
+        data += segment.length;
+        length -= segment.length;
     }
 }
+
+void StreamForwarder::buffer_data(const uint8_t *data, uint32_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    m_buffer.insert(m_buffer.end(), data, data + length);
+    if (m_max_delay_in_ms > 0) {
+        // Already running if older data is waiting, which is then forwarded earlier
+        m_timer_engine.start_timer(m_flush_timer, m_max_delay_in_ms, TimerEngine::ONE_SHOT);
+    }
+}
+
+void StreamForwarder::flush_timer_expired()
+{
+    stream_data(0, 0);
+}
@@ -21,12 +21,16 @@
 #include <rplayer/ts/TimeStamp.h>
 #include <rplayer/ILog.h>
 #include <utils/utils.h>
+#include <utils/Metrics.h>
 #include <porting_layer/Log.h>
 #include <porting_layer/AutoLock.h>
 #include <porting_layer/Thread.h>
 #include <porting_layer/TimeStamp.h>
 
+#include <vector>
+
 #include <assert.h>
+#include <string.h>
 
 using namespace ctvc;
 
@@ -177,6 +181,15 @@ public:
         switch (data_type) {
         case rplayer::IEventSink::KEY_PRESS:
             m_latency_data_callback->latency_stream_data(ILatencyData::KEY_PRESS, adjusted_pts, TimeStamp::zero().add_milliseconds(data) /* FIXME: Should be marked as absolute time, actually */);
+
+            // Remember the marker so it can be traced up to the first output that follows it
+            if (m_pending_markers.size() < MAX_PENDING_MARKERS) {
+                PendingMarker marker;
+                marker.original_event_time = TimeStamp::zero().add_milliseconds(data);
+                marker.marker_time = TimeStamp::now();
+                marker.pts = adjusted_pts;
+                m_pending_markers.push_back(marker);
+            }
             break;
         case rplayer::IEventSink::FIRST_PAINT:
             m_latency_data_callback->latency_stream_data(ILatencyData::FIRST_PAINT, adjusted_pts, TimeStamp::zero());
@@ -187,6 +200,27 @@ public:
         }
     }
 
+    void reset()
+    {
+        m_pending_markers.clear();
+    }
+
+    // Called for every output of stream data
+    void stream_data_output()
+    {
+        if (m_pending_markers.empty()) {
+            return;
+        }
+
+        TimeStamp output_time(TimeStamp::now());
+        for (std::vector<PendingMarker>::const_iterator i = m_pending_markers.begin(); i != m_pending_markers.end(); ++i) {
+            if (m_latency_data_callback) {
+                m_latency_data_callback->latency_marker_output(i->original_event_time, i->marker_time, output_time, i->pts);
+            }
+        }
+        m_pending_markers.clear();
+    }
+
     void pcrReceived(uint64_t pcr90kHz, int /*pcrExt27MHz*/, bool /*hasDiscontinuity*/)
     {
         m_time_of_last_pcr_reception = TimeStamp::now();
@@ -198,9 +232,19 @@ public:
     }
 
 private:
+    static const uint32_t MAX_PENDING_MARKERS = 16;
+
+    struct PendingMarker
+    {
+        TimeStamp original_event_time;
+        TimeStamp marker_time;
+        TimeStamp pts;
+    };
+
     ILatencyData *m_latency_data_callback;
     uint64_t m_last_pcr_90khz;
     TimeStamp m_time_of_last_pcr_reception;
+    std::vector<PendingMarker> m_pending_markers;
 };
 
 // Helper class to catch stall events from RPlayer and forward them as stall events to the SessionImpl.
@@ -208,7 +252,9 @@ class Streamer::StallEventSink : public rplayer::RPlayer::ICallback
 {
 public:
     StallEventSink() :
-        m_stall_event_callback(0)
+        m_stall_event_callback(0),
+        m_stalls(Metrics::get_counter("streamer.stalls")),
+        m_stall_duration(Metrics::get_distribution("streamer.stall_duration_ms", STALL_DURATION_DISTRIBUTION_HIGHEST_VALUE_IN_MS))
     {
     }
 
@@ -220,6 +266,9 @@ public:
     // Implements rplayer::RPlayer::ICallback
     void stallDetected(const std::string &id, bool is_audio_not_video, const rplayer::TimeStamp &stallDuration)
     {
+        m_stalls.add();
+        m_stall_duration.add_sample(stallDuration.getAsMilliseconds());
+
         if (!m_stall_event_callback) {
             return;
         }
@@ -228,7 +277,92 @@ public:
     }
 
 private:
+    static const int32_t STALL_DURATION_DISTRIBUTION_HIGHEST_VALUE_IN_MS = 60000;
+
     IStallEvent *m_stall_event_callback;
+    Metrics::Counter &m_stalls;
+    Metrics::Distribution &m_stall_duration;
+};
+
+// Helper class that keeps the Streamer metrics and pushes the RPlayer statistics into the metrics registry.
+// The RPlayer counts are cumulative per RPlayer, so only the increase since the last collection is added;
+// that way the registry totals stay correct when there are multiple Streamers.
+class Streamer::MetricsCollector : public Metrics::ICollector
+{
+public:
+    MetricsCollector(Streamer &streamer) :
+        m_streamer(streamer),
+        m_bytes_in(Metrics::get_counter("streamer.bytes_in")),
+        m_bytes_out(Metrics::get_counter("streamer.bytes_out")),
+        m_stream_timeouts(Metrics::get_counter("streamer.stream_timeouts")),
+        m_ts_packets(Metrics::get_counter("ts_demux.packets")),
+        m_cc_errors(Metrics::get_counter("ts_demux.cc_errors")),
+        m_pid_drops(Metrics::get_counter("ts_demux.pid_drops")),
+        m_rams_commands(Metrics::get_counter("rams_interpreter.commands")),
+        m_rams_units(Metrics::get_gauge("rams_interpreter.unit_store_occupancy")),
+        m_filler_frames(Metrics::get_counter("underrun_mitigator.filler_frames")),
+        m_pts_adjustments(Metrics::get_counter("underrun_mitigator.pts_adjustments"))
+    {
+        memset(&m_last_statistics, 0, sizeof(m_last_statistics));
+
+        Metrics::register_collector(*this);
+    }
+
+    ~MetricsCollector()
+    {
+        Metrics::unregister_collector(*this);
+
+        // The units of this Streamer no longer occupy any store
+        m_rams_units.add(-static_cast<int64_t>(m_last_statistics.ramsUnitCount));
+    }
+
+    // Implements Metrics::ICollector
+    void collect_metrics()
+    {
+        AutoLock auto_lock(m_streamer.m_mutex);
+
+        rplayer::RPlayer::Statistics statistics;
+        m_streamer.m_rplayer.getStatistics(statistics);
+
+        m_ts_packets.add(statistics.tsPacketCount - m_last_statistics.tsPacketCount);
+        m_cc_errors.add(statistics.ccErrorCount - m_last_statistics.ccErrorCount);
+        m_pid_drops.add(statistics.pidDropCount - m_last_statistics.pidDropCount);
+        m_rams_commands.add(statistics.ramsCommandCount - m_last_statistics.ramsCommandCount);
+        m_rams_units.add(static_cast<int64_t>(statistics.ramsUnitCount) - static_cast<int64_t>(m_last_statistics.ramsUnitCount));
+        m_filler_frames.add(statistics.fillerFrameCount - m_last_statistics.fillerFrameCount);
+        m_pts_adjustments.add(statistics.ptsAdjustmentCount - m_last_statistics.ptsAdjustmentCount);
+
+        m_last_statistics = statistics;
+    }
+
+    Metrics::Counter &bytes_in()
+    {
+        return m_bytes_in;
+    }
+
+    Metrics::Counter &bytes_out()
+    {
+        return m_bytes_out;
+    }
+
+    Metrics::Counter &stream_timeouts()
+    {
+        return m_stream_timeouts;
+    }
+
+private:
+    Streamer &m_streamer;
+    Metrics::Counter &m_bytes_in;
+    Metrics::Counter &m_bytes_out;
+    Metrics::Counter &m_stream_timeouts;
+    Metrics::Counter &m_ts_packets;
+    Metrics::Counter &m_cc_errors;
+    Metrics::Counter &m_pid_drops;
+    Metrics::Counter &m_rams_commands;
+    Metrics::Gauge &m_rams_units;
+    Metrics::Counter &m_filler_frames;
+    Metrics::Counter &m_pts_adjustments;
+    rplayer::RPlayer::Statistics m_last_statistics;
 };
 
 // Helper class that forwards the RPlayer logging to our log output
@@ -281,7 +415,8 @@ Streamer::Streamer() :
     m_rams_chunk_allocator(new RamsChunkAllocator),
     m_media_player_callback(0),
     m_stream_timout_mark_time_in_ms(0),
-    m_was_stream_data_sent(false)
+    m_was_stream_data_sent(false),
+    m_metrics_collector(*new MetricsCollector(*this))
 {
     m_rplayer.setEnabledFeatures(rplayer::RPlayer::FEATURE_RAMS_DECODER);
     m_rplayer.setTsPacketOutput(m_packet_receptacle);
@@ -295,6 +430,8 @@ Streamer::Streamer() :
 
 Streamer::~Streamer()
 {
+    delete &m_metrics_collector;
+
     stop_stream();
 
     m_rplayer.registerStreamDecryptEngine(0);
@@ -319,6 +456,7 @@ void Streamer::reinitialize()
 
     m_rplayer.reinitialize();
     m_rplayer.setEnabledFeatures(rplayer::RPlayer::FEATURE_RAMS_DECODER);
+    m_rplayer_latency_event_sink.reset();
 }
 
 void Streamer::set_rplayer_parameter(const std::string &parameter, const std::string &value)
@@ -423,6 +561,8 @@ void Streamer::stream_data(const uint8_t *data, uint32_t size)
     // Sample the last time data was received (in order to detect timeouts)
     m_stream_timout_mark_time_in_ms = now_in_ms;
 
+    m_metrics_collector.bytes_in().add(size);
+
     // Update the rplayer time with the current time (so any synchronization works properly)
     // TODO: Replacing this by a callback from rplayer to get the time only when needed will reduce overhead albeit more complex, though.
     // Need to call this in real time as well as just before parsing RAMS packets
@@ -450,6 +590,8 @@ void Streamer::stream_data_from_rplayer(const uint8_t *data, uint32_t size)
     if (m_current_stream_player) {
         m_current_stream_player->stream_data(data, size);
         m_was_stream_data_sent = true;
+        m_metrics_collector.bytes_out().add(size);
+        m_rplayer_latency_event_sink.stream_data_output();
     }
 }
 
@@ -478,6 +620,7 @@ void Streamer::trigger()
     // If longer than STREAM_TIMEOUT_IN_MS, a time-out occurs and we need to signal stream absence.
     if (m_current_stream_player && static_cast<uint32_t>(now_in_ms - m_stream_timout_mark_time_in_ms) > STREAM_TIMEOUT_IN_MS) {
         CTVC_LOG_WARNING("Stream timeout occurs");
+        m_metrics_collector.stream_timeouts().add();
         // Make sure we'll send only one event in the next few seconds.
         m_stream_timout_mark_time_in_ms = now_in_ms;
         // Send an unrecoverable error event; this will lead to the same stream confirm error message
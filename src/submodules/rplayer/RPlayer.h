@@ -76,6 +76,20 @@ public:
     // Currently, the values are only available if underrun mitigation is enabled.
     void getStatus(uint64_t &currentStreamTimeIn90kHzTicks, uint32_t &stalledDurationInMs, uint32_t &pcrDelayIn90kHzTicks);
 
+    // Statistics of the RPlayer components.
+    // Counts are accumulated since construction; they are not cleared by reset() or reinitialize().
+    struct Statistics
+    {
+        uint64_t tsPacketCount;         // Transport packets parsed by the demultiplexers (CENC decryptor and underrun mitigator)
+        uint64_t ccErrorCount;          // Continuity counter errors found by the demultiplexers
+        uint64_t pidDropCount;          // Packets dropped by the demultiplexers because no parser is set up for their PID
+        uint64_t ramsCommandCount;      // RAMS commands interpreted
+        uint32_t ramsUnitCount;         // Units currently held in the RAMS unit store
+        uint64_t fillerFrameCount;      // Filler frames inserted by the underrun mitigator
+        uint64_t ptsAdjustmentCount;    // Frames whose time stamps were shifted by the underrun mitigator
+    };
+    void getStatistics(Statistics &statistics) const;
+
     // Set the callback object
     void registerCallback(ICallback *);
 
@@ -50,6 +50,10 @@ public:
     // management to properly operate.
     void setCurrentTime(uint16_t timeInMs);
 
+    // Statistics: the number of RAMS commands interpreted since construction and the
+    // number of units currently held in the unit store.
+    void getStatistics(uint64_t &commandCount, uint32_t &unitCount) const;
+
 private:
     Rams(const Rams &);
     Rams &operator=(const Rams &);
@@ -67,6 +67,12 @@ void Rams::setCurrentTime(uint16_t timeInMs)
     m_ramsInterpreter.setCurrentTime(timeInMs);
 }
 
+void Rams::getStatistics(uint64_t &commandCount, uint32_t &unitCount) const
+{
+    commandCount = m_ramsInterpreter.getCommandCount();
+    unitCount = m_ramsUnitStore.getUnitCount();
+}
+
 void Rams::put(const uint8_t *data, uint32_t size)
 {
     const uint8_t *end = data + size;
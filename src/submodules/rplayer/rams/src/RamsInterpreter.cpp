@@ -22,6 +22,7 @@ static const uint8_t PAYLOAD_TYPE_RA_ECB_TS = 1;
 
 RamsInterpreter::RamsInterpreter(RamsUnitStore &ramsUnitStore) :
     m_isKeyInfoSet(false),
+    m_commandCount(0),
     m_parserState(STATE_PARSING_HEADER),
     m_currentRamsHeader(0),
     m_streamDecryptEngine(0),
@@ -70,6 +71,11 @@ void RamsInterpreter::reset()
     m_ramsClock.reset();
 }
 
+uint64_t RamsInterpreter::getCommandCount() const
+{
+    return m_commandCount;
+}
+
 void RamsInterpreter::resetCurrentRamsParsingState()
 {
     if (m_currentRamsHeader) {
@@ -98,6 +104,7 @@ void RamsInterpreter::parse(const uint8_t *data, uint32_t size, bool startFlag,
         bool isFirstCommand = true;
         bool isResetAsLastCommand = false;
         while (m_currentRamsHeader->getNextCommand(command)) {
+            m_commandCount++;
             isResetAsLastCommand = false; // May have been set to true by an earlier RESET, but any command following it means that that RESET command was not the last command in the list.
 
             switch (command.m_code) {
@@ -45,6 +45,9 @@ public:
 
     void setCurrentTime(uint16_t timeInMs);
 
+    // Number of RAMS commands interpreted since construction
+    uint64_t getCommandCount() const;
+
     static const uint8_t COMMAND_RESET    = 0;
     static const uint8_t COMMAND_LABEL    = 1;
     static const uint8_t COMMAND_DELETE   = 2;
@@ -62,6 +65,7 @@ private: // Members
     };
 
     bool m_isKeyInfoSet;
+    uint64_t m_commandCount;
 
     // Variables to keep the state of the current packet
     ParserState m_parserState;
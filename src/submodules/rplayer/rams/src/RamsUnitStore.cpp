@@ -29,7 +29,8 @@ using namespace rplayer;
 
 RamsUnitStore::RamsUnitStore() :
     m_chunkAllocator(0),
-    m_units(MAX_UNIT_COUNT)
+    m_units(MAX_UNIT_COUNT),
+    m_unitCount(0)
 {
     memset(&m_units[0], 0, MAX_UNIT_COUNT * sizeof(m_units[0]));
 }
@@ -71,6 +72,7 @@ void RamsUnitStore::reset()
             m_pool.push_back(unit);
         }
     }
+    m_unitCount = 0;
 }
 
 RamsUnit *RamsUnitStore::getUnit(uint32_t unitId) const
@@ -102,6 +104,9 @@ RamsUnit *RamsUnitStore::getOrAllocateUnit(uint32_t unitId)
         }
 
         m_units[unitId] = unit;
+        if (unit) {
+            m_unitCount++;
+        }
     }
 
     return unit;
@@ -118,5 +123,11 @@ void RamsUnitStore::deleteUnit(uint32_t unitId)
         m_units[unitId] = 0;
         unit->clear();
         m_pool.push_back(unit);
+        m_unitCount--;
     }
 }
+
+uint32_t RamsUnitStore::getUnitCount() const
+{
+    return m_unitCount;
+}
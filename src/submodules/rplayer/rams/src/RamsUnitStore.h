@@ -40,6 +40,9 @@ public:
     // Delete the unit with given unit ID (or empty its contents).
     void deleteUnit(uint32_t unitId);
 
+    // Number of units currently in use
+    uint32_t getUnitCount() const;
+
 private:
     RamsUnitStore(const RamsUnitStore &);
     RamsUnitStore &operator=(const RamsUnitStore &);
@@ -49,6 +52,7 @@ private:
     IRamsChunkAllocator *m_chunkAllocator;
     std::vector<RamsUnit *> m_units; // Fixed size
     std::vector<RamsUnit *> m_pool;
+    uint32_t m_unitCount;
 };
 
 } // namespace
@@ -112,6 +112,20 @@ void RPlayer::getStatus(uint64_t &currentStreamTimeIn90kHzTicks, uint32_t &stall
     }
 }
 
+void RPlayer::getStatistics(Statistics &statistics) const
+{
+    uint64_t packetCount = 0;
+    uint64_t continuityErrorCount = 0;
+    uint64_t droppedPacketCount = 0;
+    m_impl.m_underrunMitigator.getStatistics(statistics.fillerFrameCount, statistics.ptsAdjustmentCount, packetCount, continuityErrorCount, droppedPacketCount);
+    m_impl.m_demux.getStatistics(statistics.tsPacketCount, statistics.ccErrorCount, statistics.pidDropCount);
+    statistics.tsPacketCount += packetCount;
+    statistics.ccErrorCount += continuityErrorCount;
+    statistics.pidDropCount += droppedPacketCount;
+
+    m_impl.m_rams.getStatistics(statistics.ramsCommandCount, statistics.ramsUnitCount);
+}
+
 void RPlayer::registerCallback(ICallback *callback)
 {
     m_impl.m_underrunMitigator.registerCallback(callback);
@@ -52,6 +52,10 @@ public:
     bool hasVideo() const;
     bool hasKeyFrameVideo() const;
 
+    // Statistics, accumulated since construction (not cleared by reset()).
+    // Dropped packets are packets on PIDs for which no parser is set up.
+    void getStatistics(uint64_t &packetCount, uint64_t &continuityErrorCount, uint64_t &droppedPacketCount) const;
+
     // For decryption/remultiplexing purposes, an IPacketSink interface can be passed, which
     // will receive any successfully parsed and potentially decrypted transport packet.
     // Only one packet will be sent at a time, and the sent size will always be 188 bytes.
@@ -40,7 +40,7 @@ void LatencyDataParser::parse(const uint8_t *data, uint32_t size)
 {
     RPLAYER_LOG_DEBUG("Got data size:%d", size);
 
-    if (!m_eventOut && size < 3) {
+    if (!m_eventOut || size < 3) {
         return;
     }
 
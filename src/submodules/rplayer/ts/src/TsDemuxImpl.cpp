@@ -150,7 +150,10 @@ TsDemux::Impl::Impl() :
     m_videoPid(INVALID_PID),
     m_keyFrameVideoPid(INVALID_PID),
     m_pcrPid(INVALID_PID),
-    m_latencyDataPid(INVALID_PID)
+    m_latencyDataPid(INVALID_PID),
+    m_packetCount(0),
+    m_continuityErrorCount(0),
+    m_droppedPacketCount(0)
 {
     setupPat();
 }
@@ -324,6 +327,8 @@ void TsDemux::Impl::parseTsPacket(const uint8_t *packetStart, const uint8_t *&pO
     const int payloadPresent = (data[3] & 0x10) != 0;
     const int continuityCounter = data[3] & 0x0F;
 
+    m_packetCount++;
+
     if (pid == NULL_PACKET_PID) {
         // Null packet, discard
         return;
@@ -370,9 +375,11 @@ void TsDemux::Impl::parseTsPacket(const uint8_t *packetStart, const uint8_t *&pO
         return;
     }
 
-    Parser *stream = m_parsers[pid];
+    std::map<int, Parser *>::const_iterator parser = m_parsers.find(pid);
+    Parser *stream = parser != m_parsers.end() ? parser->second : 0;
     if (!stream) {
         RPLAYER_LOG_DEBUG("No parser found for PID %d", pid);
+        m_droppedPacketCount++;
         return;
     }
 
@@ -381,6 +388,7 @@ void TsDemux::Impl::parseTsPacket(const uint8_t *packetStart, const uint8_t *&pO
         // Continuity Counter error on pid
         // For mediasource, seeks will lead to CC errors. Because of this, the log level has been reduced to debug.
         RPLAYER_LOG_DEBUG("CC error: %d, expected %d (PID=%d)", continuityCounter, expectedContinuityCounter, pid);
+        m_continuityErrorCount++;
     }
 
     stream->m_continuityCounter = continuityCounter;
@@ -447,6 +455,13 @@ bool TsDemux::hasKeyFrameVideo() const
     return m_impl.m_keyFrameVideoPid != INVALID_PID;
 }
 
+void TsDemux::getStatistics(uint64_t &packetCount, uint64_t &continuityErrorCount, uint64_t &droppedPacketCount) const
+{
+    packetCount = m_impl.m_packetCount;
+    continuityErrorCount = m_impl.m_continuityErrorCount;
+    droppedPacketCount = m_impl.m_droppedPacketCount;
+}
+
 void TsDemux::Impl::setupPat()
 {
     assert(!m_parsers[PAT_PID]);
@@ -109,6 +109,10 @@ public:
 
     std::vector<IDecryptEngineFactory *> m_decryptEngineFactories;
 
+    uint64_t m_packetCount;
+    uint64_t m_continuityErrorCount;
+    uint64_t m_droppedPacketCount;
+
     void cleanup();
     void parseTsPacket(const uint8_t *p, const uint8_t *&pOut);
     void parsePsiSection(const uint8_t *p, uint32_t size);
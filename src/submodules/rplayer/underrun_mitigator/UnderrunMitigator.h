@@ -42,6 +42,9 @@ public:
     TimeStamp getStalledDuration(); // Total accumulated stalled duration.
     TimeStamp getPcrDelay(); // Egress PCR correction (only non-zero if filler frames were inserted and need correction by the compositor).
 
+    // Statistics, accumulated since construction (not cleared by reset()).
+    void getStatistics(uint64_t &fillerFrameCount, uint64_t &ptsAdjustmentCount, uint64_t &packetCount, uint64_t &continuityErrorCount, uint64_t &droppedPacketCount) const;
+
     // Bring the underrun mitigator back into its state similar to after construction
     // This will reset all parameters and dynamic state but it won't
     // unregister any registered TS or event output or the like.
@@ -200,6 +200,7 @@ Frame *AudioFillerFrameInserter::getNextFrame(TimeStamp pcr)
                     m_delay += frame->m_duration;
                     frame->m_pts = nextPts;
                     RPLAYER_LOG_INFO("Inserting filler frame, length=%ums, delay=%ums", static_cast<uint32_t>(frame->m_duration.getAsMilliseconds()), static_cast<uint32_t>(m_delay.getAsMilliseconds()));
+                    UnderrunAlgorithmBase::notifyFillerFrameInserted();
                 }
             }
         }
@@ -122,6 +122,9 @@ void UnderrunAlgorithmBase::notifyDelay(const TimeStamp &delay)
         return;
     }
 
+    // Any delay means the time stamps of the frame were shifted.
+    m_callback.ptsAdjusted();
+
     // The stall is computed by looking at the current delay vs. the previous delay.
     // If the delay increased, there was a stall. If it decreased, there is latency
     // mitigation going on (speed-up of playback) and no stall is reported.
@@ -139,6 +142,11 @@ void UnderrunAlgorithmBase::notifyDelay(const TimeStamp &delay)
     m_callback.stallDetected(stallTime);
 }
 
+void UnderrunAlgorithmBase::notifyFillerFrameInserted()
+{
+    m_callback.fillerFrameInserted();
+}
+
 TimeStamp UnderrunAlgorithmBase::getStalledDuration()
 {
     return m_accumulatedStalledDuration;
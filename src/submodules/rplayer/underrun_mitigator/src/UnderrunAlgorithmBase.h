@@ -20,6 +20,8 @@ public:
     struct ICallback
     {
         virtual void stallDetected(const TimeStamp &stallDuration) = 0;
+        virtual void fillerFrameInserted() = 0;
+        virtual void ptsAdjusted() = 0;
     };
 
     UnderrunAlgorithmBase(StreamBuffer &source, const UnderrunAlgorithmParams &params, ICallback &callback);
@@ -55,6 +57,9 @@ protected:
     // Called by derived class when a delay is detected (i.e. any received frame that experiences a delay > 0).
     void notifyDelay(const TimeStamp &delayTime);
 
+    // Called by derived class when a filler frame is inserted.
+    void notifyFillerFrameInserted();
+
 private:
     UnderrunAlgorithmBase(const UnderrunAlgorithmBase &);
     UnderrunAlgorithmBase &operator=(const UnderrunAlgorithmBase &);
@@ -64,6 +64,16 @@ public:
             m_impl.stallDetected(m_isAudioNotVideo, stallDuration);
         }
 
+        void fillerFrameInserted()
+        {
+            m_impl.m_fillerFrameCount++;
+        }
+
+        void ptsAdjusted()
+        {
+            m_impl.m_ptsAdjustmentCount++;
+        }
+
     private:
         Impl &m_impl;
         bool m_isAudioNotVideo;
@@ -94,6 +104,10 @@ public:
 
     TimeStamp m_ingressStreamTime;
 
+    // Statistics
+    uint64_t m_fillerFrameCount;
+    uint64_t m_ptsAdjustmentCount;
+
     void generateOutput();
 
     void stallDetected(bool isAudioNotVideo, const TimeStamp &stallDuration);
@@ -212,6 +226,13 @@ TimeStamp UnderrunMitigator::getPcrDelay()
     return TimeStamp();
 }
 
+void UnderrunMitigator::getStatistics(uint64_t &fillerFrameCount, uint64_t &ptsAdjustmentCount, uint64_t &packetCount, uint64_t &continuityErrorCount, uint64_t &droppedPacketCount) const
+{
+    fillerFrameCount = m_impl.m_fillerFrameCount;
+    ptsAdjustmentCount = m_impl.m_ptsAdjustmentCount;
+    m_impl.m_demux.getStatistics(packetCount, continuityErrorCount, droppedPacketCount);
+}
+
 void UnderrunMitigator::reinitialize()
 {
     m_impl.reinitialize();
@@ -258,7 +279,9 @@ UnderrunMitigator::Impl::Impl() :
     m_lastTime(0),
     m_clockSlowdownRemainder(0),
     m_pcrResyncThreshold(0),
-    m_ingressPcrOffset(0)
+    m_ingressPcrOffset(0),
+    m_fillerFrameCount(0),
+    m_ptsAdjustmentCount(0)
 {
     m_demux.setEventOutput(this);
     m_demux.setVideoOutput(&m_videoBuffer);
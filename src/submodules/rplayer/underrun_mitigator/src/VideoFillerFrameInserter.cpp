@@ -197,6 +197,7 @@ Frame *VideoFillerFrameInserter::getNextFrame(TimeStamp pcr)
                     m_delay += getParams().m_defaultFillerFrameDuration;
                     frame->m_pts = nextPts;
                     RPLAYER_LOG_INFO("Inserting filler frame after %ums, delay=%ums", static_cast<uint32_t>(getParams().m_defaultFillerFrameDuration.getAsMilliseconds()), static_cast<uint32_t>(m_delay.getAsMilliseconds()));
+                    UnderrunAlgorithmBase::notifyFillerFrameInserted();
                 }
             }
         }
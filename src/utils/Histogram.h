@@ -33,6 +33,13 @@ namespace ctvc
 // To save duplication of information, the HistogramBinDefinition class keeps track of the
 // bin size definition and the data itself is kept in a separate Histogram object.
 //
+// Besides explicitly defined bins, a bin definition can be log-linear (HDR-style): values
+// are kept with a configurable number of significant decimal digits over the whole range,
+// so the long tail of a distribution keeps the same relative resolution as its body.
+// Accumulating into a log-linear histogram takes constant time, and percentiles can be
+// queried from either kind of histogram. Histograms with the same bin definition can be
+// merged; copying a histogram yields a snapshot.
+//
 
 class Histogram
 {
@@ -45,6 +52,15 @@ public:
         // Add bins to the definition
         void add_bins(int32_t first_bin_start, const uint32_t *bin_widths, uint32_t n_bins);
 
+        // Define log-linear bins covering the values 0 up to and including highest_value, with a
+        // resolution of the given number of significant decimal digits (1 to 5).
+        // Values outside the range are clamped to it.
+        // This replaces any bins added with add_bins().
+        void set_log_linear(int32_t highest_value, uint32_t significant_digits);
+
+        // Whether the bins are log-linear
+        bool is_log_linear() const;
+
         // The number of bins in this histogram
         uint32_t get_n_bins() const;
 
@@ -57,6 +73,13 @@ public:
 
         std::vector<int32_t> m_bin_starts;
 
+        bool m_is_log_linear;
+        int32_t m_highest_value;
+        uint32_t m_sub_bin_count_magnitude; // log2 of the number of bins per power of 2
+        uint32_t m_n_log_linear_bins;
+
+        uint32_t get_log_linear_bin_index(int32_t value) const;
+
         // Accumulate a value into given histogram data
         void accumulate(int32_t value, Histogram &histogram) const;
     };
@@ -78,11 +101,27 @@ public:
     // Get the total number of accumulated samples
     uint32_t get_n_samples() const;
 
+    // Get the smallest and largest accumulated value; 0 if there are no samples
+    int32_t get_min_value() const;
+    int32_t get_max_value() const;
+
+    // Add the accumulated data of another histogram with the same bin definition
+    void merge(const Histogram &other);
+
+    // Get the value below which the given percentage (0 to 100) of the samples fall.
+    // The result is the highest value of the bin the percentile falls in, limited to the
+    // largest accumulated value; 0 if there are no samples.
+    int32_t get_value_at_percentile(double percentile) const;
+
 private:
+    Histogram &operator=(const Histogram &);
+
     const BinDefinition &m_bin_definition;
 
     std::vector<uint32_t> m_entries;
     uint32_t m_n_samples;
+    int32_t m_min_value;
+    int32_t m_max_value;
 };
 
 }
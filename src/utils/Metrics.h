@@ -0,0 +1,160 @@
+///
+/// \file Metrics.h
+///
+/// \brief CloudTV Nano SDK process-wide metrics registry.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+namespace ctvc
+{
+
+//
+// Process-wide registry of named metrics, meant for counting what happens on the hot paths
+// of the pipeline (packets, bytes, errors, stalls) at negligible cost and reading it all
+// back in one go, e.g. for a periodic dump or for fleet-wide capacity planning.
+//
+// Counters only increase. Their value is spread over a number of shards, and a thread only
+// does an atomic add on the shard its identity hashes to, so threads hardly ever contend on
+// the same cache line. The value of a counter is the sum of its shards.
+// Gauges hold a level that can go up and down, e.g. the occupancy of a store.
+// Distributions accumulate samples into a log-linear histogram per shard.
+//
+// Metrics are created on first use and live as long as the process. Looking a metric up
+// takes a lock, so look it up once (e.g. in a constructor) and keep the reference.
+// Names are dot-separated, component first, e.g. "tcp_connection.bytes_received".
+//
+// Components that keep their own statistics, such as the rplayer, which cannot depend on this
+// registry, register a collector. Collectors are called before each snapshot so they can push
+// their numbers into the registry.
+//
+
+class Metrics
+{
+public:
+    class Counter
+    {
+    public:
+        // Add delta to the counter
+        void add(uint64_t delta = 1);
+
+        // Sum of all shards
+        uint64_t get_value() const;
+
+    private:
+        friend class Metrics;
+
+        Counter();
+        ~Counter();
+        Counter(const Counter &);
+        Counter &operator=(const Counter &);
+
+        struct Shard;
+        Shard *m_shards;
+    };
+
+    class Gauge
+    {
+    public:
+        void set(int64_t value);
+        void add(int64_t delta);
+
+        int64_t get_value() const;
+
+    private:
+        friend class Metrics;
+
+        Gauge();
+        ~Gauge();
+        Gauge(const Gauge &);
+        Gauge &operator=(const Gauge &);
+
+        struct Value;
+        Value &m_value;
+    };
+
+    class Distribution
+    {
+    public:
+        // Accumulate a sample. Values outside 0 up to the highest value are clamped to that range.
+        void add_sample(int32_t value);
+
+    private:
+        friend class Metrics;
+
+        Distribution(int32_t highest_value);
+        ~Distribution();
+        Distribution(const Distribution &);
+        Distribution &operator=(const Distribution &);
+
+        struct Shards;
+        Shards &m_shards;
+    };
+
+    // Interface of components that push their own statistics into the registry on demand
+    struct ICollector
+    {
+        virtual ~ICollector()
+        {
+        }
+
+        // Called before a snapshot is taken; update the metrics of the component here.
+        virtual void collect_metrics() = 0;
+    };
+
+    enum Type
+    {
+        TYPE_COUNTER,
+        TYPE_GAUGE,
+        TYPE_DISTRIBUTION
+    };
+
+    struct Sample
+    {
+        std::string name;
+        Type type;
+        int64_t value; // Counter or gauge value, or the number of samples of a distribution
+        // Distributions only
+        int32_t p50;
+        int32_t p90;
+        int32_t p99;
+        int32_t max;
+    };
+
+    // Get the metric with the given name, creating it if it does not exist yet.
+    // A name identifies one metric; asking for it with a different type is a programming error.
+    static Counter &get_counter(const std::string &name);
+    static Gauge &get_gauge(const std::string &name);
+    // Distributions keep 2 significant digits over the range 0 up to and including highest_value.
+    static Distribution &get_distribution(const std::string &name, int32_t highest_value);
+
+    // A collector must be unregistered before it is destroyed.
+    static void register_collector(ICollector &collector);
+    static void unregister_collector(ICollector &collector);
+
+    // Get the current value of all metrics, sorted by name.
+    static void get_snapshot(std::vector<Sample> &samples/*out*/);
+
+    // Get a text dump of the current value of all metrics, one metric per line, sorted by name:
+    //   <name> <value>
+    //   <name> n=<samples> p50=<value> p90=<value> p99=<value> max=<value>
+    static std::string dump();
+
+private:
+    Metrics(); // Not instantiable, all access is through the static methods
+
+    class Registry;
+    static Registry &registry();
+};
+
+}
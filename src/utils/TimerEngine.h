@@ -13,6 +13,7 @@
 
 #include <porting_layer/Thread.h>
 #include <porting_layer/Condition.h>
+#include <porting_layer/Semaphore.h>
 #include <porting_layer/TimeStamp.h>
 #include <porting_layer/ResultCode.h>
 
@@ -25,6 +26,12 @@ namespace ctvc {
 //
 // This class provides timers for one shot or periodic timing purposes.
 //
+// Timers are kept in a hierarchical timing wheel, so starting and canceling a
+// timer takes constant time regardless of the number of registered timers.
+// Expiration times are rounded up to the tick of the engine; timers that
+// expire in the same tick are fired together in a single wake-up. With the
+// default tick of 1 ms, timers fire with millisecond accuracy.
+//
 
 class TimerEngine : public Thread::IRunnable
 {
@@ -35,8 +42,15 @@ public:
     static const ResultCode TIMER_NOT_REGISTERED; //!< The requested timer is not registered. (See \a cancel_timer().)
     static const ResultCode ILLEGAL_TIMEOUT; //!< The requested timeout_in_ms has an illegal value. (See \a start_timer().)
 
+    struct TimerEntry;
+
     struct ITimer
     {
+        ITimer() :
+            m_timer_entry(0)
+        {
+        }
+
         virtual ~ITimer()
         {
         }
@@ -56,9 +70,40 @@ public:
         virtual void timer_done()
         {
         }
+
+    private:
+        friend class TimerEngine;
+
+        // Registration of this timer, owned by the TimerEngine it is started on.
+        // A timer can be registered with only one TimerEngine at a time.
+        TimerEntry *m_timer_entry;
+    };
+
+    /// \brief Statistics of the timer engine.
+    struct Stats
+    {
+        Stats() :
+            armed_timers(0),
+            fired_timers(0),
+            coalesced_timers(0),
+            late_fires(0),
+            max_lateness_in_ms(0)
+        {
+        }
+
+        uint32_t armed_timers; //!< Number of timers currently registered.
+        uint64_t fired_timers; //!< Number of timer expirations signaled.
+        uint64_t coalesced_timers; //!< Number of timer expirations that shared a wake-up with an earlier timer of the same tick.
+        uint64_t late_fires; //!< Number of timer expirations signaled more than one tick after their expiration time.
+        uint32_t max_lateness_in_ms; //!< Largest delay between expiration time and signaling of any timer.
     };
 
-    TimerEngine(const std::string &thread_name);
+    /// \brief Constructor.
+    /// \param[in] thread_name Name of the timer thread.
+    /// \param[in] tick_in_ms Resolution of the timer engine. Expiration times are
+    ///            rounded up to a multiple of this value, so timers that expire
+    ///            within the same tick are coalesced into one wake-up.
+    TimerEngine(const std::string &thread_name, uint32_t tick_in_ms = 1);
     ~TimerEngine();
 
     /// \brief Start the timer engine.
@@ -90,38 +135,64 @@ public:
     /// \return ResultCode::SUCCESS if successful, an error code otherwise.
     ResultCode cancel_timer(ITimer &timer);
 
-private:
-    Thread m_thread;
-    Condition m_condition;
+    /// \brief Wait until the timers that had expired at the time of the call have been signaled.
+    ///        Expired timers are signaled without holding the lock of the engine, so they can still be
+    ///        called right after they have been canceled. An object that shares the engine with others
+    ///        calls this after canceling its timers and before it is destroyed.
+    /// \note Returns immediately when called from a timer function.
+    void wait_for_signaled_timers();
 
-    struct TimerEntry
-    {
-        TimerEntry(ITimer &timer, const TimeStamp &expiration_time, uint32_t timeout_in_ms, Mode mode) :
-            m_timer(&timer),
-            m_expiration_time(expiration_time),
-            m_timeout_in_ms(timeout_in_ms),
-            m_mode(mode)
-        {
-        }
+    /// \brief Get the statistics of the timer engine.
+    /// \return The current statistics.
+    Stats get_stats();
 
-        bool operator==(const ITimer *t) const
-        {
-            return m_timer == t;
-        }
+    /// \brief Reset the expiration statistics (all but the number of armed timers).
+    void reset_stats();
 
-        ITimer *m_timer;
-        TimeStamp m_expiration_time;
-        uint32_t m_timeout_in_ms;
-        Mode m_mode;
-    };
+private:
+    // The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each. A slot of level n
+    // spans WHEEL_SLOTS^n ticks. Timers further away than the wheel can hold are parked
+    // in the outermost level and re-inserted when that slot is cascaded.
+    static const uint32_t WHEEL_LEVELS = 4;
+    static const uint32_t WHEEL_SLOT_BITS = 6;
+    static const uint32_t WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS; // Must match the bit count of the slot occupancy mask
+    static const uint64_t WHEEL_RANGE = static_cast<uint64_t>(1) << (WHEEL_LEVELS * WHEEL_SLOT_BITS);
+    static const uint64_t NO_TICK = ~static_cast<uint64_t>(0);
 
-    static int compare_func(const void *, const void *);
-    void sort_timers();
+    Thread m_thread;
+    Condition m_condition;
 
-    // We use a vector and simple linear search. That should be fine for
-    // all cases because we expect only a very limited number of timers
-    // to be registered at any single point in time.
-    std::vector<TimerEntry> m_timers;
+    const int64_t m_tick_in_us;
+    TimeStamp m_epoch; // Time of tick 0
+    uint64_t m_current_tick; // Last tick that has been processed
+    uint64_t m_wakeup_tick; // Tick the timer thread is waiting for, NO_TICK if none
+
+    TimerEntry *m_slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t m_slot_occupancy[WHEEL_LEVELS]; // One bit for each non-empty slot
+    TimerEntry *m_free_entries; // Recycled entries, linked through m_next
+
+    Stats m_stats;
+    uint64_t m_signal_passes; // Passes of the timer thread that started signaling expired timers
+    uint64_t m_signaled_passes; // Passes that have completed signaling
+    std::vector<Semaphore *> m_signal_waiters; // Posted when the current pass has completed signaling
+
+    // Owned by the timer thread, kept to prevent reallocation on each wake-up.
+    std::vector<ITimer *> m_expired_timers;
+    std::vector<ITimer *> m_removed_timers;
+
+    uint64_t get_tick(const TimeStamp &t, bool round_up) const;
+    TimeStamp get_time_of_tick(uint64_t tick) const;
+
+    TimerEntry *allocate_entry();
+    void free_entry(TimerEntry *entry);
+    void insert_entry(TimerEntry *entry);
+    void remove_entry(TimerEntry *entry);
+    TimerEntry *detach_slot(uint32_t level, uint32_t slot);
+
+    bool find_next_event_tick(uint64_t &tick) const;
+    void advance_to(uint64_t tick, const TimeStamp &now);
+    void process_tick(uint64_t tick, const TimeStamp &now);
+    void expire_entry(TimerEntry *entry, const TimeStamp &now);
 
     void fire_timers(const TimeStamp &now);
 
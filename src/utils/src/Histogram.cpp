@@ -12,12 +12,42 @@
 #include <utils/Histogram.h>
 
 #include <assert.h>
+#include <stddef.h>
 
 using namespace ctvc;
 
+// Number of bits needed to represent the given value, i.e. the position of the highest set bit plus 1
+static uint32_t get_bit_length(uint32_t v)
+{
+    uint32_t n = 0;
+    if (v >= (1U << 16)) {
+        n += 16;
+        v >>= 16;
+    }
+    if (v >= (1U << 8)) {
+        n += 8;
+        v >>= 8;
+    }
+    if (v >= (1U << 4)) {
+        n += 4;
+        v >>= 4;
+    }
+    if (v >= (1U << 2)) {
+        n += 2;
+        v >>= 2;
+    }
+    if (v >= (1U << 1)) {
+        n += 1;
+        v >>= 1;
+    }
+    return n + v;
+}
+
 Histogram::Histogram(const BinDefinition &bin_definition) :
     m_bin_definition(bin_definition),
-    m_n_samples(0)
+    m_n_samples(0),
+    m_min_value(0),
+    m_max_value(0)
 {
     clear();
 }
@@ -30,12 +60,20 @@ const Histogram::BinDefinition &Histogram::get_bin_definition() const
 void Histogram::clear()
 {
     m_n_samples = 0;
+    m_min_value = 0;
+    m_max_value = 0;
     m_entries.clear();
     m_entries.resize(m_bin_definition.get_n_bins());
 }
 
 void Histogram::accumulate(int32_t value)
 {
+    if (m_n_samples == 0 || value < m_min_value) {
+        m_min_value = value;
+    }
+    if (m_n_samples == 0 || value > m_max_value) {
+        m_max_value = value;
+    }
     m_n_samples++;
     m_bin_definition.accumulate(value, *this);
 }
@@ -52,12 +90,82 @@ uint32_t Histogram::get_n_samples() const
     return m_n_samples;
 }
 
-Histogram::BinDefinition::BinDefinition()
+int32_t Histogram::get_min_value() const
+{
+    return m_min_value;
+}
+
+int32_t Histogram::get_max_value() const
+{
+    return m_max_value;
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    assert(&other.m_bin_definition == &m_bin_definition);
+    assert(other.m_entries.size() == m_entries.size());
+
+    if (other.m_n_samples == 0) {
+        return;
+    }
+
+    if (m_n_samples == 0 || other.m_min_value < m_min_value) {
+        m_min_value = other.m_min_value;
+    }
+    if (m_n_samples == 0 || other.m_max_value > m_max_value) {
+        m_max_value = other.m_max_value;
+    }
+    m_n_samples += other.m_n_samples;
+
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        m_entries[i] += other.m_entries[i];
+    }
+}
+
+int32_t Histogram::get_value_at_percentile(double percentile) const
+{
+    if (m_n_samples == 0) {
+        return 0;
+    }
+
+    if (percentile > 100.0) {
+        percentile = 100.0;
+    }
+
+    // The number of samples that must be at or below the returned value, at least 1.
+    uint64_t count_at_percentile = static_cast<uint64_t>(percentile / 100.0 * m_n_samples + 0.5);
+    if (count_at_percentile < 1) {
+        count_at_percentile = 1;
+    }
+
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < m_entries.size(); i++) {
+        count += m_entries[i];
+        if (count >= count_at_percentile) {
+            int start;
+            int end;
+            m_bin_definition.get_bin_range(i, start, end);
+            int32_t value = end - 1;
+            return value < m_max_value ? value : m_max_value;
+        }
+    }
+
+    // The remaining samples were outside the range of the bins.
+    return m_max_value;
+}
+
+Histogram::BinDefinition::BinDefinition() :
+    m_is_log_linear(false),
+    m_highest_value(0),
+    m_sub_bin_count_magnitude(0),
+    m_n_log_linear_bins(0)
 {
 }
 
 void Histogram::BinDefinition::add_bins(int32_t first_bin_start, const uint32_t *bin_widths, uint32_t n_bins)
 {
+    assert(!m_is_log_linear);
+
     m_bin_starts.push_back(first_bin_start);
 
     int32_t bin_start = first_bin_start;
@@ -67,21 +175,97 @@ void Histogram::BinDefinition::add_bins(int32_t first_bin_start, const uint32_t
     }
 }
 
+void Histogram::BinDefinition::set_log_linear(int32_t highest_value, uint32_t significant_digits)
+{
+    assert(highest_value > 0);
+
+    if (significant_digits < 1) {
+        significant_digits = 1;
+    } else if (significant_digits > 5) {
+        significant_digits = 5;
+    }
+
+    // Values up to 2 * 10^digits are kept with a resolution of 1, which takes the given number of
+    // significant digits. Each next power of 2 reuses the upper half of those bins at twice the width.
+    uint32_t largest_value_with_unit_resolution = 2;
+    for (uint32_t i = 0; i < significant_digits; i++) {
+        largest_value_with_unit_resolution *= 10;
+    }
+    m_sub_bin_count_magnitude = get_bit_length(largest_value_with_unit_resolution - 1);
+
+    // Count the number of powers of 2 needed to cover the highest value.
+    uint32_t n_buckets = 1;
+    for (uint64_t smallest_untrackable_value = static_cast<uint64_t>(1) << m_sub_bin_count_magnitude; smallest_untrackable_value <= static_cast<uint64_t>(highest_value); smallest_untrackable_value <<= 1) {
+        n_buckets++;
+    }
+
+    m_bin_starts.clear();
+    m_is_log_linear = true;
+    m_highest_value = highest_value;
+    m_n_log_linear_bins = (n_buckets + 1) << (m_sub_bin_count_magnitude - 1);
+}
+
+bool Histogram::BinDefinition::is_log_linear() const
+{
+    return m_is_log_linear;
+}
+
 uint32_t Histogram::BinDefinition::get_n_bins() const
 {
-    return m_bin_starts.size() - 1;
+    if (m_is_log_linear) {
+        return m_n_log_linear_bins;
+    }
+
+    // No bins until the first is added
+    return m_bin_starts.empty() ? 0 : m_bin_starts.size() - 1;
 }
 
 void Histogram::BinDefinition::get_bin_range(uint32_t bin_index, int &start/*out*/, int &end/*out*/) const
 {
     assert(bin_index < get_n_bins());
 
+    if (m_is_log_linear) {
+        const uint32_t half_count_magnitude = m_sub_bin_count_magnitude - 1;
+        const uint32_t half_count = 1U << half_count_magnitude;
+        int32_t bucket_index = static_cast<int32_t>(bin_index >> half_count_magnitude) - 1;
+        uint32_t sub_bin_index = (bin_index & (half_count - 1)) + half_count;
+        if (bucket_index < 0) {
+            sub_bin_index -= half_count;
+            bucket_index = 0;
+        }
+        start = static_cast<int>(static_cast<int64_t>(sub_bin_index) << bucket_index);
+        end = static_cast<int>((static_cast<int64_t>(sub_bin_index) + 1) << bucket_index);
+        return;
+    }
+
     start = m_bin_starts[bin_index];
     end = m_bin_starts[bin_index + 1];
 }
 
+uint32_t Histogram::BinDefinition::get_log_linear_bin_index(int32_t value) const
+{
+    uint32_t v = value < 0 ? 0 : value > m_highest_value ? m_highest_value : value;
+
+    // The bucket is the power of 2 the value falls in, relative to the unit resolution range.
+    // Within a bucket, the value is shifted down to its sub-bin; only the upper half of the
+    // sub-bins is used for any bucket but the first one.
+    const uint32_t half_count_magnitude = m_sub_bin_count_magnitude - 1;
+    const uint32_t sub_bin_mask = (1U << m_sub_bin_count_magnitude) - 1;
+    uint32_t bucket_index = get_bit_length(v | sub_bin_mask) - m_sub_bin_count_magnitude;
+    uint32_t sub_bin_index = v >> bucket_index;
+
+    return ((bucket_index + 1) << half_count_magnitude) + sub_bin_index - (1U << half_count_magnitude);
+}
+
 void Histogram::BinDefinition::accumulate(int32_t value, Histogram &histogram) const
 {
+    if (m_is_log_linear) {
+        assert(histogram.m_entries.size() == m_n_log_linear_bins);
+
+        histogram.m_entries[get_log_linear_bin_index(value)]++;
+        return;
+    }
+
     assert(m_bin_starts.size() > 0);
     assert(histogram.m_entries.size() == m_bin_starts.size() - 1);
 
@@ -0,0 +1,356 @@
+///
+/// \file Metrics.cpp
+///
+/// \brief CloudTV Nano SDK process-wide metrics registry implementation.
+///
+///
+/// \copyright Copyright © 2017 ActiveVideo, Inc. and/or its affiliates.
+/// Reproduction in whole or in part without written permission is prohibited.
+/// All rights reserved. U.S. Patents listed at http://www.activevideo.com/patents
+///
+
+#include <utils/Metrics.h>
+#include <utils/Histogram.h>
+#include <utils/utils.h>
+
+#include <porting_layer/Atomic.h>
+#include <porting_layer/AutoLock.h>
+#include <porting_layer/Mutex.h>
+#include <porting_layer/Thread.h>
+
+#include <algorithm>
+#include <map>
+
+#include <assert.h>
+#include <stddef.h>
+
+using namespace ctvc;
+
+#if !defined __GNUC__ || defined __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+// 64-bit atomics are lock-free (or AtomicInteger falls back to a mutex anyway)
+typedef uint64_t CounterWord;
+typedef int64_t GaugeWord;
+#else
+// Only native word atomics are available, so counters and gauges wrap at 2^32.
+typedef unsigned long CounterWord;
+typedef long GaugeWord;
+#endif
+
+static const uint32_t N_SHARDS = 8; // Power of 2
+static const uint32_t CACHE_LINE_SIZE = 64;
+static const uint32_t DISTRIBUTION_SIGNIFICANT_DIGITS = 2;
+
+// Threads are spread over the shards by the address of their Thread object. Threads that
+// were not created through Thread (e.g. the main thread) share shard 0.
+static uint32_t get_shard_index()
+{
+    uintptr_t thread = reinterpret_cast<uintptr_t>(Thread::self());
+    return static_cast<uint32_t>((thread >> 6) ^ (thread >> 12)) & (N_SHARDS - 1);
+}
+
+//
+// Counter
+//
+
+struct Metrics::Counter::Shard
+{
+    AtomicInteger<CounterWord> value;
+    // Keep shards on separate cache lines so threads on different shards don't contend
+    uint8_t padding[CACHE_LINE_SIZE > sizeof(AtomicInteger<CounterWord>) ? CACHE_LINE_SIZE - sizeof(AtomicInteger<CounterWord>) : 1];
+};
+
+Metrics::Counter::Counter() :
+    m_shards(new Shard[N_SHARDS])
+{
+}
+
+Metrics::Counter::~Counter()
+{
+    delete[] m_shards;
+}
+
+void Metrics::Counter::add(uint64_t delta)
+{
+    m_shards[get_shard_index()].value.fetch_add(static_cast<CounterWord>(delta));
+}
+
+uint64_t Metrics::Counter::get_value() const
+{
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < N_SHARDS; i++) {
+        value += m_shards[i].value.load();
+    }
+
+    return value;
+}
+
+//
+// Gauge
+//
+
+struct Metrics::Gauge::Value
+{
+    AtomicInteger<GaugeWord> value;
+};
+
+Metrics::Gauge::Gauge() :
+    m_value(*new Value())
+{
+}
+
+Metrics::Gauge::~Gauge()
+{
+    delete &m_value;
+}
+
+void Metrics::Gauge::set(int64_t value)
+{
+    m_value.value.store(static_cast<GaugeWord>(value));
+}
+
+void Metrics::Gauge::add(int64_t delta)
+{
+    m_value.value.fetch_add(static_cast<GaugeWord>(delta));
+}
+
+int64_t Metrics::Gauge::get_value() const
+{
+    return m_value.value.load();
+}
+
+//
+// Distribution
+//
+
+struct Metrics::Distribution::Shards
+{
+    Histogram::BinDefinition bin_definition;
+    int32_t highest_value;
+    // A histogram is too big to update atomically, so each shard has its own lock.
+    // Threads on different shards still don't contend.
+    Mutex mutex[N_SHARDS];
+    Histogram *histogram[N_SHARDS];
+};
+
+Metrics::Distribution::Distribution(int32_t highest_value) :
+    m_shards(*new Shards())
+{
+    m_shards.bin_definition.set_log_linear(highest_value, DISTRIBUTION_SIGNIFICANT_DIGITS);
+    m_shards.highest_value = highest_value;
+    for (uint32_t i = 0; i < N_SHARDS; i++) {
+        m_shards.histogram[i] = new Histogram(m_shards.bin_definition);
+    }
+}
+
+Metrics::Distribution::~Distribution()
+{
+    for (uint32_t i = 0; i < N_SHARDS; i++) {
+        delete m_shards.histogram[i];
+    }
+    delete &m_shards;
+}
+
+void Metrics::Distribution::add_sample(int32_t value)
+{
+    if (value < 0) {
+        value = 0;
+    } else if (value > m_shards.highest_value) {
+        value = m_shards.highest_value;
+    }
+
+    uint32_t i = get_shard_index();
+    AutoLock lck(m_shards.mutex[i]);
+    m_shards.histogram[i]->accumulate(value);
+}
+
+//
+// Registry
+//
+
+class Metrics::Registry
+{
+public:
+    Registry()
+    {
+    }
+
+    ~Registry()
+    {
+        for (std::map<std::string, Counter *>::iterator i = m_counters.begin(); i != m_counters.end(); ++i) {
+            delete i->second;
+        }
+        for (std::map<std::string, Gauge *>::iterator i = m_gauges.begin(); i != m_gauges.end(); ++i) {
+            delete i->second;
+        }
+        for (std::map<std::string, Distribution *>::iterator i = m_distributions.begin(); i != m_distributions.end(); ++i) {
+            delete i->second;
+        }
+    }
+
+    // Collectors have a lock of their own: a collector may take locks of its component while
+    // that component, holding those locks, looks up a metric.
+    Mutex m_collector_mutex;
+    std::vector<ICollector *> m_collectors;
+
+    Mutex m_mutex;
+    std::map<std::string, Counter *> m_counters;
+    std::map<std::string, Gauge *> m_gauges;
+    std::map<std::string, Distribution *> m_distributions;
+
+private:
+    Registry(const Registry &);
+    Registry &operator=(const Registry &);
+};
+
+Metrics::Registry &Metrics::registry()
+{
+    static Registry s_registry;
+
+    return s_registry;
+}
+
+Metrics::Counter &Metrics::get_counter(const std::string &name)
+{
+    Registry &r(registry());
+    AutoLock lck(r.m_mutex);
+
+    assert(r.m_gauges.find(name) == r.m_gauges.end() && r.m_distributions.find(name) == r.m_distributions.end());
+
+    Counter *&counter = r.m_counters[name];
+    if (!counter) {
+        counter = new Counter();
+    }
+
+    return *counter;
+}
+
+Metrics::Gauge &Metrics::get_gauge(const std::string &name)
+{
+    Registry &r(registry());
+    AutoLock lck(r.m_mutex);
+
+    assert(r.m_counters.find(name) == r.m_counters.end() && r.m_distributions.find(name) == r.m_distributions.end());
+
+    Gauge *&gauge = r.m_gauges[name];
+    if (!gauge) {
+        gauge = new Gauge();
+    }
+
+    return *gauge;
+}
+
+Metrics::Distribution &Metrics::get_distribution(const std::string &name, int32_t highest_value)
+{
+    Registry &r(registry());
+    AutoLock lck(r.m_mutex);
+
+    assert(r.m_counters.find(name) == r.m_counters.end() && r.m_gauges.find(name) == r.m_gauges.end());
+
+    Distribution *&distribution = r.m_distributions[name];
+    if (!distribution) {
+        distribution = new Distribution(highest_value);
+    }
+
+    return *distribution;
+}
+
+void Metrics::register_collector(ICollector &collector)
+{
+    Registry &r(registry());
+    AutoLock lck(r.m_collector_mutex);
+
+    if (std::find(r.m_collectors.begin(), r.m_collectors.end(), &collector) == r.m_collectors.end()) {
+        r.m_collectors.push_back(&collector);
+    }
+}
+
+void Metrics::unregister_collector(ICollector &collector)
+{
+    Registry &r(registry());
+    AutoLock lck(r.m_collector_mutex);
+
+    std::vector<ICollector *>::iterator i = std::find(r.m_collectors.begin(), r.m_collectors.end(), &collector);
+    if (i != r.m_collectors.end()) {
+        r.m_collectors.erase(i);
+    }
+}
+
+static bool is_sample_name_less(const Metrics::Sample &lhs, const Metrics::Sample &rhs)
+{
+    return lhs.name < rhs.name;
+}
+
+void Metrics::get_snapshot(std::vector<Sample> &samples/*out*/)
+{
+    Registry &r(registry());
+
+    {
+        AutoLock lck(r.m_collector_mutex);
+
+        for (std::vector<ICollector *>::const_iterator i = r.m_collectors.begin(); i != r.m_collectors.end(); ++i) {
+            (*i)->collect_metrics();
+        }
+    }
+
+    AutoLock lck(r.m_mutex);
+
+    samples.clear();
+    samples.reserve(r.m_counters.size() + r.m_gauges.size() + r.m_distributions.size());
+
+    Sample sample;
+    sample.p50 = 0;
+    sample.p90 = 0;
+    sample.p99 = 0;
+    sample.max = 0;
+
+    sample.type = TYPE_COUNTER;
+    for (std::map<std::string, Counter *>::const_iterator i = r.m_counters.begin(); i != r.m_counters.end(); ++i) {
+        sample.name = i->first;
+        sample.value = static_cast<int64_t>(i->second->get_value());
+        samples.push_back(sample);
+    }
+
+    sample.type = TYPE_GAUGE;
+    for (std::map<std::string, Gauge *>::const_iterator i = r.m_gauges.begin(); i != r.m_gauges.end(); ++i) {
+        sample.name = i->first;
+        sample.value = i->second->get_value();
+        samples.push_back(sample);
+    }
+
+    sample.type = TYPE_DISTRIBUTION;
+    for (std::map<std::string, Distribution *>::const_iterator i = r.m_distributions.begin(); i != r.m_distributions.end(); ++i) {
+        Distribution::Shards &shards(i->second->m_shards);
+        Histogram total(shards.bin_definition);
+        for (uint32_t j = 0; j < N_SHARDS; j++) {
+            AutoLock shard_lck(shards.mutex[j]);
+            total.merge(*shards.histogram[j]);
+        }
+
+        sample.name = i->first;
+        sample.value = total.get_n_samples();
+        sample.p50 = total.get_value_at_percentile(50.0);
+        sample.p90 = total.get_value_at_percentile(90.0);
+        sample.p99 = total.get_value_at_percentile(99.0);
+        sample.max = total.get_max_value();
+        samples.push_back(sample);
+    }
+
+    std::sort(samples.begin(), samples.end(), is_sample_name_less);
+}
+
+std::string Metrics::dump()
+{
+    std::vector<Sample> samples;
+    get_snapshot(samples);
+
+    std::string result;
+    for (std::vector<Sample>::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+        if (i->type == TYPE_DISTRIBUTION) {
+            string_printf_append(result, "%s n=%lld p50=%d p90=%d p99=%d max=%d\n", i->name.c_str(), static_cast<long long>(i->value), i->p50, i->p90, i->p99, i->max);
+        } else {
+            string_printf_append(result, "%s %lld\n", i->name.c_str(), static_cast<long long>(i->value));
+        }
+    }
+
+    return result;
+}
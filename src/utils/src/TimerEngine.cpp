@@ -14,11 +14,8 @@
 #include <porting_layer/AutoLock.h>
 #include <porting_layer/Log.h>
 
-#include <algorithm>
-
 #include <assert.h>
 #include <stddef.h>
-#include <stdlib.h>
 
 using namespace ctvc;
 
@@ -28,14 +25,104 @@ const ResultCode TimerEngine::TIMER_ALREADY_REGISTERED("The requested timer has
 const ResultCode TimerEngine::TIMER_NOT_REGISTERED("The requested timer is not registered");
 const ResultCode TimerEngine::ILLEGAL_TIMEOUT("The requested timeout_in_ms has an illegal value");
 
-TimerEngine::TimerEngine(const std::string &thread_name) :
-    m_thread(thread_name)
+const uint32_t TimerEngine::WHEEL_LEVELS;
+const uint32_t TimerEngine::WHEEL_SLOT_BITS;
+const uint32_t TimerEngine::WHEEL_SLOTS;
+const uint64_t TimerEngine::WHEEL_RANGE;
+const uint64_t TimerEngine::NO_TICK;
+
+struct TimerEngine::TimerEntry
 {
+    TimerEntry() :
+        m_engine(0),
+        m_timer(0),
+        m_expiry_tick(0),
+        m_timeout_in_ms(0),
+        m_mode(ONE_SHOT),
+        m_level(0),
+        m_slot(0),
+        m_prev(0),
+        m_next(0)
+    {
+    }
+
+    TimerEngine *m_engine;
+    ITimer *m_timer;
+    TimeStamp m_expiration_time;
+    uint64_t m_expiry_tick; // Expiration time rounded up to whole ticks
+    uint32_t m_timeout_in_ms;
+    Mode m_mode;
+
+    // Position in the wheel
+    uint32_t m_level;
+    uint32_t m_slot;
+    TimerEntry *m_prev;
+    TimerEntry *m_next;
+};
+
+static uint32_t lowest_set_bit(uint64_t v)
+{
+    assert(v != 0);
+
+    uint32_t n = 0;
+    if ((v & 0xFFFFFFFFULL) == 0) {
+        n += 32;
+        v >>= 32;
+    }
+    if ((v & 0xFFFF) == 0) {
+        n += 16;
+        v >>= 16;
+    }
+    if ((v & 0xFF) == 0) {
+        n += 8;
+        v >>= 8;
+    }
+    if ((v & 0xF) == 0) {
+        n += 4;
+        v >>= 4;
+    }
+    if ((v & 0x3) == 0) {
+        n += 2;
+        v >>= 2;
+    }
+    if ((v & 0x1) == 0) {
+        n += 1;
+    }
+    return n;
+}
+
+static uint64_t rotate_right(uint64_t v, uint32_t n)
+{
+    return n == 0 ? v : (v >> n) | (v << (64 - n));
+}
+
+TimerEngine::TimerEngine(const std::string &thread_name, uint32_t tick_in_ms) :
+    m_thread(thread_name),
+    m_tick_in_us(static_cast<int64_t>(tick_in_ms > 0 ? tick_in_ms : 1) * 1000),
+    m_epoch(TimeStamp::now()),
+    m_current_tick(0),
+    m_wakeup_tick(NO_TICK),
+    m_free_entries(0),
+    m_signal_passes(0),
+    m_signaled_passes(0)
+{
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < WHEEL_SLOTS; slot++) {
+            m_slots[level][slot] = 0;
+        }
+        m_slot_occupancy[level] = 0;
+    }
 }
 
 TimerEngine::~TimerEngine()
 {
     stop();
+
+    while (m_free_entries) {
+        TimerEntry *entry = m_free_entries;
+        m_free_entries = entry->m_next;
+        delete entry;
+    }
 }
 
 ResultCode TimerEngine::start(Thread::Priority priority)
@@ -55,17 +142,27 @@ void TimerEngine::stop()
         AutoLock lck(m_condition);
 
         // Cancel all present timers.
-        while (!m_timers.empty()) {
-            TimerEntry *p = &m_timers.back();
+        for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+            for (uint32_t slot = 0; slot < WHEEL_SLOTS; slot++) {
+                TimerEntry *entry = detach_slot(level, slot);
+                while (entry) {
+                    TimerEntry *next = entry->m_next;
+                    ITimer *timer = entry->m_timer;
 
-            // Signal the timer that it is canceled.
-            p->m_timer->timer_canceled();
+                    // Remove the given timer entry itself.
+                    timer->m_timer_entry = 0;
+                    free_entry(entry);
+                    m_stats.armed_timers--;
 
-            // And signal its removal.
-            p->m_timer->timer_done();
+                    // Signal the timer that it is canceled.
+                    timer->timer_canceled();
 
-            // Remove the given timer entry itself.
-            m_timers.pop_back();
+                    // And signal its removal.
+                    timer->timer_done();
+
+                    entry = next;
+                }
+            }
         }
 
         m_thread.stop();
@@ -78,28 +175,31 @@ void TimerEngine::stop()
 
 bool TimerEngine::run()
 {
-    const TimeStamp now = TimeStamp::now();
-
     // Fire any timers that need firing.
-    fire_timers(now);
+    fire_timers(TimeStamp::now());
 
     AutoLock lck(m_condition);
 
-    // Compute the next time the first timer should be fired.
-    // From the current expiration time (still standing or rescheduled) we keep the smallest for earliest firing time.
-    // We're sorted, so therefore we only have to check the first timer.
+    // Compute the next time the thread should wake up. This is either the expiration of the
+    // first timer in the innermost level or the moment an outer level slot must be cascaded.
+    // The time is sampled again because the expired timers may have taken some time.
+    const TimeStamp now = TimeStamp::now();
     uint32_t wait_time = ~0U;
-    if (!m_timers.empty()) {
+    uint64_t next_tick;
+    if (find_next_event_tick(next_tick)) {
         // We round up to make sure we wait at least 1 ms, even if the time difference is really small (a few us).
         // Even though we have already fired all expired timers we may still find one that is expired now; this can happen
         // if an expiring timer was added just after fire_timers() was called.
-        int64_t diff = (m_timers[0].m_expiration_time - now).get_as_milliseconds();
+        int64_t diff = (get_time_of_tick(next_tick).get_as_microseconds() - now.get_as_microseconds() + 999) / 1000;
         if (diff <= 0) {
             diff = 1;
         }
         if (diff < wait_time) {
             wait_time = diff;
         }
+        m_wakeup_tick = next_tick;
+    } else {
+        m_wakeup_tick = NO_TICK;
     }
 
     if (!m_thread.must_stop()) {
@@ -123,18 +223,26 @@ ResultCode TimerEngine::start_timer(ITimer &timer, uint32_t timeout_in_ms, Mode
         return NOT_STARTED;
     }
 
-    if (std::find(m_timers.begin(), m_timers.end(), &timer) != m_timers.end()) {
+    if (timer.m_timer_entry) {
         return TIMER_ALREADY_REGISTERED;
     }
 
-    // Put the timer in our list.
-    m_timers.push_back(TimerEntry(timer, TimeStamp::now().add_milliseconds(timeout_in_ms), timeout_in_ms, mode));
-
-    // And sort the list
-    sort_timers();
-
-    // Trigger the loop so the proper time to wait will be computed.
-    m_condition.notify();
+    // Put the timer in the wheel.
+    TimerEntry *entry = allocate_entry();
+    entry->m_timer = &timer;
+    entry->m_expiration_time = TimeStamp::now().add_milliseconds(timeout_in_ms);
+    entry->m_expiry_tick = get_tick(entry->m_expiration_time, true);
+    entry->m_timeout_in_ms = timeout_in_ms;
+    entry->m_mode = mode;
+    insert_entry(entry);
+
+    timer.m_timer_entry = entry;
+    m_stats.armed_timers++;
+
+    // Trigger the loop if the new timer expires before the time it is currently waiting for.
+    if (entry->m_expiry_tick < m_wakeup_tick) {
+        m_condition.notify();
+    }
 
     return ResultCode::SUCCESS;
 }
@@ -147,99 +255,321 @@ ResultCode TimerEngine::cancel_timer(ITimer &timer)
         return NOT_STARTED;
     }
 
-    std::vector<TimerEntry>::iterator it = std::find(m_timers.begin(), m_timers.end(), &timer);
-    if (it == m_timers.end()) {
+    TimerEntry *entry = timer.m_timer_entry;
+    if (!entry || entry->m_engine != this) {
         return TIMER_NOT_REGISTERED;
     }
 
+    // Remove the entry from the wheel.
+    // No need to trigger the loop; at worst it wakes up once for nothing.
+    remove_entry(entry);
+    timer.m_timer_entry = 0;
+    free_entry(entry);
+    m_stats.armed_timers--;
+
     // Signal the timer that it is canceled.
-    it->m_timer->timer_canceled();
+    timer.timer_canceled();
 
     // Signal its removal.
-    it->m_timer->timer_done();
-
-    // And remove the entry from our list.
-    m_timers.erase(it);
+    timer.timer_done();
 
     return ResultCode::SUCCESS;
 }
 
-void TimerEngine::fire_timers(const TimeStamp &now)
+void TimerEngine::wait_for_signaled_timers()
+{
+    if (Thread::self() == &m_thread) {
+        return;
+    }
+
+    AutoLock lck(m_condition);
+
+    // Every waiter has a semaphore of its own, so a waiter can't take the post meant for another
+    const uint64_t pass = m_signal_passes;
+    while (m_signaled_passes < pass && m_thread.is_running()) {
+        Semaphore signaled;
+        m_signal_waiters.push_back(&signaled);
+        m_condition.unlock();
+        signaled.wait();
+        m_condition.lock();
+    }
+}
+
+TimerEngine::Stats TimerEngine::get_stats()
+{
+    AutoLock lck(m_condition);
+
+    return m_stats;
+}
+
+void TimerEngine::reset_stats()
 {
-    std::vector<ITimer *> expired_timers;
-    std::vector<ITimer *> removed_timers;
+    AutoLock lck(m_condition);
+
+    uint32_t armed_timers = m_stats.armed_timers;
+    m_stats = Stats();
+    m_stats.armed_timers = armed_timers;
+}
 
+void TimerEngine::fire_timers(const TimeStamp &now)
+{
     {
         // The mutex is not yet locked here, so we need to lock it when accessing our data
         AutoLock lck(m_condition);
 
-        // Check all timers that are expired; this is a sorted list, so we can stop at the first non-expired timer.
-        bool has_list_changed = false;
-        for (size_t i = 0; i < m_timers.size(); i++) {
-            TimerEntry &t(m_timers[i]);
-
-            if (now >= t.m_expiration_time) {
-                // The timer expired, so we must signal this.
-                expired_timers.push_back(t.m_timer);
-
-                // And check what to do next.
-                switch (t.m_mode) {
-                case ONE_SHOT:
-                    // We must remove any firing one-shot timer.
-                    // Make sure their removal is signaled.
-                    removed_timers.push_back(t.m_timer);
-
-                    // Remove the given timer entry.
-                    m_timers.erase(m_timers.begin() + i);
-
-                    i--; // Compensate for i++ at end-of-loop
-                    continue; // No further processing for this timer since it was just removed. No resorting needs to be done either.
-
-                case PERIODIC:
-                    // Re-schedule a periodic timer.
-                    t.m_expiration_time.add_milliseconds(t.m_timeout_in_ms); // Adding time to 'now' would cause time creep.
-                    if (now >= t.m_expiration_time) {
-                        // Safeguard: we wait at least 1 ms
-                        t.m_expiration_time = now;
-                        t.m_expiration_time.add_milliseconds(1);
-                    }
-                    has_list_changed = true; // We'll need to resort the list.
-                    break;
-                }
-            } else {
-                // The timer didn't expire so we can quit checking.
-                break;
-            }
-        }
+        m_expired_timers.clear();
+        m_removed_timers.clear();
+        m_signal_passes++;
 
-        // And re-sort the list if necessary.
-        if (has_list_changed && m_timers.size() > 1) {
-            sort_timers();
-        }
+        // Process all ticks up to now, collecting the expired timers.
+        advance_to(get_tick(now, false), now);
     }
 
     // Signal all expired timers while not holding our mutex.
     // (Prevents deadlocks in case the called object just happens to try to access us at the same time.)
-    for (size_t i = 0; i < expired_timers.size(); i++) {
-        expired_timers[i]->timer_expired();
+    for (size_t i = 0; i < m_expired_timers.size(); i++) {
+        m_expired_timers[i]->timer_expired();
     }
 
     // Signal all removed timers while not holding our mutex.
     // (Prevents deadlocks in case the called object just happens to try to access us at the same time.)
-    for (size_t i = 0; i < removed_timers.size(); i++) {
-        removed_timers[i]->timer_done();
+    for (size_t i = 0; i < m_removed_timers.size(); i++) {
+        m_removed_timers[i]->timer_done();
+    }
+
+    AutoLock lck(m_condition);
+    m_signaled_passes = m_signal_passes;
+    for (size_t i = 0; i < m_signal_waiters.size(); i++) {
+        m_signal_waiters[i]->post();
+    }
+    m_signal_waiters.clear();
+}
+
+uint64_t TimerEngine::get_tick(const TimeStamp &t, bool round_up) const
+{
+    int64_t us = t.get_as_microseconds() - m_epoch.get_as_microseconds();
+    if (us <= 0) {
+        return 0;
     }
+
+    uint64_t tick = us / m_tick_in_us;
+    if (round_up && (us % m_tick_in_us) != 0) {
+        tick++;
+    }
+
+    return tick;
 }
 
-int TimerEngine::compare_func(const void *_a, const void *_b)
+TimeStamp TimerEngine::get_time_of_tick(uint64_t tick) const
 {
-    const TimerEntry &a(*reinterpret_cast<const TimerEntry *>(_a));
-    const TimerEntry &b(*reinterpret_cast<const TimerEntry *>(_b));
+    TimeStamp t(m_epoch);
+    t.add_microseconds(static_cast<int64_t>(tick) * m_tick_in_us);
+    return t;
+}
 
-    return a.m_expiration_time < b.m_expiration_time ? -1 : a.m_expiration_time > b.m_expiration_time ? 1 : 0;
+TimerEngine::TimerEntry *TimerEngine::allocate_entry()
+{
+    TimerEntry *entry = m_free_entries;
+    if (entry) {
+        m_free_entries = entry->m_next;
+        *entry = TimerEntry();
+    } else {
+        entry = new TimerEntry();
+    }
+    entry->m_engine = this;
+
+    return entry;
 }
 
-void TimerEngine::sort_timers()
+void TimerEngine::free_entry(TimerEntry *entry)
 {
-    qsort(&m_timers[0], m_timers.size(), sizeof(m_timers[0]), &compare_func);
+    entry->m_engine = 0;
+    entry->m_timer = 0;
+    entry->m_prev = 0;
+    entry->m_next = m_free_entries;
+    m_free_entries = entry;
+}
+
+void TimerEngine::insert_entry(TimerEntry *entry)
+{
+    // The wheel is positioned relative to the first tick that has not been processed yet.
+    // An entry that is already due is placed at that tick so it fires upon the next wake-up.
+    const uint64_t base = m_current_tick + 1;
+    uint64_t tick = entry->m_expiry_tick > base ? entry->m_expiry_tick : base;
+    uint64_t delta = tick - base;
+    if (delta >= WHEEL_RANGE) {
+        // Too far away; park it in the outermost level, it will be re-inserted when cascaded.
+        delta = WHEEL_RANGE - 1;
+        tick = base + delta;
+    }
+
+    uint32_t level = 0;
+    while (delta >= (static_cast<uint64_t>(1) << ((level + 1) * WHEEL_SLOT_BITS))) {
+        level++;
+    }
+    assert(level < WHEEL_LEVELS);
+
+    uint32_t slot = static_cast<uint32_t>(tick >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+
+    entry->m_level = level;
+    entry->m_slot = slot;
+    entry->m_prev = 0;
+    entry->m_next = m_slots[level][slot];
+    if (entry->m_next) {
+        entry->m_next->m_prev = entry;
+    }
+    m_slots[level][slot] = entry;
+    m_slot_occupancy[level] |= static_cast<uint64_t>(1) << slot;
+}
+
+void TimerEngine::remove_entry(TimerEntry *entry)
+{
+    if (entry->m_prev) {
+        entry->m_prev->m_next = entry->m_next;
+    } else {
+        m_slots[entry->m_level][entry->m_slot] = entry->m_next;
+    }
+    if (entry->m_next) {
+        entry->m_next->m_prev = entry->m_prev;
+    }
+    if (!m_slots[entry->m_level][entry->m_slot]) {
+        m_slot_occupancy[entry->m_level] &= ~(static_cast<uint64_t>(1) << entry->m_slot);
+    }
+    entry->m_prev = 0;
+    entry->m_next = 0;
+}
+
+TimerEngine::TimerEntry *TimerEngine::detach_slot(uint32_t level, uint32_t slot)
+{
+    TimerEntry *list = m_slots[level][slot];
+    m_slots[level][slot] = 0;
+    m_slot_occupancy[level] &= ~(static_cast<uint64_t>(1) << slot);
+
+    return list;
+}
+
+bool TimerEngine::find_next_event_tick(uint64_t &tick) const
+{
+    const uint64_t base = m_current_tick + 1;
+    uint64_t next = NO_TICK;
+
+    // The innermost level holds the entries of the next WHEEL_SLOTS ticks, one slot per tick.
+    if (m_slot_occupancy[0]) {
+        uint32_t offset = lowest_set_bit(rotate_right(m_slot_occupancy[0], static_cast<uint32_t>(base & (WHEEL_SLOTS - 1))));
+        next = base + offset;
+    }
+
+    // The outer levels need attention when their slot is due for cascading, which is at the
+    // start of the range the slot spans.
+    for (uint32_t level = 1; level < WHEEL_LEVELS; level++) {
+        if (m_slot_occupancy[level]) {
+            const uint32_t shift = level * WHEEL_SLOT_BITS;
+            uint64_t first_block = (base + (static_cast<uint64_t>(1) << shift) - 1) >> shift;
+            uint32_t offset = lowest_set_bit(rotate_right(m_slot_occupancy[level], static_cast<uint32_t>(first_block & (WHEEL_SLOTS - 1))));
+            uint64_t cascade_tick = (first_block + offset) << shift;
+            if (cascade_tick < next) {
+                next = cascade_tick;
+            }
+        }
+    }
+
+    if (next == NO_TICK) {
+        return false;
+    }
+
+    tick = next;
+    return true;
+}
+
+void TimerEngine::advance_to(uint64_t tick, const TimeStamp &now)
+{
+    while (m_current_tick < tick) {
+        uint64_t next_tick;
+        if (!find_next_event_tick(next_tick) || next_tick > tick) {
+            // Nothing happens in between, so we can skip all intermediate ticks.
+            m_current_tick = tick;
+            break;
+        }
+
+        m_current_tick = next_tick - 1;
+        process_tick(next_tick, now);
+    }
+}
+
+void TimerEngine::process_tick(uint64_t tick, const TimeStamp &now)
+{
+    // Cascade the outer level slots that start at this tick, outermost first.
+    // Their entries are re-inserted relative to this tick and end up in the inner levels.
+    for (uint32_t level = WHEEL_LEVELS - 1; level > 0; level--) {
+        const uint32_t shift = level * WHEEL_SLOT_BITS;
+        if ((tick & ((static_cast<uint64_t>(1) << shift) - 1)) == 0) {
+            TimerEntry *entry = detach_slot(level, static_cast<uint32_t>(tick >> shift) & (WHEEL_SLOTS - 1));
+            while (entry) {
+                TimerEntry *next = entry->m_next;
+                insert_entry(entry);
+                entry = next;
+            }
+        }
+    }
+
+    // All timers in the innermost slot of this tick expire together.
+    TimerEntry *entry = detach_slot(0, static_cast<uint32_t>(tick) & (WHEEL_SLOTS - 1));
+    m_current_tick = tick;
+
+    uint32_t expired_count = 0;
+    while (entry) {
+        TimerEntry *next = entry->m_next;
+        if (entry->m_expiry_tick <= tick) {
+            expire_entry(entry, now);
+            expired_count++;
+        } else {
+            insert_entry(entry);
+        }
+        entry = next;
+    }
+
+    if (expired_count > 1) {
+        m_stats.coalesced_timers += expired_count - 1;
+    }
+}
+
+void TimerEngine::expire_entry(TimerEntry *entry, const TimeStamp &now)
+{
+    ITimer *timer = entry->m_timer;
+
+    // The timer expired, so we must signal this.
+    m_expired_timers.push_back(timer);
+
+    m_stats.fired_timers++;
+    int64_t lateness_in_us = now.get_as_microseconds() - entry->m_expiration_time.get_as_microseconds();
+    if (lateness_in_us > m_tick_in_us) {
+        m_stats.late_fires++;
+    }
+    if (lateness_in_us / 1000 > m_stats.max_lateness_in_ms) {
+        m_stats.max_lateness_in_ms = static_cast<uint32_t>(lateness_in_us / 1000);
+    }
+
+    // And check what to do next.
+    switch (entry->m_mode) {
+    case ONE_SHOT:
+        // We must remove any firing one-shot timer.
+        // Make sure their removal is signaled.
+        m_removed_timers.push_back(timer);
+        timer->m_timer_entry = 0;
+        free_entry(entry);
+        m_stats.armed_timers--;
+        break;
+
+    case PERIODIC:
+        // Re-schedule a periodic timer.
+        entry->m_expiration_time.add_milliseconds(entry->m_timeout_in_ms); // Adding time to 'now' would cause time creep.
+        if (now >= entry->m_expiration_time) {
+            // Safeguard: we wait at least 1 ms
+            entry->m_expiration_time = now;
+            entry->m_expiration_time.add_milliseconds(1);
+        }
+        entry->m_expiry_tick = get_tick(entry->m_expiration_time, true);
+        insert_entry(entry);
+        break;
+    }
 }